@@ -1,754 +1,1055 @@
-/* This file is part of Aethered, a collection of virtual device drivers for
- * Windows.
- *
- * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
- *
- * Aethered is free software; you can redistribute it and/or
- * modify it under the terms of the GNU General Public License 
- * as published by the Free Software Foundation; either
- * version 3 of the License, or (at your option) any later version.
- *
- * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
- * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
- * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
- * for more details.
- *
- * You should have received a copy of the GNU General Public License 
- * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
-#include "aem.h"
-
-#ifdef ALLOC_PRAGMA
-  #pragma alloc_text(INIT, DriverEntry)
-  #pragma alloc_text(PAGE, AddDevice)
-  #pragma alloc_text(PAGE, Unload)
-  #pragma alloc_text(PAGE, PnP)
-#endif 
-
-/** Installable driver initialization entry point. This entry point is called directly by the I/O system.
- * 
- * @param DriverObject                 Pointer to the driver object.
- * @param RegistryPath                 Pointer to a unicode string representing the path to driver-specific key in the registry.
- * @returns                            STATUS_SUCCESS if successful, STATUS_UNSUCCESSFUL otherwise. */
-NTSTATUS DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath) {
-  NTSTATUS                    ntStatus;
-  HID_MINIDRIVER_REGISTRATION hidMinidriverRegistration;
-
-  DebugPrint(("Enter DriverEntry()\n"));
-
-  DriverObject->MajorFunction[IRP_MJ_INTERNAL_DEVICE_CONTROL] = InternalIoctl;
-  DriverObject->MajorFunction[IRP_MJ_PNP]                     = PnP;
-  DriverObject->MajorFunction[IRP_MJ_POWER]                   = Power;
-  DriverObject->DriverUnload                                  = Unload;
-  DriverObject->DriverExtension->AddDevice                    = AddDevice;
-
-  RtlZeroMemory(&hidMinidriverRegistration, sizeof(hidMinidriverRegistration));
-
-  /* Revision must be set to HID_REVISION by the minidriver. */
-  hidMinidriverRegistration.Revision            = HID_REVISION;
-  hidMinidriverRegistration.DriverObject        = DriverObject;
-  hidMinidriverRegistration.RegistryPath        = RegistryPath;
-  hidMinidriverRegistration.DeviceExtensionSize = sizeof(AEM_DEVICE_EXTENSION);
-
-  /* If "DevicesArePolled" is FALSE then the hidclass driver does not do polling and instead reuses a 
-   * few Irps (ping-pong) if the device has an Input item. Otherwise, it will do polling at regular intervals. 
-   * USB HID devices do not need polling by the HID class driver. Some legacy devices may need polling. */
-  hidMinidriverRegistration.DevicesArePolled = FALSE; 
-
-  /* Register with hidclass. */
-  ntStatus = HidRegisterMinidriver(&hidMinidriverRegistration);
-  if(!NT_SUCCESS(ntStatus))
-      DebugPrint(("HidRegisterMinidriver FAILED, returnCode=%x\n", ntStatus));
-  
-  DebugPrint(("Exit DriverEntry() status=0x%x\n", ntStatus));
-  return ntStatus;
-}
-
-/** HidClass Driver calls our AddDevice routine after creating a FDO for us. 
- * We do not need to create a device object or attach it to the PDO. Hidclass driver will do it for us.
- * 
- * @param DriverObject                 Pointer to the driver object.
- * @param FunctionalDeviceObject       Pointer to the FDO created by the Hidclass driver for us.
- * @returns                            NT status code. */
-NTSTATUS AddDevice(PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT FunctionalDeviceObject) {
-  NTSTATUS                  ntStatus = STATUS_SUCCESS;
-  PAEM_DEVICE_EXTENSION deviceInfo;
-
-  PAGED_CODE();
-  DebugPrint(("Enter AddDevice(DriverObject=0x%x, FunctionalDeviceObject=0x%x)\n", DriverObject, FunctionalDeviceObject));
-  ASSERTMSG("AddDevice:", FunctionalDeviceObject != NULL);
-
-  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(FunctionalDeviceObject);
-
-  /* Initialize all the members of device extension. */
-  RtlZeroMemory(deviceInfo, sizeof(AEM_DEVICE_EXTENSION));
-
-  /* Set the initial state of the FDO. */
-  deviceInfo->DevicePnPState = NotStarted;
-  deviceInfo->PreviousPnPState = NotStarted;
-    
-  deviceInfo->InfoReport.Report.ReportId = AEM_CONTROL_REPORT_ID;
-  deviceInfo->InfoReport.Report.ControlCode = AEM_CONTROL_CODE_INFO;
-  deviceInfo->InfoReport.Flags = 0;
-#ifdef AEM_RELATIVE_MOTION
-  deviceInfo->InfoReport.Flags |= AEM_FLAG_RELATIVE;
-#endif
-  deviceInfo->InfoReport.MessageQueueCapacity = AEM_MESSAGE_QUEUE_SIZE;
-
-  KeInitializeSpinLock(&deviceInfo->MessageQueueLock);
-  deviceInfo->MessageQueueEnd = 0;
-  deviceInfo->MessageQueueStart = 0;
-
-  deviceInfo->MessageCheckInterval = AEM_DEFAULT_MESSAGE_CHECK_INTERVAL;
-
-  /* Initialization finished. */
-  FunctionalDeviceObject->Flags &= ~DO_DEVICE_INITIALIZING;
-  
-  DebugPrint(("Exit AddDevice\n", ntStatus));
-  return ntStatus;
-}
-
-
-/** Handles PnP IRPs sent to FDO.
- * 
- * @param DeviceObject                 Pointer to device object.
- * @param Irp                          Pointer to a PnP IRP.
- * @returns                            NT status code. */
-NTSTATUS PnP(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
-  NTSTATUS                    ntStatus, queryStatus;
-  PAEM_DEVICE_EXTENSION   deviceInfo;
-  KEVENT                      startEvent;
-  PIO_STACK_LOCATION          IrpStack, previousSp;
-  PWCHAR                      buffer;
-
-  PAGED_CODE();
-
-  /* Get a pointer to the device extension. */
-  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
-
-  /* Get a pointer to the current location in the Irp. */
-  IrpStack = IoGetCurrentIrpStackLocation(Irp);
-
-  DebugPrint(("%s Irp=0x%x\n", PnPMinorFunctionString(IrpStack->MinorFunction), Irp));
-
-  switch(IrpStack->MinorFunction) {
-  case IRP_MN_START_DEVICE:
-    KeInitializeEvent(&startEvent, NotificationEvent, FALSE);
-    IoCopyCurrentIrpStackLocationToNext(Irp);
-    IoSetCompletionRoutine(Irp, PnPComplete, &startEvent, TRUE, TRUE, TRUE);
-    ntStatus = IoCallDriver(GET_NEXT_DEVICE_OBJECT(DeviceObject), Irp);
-
-    if(ntStatus == STATUS_PENDING) {
-        KeWaitForSingleObject(&startEvent, Executive, KernelMode, FALSE, NULL); /* No alerts & no timeout. */
-        ntStatus = Irp->IoStatus.Status;
-    }
-
-    if(NT_SUCCESS(ntStatus)) {
-      /* Use default "HID Descriptor" (hardcoded). 
-       * Note that ReadDescriptorFromRegistry() changes wReportLength member. */
-      deviceInfo->HidDescriptor = AemHidDescriptor;
-
-      deviceInfo->ReportDescriptor = AemReportDescriptor;
-      DebugPrint(("Using Hard-coded Report descriptor\n"));
-      
-      /* Set new PnP state. */
-      if(NT_SUCCESS(ntStatus))
-        SET_NEW_PNP_STATE(deviceInfo, Started);
-    }
-
-    Irp->IoStatus.Status = ntStatus;
-    IoCompleteRequest(Irp, IO_NO_INCREMENT);
-    return ntStatus;
-
-  case IRP_MN_STOP_DEVICE:
-    /* Mark the device as stopped. */
-    SET_NEW_PNP_STATE(deviceInfo, Stopped);
-    ntStatus = STATUS_SUCCESS;
-    break;
-
-  case IRP_MN_CANCEL_STOP_DEVICE:
-    RESTORE_PREVIOUS_PNP_STATE(deviceInfo);
-    ntStatus = STATUS_SUCCESS;         
-    break;
-
-  case IRP_MN_QUERY_STOP_DEVICE:
-    SET_NEW_PNP_STATE(deviceInfo, StopPending);
-    ntStatus = STATUS_SUCCESS;
-    break;
-
-  case IRP_MN_QUERY_REMOVE_DEVICE:
-    SET_NEW_PNP_STATE(deviceInfo, RemovePending);
-    ntStatus = STATUS_SUCCESS;
-    break;
-
-  case IRP_MN_CANCEL_REMOVE_DEVICE:
-    RESTORE_PREVIOUS_PNP_STATE(deviceInfo);
-    ntStatus = STATUS_SUCCESS;
-    break;
-
-  case IRP_MN_SURPRISE_REMOVAL:
-    SET_NEW_PNP_STATE(deviceInfo, SurpriseRemovePending);
-    ntStatus = STATUS_SUCCESS;
-    break;
-
-  case IRP_MN_REMOVE_DEVICE:
-    /* Free memory if allocated for report descriptor */
-    if(deviceInfo->ReadReportDescFromRegistry)
-      ExFreePool(deviceInfo->ReportDescriptor);
-    SET_NEW_PNP_STATE(deviceInfo, Deleted);
-    ntStatus = STATUS_SUCCESS;           
-    break;
-      
-  case IRP_MN_QUERY_ID:
-    /* This check is required to filter out QUERY_IDs forwarded by the HIDCLASS for the parent FDO. 
-     * These IDs are sent by PNP manager for the parent FDO if you root-enumerate this driver. */
-    previousSp = ((PIO_STACK_LOCATION) ((UCHAR *) (IrpStack) + sizeof(IO_STACK_LOCATION)));
-    
-    if(previousSp->DeviceObject == DeviceObject) {
-      /* Filtering out this basically prevents the Found New Hardware popup for the root-enumerated VHIDMINI on reboot. */
-      ntStatus = Irp->IoStatus.Status;            
-      break;
-    }
-            
-    switch (IrpStack->Parameters.QueryId.IdType) {
-    case BusQueryDeviceID:
-    case BusQueryHardwareIDs:
-      /* HIDClass is asking for child deviceid & hardwareids. Let us just make up some id for our child device. */
-      buffer = (PWCHAR) ExAllocatePoolWithTag(NonPagedPool, AEM_HARDWARE_IDS_LENGTH, AEM_POOL_TAG);
-
-      if(buffer) {
-        /* Do the copy, store the buffer in the Irp. */
-        RtlCopyMemory(buffer, AEM_HARDWARE_IDS, AEM_HARDWARE_IDS_LENGTH);
-        Irp->IoStatus.Information = (ULONG_PTR) buffer;
-        ntStatus = STATUS_SUCCESS;
-      } else {
-        /* No memory. */
-        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
-      }
-      Irp->IoStatus.Status = ntStatus;
-
-      /* We don't need to forward this to our bus. 
-       * This query is for our child so we should complete it right here. Fallthru. */
-      IoCompleteRequest(Irp, IO_NO_INCREMENT);
-      return ntStatus;           
-             
-    default:            
-      ntStatus = Irp->IoStatus.Status;
-      IoCompleteRequest(Irp, IO_NO_INCREMENT);          
-      return ntStatus;
-    }
-
-  default:         
-    ntStatus = Irp->IoStatus.Status;
-    break;
-  }
-  
-  Irp->IoStatus.Status = ntStatus;
-  IoSkipCurrentIrpStackLocation(Irp);
-  return IoCallDriver(GET_NEXT_DEVICE_OBJECT(DeviceObject), Irp);
-}
-
-NTSTATUS PnPComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,PVOID Context) {
-  DebugPrint(("PnPComplete(DeviceObject=0x%x,Irp=0x%x,Context=0x%x)\n", DeviceObject, Irp, Context));
-  UNREFERENCED_PARAMETER(DeviceObject);
-
-  if(Irp->PendingReturned)
-    KeSetEvent((PKEVENT) Context, 0, FALSE);
-  return STATUS_MORE_PROCESSING_REQUIRED;
-}
-
-/** This routine is the dispatch routine for power irps.
- * Does nothing except forwarding the IRP to the next device in the stack.
- *
- * @param DeviceObject                 Pointer to the device object.
- * @param Irp                          Pointer to the request packet.
- * @returns                            NT Status code. */
-NTSTATUS Power(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
-  DebugPrint(("Enter Power()\n"));
-  
-  /* Make sure to store and restore the device context depending on whether the system is going into 
-   * lower power state or resuming. The job of converting S-IRPs to D-IRPs is done by HIDCLASS. 
-   * All you need to do here is handle Set-Power request for device power state according to the 
-   * guidelines given in the power management documentation of the DDK. 
-   * Before powering down your device make sure to cancel any pending IRPs, if any, sent by you to the lower device stack. */
-
-  PoStartNextPowerIrp(Irp);     
-  IoSkipCurrentIrpStackLocation(Irp);
-  return PoCallDriver(GET_NEXT_DEVICE_OBJECT(DeviceObject), Irp);
-}
-
-
-/** Free all the allocated resources, etc.
- *
- * @param DriverObject                 Pointer to a driver object. */
-VOID Unload(PDRIVER_OBJECT DriverObject) {
-  PAGED_CODE();
-  
-  /* The device object(s) should be NULL now 
-   * (since we unload, all the devices objects associated with this driver must have been deleted). */
-  DebugPrint(("Enter Unload()\n"));
-  ASSERT(DriverObject->DeviceObject == NULL);
-  return;
-}
-
-
-/** Handles all the internal ioctls.
- *
- * @param DeviceObject                 Pointer to the device object.
- * @param Irp                          Pointer to the request packet.
- * @returns                            NT Status code. */
-NTSTATUS InternalIoctl(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
-  NTSTATUS            ntStatus = STATUS_SUCCESS;
-  PIO_STACK_LOCATION  IrpStack;
-
-  //DebugPrint(("Enter InternalIoctl (DO=0x%x,Irp=0x%x)\n", DeviceObject, Irp));
-  IrpStack = IoGetCurrentIrpStackLocation(Irp);
-
-  switch(IrpStack->Parameters.DeviceIoControl.IoControlCode) {
-  case IOCTL_HID_GET_DEVICE_DESCRIPTOR:
-    /* Retrieves the device's HID descriptor. */
-    DebugPrint(("IOCTL_HID_GET_DEVICE_DESCRIPTOR\n"));
-    ntStatus = GetHidDescriptor(DeviceObject, Irp);
-    break;
-
-  case IOCTL_HID_GET_REPORT_DESCRIPTOR:
-    /* Obtains the report descriptor for the HID device. */
-    DebugPrint(("IOCTL_HID_GET_REPORT_DESCRIPTOR\n"));
-    ntStatus = GetReportDescriptor(DeviceObject, Irp);
-    break;
-
-  case IOCTL_HID_READ_REPORT:
-    /* Return a report from the device into a class driver-supplied buffer. */
-    //DebugPrint(("IOCTL_HID_READ_REPORT\n"));
-    ntStatus = ReadReport(DeviceObject, Irp);
-    return ntStatus;
-      
-  case IOCTL_HID_GET_DEVICE_ATTRIBUTES:
-    /* Retrieves a device's attributes in a HID_DEVICE_ATTRIBUTES structure. */
-    DebugPrint(("IOCTL_HID_GET_DEVICE_ATTRIBUTES\n"));
-    ntStatus = GetDeviceAttributes(DeviceObject, Irp);
-    break;
-
-  case IOCTL_HID_WRITE_REPORT:
-    /* Transmits a class driver-supplied report to the device. */
-    DebugPrint(("IOCTL_HID_WRITE_REPORT\n"));
-    ntStatus = STATUS_NOT_SUPPORTED;
-    break;
-
-  case IOCTL_HID_SET_FEATURE:
-    /* This sends a HID class feature report to a top-level collection of a HID class device. */
-    DebugPrint(("IOCTL_HID_SET_FEATURE\n"));
-    ntStatus = STATUS_NOT_SUPPORTED;
-    break;
-
-  case IOCTL_HID_GET_FEATURE:
-    DebugPrint(("IOCTL_HID_GET_FEATURE\n"));
-    ntStatus = GetFeature(DeviceObject, Irp);                
-    break;
-
-  case IOCTL_HID_GET_STRING:
-    /* Requests that the HID minidriver retrieve a human-readable string for either the manufacturer ID, 
-     * the product ID, or the serial number from the string descriptor of the device. 
-     * The minidriver must send a Get String Descriptor request to the device, in order to retrieve 
-     * the string descriptor, then it must extract the string at the appropriate index from the string descriptor 
-     * and return it in the output buffer indicated by the IRP. 
-     * Before sending the Get String Descriptor request, the minidriver must retrieve the appropriate 
-     * index for the manufacturer ID, the product ID or the serial number from the device extension of a top 
-     * level collection associated with the device. */
-    DebugPrint(("IOCTL_HID_GET_STRING\n"));
-    ntStatus = STATUS_NOT_SUPPORTED;
-    break;
-
-  case IOCTL_HID_ACTIVATE_DEVICE:
-    /* Makes the device ready for I/O operations. */
-    DebugPrint(("IOCTL_HID_ACTIVATE_DEVICE\n"));
-    ntStatus = STATUS_NOT_SUPPORTED;
-    break;
-
-  case IOCTL_HID_DEACTIVATE_DEVICE:
-    /* Causes the device to cease operations and terminate all outstanding I/O requests. */
-    DebugPrint(("IOCTL_HID_DEACTIVATE_DEVICE\n"));
-    ntStatus = STATUS_NOT_SUPPORTED;
-    break;
-
-  default:
-    DebugPrint(("Unknown or unsupported IOCTL (%x)\n", IrpStack->Parameters.DeviceIoControl.IoControlCode));
-    ntStatus = STATUS_NOT_SUPPORTED;
-    break;
-  }
-
-  /* Set real return status in Irp. */
-  Irp->IoStatus.Status = ntStatus;
-  IoCompleteRequest(Irp, IO_NO_INCREMENT);
-  ntStatus = STATUS_SUCCESS;
-
-  return ntStatus;
-} 
-
-/** Handles Ioctls for get feature for all the collection. 
- * For control collection (custom defined collection) it handles the user-defined control codes for sideband communication.
- *
- * @param DeviceObject                 Pointer to a device object.
- * @param Irp                          Pointer to Interrupt Request Packet.
- * @returns                            NT status code. */
-NTSTATUS GetFeature(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
-  PIO_STACK_LOCATION        IrpStack;
-  PHID_XFER_PACKET          transferPacket = NULL;
-  PAEM_DEVICE_EXTENSION     deviceInfo;
-  PAEM_FEATURE_REPORT       featureReport;
-  KIRQL                     irql;
-
-  IrpStack = IoGetCurrentIrpStackLocation(Irp);
-  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
-  transferPacket = (PHID_XFER_PACKET) Irp->UserBuffer;
-
-  if(transferPacket->reportId == AEM_CONTROL_REPORT_ID) {
-    DebugPrint(("Report Id AEM_CONTROL_REPORT_ID devinfo=0x%x irql=%d\n", deviceInfo, KeGetCurrentIrql()));
-    if(transferPacket->reportBufferLen < sizeof(AEM_FEATURE_REPORT))
-      return STATUS_BUFFER_TOO_SMALL;
-
-    featureReport = (PAEM_FEATURE_REPORT) transferPacket->reportBuffer;
-    switch(featureReport->ControlCode) {
-    case AEM_CONTROL_CODE_MOVE: {
-      PAEM_MOVE_FEATURE_REPORT report = (PAEM_MOVE_FEATURE_REPORT) transferPacket->reportBuffer;
-      DWORD32 newQueueEnd;
-      if(transferPacket->reportBufferLen < sizeof(AEM_MOVE_FEATURE_REPORT))
-        return STATUS_BUFFER_TOO_SMALL;
-      KeAcquireSpinLock(&deviceInfo->MessageQueueLock, &irql);
-      newQueueEnd = (deviceInfo->MessageQueueEnd + 1) % AEM_MESSAGE_QUEUE_SIZE;
-      if(newQueueEnd != deviceInfo->MessageQueueStart) {
-        RtlCopyMemory(&deviceInfo->MessageQueue[deviceInfo->MessageQueueEnd], transferPacket->reportBuffer, sizeof(AEM_MOVE_FEATURE_REPORT));
-        deviceInfo->MessageQueueEnd = newQueueEnd;
-      } else
-        report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;   
-      KeReleaseSpinLock(&deviceInfo->MessageQueueLock, irql);
-      break;
-    }
-    case AEM_CONTROL_CODE_INFO: {
-      if(transferPacket->reportBufferLen < sizeof(AEM_INFO_FEATURE_REPORT))
-        return STATUS_BUFFER_TOO_SMALL;
-      RtlCopyMemory(transferPacket->reportBuffer, &deviceInfo->InfoReport, sizeof(AEM_INFO_FEATURE_REPORT));
-      break;
-    }
-    case AEM_CONTROL_CODE_CLEAR_QUEUE: {
-      KeAcquireSpinLock(&deviceInfo->MessageQueueLock, &irql);
-      deviceInfo->MessageQueueStart = 0;
-      deviceInfo->MessageQueueEnd = 0;
-      KeReleaseSpinLock(&deviceInfo->MessageQueueLock, irql);
-      break;
-    }
-    case AEM_CONTROL_CODE_QUEUE_SIZE: {
-      PAEM_DWORD_FEATURE_REPORT report = (PAEM_DWORD_FEATURE_REPORT) transferPacket->reportBuffer;
-      int value;
-      if(transferPacket->reportBufferLen < sizeof(AEM_DWORD_FEATURE_REPORT))
-        return STATUS_BUFFER_TOO_SMALL;
-      value = deviceInfo->MessageQueueEnd - deviceInfo->MessageQueueStart;
-      report->Value = value < 0 ? value + AEM_MESSAGE_QUEUE_SIZE : value;
-      break;
-    }
-    case AEM_CONTROL_CODE_INTERVAL: {
-      DWORD32                   newDelay;
-      PAEM_DWORD_FEATURE_REPORT report = (PAEM_DWORD_FEATURE_REPORT) transferPacket->reportBuffer;
-      if(transferPacket->reportBufferLen < sizeof(AEM_DWORD_FEATURE_REPORT))
-        return STATUS_BUFFER_TOO_SMALL;
-      newDelay = report->Value;
-      report->Value = deviceInfo->MessageCheckInterval;
-      if(newDelay >= AEM_MINIMAL_MESSAGE_CHECK_INTERVAL)
-        deviceInfo->MessageCheckInterval = newDelay;
-      else
-        report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;
-      break;
-    }
-    default:
-      return STATUS_NOT_SUPPORTED;
-    }
-
-    return STATUS_SUCCESS;
-  } else
-    return STATUS_NOT_SUPPORTED;
-}
-
-
-/** Finds the HID descriptor and copies it into the buffer provided by the Irp.
- * 
- * @param DeviceObject                 Pointer to a device object.
- * @param Irp                          Pointer to Interrupt Request Packet.
- * @returns                            NT status code. */
-NTSTATUS GetHidDescriptor(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
-  NTSTATUS                  ntStatus = STATUS_SUCCESS;
-  PAEM_DEVICE_EXTENSION deviceInfo;
-  PIO_STACK_LOCATION        IrpStack;
-  ULONG                     bytesToCopy;
-
-  DebugPrint(("GetHIDDescriptor Entry\n"));
-  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
-  IrpStack = IoGetCurrentIrpStackLocation(Irp);
-
-  DebugPrint(("HIDCLASS Buffer = 0x%x, Buffer length = 0x%x\n", Irp->UserBuffer, IrpStack->Parameters.DeviceIoControl.OutputBufferLength));
-  bytesToCopy = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
-  if(!bytesToCopy)
-    return STATUS_BUFFER_TOO_SMALL;
-
-  /* Since HidDescriptor.bLength could be >= sizeof(HID_DESCRIPTOR) we just check for HidDescriptor.bLength and 
-   * copy MIN (OutputBufferLength, DeviceExtension->HidDescriptor->bLength) */
-  if(bytesToCopy > deviceInfo->HidDescriptor.bLength)
-    bytesToCopy = deviceInfo->HidDescriptor.bLength;
-
-  DebugPrint(("Copying %d bytes to HIDCLASS buffer\n", bytesToCopy));
-
-  RtlCopyMemory((PUCHAR) Irp->UserBuffer, (PUCHAR) &deviceInfo->HidDescriptor, bytesToCopy);                
-
-  DebugPrint(("   bLength: 0x%x \n"
-              "   bDescriptorType: 0x%x \n"
-              "   bcdHID: 0x%x \n"
-              "   bCountry: 0x%x \n"
-              "   bNumDescriptors: 0x%x \n"
-              "   bReportType: 0x%x \n"
-              "   wReportLength: 0x%x \n",
-              deviceInfo->HidDescriptor.bLength, 
-              deviceInfo->HidDescriptor.bDescriptorType,
-              deviceInfo->HidDescriptor.bcdHID,
-              deviceInfo->HidDescriptor.bCountry,
-              deviceInfo->HidDescriptor.bNumDescriptors,
-              deviceInfo->HidDescriptor.DescriptorList[0].bReportType,
-              deviceInfo->HidDescriptor.DescriptorList[0].wReportLength));
-
-  /* Report how many bytes were copied. */
-  Irp->IoStatus.Information = bytesToCopy;
-
-  DebugPrint(("HidMiniGetHIDDescriptor Exit = 0x%x\n", ntStatus));
-  return ntStatus;
-}
-
-
-/** Creates reports and sends it back to the requester.
- *
- * @param DeviceObject                 Pointer to a device object.
- * @param Irp                          Pointer to Interrupt Request Packet.
- * @returns                            NT status code. */
-NTSTATUS ReadReport(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
-  NTSTATUS                  ntStatus = STATUS_PENDING;
-  PAEM_DEVICE_EXTENSION deviceInfo;
-  PIO_STACK_LOCATION        IrpStack;
-  LARGE_INTEGER             timeout;
-  PREAD_TIMER               readTimer;
-
-  //DebugPrint(("ReadReport Entry, irql=%d\n", KeGetCurrentIrql()));
-  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
-
-  /* Allocate the Timer structure. */
-  readTimer = ExAllocatePoolWithTag(NonPagedPool, sizeof(READ_TIMER), AEM_POOL_TAG);
-
-  if(!readTimer) {
-    DebugPrint(("Mem allocation for readTimer failed\n"));
-    Irp->IoStatus.Status = ntStatus = STATUS_INSUFFICIENT_RESOURCES;
-    IoCompleteRequest(Irp, IO_NO_INCREMENT);
-  } else {
-    RtlZeroMemory(readTimer, sizeof(READ_TIMER));
-    
-    /* Since the IRP will be completed later in the DPC, mark the IRP pending and return STATUS_PENDING. */
-    IoMarkIrpPending(Irp);
-    
-    /* Remember the Irp & DeviceObject. */
-    readTimer->Irp = Irp;
-    readTimer->DeviceObject = DeviceObject;
-
-    /* Initialize the DPC structure and Timer. */
-    KeInitializeDpc(&readTimer->ReadTimerDpc, ReadTimerDpcRoutine, (PVOID) readTimer);
-    KeInitializeTimer(&readTimer->ReadTimer);
-
-    /* Queue the timer DPC. */
-    timeout.HighPart = -1;
-    timeout.LowPart = -(LONG) (10 * deviceInfo->MessageCheckInterval); /* In 100 ns. */
-    KeSetTimer(&readTimer->ReadTimer, timeout, &readTimer->ReadTimerDpc);
-  }
-  
-  //DebugPrint(("ReadReport Exit = 0x%x\n", ntStatus));
-  return ntStatus;
-}
-
-VOID ReadTimerDpcRoutine(PKDPC Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2) {
-  NTSTATUS                  ntStatus = STATUS_SUCCESS;
-  PAEM_DEVICE_EXTENSION     deviceInfo;
-  PIRP                      Irp;
-  PIO_STACK_LOCATION        IrpStack;
-  PREAD_TIMER               readTimer;
-  ULONG                     reportSize = AEM_INPUT_REPORT_SIZE + 1;
-  PUCHAR                    readReport;
-  LARGE_INTEGER             timeout;
-  AEM_MOVE_FEATURE_REPORT   moveReport;
-  KIRQL                     irql;
-
-  readTimer = (PREAD_TIMER) DeferredContext;
-  Irp = readTimer->Irp;
-  IrpStack = IoGetCurrentIrpStackLocation(Irp);
-  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(readTimer->DeviceObject);
-  readReport = (PUCHAR) Irp->UserBuffer;
-
-  //DebugPrint(("ReadTimerDpcRoutine Entry, devinfo=0x%x, irql=%d\n", deviceInfo, KeGetCurrentIrql()));
-
-  if(IrpStack->Parameters.DeviceIoControl.OutputBufferLength < reportSize) {
-    /* First check the size of the output buffer. */
-    DebugPrint(("ReadReport: Buffer too small, output=0x%x need=0x%x\n", IrpStack->Parameters.DeviceIoControl.OutputBufferLength, reportSize));
-    ntStatus = STATUS_BUFFER_TOO_SMALL;
-  } else if(deviceInfo->MessageQueueStart == deviceInfo->MessageQueueEnd) {
-    /* Then check whether there is any input. */
-    //DebugPrint(("ReadReport: nothing to output\n"));
-
-    /* Ignore this one. */
-    readReport[0] = AEM_CONTROL_REPORT_ID;
-
-    /* Report how many bytes were copied. */
-    Irp->IoStatus.Information = reportSize;
-  } else {
-    KeAcquireSpinLock(&deviceInfo->MessageQueueLock, &irql);
-    RtlCopyMemory(&moveReport, &deviceInfo->MessageQueue[deviceInfo->MessageQueueStart], sizeof(AEM_MOVE_FEATURE_REPORT));
-    deviceInfo->MessageQueueStart = (deviceInfo->MessageQueueStart + 1) % AEM_MESSAGE_QUEUE_SIZE;
-    KeReleaseSpinLock(&deviceInfo->MessageQueueLock, irql);
-    
-    /* Create input report. */
-    //DebugPrint(("%d %d %d %d\n", (int) moveReport.Report.ReportId, (int) moveReport.Point.X, (int) moveReport.Point.Y, (int) moveReport.Buttons));
-    readReport[0] = AEM_POINTER_REPORT_ID;
-    readReport[1] = moveReport.Buttons;
-#ifdef AEM_RELATIVE_MOTION
-    readReport[2] = (UCHAR) moveReport.Point.X;
-    readReport[3] = (UCHAR) moveReport.Point.Y;
-#else
-    *((PSHORT_POINT) (readReport + 2)) = moveReport.Point;
-#endif
-    
-    /* Copy input report to the Irp buffer. */
-    RtlCopyMemory(Irp->UserBuffer, readReport, reportSize);
-    
-    /* Report how many bytes were copied. */
-    Irp->IoStatus.Information = reportSize;
-  }
-
-  /* Set real return status in Irp. */
-  Irp->IoStatus.Status = ntStatus;
-  IoCompleteRequest(Irp, IO_NO_INCREMENT);
-
-  /* Free the DPC structure. */
-  ExFreePool(readTimer);
-  
-  //DebugPrint(("ReadTimerDpcRoutine Exit = 0x%x\n", ntStatus));
-}
-
-
-/** Finds the Report descriptor and copies it into the buffer provided by the Irp.
- *
- * @param DeviceObject                 Pointer to a device object.
- * @param Irp                          Pointer to Interrupt Request Packet.
- * @returns                            NT status code. */
-NTSTATUS GetReportDescriptor(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
-  NTSTATUS                  ntStatus = STATUS_SUCCESS;
-  PAEM_DEVICE_EXTENSION deviceInfo;
-  PIO_STACK_LOCATION        IrpStack;
-  ULONG                     bytesToCopy;
-
-  DebugPrint(("HidMiniGetReportDescriptor Entry\n"));
-  IrpStack = IoGetCurrentIrpStackLocation(Irp);
-  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
-
-  /* Copy device descriptor to HIDCLASS buffer. */
-  DebugPrint(("HIDCLASS Buffer = 0x%x, Buffer length = 0x%x\n", Irp->UserBuffer, IrpStack->Parameters.DeviceIoControl.OutputBufferLength));
-  bytesToCopy = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
-  if(!bytesToCopy)
-    return STATUS_BUFFER_TOO_SMALL;
-  if(bytesToCopy > deviceInfo->HidDescriptor.DescriptorList[0].wReportLength)
-      bytesToCopy = deviceInfo->HidDescriptor.DescriptorList[0].wReportLength;
-  DebugPrint(("Copying 0x%x bytes to HIDCLASS buffer\n", bytesToCopy));
-  RtlCopyMemory((PUCHAR) Irp->UserBuffer, (PUCHAR) deviceInfo->ReportDescriptor, bytesToCopy);
-
-  /* Report how many bytes were copied. */
-  Irp->IoStatus.Information = bytesToCopy;
-
-  DebugPrint(("HidMiniGetReportDescriptor Exit = 0x%x\n", ntStatus));
-  return ntStatus;
-}
-
-
-/** Fill in the given struct _HID_DEVICE_ATTRIBUTES.
- * 
- * @param DeviceObject                 Pointer to a device object.
- * @param Irp                          Pointer to Interrupt Request Packet.
- * @returns                            NT status code. */
-NTSTATUS GetDeviceAttributes(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
-  NTSTATUS               ntStatus = STATUS_SUCCESS;
-  PIO_STACK_LOCATION     irpStack;
-  PHID_DEVICE_ATTRIBUTES deviceAttributes;
-
-  DebugPrint(("HidMiniGetDeviceAttributes Entry\n"));
-
-  irpStack = IoGetCurrentIrpStackLocation(Irp);
-  deviceAttributes = (PHID_DEVICE_ATTRIBUTES) Irp->UserBuffer;
-  if(sizeof(HID_DEVICE_ATTRIBUTES) > irpStack->Parameters.DeviceIoControl.OutputBufferLength)
-    return STATUS_BUFFER_TOO_SMALL;
-  
-  /* Report how many bytes were copied. */
-  Irp->IoStatus.Information = sizeof(HID_DEVICE_ATTRIBUTES);
-  
-  /* Write result. */
-  deviceAttributes->Size = sizeof(HID_DEVICE_ATTRIBUTES);
-  deviceAttributes->VendorID = AEM_VENDOR_ID;
-  deviceAttributes->ProductID = AEM_PRODUCT_ID;
-  deviceAttributes->VersionNumber = AEM_VERSION;
-
-  DebugPrint(("HidMiniGetAttributes Exit = 0x%x\n", ntStatus));
-  return ntStatus;
-}
-
-#if DBG
-PCHAR PnPMinorFunctionString(UCHAR MinorFunction) {
-  switch (MinorFunction) {
-  case IRP_MN_START_DEVICE:
-    return "IRP_MN_START_DEVICE";
-  case IRP_MN_QUERY_REMOVE_DEVICE:
-    return "IRP_MN_QUERY_REMOVE_DEVICE";
-  case IRP_MN_REMOVE_DEVICE:
-    return "IRP_MN_REMOVE_DEVICE";
-  case IRP_MN_CANCEL_REMOVE_DEVICE:
-    return "IRP_MN_CANCEL_REMOVE_DEVICE";
-  case IRP_MN_STOP_DEVICE:
-    return "IRP_MN_STOP_DEVICE";
-  case IRP_MN_QUERY_STOP_DEVICE:
-    return "IRP_MN_QUERY_STOP_DEVICE";
-  case IRP_MN_CANCEL_STOP_DEVICE:
-    return "IRP_MN_CANCEL_STOP_DEVICE";
-  case IRP_MN_QUERY_DEVICE_RELATIONS:
-    return "IRP_MN_QUERY_DEVICE_RELATIONS";
-  case IRP_MN_QUERY_INTERFACE:
-    return "IRP_MN_QUERY_INTERFACE";
-  case IRP_MN_QUERY_CAPABILITIES:
-    return "IRP_MN_QUERY_CAPABILITIES";
-  case IRP_MN_QUERY_RESOURCES:
-    return "IRP_MN_QUERY_RESOURCES";
-  case IRP_MN_QUERY_RESOURCE_REQUIREMENTS:
-    return "IRP_MN_QUERY_RESOURCE_REQUIREMENTS";
-  case IRP_MN_QUERY_DEVICE_TEXT:
-    return "IRP_MN_QUERY_DEVICE_TEXT";
-  case IRP_MN_FILTER_RESOURCE_REQUIREMENTS:
-    return "IRP_MN_FILTER_RESOURCE_REQUIREMENTS";
-  case IRP_MN_READ_CONFIG:
-    return "IRP_MN_READ_CONFIG";
-  case IRP_MN_WRITE_CONFIG:
-    return "IRP_MN_WRITE_CONFIG";
-  case IRP_MN_EJECT:
-    return "IRP_MN_EJECT";
-  case IRP_MN_SET_LOCK:
-    return "IRP_MN_SET_LOCK";
-  case IRP_MN_QUERY_ID:
-    return "IRP_MN_QUERY_ID";
-  case IRP_MN_QUERY_PNP_DEVICE_STATE:
-    return "IRP_MN_QUERY_PNP_DEVICE_STATE";
-  case IRP_MN_QUERY_BUS_INFORMATION:
-    return "IRP_MN_QUERY_BUS_INFORMATION";
-  case IRP_MN_DEVICE_USAGE_NOTIFICATION:
-    return "IRP_MN_DEVICE_USAGE_NOTIFICATION";
-  case IRP_MN_SURPRISE_REMOVAL:
-    return "IRP_MN_SURPRISE_REMOVAL";
-  default:
-    return "unknown_pnp_irp";
-  }
-}
-#endif
-
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "aem.h"
+
+#ifdef ALLOC_PRAGMA
+  #pragma alloc_text(INIT, DriverEntry)
+  #pragma alloc_text(PAGE, AddDevice)
+  #pragma alloc_text(PAGE, Unload)
+  #pragma alloc_text(PAGE, PnP)
+  #pragma alloc_text(PAGE, CreateSharedPage)
+  #pragma alloc_text(PAGE, DeleteSharedPage)
+  #pragma alloc_text(PAGE, CreateStatsPage)
+  #pragma alloc_text(PAGE, DeleteStatsPage)
+  #pragma alloc_text(PAGE, CreateChannelPage)
+  #pragma alloc_text(PAGE, DeleteChannelPage)
+#endif 
+
+C_ASSERT(sizeof(AEM_STATS_PAGE) <= PAGE_SIZE);
+C_ASSERT(sizeof(AEM_CHANNEL_PAGE) <= PAGE_SIZE);
+C_ASSERT(AEM_OUTPUT_REPORT_SIZE + 1 >= sizeof(AEM_BATCH_FEATURE_REPORT));
+C_ASSERT(AEM_OUTPUT_REPORT_SIZE + 1 >= sizeof(AEM_TIMED_BATCH_FEATURE_REPORT));
+
+/** Number of statistics & channel pages created so far, used to give each page a unique name. */
+LONG StatsPageCount;
+LONG ChannelPageCount;
+
+/** Installable driver initialization entry point. This entry point is called directly by the I/O system.
+ * 
+ * @param DriverObject                 Pointer to the driver object.
+ * @param RegistryPath                 Pointer to a unicode string representing the path to driver-specific key in the registry.
+ * @returns                            STATUS_SUCCESS if successful, STATUS_UNSUCCESSFUL otherwise. */
+NTSTATUS DriverEntry(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath) {
+  NTSTATUS                    ntStatus;
+  HID_MINIDRIVER_REGISTRATION hidMinidriverRegistration;
+
+  DebugPrint(("Enter DriverEntry()\n"));
+
+  DriverObject->MajorFunction[IRP_MJ_INTERNAL_DEVICE_CONTROL] = InternalIoctl;
+  DriverObject->MajorFunction[IRP_MJ_PNP]                     = PnP;
+  DriverObject->MajorFunction[IRP_MJ_POWER]                   = Power;
+  DriverObject->DriverUnload                                  = Unload;
+  DriverObject->DriverExtension->AddDevice                    = AddDevice;
+
+  RtlZeroMemory(&hidMinidriverRegistration, sizeof(hidMinidriverRegistration));
+
+  /* Revision must be set to HID_REVISION by the minidriver. */
+  hidMinidriverRegistration.Revision            = HID_REVISION;
+  hidMinidriverRegistration.DriverObject        = DriverObject;
+  hidMinidriverRegistration.RegistryPath        = RegistryPath;
+  hidMinidriverRegistration.DeviceExtensionSize = sizeof(AEM_DEVICE_EXTENSION);
+
+  /* If "DevicesArePolled" is FALSE then the hidclass driver does not do polling and instead reuses a 
+   * few Irps (ping-pong) if the device has an Input item. Otherwise, it will do polling at regular intervals. 
+   * USB HID devices do not need polling by the HID class driver. Some legacy devices may need polling. */
+  hidMinidriverRegistration.DevicesArePolled = FALSE; 
+
+  /* Register with hidclass. */
+  ntStatus = HidRegisterMinidriver(&hidMinidriverRegistration);
+  if(!NT_SUCCESS(ntStatus))
+      DebugPrint(("HidRegisterMinidriver FAILED, returnCode=%x\n", ntStatus));
+  
+  DebugPrint(("Exit DriverEntry() status=0x%x\n", ntStatus));
+  return ntStatus;
+}
+
+/** HidClass Driver calls our AddDevice routine after creating a FDO for us. 
+ * We do not need to create a device object or attach it to the PDO. Hidclass driver will do it for us.
+ * 
+ * @param DriverObject                 Pointer to the driver object.
+ * @param FunctionalDeviceObject       Pointer to the FDO created by the Hidclass driver for us.
+ * @returns                            NT status code. */
+NTSTATUS AddDevice(PDRIVER_OBJECT DriverObject, PDEVICE_OBJECT FunctionalDeviceObject) {
+  NTSTATUS                  ntStatus = STATUS_SUCCESS;
+  PAEM_DEVICE_EXTENSION deviceInfo;
+
+  PAGED_CODE();
+  DebugPrint(("Enter AddDevice(DriverObject=0x%x, FunctionalDeviceObject=0x%x)\n", DriverObject, FunctionalDeviceObject));
+  ASSERTMSG("AddDevice:", FunctionalDeviceObject != NULL);
+
+  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(FunctionalDeviceObject);
+
+  /* Initialize all the members of device extension. */
+  RtlZeroMemory(deviceInfo, sizeof(AEM_DEVICE_EXTENSION));
+
+  /* Set the initial state of the FDO. */
+  deviceInfo->DevicePnPState = NotStarted;
+  deviceInfo->PreviousPnPState = NotStarted;
+    
+  ntStatus = AemCoreInit(&deviceInfo->Core);
+  if(!NT_SUCCESS(ntStatus)) {
+    DebugPrint(("Mem allocation for message queue or schedule failed\n"));
+    return ntStatus;
+  }
+  KeInitializeTimer(&deviceInfo->ScheduleTimer);
+  KeInitializeDpc(&deviceInfo->ScheduleDpc, ScheduleDpcRoutine, (PVOID) &deviceInfo->Core);
+
+  /* Device works without the statistics page, the counters are then kept in the core. */
+  if(!NT_SUCCESS(CreateStatsPage(deviceInfo)))
+    DebugPrint(("Statistics page could not be created\n"));
+
+  /* Same goes for the submission channel, clients then send their moves with feature requests. */
+  if(!NT_SUCCESS(CreateChannelPage(deviceInfo)))
+    DebugPrint(("Channel page could not be created\n"));
+
+  InitializeListHead(&deviceInfo->PendingReadIrps);
+  IoCsqInitialize(&deviceInfo->ReadIrpQueue, ReadIrpQueueInsert, ReadIrpQueueRemove, ReadIrpQueuePeekNext, 
+                  ReadIrpQueueAcquireLock, ReadIrpQueueReleaseLock, ReadIrpQueueCompleteCanceled);
+
+  /* Delayed read Irps share a single timer, whatever number of them hidclass keeps pending. */
+  KeInitializeTimer(&deviceInfo->ReadTimer);
+  KeInitializeDpc(&deviceInfo->ReadDpc, ReadDpcRoutine, (PVOID) deviceInfo);
+  InitializeListHead(&deviceInfo->DelayedReadIrps);
+  AemReadTimerInit(&deviceInfo->ReadTimerState);
+
+  /* Initialization finished. */
+  FunctionalDeviceObject->Flags &= ~DO_DEVICE_INITIALIZING;
+  
+  DebugPrint(("Exit AddDevice\n", ntStatus));
+  return ntStatus;
+}
+
+
+/** Handles PnP IRPs sent to FDO.
+ * 
+ * @param DeviceObject                 Pointer to device object.
+ * @param Irp                          Pointer to a PnP IRP.
+ * @returns                            NT status code. */
+NTSTATUS PnP(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+  NTSTATUS                    ntStatus, queryStatus;
+  PAEM_DEVICE_EXTENSION   deviceInfo;
+  KEVENT                      startEvent;
+  PIO_STACK_LOCATION          IrpStack, previousSp;
+  PWCHAR                      buffer;
+
+  PAGED_CODE();
+
+  /* Get a pointer to the device extension. */
+  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
+
+  /* Get a pointer to the current location in the Irp. */
+  IrpStack = IoGetCurrentIrpStackLocation(Irp);
+
+  DebugPrint(("%s Irp=0x%x\n", PnPMinorFunctionString(IrpStack->MinorFunction), Irp));
+
+  switch(IrpStack->MinorFunction) {
+  case IRP_MN_START_DEVICE:
+    KeInitializeEvent(&startEvent, NotificationEvent, FALSE);
+    IoCopyCurrentIrpStackLocationToNext(Irp);
+    IoSetCompletionRoutine(Irp, PnPComplete, &startEvent, TRUE, TRUE, TRUE);
+    ntStatus = IoCallDriver(GET_NEXT_DEVICE_OBJECT(DeviceObject), Irp);
+
+    if(ntStatus == STATUS_PENDING) {
+        KeWaitForSingleObject(&startEvent, Executive, KernelMode, FALSE, NULL); /* No alerts & no timeout. */
+        ntStatus = Irp->IoStatus.Status;
+    }
+
+    if(NT_SUCCESS(ntStatus)) {
+      /* Use default "HID Descriptor" (hardcoded). 
+       * Note that ReadDescriptorFromRegistry() changes wReportLength member. */
+      deviceInfo->HidDescriptor = AemHidDescriptor;
+
+      deviceInfo->ReportDescriptor = AemReportDescriptor;
+      DebugPrint(("Using Hard-coded Report descriptor\n"));
+      
+      /* Set new PnP state. */
+      if(NT_SUCCESS(ntStatus))
+        SET_NEW_PNP_STATE(deviceInfo, Started);
+    }
+
+    Irp->IoStatus.Status = ntStatus;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    return ntStatus;
+
+  case IRP_MN_STOP_DEVICE:
+    /* Mark the device as stopped. */
+    SET_NEW_PNP_STATE(deviceInfo, Stopped);
+    ntStatus = STATUS_SUCCESS;
+    break;
+
+  case IRP_MN_CANCEL_STOP_DEVICE:
+    RESTORE_PREVIOUS_PNP_STATE(deviceInfo);
+    ntStatus = STATUS_SUCCESS;         
+    break;
+
+  case IRP_MN_QUERY_STOP_DEVICE:
+    SET_NEW_PNP_STATE(deviceInfo, StopPending);
+    ntStatus = STATUS_SUCCESS;
+    break;
+
+  case IRP_MN_QUERY_REMOVE_DEVICE:
+    SET_NEW_PNP_STATE(deviceInfo, RemovePending);
+    ntStatus = STATUS_SUCCESS;
+    break;
+
+  case IRP_MN_CANCEL_REMOVE_DEVICE:
+    RESTORE_PREVIOUS_PNP_STATE(deviceInfo);
+    ntStatus = STATUS_SUCCESS;
+    break;
+
+  case IRP_MN_SURPRISE_REMOVAL:
+    SET_NEW_PNP_STATE(deviceInfo, SurpriseRemovePending);
+    ntStatus = STATUS_SUCCESS;
+    break;
+
+  case IRP_MN_REMOVE_DEVICE:
+    /* Free memory if allocated for report descriptor */
+    if(deviceInfo->ReadReportDescFromRegistry)
+      ExFreePool(deviceInfo->ReportDescriptor);
+    StopTimers(deviceInfo);
+    DeleteStatsPage(deviceInfo);
+    DeleteChannelPage(deviceInfo);
+    AemCoreFree(&deviceInfo->Core);
+    SET_NEW_PNP_STATE(deviceInfo, Deleted);
+    ntStatus = STATUS_SUCCESS;           
+    break;
+      
+  case IRP_MN_QUERY_ID:
+    /* This check is required to filter out QUERY_IDs forwarded by the HIDCLASS for the parent FDO. 
+     * These IDs are sent by PNP manager for the parent FDO if you root-enumerate this driver. */
+    previousSp = ((PIO_STACK_LOCATION) ((UCHAR *) (IrpStack) + sizeof(IO_STACK_LOCATION)));
+    
+    if(previousSp->DeviceObject == DeviceObject) {
+      /* Filtering out this basically prevents the Found New Hardware popup for the root-enumerated VHIDMINI on reboot. */
+      ntStatus = Irp->IoStatus.Status;            
+      break;
+    }
+            
+    switch (IrpStack->Parameters.QueryId.IdType) {
+    case BusQueryDeviceID:
+    case BusQueryHardwareIDs:
+      /* HIDClass is asking for child deviceid & hardwareids. Let us just make up some id for our child device. */
+      buffer = (PWCHAR) ExAllocatePoolWithTag(NonPagedPool, AEM_HARDWARE_IDS_LENGTH, AEM_POOL_TAG);
+
+      if(buffer) {
+        /* Do the copy, store the buffer in the Irp. */
+        RtlCopyMemory(buffer, AEM_HARDWARE_IDS, AEM_HARDWARE_IDS_LENGTH);
+        Irp->IoStatus.Information = (ULONG_PTR) buffer;
+        ntStatus = STATUS_SUCCESS;
+      } else {
+        /* No memory. */
+        ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+      }
+      Irp->IoStatus.Status = ntStatus;
+
+      /* We don't need to forward this to our bus. 
+       * This query is for our child so we should complete it right here. Fallthru. */
+      IoCompleteRequest(Irp, IO_NO_INCREMENT);
+      return ntStatus;           
+             
+    default:            
+      ntStatus = Irp->IoStatus.Status;
+      IoCompleteRequest(Irp, IO_NO_INCREMENT);          
+      return ntStatus;
+    }
+
+  default:         
+    ntStatus = Irp->IoStatus.Status;
+    break;
+  }
+  
+  Irp->IoStatus.Status = ntStatus;
+  IoSkipCurrentIrpStackLocation(Irp);
+  return IoCallDriver(GET_NEXT_DEVICE_OBJECT(DeviceObject), Irp);
+}
+
+NTSTATUS PnPComplete(PDEVICE_OBJECT DeviceObject, PIRP Irp,PVOID Context) {
+  DebugPrint(("PnPComplete(DeviceObject=0x%x,Irp=0x%x,Context=0x%x)\n", DeviceObject, Irp, Context));
+  UNREFERENCED_PARAMETER(DeviceObject);
+
+  if(Irp->PendingReturned)
+    KeSetEvent((PKEVENT) Context, 0, FALSE);
+  return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+/** This routine is the dispatch routine for power irps.
+ * Does nothing except forwarding the IRP to the next device in the stack.
+ *
+ * @param DeviceObject                 Pointer to the device object.
+ * @param Irp                          Pointer to the request packet.
+ * @returns                            NT Status code. */
+NTSTATUS Power(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+  DebugPrint(("Enter Power()\n"));
+  
+  /* Make sure to store and restore the device context depending on whether the system is going into 
+   * lower power state or resuming. The job of converting S-IRPs to D-IRPs is done by HIDCLASS. 
+   * All you need to do here is handle Set-Power request for device power state according to the 
+   * guidelines given in the power management documentation of the DDK. 
+   * Before powering down your device make sure to cancel any pending IRPs, if any, sent by you to the lower device stack. */
+
+  PoStartNextPowerIrp(Irp);     
+  IoSkipCurrentIrpStackLocation(Irp);
+  return PoCallDriver(GET_NEXT_DEVICE_OBJECT(DeviceObject), Irp);
+}
+
+
+/** Free all the allocated resources, etc.
+ *
+ * @param DriverObject                 Pointer to a driver object. */
+VOID Unload(PDRIVER_OBJECT DriverObject) {
+  PAGED_CODE();
+  
+  /* The device object(s) should be NULL now 
+   * (since we unload, all the devices objects associated with this driver must have been deleted). */
+  DebugPrint(("Enter Unload()\n"));
+  ASSERT(DriverObject->DeviceObject == NULL);
+  return;
+}
+
+
+/** Handles all the internal ioctls.
+ *
+ * @param DeviceObject                 Pointer to the device object.
+ * @param Irp                          Pointer to the request packet.
+ * @returns                            NT Status code. */
+NTSTATUS InternalIoctl(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+  NTSTATUS            ntStatus = STATUS_SUCCESS;
+  PIO_STACK_LOCATION  IrpStack;
+
+  //DebugPrint(("Enter InternalIoctl (DO=0x%x,Irp=0x%x)\n", DeviceObject, Irp));
+  IrpStack = IoGetCurrentIrpStackLocation(Irp);
+
+  switch(IrpStack->Parameters.DeviceIoControl.IoControlCode) {
+  case IOCTL_HID_GET_DEVICE_DESCRIPTOR:
+    /* Retrieves the device's HID descriptor. */
+    DebugPrint(("IOCTL_HID_GET_DEVICE_DESCRIPTOR\n"));
+    ntStatus = GetHidDescriptor(DeviceObject, Irp);
+    break;
+
+  case IOCTL_HID_GET_REPORT_DESCRIPTOR:
+    /* Obtains the report descriptor for the HID device. */
+    DebugPrint(("IOCTL_HID_GET_REPORT_DESCRIPTOR\n"));
+    ntStatus = GetReportDescriptor(DeviceObject, Irp);
+    break;
+
+  case IOCTL_HID_READ_REPORT:
+    /* Return a report from the device into a class driver-supplied buffer. */
+    //DebugPrint(("IOCTL_HID_READ_REPORT\n"));
+    ntStatus = ReadReport(DeviceObject, Irp);
+    return ntStatus;
+      
+  case IOCTL_HID_GET_DEVICE_ATTRIBUTES:
+    /* Retrieves a device's attributes in a HID_DEVICE_ATTRIBUTES structure. */
+    DebugPrint(("IOCTL_HID_GET_DEVICE_ATTRIBUTES\n"));
+    ntStatus = GetDeviceAttributes(DeviceObject, Irp);
+    break;
+
+  case IOCTL_HID_WRITE_REPORT:
+    /* Transmits a class driver-supplied report to the device. */
+    //DebugPrint(("IOCTL_HID_WRITE_REPORT\n"));
+    ntStatus = WriteReport(DeviceObject, Irp);
+    break;
+
+  case IOCTL_HID_SET_FEATURE:
+    /* This sends a HID class feature report to a top-level collection of a HID class device. */
+    DebugPrint(("IOCTL_HID_SET_FEATURE\n"));
+    ntStatus = STATUS_NOT_SUPPORTED;
+    break;
+
+  case IOCTL_HID_GET_FEATURE:
+    DebugPrint(("IOCTL_HID_GET_FEATURE\n"));
+    ntStatus = GetFeature(DeviceObject, Irp);                
+    break;
+
+  case IOCTL_HID_GET_STRING:
+    /* Requests that the HID minidriver retrieve a human-readable string for either the manufacturer ID, 
+     * the product ID, or the serial number from the string descriptor of the device. 
+     * The minidriver must send a Get String Descriptor request to the device, in order to retrieve 
+     * the string descriptor, then it must extract the string at the appropriate index from the string descriptor 
+     * and return it in the output buffer indicated by the IRP. 
+     * Before sending the Get String Descriptor request, the minidriver must retrieve the appropriate 
+     * index for the manufacturer ID, the product ID or the serial number from the device extension of a top 
+     * level collection associated with the device. */
+    DebugPrint(("IOCTL_HID_GET_STRING\n"));
+    ntStatus = STATUS_NOT_SUPPORTED;
+    break;
+
+  case IOCTL_HID_ACTIVATE_DEVICE:
+    /* Makes the device ready for I/O operations. */
+    DebugPrint(("IOCTL_HID_ACTIVATE_DEVICE\n"));
+    ntStatus = STATUS_NOT_SUPPORTED;
+    break;
+
+  case IOCTL_HID_DEACTIVATE_DEVICE:
+    /* Causes the device to cease operations and terminate all outstanding I/O requests. */
+    DebugPrint(("IOCTL_HID_DEACTIVATE_DEVICE\n"));
+    ntStatus = STATUS_NOT_SUPPORTED;
+    break;
+
+  default:
+    DebugPrint(("Unknown or unsupported IOCTL (%x)\n", IrpStack->Parameters.DeviceIoControl.IoControlCode));
+    ntStatus = STATUS_NOT_SUPPORTED;
+    break;
+  }
+
+  /* Set real return status in Irp. */
+  Irp->IoStatus.Status = ntStatus;
+  IoCompleteRequest(Irp, IO_NO_INCREMENT);
+  ntStatus = STATUS_SUCCESS;
+
+  return ntStatus;
+} 
+
+/** Handles Ioctls for get feature for all the collection. 
+ * Control codes of the control collection (custom defined collection) are handled by the core, see AemCoreGetFeature.
+ *
+ * @param DeviceObject                 Pointer to a device object.
+ * @param Irp                          Pointer to Interrupt Request Packet.
+ * @returns                            NT status code. */
+NTSTATUS GetFeature(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+  PHID_XFER_PACKET          transferPacket;
+  PAEM_DEVICE_EXTENSION     deviceInfo;
+
+  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
+  transferPacket = (PHID_XFER_PACKET) Irp->UserBuffer;
+
+  DebugPrint(("Report Id 0x%x devinfo=0x%x irql=%d\n", transferPacket->reportId, deviceInfo, KeGetCurrentIrql()));
+  return AemCoreGetFeature(&deviceInfo->Core, transferPacket->reportId, transferPacket->reportBuffer, transferPacket->reportBufferLen);
+}
+
+/** Handles Ioctls for write report. Output reports of the control collection carry submissions, see AemCoreWriteReport.
+ *
+ * @param DeviceObject                 Pointer to a device object.
+ * @param Irp                          Pointer to Interrupt Request Packet.
+ * @returns                            NT status code. */
+NTSTATUS WriteReport(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+  PHID_XFER_PACKET          transferPacket;
+  PAEM_DEVICE_EXTENSION     deviceInfo;
+  NTSTATUS                  ntStatus;
+
+  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
+  transferPacket = (PHID_XFER_PACKET) Irp->UserBuffer;
+
+  ntStatus = AemCoreWriteReport(&deviceInfo->Core, transferPacket->reportId, transferPacket->reportBuffer, transferPacket->reportBufferLen);
+  if(NT_SUCCESS(ntStatus))
+    Irp->IoStatus.Information = transferPacket->reportBufferLen;
+  return ntStatus;
+}
+
+/** Finds the HID descriptor and copies it into the buffer provided by the Irp.
+ * 
+ * @param DeviceObject                 Pointer to a device object.
+ * @param Irp                          Pointer to Interrupt Request Packet.
+ * @returns                            NT status code. */
+NTSTATUS GetHidDescriptor(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+  NTSTATUS                  ntStatus = STATUS_SUCCESS;
+  PAEM_DEVICE_EXTENSION deviceInfo;
+  PIO_STACK_LOCATION        IrpStack;
+  ULONG                     bytesToCopy;
+
+  DebugPrint(("GetHIDDescriptor Entry\n"));
+  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
+  IrpStack = IoGetCurrentIrpStackLocation(Irp);
+
+  DebugPrint(("HIDCLASS Buffer = 0x%x, Buffer length = 0x%x\n", Irp->UserBuffer, IrpStack->Parameters.DeviceIoControl.OutputBufferLength));
+  bytesToCopy = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+  if(!bytesToCopy)
+    return STATUS_BUFFER_TOO_SMALL;
+
+  /* Since HidDescriptor.bLength could be >= sizeof(HID_DESCRIPTOR) we just check for HidDescriptor.bLength and 
+   * copy MIN (OutputBufferLength, DeviceExtension->HidDescriptor->bLength) */
+  if(bytesToCopy > deviceInfo->HidDescriptor.bLength)
+    bytesToCopy = deviceInfo->HidDescriptor.bLength;
+
+  DebugPrint(("Copying %d bytes to HIDCLASS buffer\n", bytesToCopy));
+
+  RtlCopyMemory((PUCHAR) Irp->UserBuffer, (PUCHAR) &deviceInfo->HidDescriptor, bytesToCopy);                
+
+  DebugPrint(("   bLength: 0x%x \n"
+              "   bDescriptorType: 0x%x \n"
+              "   bcdHID: 0x%x \n"
+              "   bCountry: 0x%x \n"
+              "   bNumDescriptors: 0x%x \n"
+              "   bReportType: 0x%x \n"
+              "   wReportLength: 0x%x \n",
+              deviceInfo->HidDescriptor.bLength, 
+              deviceInfo->HidDescriptor.bDescriptorType,
+              deviceInfo->HidDescriptor.bcdHID,
+              deviceInfo->HidDescriptor.bCountry,
+              deviceInfo->HidDescriptor.bNumDescriptors,
+              deviceInfo->HidDescriptor.DescriptorList[0].bReportType,
+              deviceInfo->HidDescriptor.DescriptorList[0].wReportLength));
+
+  /* Report how many bytes were copied. */
+  Irp->IoStatus.Information = bytesToCopy;
+
+  DebugPrint(("HidMiniGetHIDDescriptor Exit = 0x%x\n", ntStatus));
+  return ntStatus;
+}
+
+
+/** Handles IOCTL_HID_READ_REPORT. The Irp is completed as soon as there is an input report 
+ * to return and the message check interval since the previous report has elapsed. 
+ * While the message queue is empty, the Irp is parked in a cancel-safe queue and is
+ * completed from the GetFeature path when new messages arrive.
+ *
+ * @param DeviceObject                 Pointer to a device object.
+ * @param Irp                          Pointer to Interrupt Request Packet.
+ * @returns                            NT status code. */
+NTSTATUS ReadReport(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+  PIO_STACK_LOCATION        IrpStack;
+  ULONG                     reportSize = AEM_INPUT_REPORT_SIZE + 1;
+
+  //DebugPrint(("ReadReport Entry, irql=%d\n", KeGetCurrentIrql()));
+  IrpStack = IoGetCurrentIrpStackLocation(Irp);
+
+  /* First check the size of the output buffer. */
+  if(IrpStack->Parameters.DeviceIoControl.OutputBufferLength < reportSize) {
+    DebugPrint(("ReadReport: Buffer too small, output=0x%x need=0x%x\n", IrpStack->Parameters.DeviceIoControl.OutputBufferLength, reportSize));
+    Irp->IoStatus.Status = STATUS_BUFFER_TOO_SMALL;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+
+  /* The Irp will be completed later, either from the timer DPC or from GetFeature. */
+  IoMarkIrpPending(Irp);
+  AemCoreRead(&GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject)->Core, Irp);
+
+  //DebugPrint(("ReadReport Exit = 0x%x\n", STATUS_PENDING));
+  return STATUS_PENDING;
+}
+
+
+/* Platform functions for the core, see platform.h. Read requests are read Irps. */
+
+ULONGLONG AemPlatformInterruptTime(PAEM_CORE Core) {
+  UNREFERENCED_PARAMETER(Core);
+  return KeQueryInterruptTime();
+}
+
+LONGLONG AemPlatformSystemTime(PAEM_CORE Core) {
+  LARGE_INTEGER             systemTime;
+
+  UNREFERENCED_PARAMETER(Core);
+  KeQuerySystemTime(&systemTime);
+  return systemTime.QuadPart;
+}
+
+VOID AemPlatformSetScheduleTimer(PAEM_CORE Core, ULONGLONG DueTime) {
+  PAEM_DEVICE_EXTENSION     deviceInfo = CONTAINING_RECORD(Core, AEM_DEVICE_EXTENSION, Core);
+  LARGE_INTEGER             timeout;
+  ULONGLONG                 now;
+
+  now = KeQueryInterruptTime();
+  timeout.QuadPart = DueTime > now ? -(LONGLONG) (DueTime - now) : -1; /* In 100 ns. */
+  KeSetTimer(&deviceInfo->ScheduleTimer, timeout, &deviceInfo->ScheduleDpc);
+}
+
+VOID AemPlatformCancelScheduleTimer(PAEM_CORE Core) {
+  PAEM_DEVICE_EXTENSION     deviceInfo = CONTAINING_RECORD(Core, AEM_DEVICE_EXTENSION, Core);
+
+  KeCancelTimer(&deviceInfo->ScheduleTimer);
+}
+
+BOOLEAN AemPlatformDelayRead(PAEM_CORE Core, PVOID Request, ULONGLONG DueTime) {
+  PAEM_DEVICE_EXTENSION     deviceInfo = CONTAINING_RECORD(Core, AEM_DEVICE_EXTENSION, Core);
+  PIRP                      Irp = (PIRP) Request;
+  PLIST_ENTRY               entry;
+  KIRQL                     irql;
+
+  KeAcquireSpinLock(&Core->ReadLock, &irql);
+  READ_IRP_DUE_TIME(Irp) = DueTime;
+
+  /* Slots are reserved in order, so the Irp almost always goes to the tail. */
+  for(entry = deviceInfo->DelayedReadIrps.Blink; entry != &deviceInfo->DelayedReadIrps; entry = entry->Blink)
+    if(READ_IRP_DUE_TIME(CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry)) <= DueTime)
+      break;
+  InsertHeadList(entry, &Irp->Tail.Overlay.ListEntry);
+
+  if(AemReadTimerIsArmNeeded(&deviceInfo->ReadTimerState, DueTime, deviceInfo->DelayedReadIrps.Flink == &Irp->Tail.Overlay.ListEntry))
+    ArmReadTimer(deviceInfo, DueTime);
+  KeReleaseSpinLock(&Core->ReadLock, irql);
+  return TRUE;
+}
+
+VOID AemPlatformParkRead(PAEM_CORE Core, PVOID Request) {
+  PAEM_DEVICE_EXTENSION     deviceInfo = CONTAINING_RECORD(Core, AEM_DEVICE_EXTENSION, Core);
+
+  IoCsqInsertIrp(&deviceInfo->ReadIrpQueue, (PIRP) Request, NULL);
+}
+
+PVOID AemPlatformUnparkRead(PAEM_CORE Core) {
+  PAEM_DEVICE_EXTENSION     deviceInfo = CONTAINING_RECORD(Core, AEM_DEVICE_EXTENSION, Core);
+
+  return IoCsqRemoveNextIrp(&deviceInfo->ReadIrpQueue, NULL);
+}
+
+VOID AemPlatformCompleteRead(PAEM_CORE Core, PVOID Request, NTSTATUS Status, PUCHAR Report, ULONG Size) {
+  PIRP                      Irp = (PIRP) Request;
+
+  UNREFERENCED_PARAMETER(Core);
+  if(NT_SUCCESS(Status)) {
+    RtlCopyMemory(Irp->UserBuffer, Report, Size);
+
+    /* Report how many bytes were copied. */
+    Irp->IoStatus.Information = Size;
+  } else {
+    Irp->IoStatus.Information = 0;
+  }
+
+  /* Set real return status in Irp. */
+  Irp->IoStatus.Status = Status;
+  IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+VOID ScheduleDpcRoutine(PKDPC Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2) {
+  /* The earliest timed message is due. If all read Irps are waiting for their emission slots,
+   * the message will be picked up by the first of them. */
+  AemCoreTrace((PAEM_CORE) DeferredContext, AEM_TRACE_SCHEDULE_TIMER, 0, 0);
+  AemCoreWake((PAEM_CORE) DeferredContext);
+}
+
+VOID ReadDpcRoutine(PKDPC Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2) {
+  PAEM_DEVICE_EXTENSION     deviceInfo = (PAEM_DEVICE_EXTENSION) DeferredContext;
+  LIST_ENTRY                dueIrps;
+  PLIST_ENTRY               entry;
+  PIRP                      Irp;
+  ULONGLONG                 now, dueTime;
+
+  InitializeListHead(&dueIrps);
+
+  /* Normally a single Irp is due per period. Several of them are due when emission slots are shorter than clock ticks. */
+  KeAcquireSpinLockAtDpcLevel(&deviceInfo->Core.ReadLock);
+  now = KeQueryInterruptTime();
+  while(!IsListEmpty(&deviceInfo->DelayedReadIrps)) {
+    Irp = CONTAINING_RECORD(deviceInfo->DelayedReadIrps.Flink, IRP, Tail.Overlay.ListEntry);
+    if(READ_IRP_DUE_TIME(Irp) > now)
+      break;
+    RemoveHeadList(&deviceInfo->DelayedReadIrps);
+    InsertTailList(&dueIrps, &Irp->Tail.Overlay.ListEntry);
+  }
+  if(!IsListEmpty(&dueIrps))
+    deviceInfo->Core.ReadTimerTicks++;
+
+  /* Keep the timer running while the next slot is on its period, which it is as long as the interval doesn't change.
+   * Otherwise move the timer to the next slot, or stop it if there are no Irps left. */
+  if(IsListEmpty(&deviceInfo->DelayedReadIrps)) {
+    KeCancelTimer(&deviceInfo->ReadTimer);
+    AemReadTimerStop(&deviceInfo->ReadTimerState);
+  } else {
+    dueTime = READ_IRP_DUE_TIME(CONTAINING_RECORD(deviceInfo->DelayedReadIrps.Flink, IRP, Tail.Overlay.ListEntry));
+    if(AemReadTimerAdvance(&deviceInfo->ReadTimerState, now, dueTime)) {
+      deviceInfo->Core.ReadTimerRearms++;
+      ArmReadTimer(deviceInfo, dueTime);
+    }
+  }
+  KeReleaseSpinLockFromDpcLevel(&deviceInfo->Core.ReadLock);
+
+  while(!IsListEmpty(&dueIrps)) {
+    entry = RemoveHeadList(&dueIrps);
+    Irp = CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry);
+    AemCoreTrace(&deviceInfo->Core, AEM_TRACE_READ_TIMER, (DWORD32) (ULONG_PTR) Irp, 0);
+    AemCoreCompleteRead(&deviceInfo->Core, Irp);
+  }
+}
+
+/** Starts the read timer at the given due time, with the period of the current emission interval.
+ * Intervals that are not whole milliseconds are off the period, the timer is then moved on every slot. 
+ * Must be called with Core.ReadLock held.
+ *
+ * @param DeviceInfo                   Device extension.
+ * @param DueTime                      Interrupt time of the first period. */
+VOID ArmReadTimer(PAEM_DEVICE_EXTENSION DeviceInfo, ULONGLONG DueTime) {
+  LARGE_INTEGER             timeout;
+  LONG                      period;
+
+  period = AemReadTimerArm(&DeviceInfo->ReadTimerState, DueTime, AemCoreEmissionInterval(&DeviceInfo->Core));
+  timeout.QuadPart = -(LONGLONG) AemReadTimerDelay(&DeviceInfo->ReadTimerState, KeQueryInterruptTime()); /* In 100 ns. */
+  KeSetTimerEx(&DeviceInfo->ReadTimer, timeout, period, &DeviceInfo->ReadDpc);
+}
+
+/** Stops the timers of a device that is being removed, and fails the read Irps still waiting for their emission slots.
+ * Once this returns, no DPC of the device runs or is queued. 
+ *
+ * @param DeviceInfo                   Device extension. */
+VOID StopTimers(PAEM_DEVICE_EXTENSION DeviceInfo) {
+  LIST_ENTRY                delayedIrps;
+  PLIST_ENTRY               entry;
+  PIRP                      Irp;
+  KIRQL                     irql;
+
+  PAGED_CODE();
+
+  KeCancelTimer(&DeviceInfo->ScheduleTimer);
+
+  /* Irps are taken off the list before the timer is cancelled, so that a read DPC that is running finds 
+   * no Irps and doesn't arm the timer again. */
+  InitializeListHead(&delayedIrps);
+  KeAcquireSpinLock(&DeviceInfo->Core.ReadLock, &irql);
+  while(!IsListEmpty(&DeviceInfo->DelayedReadIrps))
+    InsertTailList(&delayedIrps, RemoveHeadList(&DeviceInfo->DelayedReadIrps));
+  AemReadTimerStop(&DeviceInfo->ReadTimerState);
+  KeReleaseSpinLock(&DeviceInfo->Core.ReadLock, irql);
+  KeCancelTimer(&DeviceInfo->ReadTimer);
+
+  /* DPCs of the timers may have been queued before they were cancelled, they must not run on the freed core. */
+  KeFlushQueuedDpcs();
+
+  while(!IsListEmpty(&delayedIrps)) {
+    entry = RemoveHeadList(&delayedIrps);
+    Irp = CONTAINING_RECORD(entry, IRP, Tail.Overlay.ListEntry);
+    Irp->IoStatus.Status = STATUS_DELETE_PENDING;
+    Irp->IoStatus.Information = 0;
+    IoCompleteRequest(Irp, IO_NO_INCREMENT);
+  }
+}
+
+
+/** Creates a named section of a single page in the global namespace, maps it into system space and locks it.
+ * Everyone may map the section with the given access. The page is accessed at DISPATCH_LEVEL, 
+ * so it is accessed through the system mapping of the MDL.
+ *
+ * @param Page                         Page to create.
+ * @param Name                         Name of the section, without the page ID.
+ * @param UserAccess                   Access to the section granted to everyone, SECTION_MAP_XXX.
+ * @param PageCount                    Number of pages created so far with this name, used to give each page a unique name.
+ * @param Address                      (out) System address of the page.
+ * @param PageId                       (out) Page ID, appended to the name of the section.
+ * @returns                            NT status code. */
+NTSTATUS CreateSharedPage(PSHARED_PAGE Page, PCSTR Name, ACCESS_MASK UserAccess, PLONG PageCount, PVOID* Address, PULONG PageId) {
+  NTSTATUS                  ntStatus;
+  WCHAR                     nameBuffer[64];
+  UNICODE_STRING            name;
+  OBJECT_ATTRIBUTES         attributes;
+  SECURITY_DESCRIPTOR       securityDescriptor;
+  PACL                      acl;
+  ULONG                     aclSize;
+  LARGE_INTEGER             sectionSize;
+  SIZE_T                    viewSize = 0;
+  PVOID                     section;
+  PVOID                     address;
+  ULONG                     pageId;
+
+  PAGED_CODE();
+
+  RtlZeroMemory(Page, sizeof(SHARED_PAGE));
+
+  /* Kernel handles bypass access checks, so a single entry for everyone is enough. */
+  aclSize = sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) + RtlLengthSid(SeExports->SeWorldSid);
+  acl = ExAllocatePoolWithTag(PagedPool, aclSize, AEM_POOL_TAG);
+  if(acl == NULL)
+    return STATUS_INSUFFICIENT_RESOURCES;
+  RtlCreateSecurityDescriptor(&securityDescriptor, SECURITY_DESCRIPTOR_REVISION);
+  RtlCreateAcl(acl, aclSize, ACL_REVISION);
+  RtlAddAccessAllowedAce(acl, ACL_REVISION, UserAccess | SECTION_QUERY, SeExports->SeWorldSid);
+  RtlSetDaclSecurityDescriptor(&securityDescriptor, TRUE, acl, FALSE);
+
+  /* Sections of a previous driver instance live on while some process has them mapped, skip their names. */
+  sectionSize.QuadPart = PAGE_SIZE;
+  do {
+    pageId = (ULONG) InterlockedIncrement(PageCount) - 1;
+    RtlStringCbPrintfW(nameBuffer, sizeof(nameBuffer), L"\\BaseNamedObjects\\%S%u", Name, pageId);
+    RtlInitUnicodeString(&name, nameBuffer);
+    InitializeObjectAttributes(&attributes, &name, OBJ_KERNEL_HANDLE, NULL, &securityDescriptor);
+    ntStatus = ZwCreateSection(&Page->Section, SECTION_ALL_ACCESS, &attributes, &sectionSize, PAGE_READWRITE, SEC_COMMIT, NULL);
+  } while(ntStatus == STATUS_OBJECT_NAME_COLLISION);
+  ExFreePool(acl);
+  if(!NT_SUCCESS(ntStatus)) {
+    Page->Section = NULL;
+    return ntStatus;
+  }
+
+  ntStatus = ObReferenceObjectByHandle(Page->Section, SECTION_MAP_READ | SECTION_MAP_WRITE, NULL, KernelMode, &section, NULL);
+  if(NT_SUCCESS(ntStatus)) {
+    ntStatus = MmMapViewInSystemSpace(section, &Page->View, &viewSize);
+    ObDereferenceObject(section);
+  }
+  if(!NT_SUCCESS(ntStatus)) {
+    Page->View = NULL;
+    DeleteSharedPage(Page);
+    return ntStatus;
+  }
+
+  Page->Mdl = IoAllocateMdl(Page->View, PAGE_SIZE, FALSE, FALSE, NULL);
+  if(Page->Mdl == NULL) {
+    DeleteSharedPage(Page);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  __try {
+    MmProbeAndLockPages(Page->Mdl, KernelMode, IoWriteAccess);
+  } __except(EXCEPTION_EXECUTE_HANDLER) {
+    DeleteSharedPage(Page);
+    return GetExceptionCode();
+  }
+
+  address = MmGetSystemAddressForMdlSafe(Page->Mdl, NormalPagePriority);
+  if(address == NULL) {
+    DeleteSharedPage(Page);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  *Address = address;
+  *PageId = pageId;
+  return STATUS_SUCCESS;
+}
+
+/** Releases whatever CreateSharedPage has managed to set up. Processes that have the page mapped keep it until they unmap it.
+ *
+ * @param Page                         Page. */
+VOID DeleteSharedPage(PSHARED_PAGE Page) {
+  PAGED_CODE();
+
+  if(Page->Mdl != NULL) {
+    if(Page->Mdl->MdlFlags & MDL_PAGES_LOCKED)
+      MmUnlockPages(Page->Mdl);
+    IoFreeMdl(Page->Mdl);
+    Page->Mdl = NULL;
+  }
+  if(Page->View != NULL) {
+    MmUnmapViewInSystemSpace(Page->View);
+    Page->View = NULL;
+  }
+  if(Page->Section != NULL) {
+    ZwClose(Page->Section);
+    Page->Section = NULL;
+  }
+}
+
+/** Creates the statistics page of the device, and moves the counters of the core into it. 
+ * Everyone may map the page for reading, and nobody may map it for writing.
+ *
+ * @param DeviceInfo                   Device extension.
+ * @returns                            NT status code. */
+NTSTATUS CreateStatsPage(PAEM_DEVICE_EXTENSION DeviceInfo) {
+  NTSTATUS                  ntStatus;
+  PVOID                     page;
+  ULONG                     pageId;
+
+  PAGED_CODE();
+
+  ntStatus = CreateSharedPage(&DeviceInfo->StatsPage, AEM_STATS_SECTION_NAME, SECTION_MAP_READ, &StatsPageCount, &page, &pageId);
+  if(!NT_SUCCESS(ntStatus))
+    return ntStatus;
+
+  AemCoreSetStatsPage(&DeviceInfo->Core, (PAEM_STATS_PAGE) page, pageId);
+  DebugPrint(("Statistics page %u created\n", pageId));
+  return STATUS_SUCCESS;
+}
+
+/** Moves the counters back into the core, and deletes the statistics page.
+ *
+ * @param DeviceInfo                   Device extension. */
+VOID DeleteStatsPage(PAEM_DEVICE_EXTENSION DeviceInfo) {
+  PAGED_CODE();
+
+  AemCoreSetStatsPage(&DeviceInfo->Core, NULL, 0);
+  DeleteSharedPage(&DeviceInfo->StatsPage);
+}
+
+/** Creates the submission channel of the device and hands it to the core.
+ * Everyone may map the page for reading and writing, the core doesn't trust its contents.
+ *
+ * @param DeviceInfo                   Device extension.
+ * @returns                            NT status code. */
+NTSTATUS CreateChannelPage(PAEM_DEVICE_EXTENSION DeviceInfo) {
+  NTSTATUS                  ntStatus;
+  PVOID                     page;
+  ULONG                     pageId;
+
+  PAGED_CODE();
+
+  ntStatus = CreateSharedPage(&DeviceInfo->ChannelPage, AEM_CHANNEL_SECTION_NAME, SECTION_MAP_READ | SECTION_MAP_WRITE, &ChannelPageCount, &page, &pageId);
+  if(!NT_SUCCESS(ntStatus))
+    return ntStatus;
+
+  AemCoreSetChannelPage(&DeviceInfo->Core, (PAEM_CHANNEL_PAGE) page, pageId);
+  DebugPrint(("Channel page %u created\n", pageId));
+  return STATUS_SUCCESS;
+}
+
+/** Takes the submission channel from the core, and deletes its page. Moves left in the channel are dropped.
+ * Page is unmapped only after the core has let go of it, see AemCoreSetChannelPage.
+ *
+ * @param DeviceInfo                   Device extension. */
+VOID DeleteChannelPage(PAEM_DEVICE_EXTENSION DeviceInfo) {
+  PAGED_CODE();
+
+  AemCoreSetChannelPage(&DeviceInfo->Core, NULL, 0);
+  DeleteSharedPage(&DeviceInfo->ChannelPage);
+}
+
+
+/* Cancel-safe queue callbacks for parked read Irps. All of them are called by the IoCsqXxx routines. */
+
+VOID ReadIrpQueueInsert(PIO_CSQ Csq, PIRP Irp) {
+  PAEM_DEVICE_EXTENSION deviceInfo = CONTAINING_RECORD(Csq, AEM_DEVICE_EXTENSION, ReadIrpQueue);
+  InsertTailList(&deviceInfo->PendingReadIrps, &Irp->Tail.Overlay.ListEntry);
+}
+
+VOID ReadIrpQueueRemove(PIO_CSQ Csq, PIRP Irp) {
+  UNREFERENCED_PARAMETER(Csq);
+  RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+}
+
+PIRP ReadIrpQueuePeekNext(PIO_CSQ Csq, PIRP Irp, PVOID PeekContext) {
+  PAEM_DEVICE_EXTENSION deviceInfo = CONTAINING_RECORD(Csq, AEM_DEVICE_EXTENSION, ReadIrpQueue);
+  PLIST_ENTRY           next;
+
+  UNREFERENCED_PARAMETER(PeekContext);
+  next = Irp == NULL ? deviceInfo->PendingReadIrps.Flink : Irp->Tail.Overlay.ListEntry.Flink;
+  if(next == &deviceInfo->PendingReadIrps)
+    return NULL;
+  return CONTAINING_RECORD(next, IRP, Tail.Overlay.ListEntry);
+}
+
+VOID ReadIrpQueueAcquireLock(PIO_CSQ Csq, PKIRQL Irql) {
+  PAEM_DEVICE_EXTENSION deviceInfo = CONTAINING_RECORD(Csq, AEM_DEVICE_EXTENSION, ReadIrpQueue);
+  KeAcquireSpinLock(&deviceInfo->Core.ReadLock, Irql);
+}
+
+VOID ReadIrpQueueReleaseLock(PIO_CSQ Csq, KIRQL Irql) {
+  PAEM_DEVICE_EXTENSION deviceInfo = CONTAINING_RECORD(Csq, AEM_DEVICE_EXTENSION, ReadIrpQueue);
+  KeReleaseSpinLock(&deviceInfo->Core.ReadLock, Irql);
+}
+
+VOID ReadIrpQueueCompleteCanceled(PIO_CSQ Csq, PIRP Irp) {
+  UNREFERENCED_PARAMETER(Csq);
+  Irp->IoStatus.Status = STATUS_CANCELLED;
+  Irp->IoStatus.Information = 0;
+  IoCompleteRequest(Irp, IO_NO_INCREMENT);
+}
+
+
+/** Finds the Report descriptor and copies it into the buffer provided by the Irp.
+ *
+ * @param DeviceObject                 Pointer to a device object.
+ * @param Irp                          Pointer to Interrupt Request Packet.
+ * @returns                            NT status code. */
+NTSTATUS GetReportDescriptor(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+  NTSTATUS                  ntStatus = STATUS_SUCCESS;
+  PAEM_DEVICE_EXTENSION deviceInfo;
+  PIO_STACK_LOCATION        IrpStack;
+  ULONG                     bytesToCopy;
+
+  DebugPrint(("HidMiniGetReportDescriptor Entry\n"));
+  IrpStack = IoGetCurrentIrpStackLocation(Irp);
+  deviceInfo = GET_MINIDRIVER_DEVICE_EXTENSION(DeviceObject);
+
+  /* Copy device descriptor to HIDCLASS buffer. */
+  DebugPrint(("HIDCLASS Buffer = 0x%x, Buffer length = 0x%x\n", Irp->UserBuffer, IrpStack->Parameters.DeviceIoControl.OutputBufferLength));
+  bytesToCopy = IrpStack->Parameters.DeviceIoControl.OutputBufferLength;
+  if(!bytesToCopy)
+    return STATUS_BUFFER_TOO_SMALL;
+  if(bytesToCopy > deviceInfo->HidDescriptor.DescriptorList[0].wReportLength)
+      bytesToCopy = deviceInfo->HidDescriptor.DescriptorList[0].wReportLength;
+  DebugPrint(("Copying 0x%x bytes to HIDCLASS buffer\n", bytesToCopy));
+  RtlCopyMemory((PUCHAR) Irp->UserBuffer, (PUCHAR) deviceInfo->ReportDescriptor, bytesToCopy);
+
+  /* Report how many bytes were copied. */
+  Irp->IoStatus.Information = bytesToCopy;
+
+  DebugPrint(("HidMiniGetReportDescriptor Exit = 0x%x\n", ntStatus));
+  return ntStatus;
+}
+
+
+/** Fill in the given struct _HID_DEVICE_ATTRIBUTES.
+ * 
+ * @param DeviceObject                 Pointer to a device object.
+ * @param Irp                          Pointer to Interrupt Request Packet.
+ * @returns                            NT status code. */
+NTSTATUS GetDeviceAttributes(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+  NTSTATUS               ntStatus = STATUS_SUCCESS;
+  PIO_STACK_LOCATION     irpStack;
+  PHID_DEVICE_ATTRIBUTES deviceAttributes;
+
+  DebugPrint(("HidMiniGetDeviceAttributes Entry\n"));
+
+  irpStack = IoGetCurrentIrpStackLocation(Irp);
+  deviceAttributes = (PHID_DEVICE_ATTRIBUTES) Irp->UserBuffer;
+  if(sizeof(HID_DEVICE_ATTRIBUTES) > irpStack->Parameters.DeviceIoControl.OutputBufferLength)
+    return STATUS_BUFFER_TOO_SMALL;
+  
+  /* Report how many bytes were copied. */
+  Irp->IoStatus.Information = sizeof(HID_DEVICE_ATTRIBUTES);
+  
+  /* Write result. */
+  deviceAttributes->Size = sizeof(HID_DEVICE_ATTRIBUTES);
+  deviceAttributes->VendorID = AEM_VENDOR_ID;
+  deviceAttributes->ProductID = AEM_PRODUCT_ID;
+  deviceAttributes->VersionNumber = AEM_VERSION;
+
+  DebugPrint(("HidMiniGetAttributes Exit = 0x%x\n", ntStatus));
+  return ntStatus;
+}
+
+#if DBG
+PCHAR PnPMinorFunctionString(UCHAR MinorFunction) {
+  switch (MinorFunction) {
+  case IRP_MN_START_DEVICE:
+    return "IRP_MN_START_DEVICE";
+  case IRP_MN_QUERY_REMOVE_DEVICE:
+    return "IRP_MN_QUERY_REMOVE_DEVICE";
+  case IRP_MN_REMOVE_DEVICE:
+    return "IRP_MN_REMOVE_DEVICE";
+  case IRP_MN_CANCEL_REMOVE_DEVICE:
+    return "IRP_MN_CANCEL_REMOVE_DEVICE";
+  case IRP_MN_STOP_DEVICE:
+    return "IRP_MN_STOP_DEVICE";
+  case IRP_MN_QUERY_STOP_DEVICE:
+    return "IRP_MN_QUERY_STOP_DEVICE";
+  case IRP_MN_CANCEL_STOP_DEVICE:
+    return "IRP_MN_CANCEL_STOP_DEVICE";
+  case IRP_MN_QUERY_DEVICE_RELATIONS:
+    return "IRP_MN_QUERY_DEVICE_RELATIONS";
+  case IRP_MN_QUERY_INTERFACE:
+    return "IRP_MN_QUERY_INTERFACE";
+  case IRP_MN_QUERY_CAPABILITIES:
+    return "IRP_MN_QUERY_CAPABILITIES";
+  case IRP_MN_QUERY_RESOURCES:
+    return "IRP_MN_QUERY_RESOURCES";
+  case IRP_MN_QUERY_RESOURCE_REQUIREMENTS:
+    return "IRP_MN_QUERY_RESOURCE_REQUIREMENTS";
+  case IRP_MN_QUERY_DEVICE_TEXT:
+    return "IRP_MN_QUERY_DEVICE_TEXT";
+  case IRP_MN_FILTER_RESOURCE_REQUIREMENTS:
+    return "IRP_MN_FILTER_RESOURCE_REQUIREMENTS";
+  case IRP_MN_READ_CONFIG:
+    return "IRP_MN_READ_CONFIG";
+  case IRP_MN_WRITE_CONFIG:
+    return "IRP_MN_WRITE_CONFIG";
+  case IRP_MN_EJECT:
+    return "IRP_MN_EJECT";
+  case IRP_MN_SET_LOCK:
+    return "IRP_MN_SET_LOCK";
+  case IRP_MN_QUERY_ID:
+    return "IRP_MN_QUERY_ID";
+  case IRP_MN_QUERY_PNP_DEVICE_STATE:
+    return "IRP_MN_QUERY_PNP_DEVICE_STATE";
+  case IRP_MN_QUERY_BUS_INFORMATION:
+    return "IRP_MN_QUERY_BUS_INFORMATION";
+  case IRP_MN_DEVICE_USAGE_NOTIFICATION:
+    return "IRP_MN_DEVICE_USAGE_NOTIFICATION";
+  case IRP_MN_SURPRISE_REMOVAL:
+    return "IRP_MN_SURPRISE_REMOVAL";
+  default:
+    return "unknown_pnp_irp";
+  }
+}
+#endif
+
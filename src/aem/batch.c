@@ -0,0 +1,83 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "batch.h"
+
+VOID AemBatchInit(PAEM_BATCH_FEATURE_REPORT Batch) {
+  Batch->Report.ReportId = AEM_CONTROL_REPORT_ID;
+  Batch->Report.ControlCode = AEM_CONTROL_CODE_MOVE_BATCH;
+  Batch->Count = 0;
+}
+
+BOOLEAN AemBatchAppend(PAEM_BATCH_FEATURE_REPORT Batch, BOOLEAN IsRelative, UCHAR Buttons, SHORT X, SHORT Y) {
+  PAEM_MOVE_ENTRY entry;
+
+  if(Batch->Count >= AEM_MAX_BATCH_SIZE)
+    return FALSE;
+
+  entry = &Batch->Entries[Batch->Count++];
+  entry->Flags = IsRelative ? 0 : AEM_MOVE_ABSOLUTE;
+  entry->Buttons = Buttons;
+  entry->Point.X = X;
+  entry->Point.Y = Y;
+  return TRUE;
+}
+
+BOOLEAN AemBatchAppendEntry(PAEM_BATCH_FEATURE_REPORT Batch, const AEM_MOVE_ENTRY *Entry) {
+  if(Batch->Count >= AEM_MAX_BATCH_SIZE)
+    return FALSE;
+
+  Batch->Entries[Batch->Count++] = *Entry;
+  return TRUE;
+}
+
+ULONG AemBatchSize(PAEM_BATCH_FEATURE_REPORT Batch) {
+  return AEM_BATCH_FEATURE_REPORT_SIZE(Batch->Count);
+}
+
+BOOLEAN AemBatchIsValid(PAEM_BATCH_FEATURE_REPORT Batch, ULONG BufferLength) {
+  if(BufferLength < AEM_BATCH_FEATURE_REPORT_SIZE(0))
+    return FALSE;
+  if(Batch->Count > AEM_MAX_BATCH_SIZE)
+    return FALSE;
+  return BufferLength >= AEM_BATCH_FEATURE_REPORT_SIZE(Batch->Count);
+}
+
+VOID AemBatchGetMessage(PAEM_BATCH_FEATURE_REPORT Batch, ULONG Index, PAEM_MESSAGE Message) {
+  AemBatchUnpackEntry(&Batch->Entries[Index], Message);
+}
+
+VOID AemBatchUnpackEntry(const AEM_MOVE_ENTRY *Entry, PAEM_MESSAGE Message) {
+  if(Entry->Flags & AEM_MOVE_KEY) {
+    Message->Kind = AEM_MESSAGE_KEY;
+    Message->Key = Entry->Buttons;
+    Message->IsKeyDown = !(Entry->Flags & AEM_MOVE_KEY_UP);
+    return;
+  }
+  Message->IsRelative = !(Entry->Flags & AEM_MOVE_ABSOLUTE);
+  Message->Buttons = Entry->Buttons;
+  if(Entry->Flags & AEM_MOVE_SCROLL) {
+    Message->Kind = AEM_MESSAGE_SCROLL;
+    Message->Wheel = Entry->Point.Y;
+    Message->Pan = Entry->Point.X;
+    Message->Point.X = 0;
+    Message->Point.Y = 0;
+    return;
+  }
+  Message->Kind = AEM_MESSAGE_MOVE;
+  Message->Point = Entry->Point;
+}
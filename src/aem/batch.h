@@ -0,0 +1,71 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_BATCH_H__
+#define __AEM_BATCH_H__
+
+#include "portable.h"
+#include "common.h"
+#include "message.h"
+
+/** Initializes an empty batch report.
+ *
+ * @param Batch                        Batch report to initialize. */
+VOID AemBatchInit(PAEM_BATCH_FEATURE_REPORT Batch);
+
+/** Appends a move to the batch report.
+ *
+ * @param Batch                        Batch report.
+ * @param IsRelative                   Motion mode of the move.
+ * @param Buttons                      Button flags.
+ * @param X                            X coordinate.
+ * @param Y                            Y coordinate.
+ * @returns                            FALSE if the batch is already full, TRUE otherwise. */
+BOOLEAN AemBatchAppend(PAEM_BATCH_FEATURE_REPORT Batch, BOOLEAN IsRelative, UCHAR Buttons, SHORT X, SHORT Y);
+
+/** Appends an entry to the batch report as it is, be it a move or a key event.
+ *
+ * @param Batch                        Batch report.
+ * @param Entry                        Entry to append.
+ * @returns                            FALSE if the batch is already full, TRUE otherwise. */
+BOOLEAN AemBatchAppendEntry(PAEM_BATCH_FEATURE_REPORT Batch, const AEM_MOVE_ENTRY *Entry);
+
+/** @param Batch                       Batch report.
+ * @returns                            Number of bytes that must be transferred for the given batch report. */
+ULONG AemBatchSize(PAEM_BATCH_FEATURE_REPORT Batch);
+
+/** Checks that a batch report received in a buffer of the given length is well-formed.
+ *
+ * @param Batch                        Batch report.
+ * @param BufferLength                 Length of the buffer holding the report, in bytes.
+ * @returns                            TRUE if the report is well-formed, FALSE otherwise. */
+BOOLEAN AemBatchIsValid(PAEM_BATCH_FEATURE_REPORT Batch, ULONG BufferLength);
+
+/** Unpacks a single move from the batch report into a queue message.
+ *
+ * @param Batch                        Batch report.
+ * @param Index                        Index of the move to unpack, must be less than Batch->Count.
+ * @param Message                      (out) Message. */
+VOID AemBatchGetMessage(PAEM_BATCH_FEATURE_REPORT Batch, ULONG Index, PAEM_MESSAGE Message);
+
+/** Unpacks a move entry into a queue message. Key and scroll entries become key and scroll messages.
+ *
+ * @param Entry                        Move entry, as found in batch reports and in the submission channel.
+ * @param Message                      (out) Message. */
+VOID AemBatchUnpackEntry(const AEM_MOVE_ENTRY *Entry, PAEM_MESSAGE Message);
+
+#endif // __AEM_BATCH_H__
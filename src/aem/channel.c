@@ -0,0 +1,145 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "channel.h"
+
+VOID AemChannelInit(PAEM_CHANNEL Channel, PAEM_CHANNEL_PAGE Page, ULONG Capacity) {
+  ULONG i;
+
+  Channel->Page = Page;
+  Channel->Mask = Capacity - 1;
+  Channel->Head = 0;
+  if(Page == NULL)
+    return;
+
+  Page->Version = AEM_CHANNEL_PAGE_VERSION;
+  Page->Capacity = Capacity;
+  Page->Tail = 0;
+  Page->Head = 0;
+  Page->Idle = 0;
+  Page->Generation = 0;
+  for(i = 0; i < Capacity; i++)
+    Page->Slots[i].Sequence = (LONG) i;
+}
+
+BOOLEAN AemChannelPeek(PAEM_CHANNEL Channel, PAEM_MOVE_ENTRY Entry) {
+  PAEM_CHANNEL_SLOT slot = &Channel->Page->Slots[Channel->Head & Channel->Mask];
+
+  if(AemReadAcquire(&slot->Sequence) != (LONG) (Channel->Head + 1))
+    return FALSE;
+
+  *Entry = slot->Entry;
+  return TRUE;
+}
+
+VOID AemChannelPop(PAEM_CHANNEL Channel) {
+  PAEM_CHANNEL_SLOT slot = &Channel->Page->Slots[Channel->Head & Channel->Mask];
+
+  AemWriteRelease(&slot->Sequence, (LONG) (Channel->Head + Channel->Mask + 1));
+  Channel->Head++;
+  AemWriteRelease(&Channel->Page->Head, (LONG) Channel->Head);
+}
+
+ULONG AemChannelClear(PAEM_CHANNEL Channel) {
+  AEM_MOVE_ENTRY entry;
+  ULONG          count = 0;
+
+  while(AemChannelPeek(Channel, &entry)) {
+    AemChannelPop(Channel);
+    count++;
+  }
+  if(AemChannelIsStuck(Channel))
+    count += AemChannelReset(Channel);
+  return count;
+}
+
+BOOLEAN AemChannelIsStuck(PAEM_CHANNEL Channel) {
+  PAEM_CHANNEL_SLOT slot = &Channel->Page->Slots[Channel->Head & Channel->Mask];
+  LONG              sequence;
+
+  sequence = AemReadAcquire(&slot->Sequence);
+  if(sequence == (LONG) (Channel->Head + 1))
+    return FALSE;
+  return sequence != (LONG) Channel->Head || AemReadAcquire(&Channel->Page->Tail) != (LONG) Channel->Head;
+}
+
+ULONG AemChannelReset(PAEM_CHANNEL Channel) {
+  PAEM_CHANNEL_PAGE page = Channel->Page;
+  ULONG             capacity = Channel->Mask + 1;
+  ULONG             base, dropped, i;
+
+  /* Producers hold positions less than a lap past the head, so two laps past it no stale position is reused. */
+  base = Channel->Head + 2 * capacity;
+  dropped = (ULONG) AemReadAcquire(&page->Tail) - Channel->Head;
+  if(dropped > capacity)
+    dropped = capacity;
+
+  /* Tail is moved before the slots are, producers meanwhile find the channel full. Exchanges are full barriers. */
+  AemInterlockedIncrement(&page->Generation);
+  AemInterlockedExchange(&page->Tail, (LONG) base);
+  for(i = 0; i < capacity; i++)
+    AemWriteRelease(&page->Slots[(base + i) & Channel->Mask].Sequence, (LONG) (base + i));
+  AemWriteRelease(&page->Head, (LONG) base);
+  Channel->Head = base;
+  return dropped;
+}
+
+BOOLEAN AemChannelSleep(PAEM_CHANNEL Channel) {
+  AEM_MOVE_ENTRY entry;
+
+  /* Exchange is a full barrier, the head slot is checked only after Idle is visible to producers. */
+  AemInterlockedExchange(&Channel->Page->Idle, 1);
+  if(!AemChannelPeek(Channel, &entry))
+    return TRUE;
+
+  AemInterlockedExchange(&Channel->Page->Idle, 0);
+  return FALSE;
+}
+
+ULONG AemChannelWrite(PAEM_CHANNEL_PAGE Page, const AEM_MOVE_ENTRY *Entries, ULONG Count) {
+  PAEM_CHANNEL_SLOT slot;
+  ULONG             mask = Page->Capacity - 1;
+  LONG              tail, sequence;
+  ULONG             written = 0;
+
+  while(written < Count) {
+    tail = AemReadAcquire(&Page->Tail);
+    slot = &Page->Slots[tail & mask];
+    sequence = AemReadAcquire(&slot->Sequence);
+
+    /* Slot still holds a move from the previous lap, the channel is full. */
+    if((LONG) ((ULONG) sequence - (ULONG) tail) < 0)
+      break;
+
+    /* Another producer has claimed it, retry with a fresh tail. */
+    if(sequence != tail || AemInterlockedCompareExchange(&Page->Tail, tail + 1, tail) != tail)
+      continue;
+
+    /* Sequence is no longer the claimed one if the channel was reset in the meantime, the move is then dropped. */
+    slot->Entry = Entries[written];
+    if(AemInterlockedCompareExchange(&slot->Sequence, tail + 1, tail) != tail)
+      break;
+    written++;
+  }
+  return written;
+}
+
+BOOLEAN AemChannelNeedsWake(PAEM_CHANNEL_PAGE Page) {
+  /* Published sequences must be visible before Idle is checked, see AemChannelSleep. */
+  AemMemoryBarrier();
+  return AemReadAcquire(&Page->Idle) != 0 && AemInterlockedExchange(&Page->Idle, 0) != 0;
+}
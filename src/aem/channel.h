@@ -0,0 +1,119 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_CHANNEL_H__
+#define __AEM_CHANNEL_H__
+
+#include "portable.h"
+#include "common.h"
+
+/* Submission channel, a bounded multi-producer / single-consumer ring of moves living in AEM_CHANNEL_PAGE, 
+ * which is shared by the driver and the processes that map it. Producers are clients of the driver,
+ * the consumer is the driver itself.
+ *
+ * Slots follow the same protocol as the slots of AEM_RING. A slot at position Pos is free for producers when 
+ * its sequence equals Pos, and holds a published move when its sequence equals Pos + 1. A producer claims a free 
+ * slot by advancing Tail with a compare-exchange, fills it and publishes it with a compare-exchange of the sequence.
+ * The consumer takes the move and hands the slot back by storing Pos + Capacity.
+ *
+ * Clients can write anything into the page, so the consumer never trusts it. It keeps its own head and capacity,
+ * reads each slot only once it is published and copies the move out before looking at it. A misbehaving client
+ * can't make the consumer read past the page.
+ *
+ * A producer that dies or is suspended between claiming a slot and publishing it leaves the head of the channel stuck,
+ * and so does a client that scribbles over the sequences. Once the head has been stuck for AEM_CHANNEL_STUCK_TIMEOUT,
+ * or when the queue is cleared, the consumer resets the channel: it bumps Generation, drops all claimed slots and 
+ * renumbers the slots two laps ahead, past the positions any producer may still hold. Publishing is a compare-exchange 
+ * from the claimed position, so a producer that was cut off by the reset finds its slot renumbered and drops its move.
+ * At worst it garbles the move of another producer, which the consumer doesn't trust anyway.
+ *
+ * Consumer doesn't poll the page while it has nothing to do. Before it goes idle it sets Idle and checks the head
+ * slot once more. A producer checks Idle after publishing, and if it is set, clears it and sends an AEM_CHANNEL_WAKE
+ * request. Both sides put a full barrier between the store and the load, so either the consumer sees the move,
+ * or the producer sees Idle. */
+
+/** How long the head of the channel may stay stuck before the consumer resets the channel, in 100 ns. */
+#define AEM_CHANNEL_STUCK_TIMEOUT 10000000
+
+typedef struct _AEM_CHANNEL {
+  PAEM_CHANNEL_PAGE Page; /**< Shared page, NULL if there is no channel. */
+  ULONG             Mask; /**< Capacity - 1, capacity is a power of two. */
+  ULONG             Head; /**< Position of the next slot to be consumed. */
+} AEM_CHANNEL, *PAEM_CHANNEL;
+
+/** Consumer side. Initializes the page and the consumer state.
+ *
+ * @param Channel                      Channel to initialize.
+ * @param Page                         Shared page, NULL for no channel.
+ * @param Capacity                     Number of slots of the page, must be a power of two not greater than AEM_CHANNEL_SIZE. */
+VOID AemChannelInit(PAEM_CHANNEL Channel, PAEM_CHANNEL_PAGE Page, ULONG Capacity);
+
+/** Consumer side. Copies out the move at the head of the channel without removing it.
+ *
+ * @param Channel                      Channel.
+ * @param Entry                        (out) Move.
+ * @returns                            FALSE if there is no published move at the head of the channel, TRUE otherwise. */
+BOOLEAN AemChannelPeek(PAEM_CHANNEL Channel, PAEM_MOVE_ENTRY Entry);
+
+/** Consumer side. Removes the move at the head of the channel, which must have been peeked.
+ *
+ * @param Channel                      Channel. */
+VOID AemChannelPop(PAEM_CHANNEL Channel);
+
+/** Consumer side. Removes all published moves, and resets the channel if some slots are claimed but not published.
+ *
+ * @param Channel                      Channel.
+ * @returns                            Number of removed moves, including the dropped claimed slots. */
+ULONG AemChannelClear(PAEM_CHANNEL Channel);
+
+/** Consumer side. Checks whether the head of the channel is stuck, i.e. its slot is neither published nor free,
+ * or it is free but has been claimed. Head stays stuck only until the producer that claimed it publishes it, 
+ * so it has to be stuck for a while before the channel is reset.
+ *
+ * @param Channel                      Channel.
+ * @returns                            TRUE if the head of the channel is stuck. */
+BOOLEAN AemChannelIsStuck(PAEM_CHANNEL Channel);
+
+/** Consumer side. Drops all claimed slots, published or not, and starts the channel anew at a new generation.
+ *
+ * @param Channel                      Channel.
+ * @returns                            Number of dropped slots, as far as the page tells. */
+ULONG AemChannelReset(PAEM_CHANNEL Channel);
+
+/** Consumer side. Asks the producers to send an AEM_CHANNEL_WAKE request once they publish the next move.
+ *
+ * @param Channel                      Channel.
+ * @returns                            TRUE if the consumer may go idle, FALSE if a move was published in the meantime. */
+BOOLEAN AemChannelSleep(PAEM_CHANNEL Channel);
+
+/** Producer side. Writes moves into the channel in order, stopping at the first one that doesn't fit,
+ * or that was dropped by a reset of the channel. Can be called concurrently by any number of producers, 
+ * in any number of processes.
+ *
+ * @param Page                         Shared page.
+ * @param Entries                      Moves.
+ * @param Count                        Number of moves.
+ * @returns                            Number of moves written. */
+ULONG AemChannelWrite(PAEM_CHANNEL_PAGE Page, const AEM_MOVE_ENTRY *Entries, ULONG Count);
+
+/** Producer side. Must be called after the moves are written. 
+ *
+ * @param Page                         Shared page.
+ * @returns                            TRUE if the consumer is idle and the caller has to send an AEM_CHANNEL_WAKE request. */
+BOOLEAN AemChannelNeedsWake(PAEM_CHANNEL_PAGE Page);
+
+#endif // __AEM_CHANNEL_H__
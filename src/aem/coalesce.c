@@ -0,0 +1,113 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "coalesce.h"
+
+/** @returns                           Value clamped to the relative report range. */
+static LONG AemCoalesceClamp(LONG Value) {
+  if(Value > AEM_MAX_RELATIVE_DELTA)
+    return AEM_MAX_RELATIVE_DELTA;
+  if(Value < -AEM_MAX_RELATIVE_DELTA)
+    return -AEM_MAX_RELATIVE_DELTA;
+  return Value;
+}
+
+VOID AemCoalesceInit(PAEM_COALESCE Coalesce) {
+  Coalesce->IsRelative = FALSE;
+  Coalesce->Count = 0;
+  Coalesce->Buttons = 0;
+  Coalesce->X = 0;
+  Coalesce->Y = 0;
+  Coalesce->EnqueueTime = 0;
+}
+
+BOOLEAN AemCoalesceCanMerge(PAEM_COALESCE Coalesce, PAEM_MESSAGE Message) {
+  return Message->Kind == AEM_MESSAGE_MOVE && 
+    (Coalesce->Count == 0 || (Coalesce->Buttons == Message->Buttons && Coalesce->IsRelative == Message->IsRelative));
+}
+
+VOID AemCoalesceMerge(PAEM_COALESCE Coalesce, PAEM_MESSAGE Message) {
+  if(Coalesce->IsRelative && Coalesce->Count != 0) {
+    Coalesce->X += Message->Point.X;
+    Coalesce->Y += Message->Point.Y;
+  } else {
+    Coalesce->X = Message->Point.X;
+    Coalesce->Y = Message->Point.Y;
+  }
+  if(Coalesce->Count == 0)
+    Coalesce->EnqueueTime = Message->EnqueueTime;
+  Coalesce->IsRelative = Message->IsRelative;
+  Coalesce->Buttons = Message->Buttons;
+  Coalesce->Count++;
+}
+
+BOOLEAN AemCoalesceIsSaturated(PAEM_COALESCE Coalesce) {
+  return Coalesce->IsRelative && (AemCoalesceClamp(Coalesce->X) != Coalesce->X || AemCoalesceClamp(Coalesce->Y) != Coalesce->Y);
+}
+
+BOOLEAN AemCoalesceSplit(PAEM_COALESCE Coalesce, PAEM_MESSAGE Message) {
+  Message->Kind = AEM_MESSAGE_MOVE;
+  Message->IsRelative = Coalesce->IsRelative;
+  Message->Buttons = Coalesce->Buttons;
+  Message->EnqueueTime = Coalesce->EnqueueTime;
+  if(Coalesce->IsRelative) {
+    Message->Point.X = (SHORT) AemCoalesceClamp(Coalesce->X);
+    Message->Point.Y = (SHORT) AemCoalesceClamp(Coalesce->Y);
+    Coalesce->X -= Message->Point.X;
+    Coalesce->Y -= Message->Point.Y;
+    if(Coalesce->X != 0 || Coalesce->Y != 0) {
+      Coalesce->Count = 1;
+      return TRUE;
+    }
+  } else {
+    Message->Point.X = (SHORT) Coalesce->X;
+    Message->Point.Y = (SHORT) Coalesce->Y;
+  }
+  Coalesce->Count = 0;
+  return FALSE;
+}
+
+ULONG AemCoalesceRing(PAEM_RING Ring) {
+  AEM_COALESCE accumulator, previous;
+  AEM_MESSAGE  message;
+  ULONG        size = AemRingSize(Ring);
+  ULONG        read, write = 0;
+
+  /* Merged messages are written back from the head. Write position never overtakes the read one. */
+  AemCoalesceInit(&accumulator);
+  for(read = 0; read < size; read++) {
+    message = *AemRingPeek(Ring, read);
+    if(AemCoalesceCanMerge(&accumulator, &message)) {
+      previous = accumulator;
+      AemCoalesceMerge(&accumulator, &message);
+      if(!AemCoalesceIsSaturated(&accumulator))
+        continue;
+      accumulator = previous;
+    }
+    if(accumulator.Count != 0)
+      AemCoalesceSplit(&accumulator, AemRingPeek(Ring, write++));
+    if(AemCoalesceCanMerge(&accumulator, &message))
+      AemCoalesceMerge(&accumulator, &message);
+    else
+      *AemRingPeek(Ring, write++) = message;
+  }
+  if(accumulator.Count != 0)
+    AemCoalesceSplit(&accumulator, AemRingPeek(Ring, write++));
+
+  AemRingTruncate(Ring, write);
+  return size - write;
+}
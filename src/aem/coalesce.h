@@ -0,0 +1,75 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_COALESCE_H__
+#define __AEM_COALESCE_H__
+
+#include "portable.h"
+#include "message.h"
+#include "ring.h"
+
+/* Merging of consecutive moves with identical button flags and motion mode. Relative deltas are summed, 
+ * and the sum is then split into report-sized messages, so that the final cursor position 
+ * is preserved exactly. Absolute positions are replaced by the last one. Moves with different 
+ * button flags are never merged, so button transitions keep their place in the input. Glides are never merged. */
+
+typedef struct _AEM_COALESCE {
+  BOOLEAN   IsRelative;  /**< Motion mode of the merged moves. */
+  ULONG     Count;       /**< Number of moves merged so far, zero if the accumulator is empty. */
+  UCHAR     Buttons;     /**< Button flags of the merged moves. */
+  LONG      X;           /**< Sum of deltas or last position. */
+  LONG      Y;           /**< Sum of deltas or last position. */
+  ULONGLONG EnqueueTime; /**< Enqueue time of the first merged move, so that merging doesn't hide its wait. */
+} AEM_COALESCE, *PAEM_COALESCE;
+
+/** Initializes an empty accumulator.
+ *
+ * @param Coalesce                     Accumulator to initialize. */
+VOID AemCoalesceInit(PAEM_COALESCE Coalesce);
+
+/** @param Coalesce                    Accumulator.
+ * @param Message                      Move.
+ * @returns                            TRUE if the move can be merged into the accumulator. */
+BOOLEAN AemCoalesceCanMerge(PAEM_COALESCE Coalesce, PAEM_MESSAGE Message);
+
+/** Merges a move into the accumulator. The move must satisfy AemCoalesceCanMerge.
+ *
+ * @param Coalesce                     Accumulator.
+ * @param Message                      Move. */
+VOID AemCoalesceMerge(PAEM_COALESCE Coalesce, PAEM_MESSAGE Message);
+
+/** @param Coalesce                    Accumulator.
+ * @returns                            TRUE if the accumulated motion doesn't fit into a single report. */
+BOOLEAN AemCoalesceIsSaturated(PAEM_COALESCE Coalesce);
+
+/** Takes a single report-sized move out of a non-empty accumulator. In relative mode 
+ * the deltas are clamped to the report range and the remainder is left in the accumulator.
+ *
+ * @param Coalesce                     Non-empty accumulator.
+ * @param Message                      (out) Move.
+ * @returns                            TRUE if some motion remains in the accumulator, FALSE if it is empty now. */
+BOOLEAN AemCoalesceSplit(PAEM_COALESCE Coalesce, PAEM_MESSAGE Message);
+
+/** Compacts the ring in place by merging runs of moves with identical button flags. Unlike 
+ * AemCoalesceSplit, relative deltas are merged only while the sum fits into a single report, 
+ * so every message in the compacted ring is still a valid report. Requires exclusive access to the ring.
+ *
+ * @param Ring                         Ring.
+ * @returns                            Number of messages that were merged away. */
+ULONG AemCoalesceRing(PAEM_RING Ring);
+
+#endif // __AEM_COALESCE_H__
@@ -1,69 +1,337 @@
-/* This file is part of Aethered, a collection of virtual device drivers for
- * Windows.
- *
- * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
- *
- * Aethered is free software; you can redistribute it and/or
- * modify it under the terms of the GNU General Public License 
- * as published by the Free Software Foundation; either
- * version 3 of the License, or (at your option) any later version.
- *
- * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
- * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
- * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
- * for more details.
- *
- * You should have received a copy of the GNU General Public License 
- * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
-#ifndef __AEM_COMMON_H__
-#define __AEM_COMMON_H__
-
-#define AEM_POINTER_REPORT_ID 0x01
-#define AEM_CONTROL_REPORT_ID 0x02
-
-#define AEM_CONTROL_USAGE 0x07
-
-#define AEM_USAGE_PAGE_SHORT 0xFF00
-#define AEM_USAGE_PAGE_BYTES 0x00, 0xFF
-
-#define AEM_CONTROL_CODE_MOVE        0x00
-#define AEM_CONTROL_CODE_INFO        0x01
-#define AEM_CONTROL_CODE_CLEAR_QUEUE 0x02
-#define AEM_CONTROL_CODE_INTERVAL    0x03
-#define AEM_CONTROL_CODE_QUEUE_SIZE  0x04
-#define AEM_CONTROL_CODE_ERROR       0xFF
-
-#define AEM_FLAG_RELATIVE 0x01
-
-#include <pshpack1.h>
-
-typedef struct _SHORT_POINT {
-  SHORT X;
-  SHORT Y;
-} SHORT_POINT, *PSHORT_POINT;
-
-typedef struct _AEM_FEATURE_REPORT {
-  UCHAR ReportId; /**< Report ID of the collection to which the control request is sent. */
-  UCHAR ControlCode; /**< Control Code / Success Flag. */
-} AEM_FEATURE_REPORT, *PAEM_FEATURE_REPORT;
-
-typedef struct _AEM_MOVE_FEATURE_REPORT {
-  AEM_FEATURE_REPORT Report; /**< Base report. */
-  UCHAR Buttons; /**< Button flags. */
-  SHORT_POINT Point; /**< New coord. */
-} AEM_MOVE_FEATURE_REPORT, *PAEM_MOVE_FEATURE_REPORT;
-
-typedef struct _AEM_INFO_FEATURE_REPORT {
-  AEM_FEATURE_REPORT Report; /**< Base report. */
-  UCHAR Flags; /**< Flags. */
-  DWORD32 MessageQueueCapacity; /**< Size of message queue. */
-} AEM_INFO_FEATURE_REPORT, *PAEM_INFO_FEATURE_REPORT;
-
-typedef struct _AEM_DWORD_FEATURE_REPORT {
-  AEM_FEATURE_REPORT Report; /**< Base report. */
-  DWORD32 Value;
-} AEM_DWORD_FEATURE_REPORT, *PAEM_DWORD_FEATURE_REPORT;
-
-#include <poppack.h>
-
-#endif // __AEM_COMMON_H__
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_COMMON_H__
+#define __AEM_COMMON_H__
+
+#define AEM_POINTER_REPORT_ID          0x01
+#define AEM_CONTROL_REPORT_ID          0x02
+#define AEM_ABSOLUTE_POINTER_REPORT_ID 0x03
+#define AEM_KEYBOARD_REPORT_ID         0x04
+
+#define AEM_CONTROL_USAGE 0x07
+
+#define AEM_USAGE_PAGE_SHORT 0xFF00
+#define AEM_USAGE_PAGE_BYTES 0x00, 0xFF
+
+#define AEM_CONTROL_CODE_MOVE        0x00
+#define AEM_CONTROL_CODE_INFO        0x01
+#define AEM_CONTROL_CODE_CLEAR_QUEUE 0x02
+#define AEM_CONTROL_CODE_INTERVAL    0x03
+#define AEM_CONTROL_CODE_QUEUE_SIZE  0x04
+#define AEM_CONTROL_CODE_MOVE_BATCH  0x05
+#define AEM_CONTROL_CODE_READ_TIMER  0x06
+#define AEM_CONTROL_CODE_CAPACITY    0x07
+#define AEM_CONTROL_CODE_TIMED_BATCH 0x08
+#define AEM_CONTROL_CODE_CATCH_UP    0x09
+#define AEM_CONTROL_CODE_MERGED      0x0A
+#define AEM_CONTROL_CODE_GLIDE       0x0B
+#define AEM_CONTROL_CODE_STATS       0x0C
+#define AEM_CONTROL_CODE_STATS_PAGE  0x0D
+#define AEM_CONTROL_CODE_TRACE       0x0E
+#define AEM_CONTROL_CODE_CHANNEL     0x0F
+#define AEM_CONTROL_CODE_PACING      0x10
+#define AEM_CONTROL_CODE_ERROR       0xFF
+
+/** Flags of AEM_INFO_FEATURE_REPORT, motion modes supported by the device. */
+#define AEM_FLAG_RELATIVE 0x01
+#define AEM_FLAG_ABSOLUTE 0x02
+#define AEM_FLAG_KEYBOARD 0x04 /**< Device has a keyboard collection and accepts key events. */
+#define AEM_FLAG_WHEEL    0x08 /**< Pointer reports carry buttons 4 and 5, vertical wheel and horizontal pan. */
+
+/** Flags of AEM_MOVE_FEATURE_REPORT and AEM_MOVE_ENTRY. */
+#define AEM_MOVE_ABSOLUTE 0x01 /**< Point is an absolute position, not a relative delta. */
+#define AEM_MOVE_KEY      0x02 /**< Entry is a key press, Buttons hold the usage of the key and Point is ignored. */
+#define AEM_MOVE_KEY_UP   0x04 /**< Key entries only. Key is released, not pressed. */
+#define AEM_MOVE_SCROLL   0x08 /**< Entry is a scroll, Point holds horizontal pan (X) and vertical wheel (Y) deltas in detents. 
+                                *   It is emitted with no motion, at the last absolute position if AEM_MOVE_ABSOLUTE is set. */
+
+/** Usages on the Keyboard/Keypad page that key events accept. Modifiers are the last eight ones. */
+#define AEM_KEY_ALL          0x00 /**< Not a key. Releasing it releases all held keys. */
+#define AEM_KEY_LEFT_CONTROL 0xE0
+#define AEM_MAX_KEY          0xE7 /**< Right GUI. */
+
+/** Range of a relative motion delta that fits into a single input report. */
+#define AEM_MAX_RELATIVE_DELTA 127
+
+/** Range of a wheel or pan delta that fits into a single input report. */
+#define AEM_MAX_WHEEL_DELTA 32767
+
+/** Easing curves of AEM_CONTROL_CODE_GLIDE. */
+#define AEM_EASING_LINEAR        0x00
+#define AEM_EASING_EASE_IN_OUT   0x01
+#define AEM_EASING_MINIMUM_JERK  0x02
+
+/** Flags of AEM_GLIDE_FEATURE_REPORT. */
+#define AEM_GLIDE_DELTA    0x01 /**< Point is a delta from the current position, not a target. Required for relative glides. */
+#define AEM_GLIDE_ABSOLUTE 0x02 /**< Glide is emitted as absolute positions, not as relative deltas. */
+
+/** Flags of AEM_CATCH_UP_FEATURE_REPORT. */
+#define AEM_CATCH_UP_ENABLED 0x01 /**< Catch-up mode is enabled. */
+#define AEM_CATCH_UP_UPDATE  0x02 /**< Request only. Apply the given settings, otherwise they are just queried. */
+
+/** Flags of AEM_PACING_FEATURE_REPORT. */
+#define AEM_PACING_ENABLED 0x01 /**< Adaptive pacing is enabled, message check interval is not used for emission slots. */
+#define AEM_PACING_UPDATE  0x02 /**< Request only. Apply the given settings, otherwise they are just queried. */
+
+/** Flags of AEM_STATS_FEATURE_REPORT. */
+#define AEM_STATS_RESET 0x01 /**< Request only. Reset the statistics once they are copied into the report. */
+
+/** Version of AEM_STATS_PAGE, changes whenever its layout does. */
+#define AEM_STATS_PAGE_VERSION 1
+
+/** Statistics page of a device lives in a named section "AemStatsN", N being the page ID returned by
+ * AEM_CONTROL_CODE_STATS_PAGE. Section is created in the global namespace and can only be mapped for reading. */
+#define AEM_STATS_SECTION_NAME "AemStats"
+
+/** Flags of AEM_CHANNEL_FEATURE_REPORT. */
+#define AEM_CHANNEL_WAKE 0x01 /**< Request only. Wake the consumer up, as requested by the channel page. */
+
+/** Version of AEM_CHANNEL_PAGE, changes whenever its layout or protocol does. */
+#define AEM_CHANNEL_PAGE_VERSION 2
+
+/** Number of slots in AEM_CHANNEL_PAGE, a power of two. */
+#define AEM_CHANNEL_SIZE 256
+
+/** Submission channel of a device lives in a named section "AemChannelN", N being the page ID returned by
+ * AEM_CONTROL_CODE_CHANNEL. Section is created in the global namespace and can be mapped for reading and writing. */
+#define AEM_CHANNEL_SECTION_NAME "AemChannel"
+
+/** Kinds of AEM_TRACE_EVENT, with the meanings of their arguments. Times are in 1/1000000 sec. */
+#define AEM_TRACE_ENQUEUE        0x01 /**< Messages queued. Arg1: queue size, Arg2: number of messages. */
+#define AEM_TRACE_QUEUE_FULL     0x02 /**< Messages rejected. Arg1: queue size, Arg2: number of messages. */
+#define AEM_TRACE_DEQUEUE        0x03 /**< Message taken from the queue. Arg1: queue size, Arg2: time it spent in the queue. */
+#define AEM_TRACE_CLEAR          0x04 /**< Queue cleared. Arg2: number of messages dropped. */
+#define AEM_TRACE_READ_PARK      0x05 /**< Read request parked until there is input. Arg1: request. */
+#define AEM_TRACE_READ_DELAY     0x06 /**< Read request delayed until its emission slot. Arg1: request, Arg2: delay. */
+#define AEM_TRACE_READ_COMPLETE  0x07 /**< Read request completed. Arg1: request, Arg2: NTSTATUS. */
+#define AEM_TRACE_READ_TIMER     0x08 /**< Delayed read request is due. Arg1: request. */
+#define AEM_TRACE_SCHEDULE_TIMER 0x09 /**< Schedule timer fired. */
+#define AEM_TRACE_INTERVAL       0x0A /**< Interval between emission slots changed, by a request or by adaptive pacing. Arg1: new interval, Arg2: old one. */
+#define AEM_TRACE_CHANNEL_RESET  0x0B /**< Submission channel reset, its head was stuck or the queue was cleared. Arg2: number of claimed slots dropped. */
+
+/** Maximal number of events in a single AEM_CONTROL_CODE_TRACE report. */
+#define AEM_MAX_TRACE_EVENTS 32
+
+/** Bucket layout of the latency histogram, see histogram.h. Values below AEM_HISTOGRAM_SUB_BUCKETS have a bucket each, 
+ * every following power of two range is split into AEM_HISTOGRAM_SUB_BUCKETS equal buckets. Values of
+ * 2^AEM_HISTOGRAM_MAX_EXPONENT and above all go into the last bucket. */
+#define AEM_HISTOGRAM_SUB_BUCKET_BITS 3
+#define AEM_HISTOGRAM_SUB_BUCKETS     (1 << AEM_HISTOGRAM_SUB_BUCKET_BITS)
+#define AEM_HISTOGRAM_MAX_EXPONENT    24
+#define AEM_HISTOGRAM_BUCKETS         ((AEM_HISTOGRAM_MAX_EXPONENT - AEM_HISTOGRAM_SUB_BUCKET_BITS + 1) * AEM_HISTOGRAM_SUB_BUCKETS)
+
+/** Size of output reports of the control collection, without report ID. Output reports carry submissions
+ * (moves, glides, batches and queue clears) in the same layout as feature reports, padded to this size. 
+ * Fits a full AEM_BATCH_FEATURE_REPORT. */
+#define AEM_OUTPUT_REPORT_SIZE       386
+#define AEM_OUTPUT_REPORT_SIZE_BYTES 0x82, 0x01
+
+/** Maximal number of moves in a single AEM_CONTROL_CODE_MOVE_BATCH report. */
+#define AEM_MAX_BATCH_SIZE 64
+
+/** Maximal number of entries in a single AEM_CONTROL_CODE_TIMED_BATCH report. */
+#define AEM_MAX_TIMED_BATCH_SIZE 32
+
+/** Flags of AEM_TIMED_ENTRY. */
+#define AEM_TIMED_WAIT       0x01 /**< Entry carries no move, it only delays the entries that follow. */
+#define AEM_TIMED_FROM_START 0x02 /**< Time is counted from the sequence start, not from the previous entry. */
+#define AEM_TIMED_ABSOLUTE   0x04 /**< Point is an absolute position, not a relative delta. */
+
+#ifdef _WIN32
+#  include <pshpack1.h>
+#else
+#  pragma pack(push, 1)
+#endif
+
+typedef struct _SHORT_POINT {
+  SHORT X;
+  SHORT Y;
+} SHORT_POINT, *PSHORT_POINT;
+
+typedef struct _AEM_FEATURE_REPORT {
+  UCHAR ReportId; /**< Report ID of the collection to which the control request is sent. */
+  UCHAR ControlCode; /**< Control Code / Success Flag. */
+} AEM_FEATURE_REPORT, *PAEM_FEATURE_REPORT;
+
+typedef struct _AEM_MOVE_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  UCHAR Buttons; /**< Button flags. */
+  SHORT_POINT Point; /**< New coord. */
+  UCHAR Flags; /**< AEM_MOVE_XXX flags. */
+} AEM_MOVE_FEATURE_REPORT, *PAEM_MOVE_FEATURE_REPORT;
+
+typedef struct _AEM_INFO_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  UCHAR Flags; /**< Flags. */
+  DWORD32 MessageQueueCapacity; /**< Size of message queue. */
+} AEM_INFO_FEATURE_REPORT, *PAEM_INFO_FEATURE_REPORT;
+
+typedef struct _AEM_DWORD_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  DWORD32 Value;
+} AEM_DWORD_FEATURE_REPORT, *PAEM_DWORD_FEATURE_REPORT;
+
+typedef struct _AEM_MOVE_ENTRY {
+  UCHAR Flags; /**< AEM_MOVE_XXX flags. */
+  UCHAR Buttons; /**< Button flags. */
+  SHORT_POINT Point; /**< New coord. */
+} AEM_MOVE_ENTRY, *PAEM_MOVE_ENTRY;
+
+/** Variable-length report, only the first Count entries are transferred. */
+typedef struct _AEM_BATCH_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  UCHAR Count; /**< Number of moves in the batch. Driver replaces it with the number of moves that were queued. */
+  AEM_MOVE_ENTRY Entries[AEM_MAX_BATCH_SIZE]; /**< Moves. */
+} AEM_BATCH_FEATURE_REPORT, *PAEM_BATCH_FEATURE_REPORT;
+
+typedef struct _AEM_READ_TIMER_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  DWORD32 Ticks; /**< Number of periods of the read timer that completed read requests. */
+  DWORD32 Rearms; /**< Number of times the read timer was moved off its period, e.g. because the interval changed. */
+} AEM_READ_TIMER_FEATURE_REPORT, *PAEM_READ_TIMER_FEATURE_REPORT;
+
+typedef struct _AEM_TIMED_ENTRY {
+  UCHAR Flags; /**< AEM_TIMED_XXX flags. */
+  UCHAR Buttons; /**< Button flags. */
+  SHORT_POINT Point; /**< New coord. */
+  DWORD32 Time; /**< Due time in 1/1000000 sec, relative to the previous entry or to the sequence start. */
+} AEM_TIMED_ENTRY, *PAEM_TIMED_ENTRY;
+
+/** Variable-length report, only the first Count entries are transferred. */
+typedef struct _AEM_TIMED_BATCH_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  UCHAR Count; /**< Number of entries in the batch. Driver replaces it with the number of entries that were scheduled. */
+  LONGLONG StartTime; /**< System time of the sequence start in 100 ns units (FILETIME), or zero to start right away. */
+  AEM_TIMED_ENTRY Entries[AEM_MAX_TIMED_BATCH_SIZE]; /**< Entries. */
+} AEM_TIMED_BATCH_FEATURE_REPORT, *PAEM_TIMED_BATCH_FEATURE_REPORT;
+
+typedef struct _AEM_GLIDE_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  UCHAR Flags; /**< AEM_GLIDE_XXX flags. */
+  UCHAR Buttons; /**< Button flags. */
+  SHORT_POINT Point; /**< Target coord or delta. */
+  UCHAR Easing; /**< AEM_EASING_XXX. */
+  DWORD32 Duration; /**< Duration in 1/1000000 sec. */
+} AEM_GLIDE_FEATURE_REPORT, *PAEM_GLIDE_FEATURE_REPORT;
+
+typedef struct _AEM_CATCH_UP_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  UCHAR Flags; /**< AEM_CATCH_UP_XXX flags. */
+  DWORD32 Threshold; /**< Queue depth above which queued moves with identical button flags are merged. */
+} AEM_CATCH_UP_FEATURE_REPORT, *PAEM_CATCH_UP_FEATURE_REPORT;
+
+typedef struct _AEM_PACING_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  UCHAR Flags; /**< AEM_PACING_XXX flags. */
+  DWORD32 MinInterval; /**< Shortest interval between emission slots, in 1/1000000 sec. */
+  DWORD32 MaxInterval; /**< Longest interval between emission slots, used while the queue is shallow, in 1/1000000 sec. */
+  DWORD32 TargetDepth; /**< Queue depth above which the interval shortens. It relaxes at a half of it or below. */
+  DWORD32 Interval; /**< Reply only. Interval currently used for emission slots, in 1/1000000 sec. */
+} AEM_PACING_FEATURE_REPORT, *PAEM_PACING_FEATURE_REPORT;
+
+typedef struct _AEM_STATS_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  UCHAR Flags; /**< AEM_STATS_XXX flags. */
+  DWORD32 LatencyCount; /**< Number of messages taken from the message queue. */
+  DWORD32 LatencyMax; /**< Longest time a message spent in the queue, in 1/1000000 sec. */
+  ULONGLONG LatencySum; /**< Total time messages spent in the queue, in 1/1000000 sec. */
+  DWORD32 LatencyBuckets[AEM_HISTOGRAM_BUCKETS]; /**< Histogram of times messages spent in the queue. */
+} AEM_STATS_FEATURE_REPORT, *PAEM_STATS_FEATURE_REPORT;
+
+/** Counters of a device, kept in a page that monitoring tools map read-only and sample without sending any requests.
+ * Counters wrap around. Every queued message is eventually either emitted or dropped, so
+ * Enqueued - Emitted - Dropped is the number of messages in the queue. */
+typedef struct _AEM_STATS_PAGE {
+  DWORD32 Version; /**< AEM_STATS_PAGE_VERSION. */
+  volatile LONG Enqueued; /**< Messages accepted into the message queue. */
+  volatile LONG Emitted; /**< Queued messages taken for emission. Glides and split moves take several input reports each. */
+  volatile LONG Dropped; /**< Queued messages merged into other ones or cleared, without being emitted on their own. */
+  volatile LONG QueueFull; /**< Messages rejected because the message queue was full. */
+  volatile LONG HighWater; /**< Largest number of messages the message queue has held. */
+  volatile LONG EmptyTicks; /**< Emission slots that came with nothing to emit. */
+  volatile LONG ReadsServed; /**< Read requests completed with an input report, including timed messages. */
+  volatile LONG ContentionSpins; /**< Spins of producers waiting for each other or for queue compaction. */
+} AEM_STATS_PAGE, *PAEM_STATS_PAGE;
+
+/** Slot of the submission channel, see channel.h for the protocol. */
+typedef struct _AEM_CHANNEL_SLOT {
+  volatile LONG Sequence; /**< Slot state. */
+  AEM_MOVE_ENTRY Entry; /**< Move. */
+  UCHAR Reserved[2];
+} AEM_CHANNEL_SLOT, *PAEM_CHANNEL_SLOT;
+
+/** Submission channel, a ring of moves shared by the driver and its clients. Clients write moves straight into it, 
+ * and the driver takes them without any requests being sent, see channel.h. */
+typedef struct _AEM_CHANNEL_PAGE {
+  DWORD32 Version; /**< AEM_CHANNEL_PAGE_VERSION. */
+  DWORD32 Capacity; /**< Number of slots, AEM_CHANNEL_SIZE. */
+  volatile LONG Tail; /**< Position of the next slot to be claimed by a client. */
+  volatile LONG Head; /**< Position of the next slot to be consumed by the driver. Informational, the driver keeps its own copy. */
+  volatile LONG Idle; /**< Non-zero while the driver waits for an AEM_CHANNEL_WAKE request. */
+  volatile LONG Generation; /**< Incremented by the driver whenever it resets the channel. */
+  DWORD32 Reserved[2];
+  AEM_CHANNEL_SLOT Slots[AEM_CHANNEL_SIZE]; /**< Slots. */
+} AEM_CHANNEL_PAGE, *PAEM_CHANNEL_PAGE;
+
+typedef struct _AEM_CHANNEL_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  UCHAR Flags; /**< AEM_CHANNEL_XXX flags. */
+  DWORD32 PageId; /**< Reply only. Page ID of the channel section. */
+} AEM_CHANNEL_FEATURE_REPORT, *PAEM_CHANNEL_FEATURE_REPORT;
+
+/** Event of the device trace, see trace.h. Read requests are identified by the low 32 bits of their addresses. */
+typedef struct _AEM_TRACE_EVENT {
+  DWORD32 Sequence; /**< Sequence number of the event plus one. */
+  UCHAR Kind; /**< AEM_TRACE_XXX. */
+  UCHAR Reserved[3];
+  ULONGLONG Time; /**< Interrupt time of the event, in 100 ns. */
+  DWORD32 Arg1; /**< Kind-specific argument. */
+  DWORD32 Arg2; /**< Kind-specific argument. */
+} AEM_TRACE_EVENT, *PAEM_TRACE_EVENT;
+
+/** Variable-length report, only the first Count events are transferred. The device replies with as many events
+ * as fit into the buffer. Events are read in chunks, each request starting where the previous one has stopped. */
+typedef struct _AEM_TRACE_FEATURE_REPORT {
+  AEM_FEATURE_REPORT Report; /**< Base report. */
+  DWORD32 First; /**< Sequence number of the first event to read. On reply, sequence number of the first event returned, 
+                  *   which is past the requested one if the events in between were overwritten. */
+  DWORD32 Next; /**< Reply only. Sequence number the next traced event will get. */
+  ULONGLONG Now; /**< Reply only. Interrupt time of the reply, in 100 ns. */
+  UCHAR Count; /**< Reply only. Number of events returned. */
+  AEM_TRACE_EVENT Events[AEM_MAX_TRACE_EVENTS]; /**< Events. */
+} AEM_TRACE_FEATURE_REPORT, *PAEM_TRACE_FEATURE_REPORT;
+
+/** Size of a batch report carrying the given number of moves. */
+#define AEM_BATCH_FEATURE_REPORT_SIZE(COUNT) \
+  (FIELD_OFFSET(AEM_BATCH_FEATURE_REPORT, Entries) + (COUNT) * sizeof(AEM_MOVE_ENTRY))
+
+/** Size of a timed batch report carrying the given number of entries. */
+#define AEM_TIMED_BATCH_FEATURE_REPORT_SIZE(COUNT) \
+  (FIELD_OFFSET(AEM_TIMED_BATCH_FEATURE_REPORT, Entries) + (COUNT) * sizeof(AEM_TIMED_ENTRY))
+
+/** Size of a trace report carrying the given number of events. */
+#define AEM_TRACE_FEATURE_REPORT_SIZE(COUNT) \
+  (FIELD_OFFSET(AEM_TRACE_FEATURE_REPORT, Events) + (COUNT) * sizeof(AEM_TRACE_EVENT))
+
+#ifdef _WIN32
+#  include <poppack.h>
+#else
+#  pragma pack(pop)
+#endif
+
+#endif // __AEM_COMMON_H__
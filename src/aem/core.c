@@ -0,0 +1,853 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "platform.h"
+
+/** Accounts and traces the time the given message spent in the message queue. Must be called with ConsumerLock held. */
+static VOID AemCoreRecordLatency(PAEM_CORE Core, PAEM_MESSAGE Message, ULONGLONG Now) {
+  ULONGLONG wait;
+
+  wait = Now > Message->EnqueueTime ? (Now - Message->EnqueueTime) / 10 : 0; /* In 1/1000000 sec. */
+  if(wait > 0xFFFFFFFF)
+    wait = 0xFFFFFFFF;
+  AemHistogramAdd(&Core->Latency, (ULONG) wait);
+  AemTraceWrite(&Core->Trace, Now, AEM_TRACE_DEQUEUE, AemRingSize(&Core->MessageQueue), (DWORD32) wait);
+}
+
+/** @returns                          Identifier of a read request in the trace. */
+static DWORD32 AemCoreTraceId(PVOID Request) {
+  return (DWORD32) (ULONG_PTR) Request;
+}
+
+/** Completes a read request and traces its completion. */
+static VOID AemCoreFinishRead(PAEM_CORE Core, PVOID Request, NTSTATUS Status, PUCHAR Report, ULONG Size) {
+  AemCoreTrace(Core, AEM_TRACE_READ_COMPLETE, AemCoreTraceId(Request), (DWORD32) Status);
+  AemPlatformCompleteRead(Core, Request, Status, Report, Size);
+}
+
+/** Raises the high-water mark to the current queue size. Producers call it concurrently. */
+static VOID AemCoreUpdateHighWater(PAEM_CORE Core) {
+  LONG                      size, highWater;
+
+  size = (LONG) AemRingSize(&Core->MessageQueue);
+  do {
+    highWater = AemReadAcquire(&Core->Stats->HighWater);
+    if(size <= highWater)
+      return;
+  } while(AemInterlockedCompareExchange(&Core->Stats->HighWater, size, highWater) != highWater);
+}
+
+/** Resets the submission channel once its head has been stuck for AEM_CHANNEL_STUCK_TIMEOUT, see channel.h.
+ * Must be called with ConsumerLock held, when there is no published move at the head. */
+static VOID AemCoreCheckChannel(PAEM_CORE Core) {
+  ULONGLONG                 now;
+  ULONG                     dropped;
+
+  if(!AemChannelIsStuck(&Core->Channel)) {
+    Core->IsChannelStuck = FALSE;
+    return;
+  }
+
+  now = AemPlatformInterruptTime(Core);
+  if(!Core->IsChannelStuck) {
+    Core->IsChannelStuck = TRUE;
+    Core->ChannelStuckTime = now;
+    return;
+  }
+  if(now - Core->ChannelStuckTime < AEM_CHANNEL_STUCK_TIMEOUT)
+    return;
+
+  dropped = AemChannelReset(&Core->Channel);
+  Core->IsChannelStuck = FALSE;
+  AemTraceWrite(&Core->Trace, now, AEM_TRACE_CHANNEL_RESET, 0, dropped);
+}
+
+/** Moves published moves from the submission channel into the message queue, as long as there is room.
+ * Moves that don't fit are left in the channel, so that its clients see it full. Must be called with ConsumerLock held. */
+static VOID AemCoreDrainChannel(PAEM_CORE Core) {
+  AEM_MOVE_ENTRY            entry;
+  AEM_MESSAGE               message;
+  LONG                      count = 0;
+
+  /* Called on every dequeue, so the empty channel has to be cheap. */
+  if(Core->Channel.Page == NULL)
+    return;
+  if(!AemChannelPeek(&Core->Channel, &entry)) {
+    AemCoreCheckChannel(Core);
+    return;
+  }
+  Core->IsChannelStuck = FALSE;
+
+  message.EnqueueTime = AemPlatformInterruptTime(Core);
+
+  /* Queue is never locked for exclusive access while ConsumerLock is held, so pushing doesn't spin. */
+  do {
+    AemBatchUnpackEntry(&entry, &message);
+    if(!AemRingPush(&Core->MessageQueue, &message))
+      break;
+    AemChannelPop(&Core->Channel);
+    count++;
+  } while(AemChannelPeek(&Core->Channel, &entry));
+
+  if(count != 0) {
+    AemInterlockedAdd(&Core->Stats->Enqueued, count);
+    AemCoreUpdateHighWater(Core);
+    AemTraceWrite(&Core->Trace, message.EnqueueTime, AEM_TRACE_ENQUEUE, AemRingSize(&Core->MessageQueue), (DWORD32) count);
+  }
+}
+
+NTSTATUS AemCoreInit(PAEM_CORE Core) {
+  PAEM_RING_SLOT            slots;
+  PAEM_SCHEDULE_ENTRY       entries;
+  PAEM_TRACE_EVENT          events;
+
+  RtlZeroMemory(Core, sizeof(AEM_CORE));
+
+  Core->InfoReport.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  Core->InfoReport.Report.ControlCode = AEM_CONTROL_CODE_INFO;
+  Core->InfoReport.Flags = AEM_FLAG_RELATIVE | AEM_FLAG_ABSOLUTE | AEM_FLAG_KEYBOARD | AEM_FLAG_WHEEL;
+  Core->InfoReport.MessageQueueCapacity = AEM_DEFAULT_MESSAGE_QUEUE_SIZE;
+
+  slots = AemAllocate(AEM_DEFAULT_MESSAGE_QUEUE_SIZE * sizeof(AEM_RING_SLOT));
+  if(!slots)
+    return STATUS_INSUFFICIENT_RESOURCES;
+  AemRingInit(&Core->MessageQueue, slots, AEM_DEFAULT_MESSAGE_QUEUE_SIZE);
+  AemLockInit(&Core->ConsumerLock);
+  Core->CatchUpEnabled = FALSE;
+  Core->CatchUpThreshold = AEM_DEFAULT_CATCH_UP_THRESHOLD;
+  Core->IsCompacted = FALSE;
+  AemCoalesceInit(&Core->Carry);
+  AemGlideInit(&Core->Glide);
+  AemKeyboardInit(&Core->Keyboard);
+  Core->LastPosition.X = 0;
+  Core->LastPosition.Y = 0;
+  AemHistogramInit(&Core->Latency);
+  Core->LocalStats.Version = AEM_STATS_PAGE_VERSION;
+  Core->Stats = &Core->LocalStats;
+  Core->MessageQueue.Spins = &Core->Stats->ContentionSpins;
+
+  entries = AemAllocate(AEM_SCHEDULE_SIZE * sizeof(AEM_SCHEDULE_ENTRY));
+  if(!entries) {
+    AemFree(slots);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  AemScheduleInit(&Core->Schedule, entries, AEM_SCHEDULE_SIZE);
+  AemLockInit(&Core->ScheduleLock);
+
+  events = AemAllocate(AEM_TRACE_SIZE * sizeof(AEM_TRACE_EVENT));
+  if(!events) {
+    AemFree(slots);
+    AemFree(entries);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  AemTraceInit(&Core->Trace, events, AEM_TRACE_SIZE);
+
+  Core->MessageCheckInterval = AEM_DEFAULT_MESSAGE_CHECK_INTERVAL;
+
+  AemLockInit(&Core->ReadLock);
+  Core->NextEmissionTime = 0;
+  Core->PacingEnabled = FALSE;
+  Core->Pacing.MinInterval = AEM_DEFAULT_PACING_MIN_INTERVAL;
+  Core->Pacing.MaxInterval = AEM_DEFAULT_PACING_MAX_INTERVAL;
+  Core->Pacing.TargetDepth = AEM_DEFAULT_PACING_TARGET_DEPTH;
+  Core->PacedInterval = AEM_DEFAULT_PACING_MAX_INTERVAL;
+  return STATUS_SUCCESS;
+}
+
+VOID AemCoreFree(PAEM_CORE Core) {
+  AemFree(Core->MessageQueue.Slots);
+  AemFree(Core->Schedule.Entries);
+  AemFree(Core->Trace.Events);
+}
+
+VOID AemCoreSetChannelPage(PAEM_CORE Core, PAEM_CHANNEL_PAGE Page, DWORD32 PageId) {
+  AEM_LOCK_STATE            lockState;
+
+  /* Consumer drains the channel under ConsumerLock, so it is done with the old page once the lock is taken. */
+  AemLockAcquire(&Core->ConsumerLock, &lockState);
+  AemChannelInit(&Core->Channel, Page, AEM_CHANNEL_SIZE);
+  Core->ChannelPageId = PageId;
+  Core->IsChannelStuck = FALSE;
+  AemLockRelease(&Core->ConsumerLock, lockState);
+}
+
+VOID AemCoreTrace(PAEM_CORE Core, UCHAR Kind, DWORD32 Arg1, DWORD32 Arg2) {
+  AemTraceWrite(&Core->Trace, AemPlatformInterruptTime(Core), Kind, Arg1, Arg2);
+}
+
+VOID AemCoreSetStatsPage(PAEM_CORE Core, PAEM_STATS_PAGE Page, DWORD32 PageId) {
+  if(Page == NULL)
+    Page = &Core->LocalStats;
+  if(Page != Core->Stats)
+    RtlCopyMemory(Page, Core->Stats, sizeof(AEM_STATS_PAGE));
+  Core->Stats = Page;
+  Core->StatsPageId = PageId;
+  Core->MessageQueue.Spins = &Page->ContentionSpins;
+}
+
+NTSTATUS AemCoreGetFeature(PAEM_CORE Core, UCHAR ReportId, PUCHAR Buffer, ULONG Length) {
+  PAEM_FEATURE_REPORT       featureReport;
+  AEM_LOCK_STATE            lockState;
+
+  if(ReportId != AEM_CONTROL_REPORT_ID)
+    return STATUS_NOT_SUPPORTED;
+
+  if(Length < sizeof(AEM_FEATURE_REPORT))
+    return STATUS_BUFFER_TOO_SMALL;
+
+  featureReport = (PAEM_FEATURE_REPORT) Buffer;
+  switch(featureReport->ControlCode) {
+  case AEM_CONTROL_CODE_MOVE: {
+    PAEM_MOVE_FEATURE_REPORT report = (PAEM_MOVE_FEATURE_REPORT) Buffer;
+    AEM_MOVE_ENTRY entry;
+    AEM_MESSAGE message;
+    if(Length < sizeof(AEM_MOVE_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    entry.Flags = report->Flags;
+    entry.Buttons = report->Buttons;
+    entry.Point = report->Point;
+    AemBatchUnpackEntry(&entry, &message);
+    if(!AemCoreEnqueue(Core, &message))
+      report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;
+    AemCoreWake(Core);
+    break;
+  }
+  case AEM_CONTROL_CODE_GLIDE: {
+    PAEM_GLIDE_FEATURE_REPORT report = (PAEM_GLIDE_FEATURE_REPORT) Buffer;
+    AEM_MESSAGE message;
+    if(Length < sizeof(AEM_GLIDE_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    message.Kind = (report->Flags & AEM_GLIDE_DELTA) ? AEM_MESSAGE_GLIDE_BY : AEM_MESSAGE_GLIDE_TO;
+    message.IsRelative = !(report->Flags & AEM_GLIDE_ABSOLUTE);
+    message.Buttons = report->Buttons;
+    message.Point = report->Point;
+    message.Easing = report->Easing;
+    message.Duration = report->Duration;
+    /* Cursor position is unknown to relative glides, so they have no targets. */
+    if((message.Kind == AEM_MESSAGE_GLIDE_TO && message.IsRelative) || message.Easing > AEM_EASING_MINIMUM_JERK) {
+      report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;
+      break;
+    }
+    if(!AemCoreEnqueue(Core, &message))
+      report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;
+    AemCoreWake(Core);
+    break;
+  }
+  case AEM_CONTROL_CODE_MOVE_BATCH: {
+    PAEM_BATCH_FEATURE_REPORT report = (PAEM_BATCH_FEATURE_REPORT) Buffer;
+    ULONG position, count, accepted = 0, i;
+    ULONGLONG now;
+    if(!AemBatchIsValid(report, Length))
+      return STATUS_BUFFER_TOO_SMALL;
+    now = AemPlatformInterruptTime(Core);
+    /* Claim as many slots as fit with a single compare-exchange, then fill & publish them.
+     * If the queue fills up, compact it and retry with the rest of the batch. */
+    AemRaiseToDispatch(&lockState);
+    for(;;) {
+      count = AemRingReserve(&Core->MessageQueue, report->Count - accepted, &position);
+      for(i = 0; i < count; i++) {
+        AemBatchGetMessage(report, accepted + i, AemRingSlot(&Core->MessageQueue, position + i));
+        AemRingSlot(&Core->MessageQueue, position + i)->EnqueueTime = now;
+      }
+      for(i = 0; i < count; i++)
+        AemRingCommit(&Core->MessageQueue, position + i);
+      accepted += count;
+      if(accepted == report->Count || AemCoreCompact(Core) == 0)
+        break;
+    }
+    AemLowerFromDispatch(lockState);
+    AemInterlockedAdd(&Core->Stats->Enqueued, (LONG) accepted);
+    AemInterlockedAdd(&Core->Stats->QueueFull, (LONG) (report->Count - accepted));
+    AemCoreUpdateHighWater(Core);
+    if(accepted != 0)
+      AemTraceWrite(&Core->Trace, now, AEM_TRACE_ENQUEUE, AemRingSize(&Core->MessageQueue), accepted);
+    if(accepted != report->Count)
+      AemTraceWrite(&Core->Trace, now, AEM_TRACE_QUEUE_FULL, AemRingSize(&Core->MessageQueue), report->Count - accepted);
+    report->Count = (UCHAR) accepted;
+    AemCoreWake(Core);
+    break;
+  }
+  case AEM_CONTROL_CODE_TIMED_BATCH: {
+    PAEM_TIMED_BATCH_FEATURE_REPORT report = (PAEM_TIMED_BATCH_FEATURE_REPORT) Buffer;
+    LONGLONG systemTime;
+    ULONGLONG startTime, elapsed;
+    if(!AemScheduleIsValidBatch(report, Length))
+      return STATUS_BUFFER_TOO_SMALL;
+    /* Schedule runs on interrupt time, which isn't affected by system clock adjustments.
+     * Start time in the past keeps the timeline, so the entries that are already due are emitted right away. */
+    startTime = AemPlatformInterruptTime(Core);
+    if(report->StartTime != 0) {
+      systemTime = AemPlatformSystemTime(Core);
+      if(report->StartTime >= systemTime) {
+        startTime += report->StartTime - systemTime;
+      } else {
+        elapsed = systemTime - report->StartTime;
+        startTime = elapsed < startTime ? startTime - elapsed : 0;
+      }
+    }
+    AemLockAcquire(&Core->ScheduleLock, &lockState);
+    report->Count = (UCHAR) AemScheduleBatch(&Core->Schedule, report, startTime);
+    AemCoreArmScheduleTimer(Core);
+    AemLockRelease(&Core->ScheduleLock, lockState);
+    AemCoreWake(Core);
+    break;
+  }
+  case AEM_CONTROL_CODE_INFO: {
+    if(Length < sizeof(AEM_INFO_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    RtlCopyMemory(Buffer, &Core->InfoReport, sizeof(AEM_INFO_FEATURE_REPORT));
+    break;
+  }
+  case AEM_CONTROL_CODE_CLEAR_QUEUE: {
+    ULONG cleared;
+    BOOLEAN isPressed;
+    AEM_MESSAGE message;
+    AemLockAcquire(&Core->ConsumerLock, &lockState);
+    cleared = AemRingClear(&Core->MessageQueue);
+    Core->IsCompacted = FALSE;
+    Core->Stats->Dropped += cleared;
+    if(Core->Channel.Page != NULL) {
+      AemChannelClear(&Core->Channel); /* Channel moves are not counted until they are queued. */
+      Core->IsChannelStuck = FALSE;
+    }
+    AemCoalesceInit(&Core->Carry);
+    AemGlideInit(&Core->Glide);
+    isPressed = AemKeyboardIsPressed(&Core->Keyboard);
+    AemLockRelease(&Core->ConsumerLock, lockState);
+    AemCoreTrace(Core, AEM_TRACE_CLEAR, 0, cleared);
+    AemLockAcquire(&Core->ScheduleLock, &lockState);
+    AemScheduleClear(&Core->Schedule);
+    AemCoreArmScheduleTimer(Core);
+    AemLockRelease(&Core->ScheduleLock, lockState);
+    /* Releases of the held keys could have been among the dropped messages, don't leave them stuck. */
+    if(isPressed) {
+      message.Kind = AEM_MESSAGE_KEY;
+      message.Key = AEM_KEY_ALL;
+      message.IsKeyDown = FALSE;
+      AemCoreEnqueue(Core, &message);
+      AemCoreWake(Core);
+    }
+    break;
+  }
+  case AEM_CONTROL_CODE_QUEUE_SIZE: {
+    PAEM_DWORD_FEATURE_REPORT report = (PAEM_DWORD_FEATURE_REPORT) Buffer;
+    if(Length < sizeof(AEM_DWORD_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    report->Value = AemRingSize(&Core->MessageQueue) + Core->Schedule.Size + (Core->Carry.Count != 0) + AemGlideIsActive(&Core->Glide);
+    break;
+  }
+  case AEM_CONTROL_CODE_READ_TIMER: {
+    PAEM_READ_TIMER_FEATURE_REPORT report = (PAEM_READ_TIMER_FEATURE_REPORT) Buffer;
+    if(Length < sizeof(AEM_READ_TIMER_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    report->Ticks = Core->ReadTimerTicks;
+    report->Rearms = Core->ReadTimerRearms;
+    break;
+  }
+  case AEM_CONTROL_CODE_CAPACITY: {
+    PAEM_DWORD_FEATURE_REPORT report = (PAEM_DWORD_FEATURE_REPORT) Buffer;
+    ULONG capacity;
+    if(Length < sizeof(AEM_DWORD_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    capacity = report->Value;
+    if(NT_SUCCESS(AemCoreSetMessageQueueCapacity(Core, &capacity)))
+      report->Value = capacity;
+    else
+      report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;
+    break;
+  }
+  case AEM_CONTROL_CODE_MERGED: {
+    PAEM_DWORD_FEATURE_REPORT report = (PAEM_DWORD_FEATURE_REPORT) Buffer;
+    if(Length < sizeof(AEM_DWORD_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    report->Value = Core->MergedCount;
+    break;
+  }
+  case AEM_CONTROL_CODE_STATS: {
+    PAEM_STATS_FEATURE_REPORT report = (PAEM_STATS_FEATURE_REPORT) Buffer;
+    if(Length < sizeof(AEM_STATS_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    AemLockAcquire(&Core->ConsumerLock, &lockState);
+    report->LatencyCount = Core->Latency.Count;
+    report->LatencyMax = Core->Latency.Max;
+    report->LatencySum = Core->Latency.Sum;
+    RtlCopyMemory(report->LatencyBuckets, Core->Latency.Buckets, sizeof(report->LatencyBuckets));
+    if(report->Flags & AEM_STATS_RESET)
+      AemHistogramInit(&Core->Latency);
+    AemLockRelease(&Core->ConsumerLock, lockState);
+    report->Flags = 0;
+    break;
+  }
+  case AEM_CONTROL_CODE_STATS_PAGE: {
+    PAEM_DWORD_FEATURE_REPORT report = (PAEM_DWORD_FEATURE_REPORT) Buffer;
+    if(Length < sizeof(AEM_DWORD_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    if(Core->Stats != &Core->LocalStats)
+      report->Value = Core->StatsPageId;
+    else
+      report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;
+    break;
+  }
+  case AEM_CONTROL_CODE_CHANNEL: {
+    PAEM_CHANNEL_FEATURE_REPORT report = (PAEM_CHANNEL_FEATURE_REPORT) Buffer;
+    if(Length < sizeof(AEM_CHANNEL_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    if(Core->Channel.Page == NULL) {
+      report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;
+      break;
+    }
+    report->PageId = Core->ChannelPageId;
+    if(report->Flags & AEM_CHANNEL_WAKE)
+      AemCoreWake(Core);
+    break;
+  }
+  case AEM_CONTROL_CODE_TRACE: {
+    PAEM_TRACE_FEATURE_REPORT report = (PAEM_TRACE_FEATURE_REPORT) Buffer;
+    ULONG first, next, count;
+    if(Length < AEM_TRACE_FEATURE_REPORT_SIZE(0))
+      return STATUS_BUFFER_TOO_SMALL;
+    count = (Length - AEM_TRACE_FEATURE_REPORT_SIZE(0)) / sizeof(AEM_TRACE_EVENT);
+    if(count > AEM_MAX_TRACE_EVENTS)
+      count = AEM_MAX_TRACE_EVENTS;
+    first = report->First;
+    report->Now = AemPlatformInterruptTime(Core);
+    report->Count = (UCHAR) AemTraceRead(&Core->Trace, &first, &next, report->Events, count);
+    report->First = first;
+    report->Next = next;
+    break;
+  }
+  case AEM_CONTROL_CODE_CATCH_UP: {
+    PAEM_CATCH_UP_FEATURE_REPORT report = (PAEM_CATCH_UP_FEATURE_REPORT) Buffer;
+    if(Length < sizeof(AEM_CATCH_UP_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    if(report->Flags & AEM_CATCH_UP_UPDATE) {
+      Core->CatchUpEnabled = (report->Flags & AEM_CATCH_UP_ENABLED) != 0;
+      Core->CatchUpThreshold = report->Threshold;
+    }
+    report->Flags = Core->CatchUpEnabled ? AEM_CATCH_UP_ENABLED : 0;
+    report->Threshold = Core->CatchUpThreshold;
+    break;
+  }
+  case AEM_CONTROL_CODE_PACING: {
+    PAEM_PACING_FEATURE_REPORT report = (PAEM_PACING_FEATURE_REPORT) Buffer;
+    if(Length < sizeof(AEM_PACING_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    if((report->Flags & AEM_PACING_UPDATE) && 
+      (report->MinInterval < AEM_MINIMAL_MESSAGE_CHECK_INTERVAL || report->MaxInterval < report->MinInterval)) {
+      report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;
+      break;
+    }
+    AemLockAcquire(&Core->ReadLock, &lockState);
+    if(report->Flags & AEM_PACING_UPDATE) {
+      /* Start relaxed, the queue will pull the interval down if it has to. */
+      Core->PacingEnabled = (report->Flags & AEM_PACING_ENABLED) != 0;
+      Core->Pacing.MinInterval = report->MinInterval;
+      Core->Pacing.MaxInterval = report->MaxInterval;
+      Core->Pacing.TargetDepth = report->TargetDepth;
+      Core->PacedInterval = report->MaxInterval;
+    }
+    report->Flags = Core->PacingEnabled ? AEM_PACING_ENABLED : 0;
+    report->MinInterval = Core->Pacing.MinInterval;
+    report->MaxInterval = Core->Pacing.MaxInterval;
+    report->TargetDepth = Core->Pacing.TargetDepth;
+    report->Interval = AemCoreEmissionInterval(Core);
+    AemLockRelease(&Core->ReadLock, lockState);
+    break;
+  }
+  case AEM_CONTROL_CODE_INTERVAL: {
+    DWORD32                   newDelay;
+    PAEM_DWORD_FEATURE_REPORT report = (PAEM_DWORD_FEATURE_REPORT) Buffer;
+    if(Length < sizeof(AEM_DWORD_FEATURE_REPORT))
+      return STATUS_BUFFER_TOO_SMALL;
+    newDelay = report->Value;
+    report->Value = Core->MessageCheckInterval;
+    if(newDelay >= AEM_MINIMAL_MESSAGE_CHECK_INTERVAL) {
+      Core->MessageCheckInterval = newDelay;
+      AemCoreTrace(Core, AEM_TRACE_INTERVAL, newDelay, report->Value);
+    } else {
+      report->Report.ControlCode = AEM_CONTROL_CODE_ERROR;
+    }
+    break;
+  }
+  default:
+    return STATUS_NOT_SUPPORTED;
+  }
+
+  return STATUS_SUCCESS;
+}
+
+NTSTATUS AemCoreWriteReport(PAEM_CORE Core, UCHAR ReportId, PUCHAR Buffer, ULONG Length) {
+  UCHAR                     report[AEM_OUTPUT_REPORT_SIZE + 1];
+  PUCHAR                    count = NULL;
+  UCHAR                     requested = 0;
+  NTSTATUS                  ntStatus;
+
+  if(ReportId != AEM_CONTROL_REPORT_ID)
+    return STATUS_NOT_SUPPORTED;
+
+  if(Length < sizeof(AEM_FEATURE_REPORT))
+    return STATUS_BUFFER_TOO_SMALL;
+  if(Length > sizeof(report))
+    return STATUS_INVALID_PARAMETER;
+
+  /* Feature request handlers write their replies in place, so they get a copy. */
+  RtlCopyMemory(report, Buffer, Length);
+  switch(((PAEM_FEATURE_REPORT) report)->ControlCode) {
+  case AEM_CONTROL_CODE_MOVE_BATCH:
+    count = &((PAEM_BATCH_FEATURE_REPORT) report)->Count;
+    break;
+  case AEM_CONTROL_CODE_TIMED_BATCH:
+    count = &((PAEM_TIMED_BATCH_FEATURE_REPORT) report)->Count;
+    break;
+  case AEM_CONTROL_CODE_MOVE:
+  case AEM_CONTROL_CODE_GLIDE:
+  case AEM_CONTROL_CODE_CLEAR_QUEUE:
+    break;
+  default:
+    return STATUS_NOT_SUPPORTED;
+  }
+  if(count != NULL)
+    requested = *count;
+
+  ntStatus = AemCoreGetFeature(Core, ReportId, report, Length);
+  if(!NT_SUCCESS(ntStatus))
+    return ntStatus;
+  if(((PAEM_FEATURE_REPORT) report)->ControlCode == AEM_CONTROL_CODE_ERROR || (count != NULL && *count != requested))
+    return STATUS_INSUFFICIENT_RESOURCES;
+  return STATUS_SUCCESS;
+}
+
+NTSTATUS AemCoreSetMessageQueueCapacity(PAEM_CORE Core, PULONG Capacity) {
+  PAEM_RING_SLOT            slots, oldSlots;
+  ULONG                     capacity;
+  AEM_LOCK_STATE            lockState;
+
+  if(*Capacity < AEM_MINIMAL_MESSAGE_QUEUE_SIZE || *Capacity > AEM_MAXIMAL_MESSAGE_QUEUE_SIZE)
+    return STATUS_INVALID_PARAMETER;
+  for(capacity = AEM_MINIMAL_MESSAGE_QUEUE_SIZE; capacity < *Capacity; capacity <<= 1)
+    ;
+
+  slots = AemAllocate(capacity * sizeof(AEM_RING_SLOT));
+  if(!slots)
+    return STATUS_INSUFFICIENT_RESOURCES;
+
+  /* Keep both the consumer and the producers out while the messages are moved. */
+  AemLockAcquire(&Core->ConsumerLock, &lockState);
+  AemRingLockExclusive(&Core->MessageQueue);
+  if(AemRingSize(&Core->MessageQueue) <= capacity) {
+    oldSlots = Core->MessageQueue.Slots;
+    AemRingRelocate(&Core->MessageQueue, slots, capacity);
+    Core->IsCompacted = FALSE;
+    Core->InfoReport.MessageQueueCapacity = capacity;
+  } else {
+    oldSlots = slots;
+    slots = NULL;
+  }
+  AemRingUnlockExclusive(&Core->MessageQueue);
+  AemLockRelease(&Core->ConsumerLock, lockState);
+
+  AemFree(oldSlots);
+  if(!slots)
+    return STATUS_INVALID_PARAMETER;
+
+  *Capacity = capacity;
+  return STATUS_SUCCESS;
+}
+
+DWORD32 AemCoreEmissionInterval(PAEM_CORE Core) {
+  return Core->PacingEnabled ? Core->PacedInterval : Core->MessageCheckInterval;
+}
+
+VOID AemCoreRead(PAEM_CORE Core, PVOID Request) {
+  ULONGLONG                 now, due;
+  DWORD32                   interval, previous;
+  AEM_LOCK_STATE            lockState;
+
+  /* Timed messages carry their own timing, they don't take emission slots. */
+  if(AemCoreIsScheduledMessageDue(Core)) {
+    AemCoreCompleteRead(Core, Request);
+    return;
+  }
+
+  /* No input, wait for a feature request or the schedule timer to wake us up. */
+  if(AemCoreIsQueueEmpty(Core)) {
+    AemCoreParkRead(Core, Request);
+    return;
+  }
+
+  /* Reserve the next emission slot. When the device was idle for longer than message check interval
+   * the slot is right now, so the first move after an idle period is not delayed. With adaptive pacing
+   * the interval to the slot after it follows the depth of the queue. */
+  AemLockAcquire(&Core->ReadLock, &lockState);
+  now = AemPlatformInterruptTime(Core);
+  due = Core->NextEmissionTime > now ? Core->NextEmissionTime : now;
+  previous = interval = Core->MessageCheckInterval;
+  if(Core->PacingEnabled) {
+    previous = Core->PacedInterval;
+    interval = AemPacingNextInterval(&Core->Pacing, previous, AemRingSize(&Core->MessageQueue));
+    Core->PacedInterval = interval;
+  }
+  Core->NextEmissionTime = due + 10 * (ULONGLONG) interval; /* In 100 ns. */
+  AemLockRelease(&Core->ReadLock, lockState);
+
+  if(interval != previous)
+    AemTraceWrite(&Core->Trace, now, AEM_TRACE_INTERVAL, interval, previous);
+
+  if(due == now) {
+    AemCoreCompleteRead(Core, Request);
+    return;
+  }
+
+  AemTraceWrite(&Core->Trace, now, AEM_TRACE_READ_DELAY, AemCoreTraceId(Request), (DWORD32) ((due - now) / 10));
+  if(!AemPlatformDelayRead(Core, Request, due))
+    AemCoreFinishRead(Core, Request, STATUS_INSUFFICIENT_RESOURCES, NULL, 0);
+}
+
+VOID AemCoreParkRead(PAEM_CORE Core, PVOID Request) {
+  AemCoreTrace(Core, AEM_TRACE_READ_PARK, AemCoreTraceId(Request), 0);
+  AemPlatformParkRead(Core, Request);
+
+  /* A message could have been queued after we've checked the queue, but before the request was parked.
+   * In this case the producer didn't see the request, so we have to wake it up ourselves. Same goes for the schedule timer. */
+  if(!AemCoreIsQueueEmpty(Core) || AemCoreIsScheduledMessageDue(Core))
+    AemCoreWake(Core);
+}
+
+VOID AemCoreWake(PAEM_CORE Core) {
+  PVOID                     request;
+
+  request = AemPlatformUnparkRead(Core);
+  if(request != NULL)
+    AemCoreRead(Core, request);
+}
+
+VOID AemCoreCompleteRead(PAEM_CORE Core, PVOID Request) {
+  UCHAR                     report[AEM_INPUT_REPORT_SIZE + 1];
+  AEM_MESSAGE               message;
+  BOOLEAN                   isEmpty;
+  ULONG                     size = 0;
+  AEM_LOCK_STATE            lockState;
+
+  AemLockAcquire(&Core->ConsumerLock, &lockState);
+  isEmpty = !AemCorePopScheduledMessage(Core, &message) && !AemCoreDequeue(Core, &message);
+  if(!isEmpty && message.Kind == AEM_MESSAGE_KEY) {
+    /* Keyboard reports carry the whole keyboard state, so key messages are packed in the order they are dequeued. */
+    AemKeyboardApply(&Core->Keyboard, message.Key, message.IsKeyDown);
+    size = AemKeyboardPack(&Core->Keyboard, report);
+  } else if(!isEmpty && !message.IsRelative) {
+    /* Absolute scrolls stay where the cursor is. */
+    if(message.Kind == AEM_MESSAGE_SCROLL)
+      message.Point = Core->LastPosition;
+    else
+      Core->LastPosition = message.Point;
+  }
+  if(isEmpty)
+    Core->Stats->EmptyTicks++;
+  else
+    Core->Stats->ReadsServed++;
+  AemLockRelease(&Core->ConsumerLock, lockState);
+
+  if(isEmpty) {
+    AemCoreParkRead(Core, Request);
+    return;
+  }
+
+  if(size == 0)
+    size = AemCorePackReport(&message, report);
+  AemCoreFinishRead(Core, Request, STATUS_SUCCESS, report, size);
+}
+
+ULONG AemCorePackReport(PAEM_MESSAGE Message, PUCHAR Report) {
+  SHORT                     wheel = 0, pan = 0;
+  ULONG                     size;
+
+  if(Message->Kind == AEM_MESSAGE_SCROLL) {
+    wheel = Message->Wheel;
+    pan = Message->Pan;
+  }
+  if(Message->IsRelative) {
+    Report[0] = AEM_POINTER_REPORT_ID;
+    Report[1] = Message->Buttons;
+    Report[2] = (UCHAR) Message->Point.X;
+    Report[3] = (UCHAR) Message->Point.Y;
+    size = AEM_RELATIVE_INPUT_REPORT_SIZE + 1;
+  } else {
+    Report[0] = AEM_ABSOLUTE_POINTER_REPORT_ID;
+    Report[1] = Message->Buttons;
+    RtlCopyMemory(Report + 2, &Message->Point, sizeof(SHORT_POINT));
+    size = AEM_ABSOLUTE_INPUT_REPORT_SIZE + 1;
+  }
+  /* Wheel and pan close both pointer reports. */
+  RtlCopyMemory(Report + size - 2 * sizeof(SHORT), &wheel, sizeof(SHORT));
+  RtlCopyMemory(Report + size - sizeof(SHORT), &pan, sizeof(SHORT));
+  return size;
+}
+
+BOOLEAN AemCoreEnqueue(PAEM_CORE Core, PAEM_MESSAGE Message) {
+  BOOLEAN                   isQueued;
+  AEM_LOCK_STATE            lockState;
+
+  Message->EnqueueTime = AemPlatformInterruptTime(Core);
+
+  /* Don't get preempted while holding a claimed slot, consumer can't get past it until it is published. */
+  AemRaiseToDispatch(&lockState);
+  isQueued = AemRingPush(&Core->MessageQueue, Message);
+
+  /* Queue is full, try to make room by merging the queued moves. */
+  if(!isQueued && AemCoreCompact(Core) != 0)
+    isQueued = AemRingPush(&Core->MessageQueue, Message);
+  AemLowerFromDispatch(lockState);
+
+  if(isQueued) {
+    AemInterlockedIncrement(&Core->Stats->Enqueued);
+    AemCoreUpdateHighWater(Core);
+  } else {
+    AemInterlockedIncrement(&Core->Stats->QueueFull);
+  }
+  AemTraceWrite(&Core->Trace, Message->EnqueueTime, isQueued ? AEM_TRACE_ENQUEUE : AEM_TRACE_QUEUE_FULL, 
+                AemRingSize(&Core->MessageQueue), 1);
+  return isQueued;
+}
+
+ULONG AemCoreCompact(PAEM_CORE Core) {
+  ULONG                     merged;
+  AEM_LOCK_STATE            lockState;
+
+  /* Nothing has been pushed since the last compaction found nothing to merge, so skip the pass over the queue. */
+  if(Core->IsCompacted && AemReadAcquire(&Core->MessageQueue.Tail) == Core->CompactedTail)
+    return 0;
+
+  /* Keep both the consumer and the producers out while the messages are moved. */
+  AemLockAcquire(&Core->ConsumerLock, &lockState);
+  AemRingLockExclusive(&Core->MessageQueue);
+  merged = AemCoalesceRing(&Core->MessageQueue);
+  Core->CompactedTail = AemRingTail(&Core->MessageQueue);
+  Core->IsCompacted = merged == 0;
+  AemRingUnlockExclusive(&Core->MessageQueue);
+  Core->MergedCount += merged;
+  Core->Stats->Dropped += merged;
+  AemLockRelease(&Core->ConsumerLock, lockState);
+
+  return merged;
+}
+
+BOOLEAN AemCoreIsQueueEmpty(PAEM_CORE Core) {
+  BOOLEAN                   isEmpty;
+  AEM_LOCK_STATE            lockState;
+
+  AemLockAcquire(&Core->ConsumerLock, &lockState);
+  for(;;) {
+    AemCoreDrainChannel(Core);
+    isEmpty = AemRingIsEmpty(&Core->MessageQueue) && Core->Carry.Count == 0 && !AemGlideIsActive(&Core->Glide);
+    if(!isEmpty || Core->Channel.Page == NULL || AemChannelSleep(&Core->Channel))
+      break;
+  }
+  AemLockRelease(&Core->ConsumerLock, lockState);
+  return isEmpty;
+}
+
+BOOLEAN AemCoreDequeue(PAEM_CORE Core, PAEM_MESSAGE Message) {
+  PAEM_COALESCE             carry;
+  PAEM_GLIDE                glide;
+  PAEM_MESSAGE              next;
+  BOOLEAN                   isCatchingUp;
+  ULONGLONG                 now;
+
+  carry = &Core->Carry;
+  glide = &Core->Glide;
+
+  AemCoreDrainChannel(Core);
+
+  if(AemGlideIsActive(glide)) {
+    AemGlideNext(glide, Message);
+    return TRUE;
+  }
+
+  now = AemPlatformInterruptTime(Core);
+  isCatchingUp = Core->CatchUpEnabled && AemRingSize(&Core->MessageQueue) > Core->CatchUpThreshold;
+
+  /* Merge while the sum fits into a report. The move that overflows it is merged too, its excess is carried. */
+  while(isCatchingUp && !AemCoalesceIsSaturated(carry)) {
+    next = AemRingPeek(&Core->MessageQueue, 0);
+    if(next == NULL || !AemCoalesceCanMerge(carry, next))
+      break;
+    if(carry->Count != 0) {
+      Core->MergedCount++;
+      Core->Stats->Dropped++;
+    } else {
+      Core->Stats->Emitted++;
+    }
+    AemCoalesceMerge(carry, next);
+    AemCoreRecordLatency(Core, next, now);
+    AemRingPop(&Core->MessageQueue, NULL);
+  }
+
+  if(carry->Count != 0) {
+    AemCoalesceSplit(carry, Message);
+    return TRUE;
+  }
+
+  if(!AemRingPop(&Core->MessageQueue, Message))
+    return FALSE;
+  AemCoreRecordLatency(Core, Message, now);
+  Core->Stats->Emitted++;
+
+  /* Glides start from the last reported position, interval is sampled once per glide. */
+  if(Message->Kind == AEM_MESSAGE_GLIDE_TO || Message->Kind == AEM_MESSAGE_GLIDE_BY) {
+    AemGlideStart(glide, Message, Core->LastPosition.X, Core->LastPosition.Y, AemCoreEmissionInterval(Core));
+    AemGlideNext(glide, Message);
+  }
+  return TRUE;
+}
+
+BOOLEAN AemCoreIsScheduledMessageDue(PAEM_CORE Core) {
+  PAEM_SCHEDULE_ENTRY       entry;
+  BOOLEAN                   isDue;
+  AEM_LOCK_STATE            lockState;
+
+  AemLockAcquire(&Core->ScheduleLock, &lockState);
+  entry = AemScheduleMin(&Core->Schedule);
+  isDue = entry != NULL && entry->DueTime <= AemPlatformInterruptTime(Core);
+  AemLockRelease(&Core->ScheduleLock, lockState);
+  return isDue;
+}
+
+BOOLEAN AemCorePopScheduledMessage(PAEM_CORE Core, PAEM_MESSAGE Message) {
+  PAEM_SCHEDULE_ENTRY       entry;
+  BOOLEAN                   isDue;
+  AEM_LOCK_STATE            lockState;
+
+  AemLockAcquire(&Core->ScheduleLock, &lockState);
+  entry = AemScheduleMin(&Core->Schedule);
+  isDue = entry != NULL && entry->DueTime <= AemPlatformInterruptTime(Core);
+  if(isDue) {
+    AemSchedulePop(&Core->Schedule, Message);
+    AemCoreArmScheduleTimer(Core);
+  }
+  AemLockRelease(&Core->ScheduleLock, lockState);
+  return isDue;
+}
+
+VOID AemCoreArmScheduleTimer(PAEM_CORE Core) {
+  PAEM_SCHEDULE_ENTRY       entry;
+
+  entry = AemScheduleMin(&Core->Schedule);
+  if(entry == NULL)
+    AemPlatformCancelScheduleTimer(Core);
+  else
+    AemPlatformSetScheduleTimer(Core, entry->DueTime);
+}
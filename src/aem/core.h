@@ -0,0 +1,267 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_CORE_H__
+#define __AEM_CORE_H__
+
+#include "portable.h"
+#include "common.h"
+#include "message.h"
+#include "batch.h"
+#include "ring.h"
+#include "schedule.h"
+#include "coalesce.h"
+#include "glide.h"
+#include "histogram.h"
+#include "trace.h"
+#include "channel.h"
+#include "pacing.h"
+#include "keyboard.h"
+
+/* Device logic of arx ethereal mouse that doesn't depend on WDM: parsing of feature reports,
+ * the message queue and the schedule, pacing of read requests and packing of input reports.
+ *
+ * Read requests are opaque to the core. The platform hands them over to AemCoreRead, and gets them
+ * back through the AemPlatformXxx functions declared in platform.h, which it has to implement. */
+
+/** Message check interval, in 1/1000000 sec. */
+#define AEM_DEFAULT_MESSAGE_CHECK_INTERVAL 8000
+#define AEM_MINIMAL_MESSAGE_CHECK_INTERVAL 5000
+
+/** Adaptive pacing settings, see pacing.h. Intervals are in 1/1000000 sec. Adaptive pacing is disabled by default. */
+#define AEM_DEFAULT_PACING_MIN_INTERVAL AEM_MINIMAL_MESSAGE_CHECK_INTERVAL
+#define AEM_DEFAULT_PACING_MAX_INTERVAL AEM_DEFAULT_MESSAGE_CHECK_INTERVAL
+#define AEM_DEFAULT_PACING_TARGET_DEPTH 16
+
+/** Size of move report queue. Queue capacity is always a power of two, and can be changed at runtime. */
+#define AEM_DEFAULT_MESSAGE_QUEUE_SIZE 1024
+#define AEM_MINIMAL_MESSAGE_QUEUE_SIZE 1
+#define AEM_MAXIMAL_MESSAGE_QUEUE_SIZE 0x40000
+
+/** Queue depth above which catch-up mode starts merging moves. Catch-up mode is disabled by default. */
+#define AEM_DEFAULT_CATCH_UP_THRESHOLD 16
+
+/** Maximal number of messages waiting for their due time. */
+#define AEM_SCHEDULE_SIZE 1024
+
+/** Number of events kept in the device trace, must be a power of two. */
+#define AEM_TRACE_SIZE 1024
+
+/** Sizes of pointer input reports, without report ID. Keyboard reports are AEM_KEYBOARD_INPUT_REPORT_SIZE long. */
+#define AEM_RELATIVE_INPUT_REPORT_SIZE 0x7
+#define AEM_ABSOLUTE_INPUT_REPORT_SIZE 0x9
+#define AEM_INPUT_REPORT_SIZE          AEM_ABSOLUTE_INPUT_REPORT_SIZE /**< Size of the largest input report. */
+
+typedef struct _AEM_CORE {
+  AEM_INFO_FEATURE_REPORT  InfoReport;
+  AEM_RING                 MessageQueue;     /**< Lock-free queue of move messages, slots are allocated with AemAllocate. */
+  AEM_LOCK                 ConsumerLock;     /**< Serializes MessageQueue consumers. Producers don't need it. */
+  DWORD32                  MessageCheckInterval;
+  BOOLEAN                  CatchUpEnabled;   /**< Merge queued moves while the queue is deeper than CatchUpThreshold. */
+  DWORD32                  CatchUpThreshold;
+  AEM_COALESCE             Carry;            /**< Merged motion that didn't fit into the last report, protected by ConsumerLock. */
+  AEM_GLIDE                Glide;            /**< Glide being expanded, protected by ConsumerLock. */
+  AEM_KEYBOARD             Keyboard;         /**< Keys held as of the last emitted keyboard report, protected by ConsumerLock. */
+  SHORT_POINT              LastPosition;     /**< Last reported absolute position, protected by ConsumerLock. */
+  DWORD32                  MergedCount;      /**< Number of messages merged by catch-up mode or queue compaction, protected by ConsumerLock. */
+  BOOLEAN                  IsCompacted;      /**< Last compaction merged nothing. Written under ConsumerLock, read by producers. */
+  LONG                     CompactedTail;    /**< MessageQueue.Tail as of the last compaction. Compaction is skipped while IsCompacted and the tail stays there. */
+  AEM_HISTOGRAM            Latency;          /**< Time messages spent in MessageQueue, protected by ConsumerLock. */
+
+  AEM_SCHEDULE             Schedule;         /**< Timed messages ordered by due interrupt time, entries are allocated with AemAllocate. */
+  AEM_LOCK                 ScheduleLock;     /**< Protects Schedule. */
+
+  AEM_LOCK                 ReadLock;         /**< Protects NextEmissionTime and adaptive pacing state. */
+  ULONGLONG                NextEmissionTime; /**< Interrupt time of the next free emission slot, in 100 ns. */
+  BOOLEAN                  PacingEnabled;    /**< Space emission slots by Pacing instead of MessageCheckInterval. */
+  AEM_PACING               Pacing;
+  DWORD32                  PacedInterval;    /**< Interval chosen by Pacing for the last emission slot, in 1/1000000 sec. */
+
+  PAEM_STATS_PAGE          Stats;            /**< Counters, either LocalStats or the page shared by the platform. */
+  AEM_STATS_PAGE           LocalStats;
+  DWORD32                  StatsPageId;      /**< Identifies the shared page, see AEM_CONTROL_CODE_STATS_PAGE. */
+
+  AEM_TRACE                Trace;            /**< Recent events, see AEM_CONTROL_CODE_TRACE. Events are allocated with AemAllocate. */
+
+  AEM_CHANNEL              Channel;          /**< Submission channel shared by the platform, moved into MessageQueue by the consumer. Protected by ConsumerLock. */
+  DWORD32                  ChannelPageId;    /**< Identifies the channel page, see AEM_CONTROL_CODE_CHANNEL. */
+  BOOLEAN                  IsChannelStuck;   /**< Head of Channel was found stuck and has been ever since, protected by ConsumerLock. */
+  ULONGLONG                ChannelStuckTime; /**< Interrupt time the head of Channel was first found stuck, protected by ConsumerLock. */
+
+  DWORD32                  ReadTimerTicks;   /**< Periods of the read timer that completed read requests. Maintained by the platform. */
+  DWORD32                  ReadTimerRearms;  /**< Times the read timer was moved off its period. Maintained by the platform. */
+} AEM_CORE, *PAEM_CORE;
+
+/** Initializes the core and allocates the message queue, the schedule and the trace.
+ *
+ * @param Core                         Core to initialize.
+ * @returns                            STATUS_SUCCESS if successful, STATUS_INSUFFICIENT_RESOURCES if out of memory. */
+NTSTATUS AemCoreInit(PAEM_CORE Core);
+
+/** Frees the message queue, the schedule and the trace. The platform must cancel its timers first.
+ *
+ * @param Core                         Core. */
+VOID AemCoreFree(PAEM_CORE Core);
+
+/** Moves the counters into a page shared by the platform, or back into the core. 
+ * Must be called while no requests are in flight, e.g. before the device is started or after it is removed.
+ *
+ * @param Core                         Core.
+ * @param Page                         Page to keep the counters in, NULL to keep them in the core.
+ * @param PageId                       Page ID returned by AEM_CONTROL_CODE_STATS_PAGE. */
+VOID AemCoreSetStatsPage(PAEM_CORE Core, PAEM_STATS_PAGE Page, DWORD32 PageId);
+
+/** Sets the page of the submission channel and initializes it. Once this returns, the core no longer touches 
+ * the previous page, which can then be freed.
+ *
+ * @param Core                         Core.
+ * @param Page                         Page shared by the platform, NULL for no channel.
+ * @param PageId                       Page ID returned by AEM_CONTROL_CODE_CHANNEL. */
+VOID AemCoreSetChannelPage(PAEM_CORE Core, PAEM_CHANNEL_PAGE Page, DWORD32 PageId);
+
+/** Appends an event to the device trace, stamped with the current interrupt time. The core traces its own events,
+ * the platform traces the timers it fires. Can be called at any IRQL up to DISPATCH_LEVEL, with or without locks held.
+ *
+ * @param Core                         Core.
+ * @param Kind                         AEM_TRACE_XXX.
+ * @param Arg1                         Kind-specific argument.
+ * @param Arg2                         Kind-specific argument. */
+VOID AemCoreTrace(PAEM_CORE Core, UCHAR Kind, DWORD32 Arg1, DWORD32 Arg2);
+
+/** Handles a feature request for the given report ID. For the control collection it handles
+ * the user-defined control codes for sideband communication.
+ *
+ * @param Core                         Core.
+ * @param ReportId                     Report ID of the request.
+ * @param Buffer                       Report buffer, the reply is written in place.
+ * @param Length                       Length of the report buffer, in bytes.
+ * @returns                            NT status code. */
+NTSTATUS AemCoreGetFeature(PAEM_CORE Core, UCHAR ReportId, PUCHAR Buffer, ULONG Length);
+
+/** Handles an output report for the given report ID. Output reports of the control collection carry the same
+ * submission requests as feature reports do, but there is no reply, so the outcome is returned as a status.
+ *
+ * @param Core                         Core.
+ * @param ReportId                     Report ID of the request.
+ * @param Buffer                       Report buffer, left unchanged.
+ * @param Length                       Length of the report buffer, in bytes, at most AEM_OUTPUT_REPORT_SIZE + 1.
+ * @returns                            STATUS_SUCCESS if the whole submission was queued, STATUS_INSUFFICIENT_RESOURCES 
+ *                                     if the queue or the schedule was full and some or all of it was rejected,
+ *                                     STATUS_NOT_SUPPORTED for control codes that aren't submissions, other NT status code otherwise. */
+NTSTATUS AemCoreWriteReport(PAEM_CORE Core, UCHAR ReportId, PUCHAR Buffer, ULONG Length);
+
+/** Reallocates the message queue with the given capacity, preserving all queued messages.
+ *
+ * @param Core                         Core.
+ * @param Capacity                     (in/out) Requested capacity, rounded up to a power of two on return.
+ * @returns                            STATUS_SUCCESS if successful, STATUS_INVALID_PARAMETER if the capacity is out of range
+ *                                     or is too small to hold the queued messages, STATUS_INSUFFICIENT_RESOURCES if out of memory. */
+NTSTATUS AemCoreSetMessageQueueCapacity(PAEM_CORE Core, PULONG Capacity);
+
+/** Can be called without ReadLock held, the interval may then be a slot stale.
+ *
+ * @param Core                         Core.
+ * @returns                            Interval between emission slots currently in use, either message check interval 
+ *                                     or the one chosen by adaptive pacing, in 1/1000000 sec. */
+DWORD32 AemCoreEmissionInterval(PAEM_CORE Core);
+
+/** Decides when the given read request is to be completed.
+ * A due timed message is emitted right away. If there is no input, the request is parked. Otherwise it is assigned
+ * the next emission slot, and is either completed right away, or is delayed until the slot comes.
+ *
+ * @param Core                         Core.
+ * @param Request                      Pending read request. */
+VOID AemCoreRead(PAEM_CORE Core, PVOID Request);
+
+/** Parks the given read request until there is some input, or a timed message is due.
+ *
+ * @param Core                         Core.
+ * @param Request                      Pending read request. */
+VOID AemCoreParkRead(PAEM_CORE Core, PVOID Request);
+
+/** Takes a parked read request, if any, and schedules its completion. Called when new input arrives,
+ * and by the platform when the schedule timer fires.
+ *
+ * @param Core                         Core. */
+VOID AemCoreWake(PAEM_CORE Core);
+
+/** Dequeues a message, packs an input report and completes the read request with it. Due timed messages
+ * take precedence over the message queue. If there is nothing to emit (e.g. the queue was emptied
+ * by AEM_CONTROL_CODE_CLEAR_QUEUE in the meantime), the request is parked instead.
+ * Called by the platform when a delayed read request is due.
+ *
+ * @param Core                         Core.
+ * @param Request                      Pending read request. */
+VOID AemCoreCompleteRead(PAEM_CORE Core, PVOID Request);
+
+/** Packs a move or a scroll into a pointer input report.
+ *
+ * @param Message                      Move or scroll. Absolute scrolls carry the position to report in Point.
+ * @param Report                       (out) Buffer for at least AEM_INPUT_REPORT_SIZE + 1 bytes.
+ * @returns                            Size of the report, including report ID. */
+ULONG AemCorePackReport(PAEM_MESSAGE Message, PUCHAR Report);
+
+/** Pushes a message into the message queue. If the queue is full, it is compacted first.
+ *
+ * @param Core                         Core.
+ * @param Message                      Message.
+ * @returns                            TRUE if the message was queued, FALSE if the queue is full. */
+BOOLEAN AemCoreEnqueue(PAEM_CORE Core, PAEM_MESSAGE Message);
+
+/** Compacts the full message queue in place by merging runs of moves with identical button flags.
+ * Final cursor position and the order of button transitions are preserved. Returns right away if nothing
+ * has been pushed since the last compaction that merged nothing.
+ *
+ * @param Core                         Core.
+ * @returns                            Number of messages merged, i.e. number of slots freed. */
+ULONG AemCoreCompact(PAEM_CORE Core);
+
+/** Moves the moves published in the submission channel into the message queue, if there is a channel. Before reporting
+ * an empty queue, asks the channel clients to wake the consumer up once they publish more.
+ *
+ * @param Core                         Core.
+ * @returns                            TRUE if there are neither queued messages, nor carried motion, nor glide moves left. */
+BOOLEAN AemCoreIsQueueEmpty(PAEM_CORE Core);
+
+/** Takes the next move from the message queue. In catch-up mode, when the queue is deeper than
+ * the threshold, a run of moves with identical button flags is merged into a single report-sized move.
+ * Relative motion that doesn't fit into the report is carried over to the next one. Glides are expanded
+ * into one move per report. Moves published in the submission channel are queued first. Must be called with ConsumerLock held.
+ *
+ * @param Core                         Core.
+ * @param Message                      (out) Message.
+ * @returns                            FALSE if the queue is empty, TRUE otherwise. */
+BOOLEAN AemCoreDequeue(PAEM_CORE Core, PAEM_MESSAGE Message);
+
+/** @param Core                        Core.
+ * @returns                            TRUE if the earliest timed message is due. */
+BOOLEAN AemCoreIsScheduledMessageDue(PAEM_CORE Core);
+
+/** Removes the earliest timed message from the schedule if it is due.
+ *
+ * @param Core                         Core.
+ * @param Message                      (out) Removed message.
+ * @returns                            TRUE if a message was removed, FALSE otherwise. */
+BOOLEAN AemCorePopScheduledMessage(PAEM_CORE Core, PAEM_MESSAGE Message);
+
+/** Arms the schedule timer for the due time of the earliest timed message, or cancels it if there are none.
+ * Must be called with ScheduleLock held.
+ *
+ * @param Core                         Core. */
+VOID AemCoreArmScheduleTimer(PAEM_CORE Core);
+
+#endif // __AEM_CORE_H__
@@ -0,0 +1,109 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "glide.h"
+
+#define AEM_GLIDE_ONE 0x10000 /**< One in 16.16 fixed point. */
+
+/** @returns                           Value clamped to the relative report range. */
+static LONG AemGlideClamp(LONG Value) {
+  if(Value > AEM_MAX_RELATIVE_DELTA)
+    return AEM_MAX_RELATIVE_DELTA;
+  if(Value < -AEM_MAX_RELATIVE_DELTA)
+    return -AEM_MAX_RELATIVE_DELTA;
+  return Value;
+}
+
+/** @returns                           Offset * Progress, rounded to nearest. */
+static LONG AemGlideScale(LONG Offset, LONG Progress) {
+  LONGLONG product = (LONGLONG) Offset * Progress;
+  return (LONG) ((product + (product >= 0 ? AEM_GLIDE_ONE / 2 : -AEM_GLIDE_ONE / 2)) / AEM_GLIDE_ONE);
+}
+
+LONG AemGlideEase(UCHAR Easing, LONG Progress) {
+  LONGLONG t = Progress, t2, t3, p;
+
+  /* Intermediate products are kept with 32 fractional bits, so that the curves stay monotonic. */
+  switch(Easing) {
+  case AEM_EASING_EASE_IN_OUT:
+    /* Smoothstep, t^2 (3 - 2t). */
+    t2 = t * t;
+    return (LONG) ((t2 * (3 * AEM_GLIDE_ONE - 2 * t)) >> 32);
+  case AEM_EASING_MINIMUM_JERK:
+    /* Minimum jerk trajectory, t^3 (10 - 15t + 6t^2). */
+    t3 = (t * t * t) >> 16;
+    p = (6 * t - 15 * AEM_GLIDE_ONE) * t + 10 * ((LONGLONG) AEM_GLIDE_ONE << 16);
+    return (LONG) (((t3 >> 8) * (p >> 8)) >> 32);
+  case AEM_EASING_LINEAR:
+  default:
+    return (LONG) t;
+  }
+}
+
+VOID AemGlideInit(PAEM_GLIDE Glide) {
+  RtlZeroMemory(Glide, sizeof(AEM_GLIDE));
+}
+
+VOID AemGlideStart(PAEM_GLIDE Glide, PAEM_MESSAGE Message, LONG StartX, LONG StartY, ULONG Interval) {
+  Glide->IsRelative = Message->IsRelative;
+  Glide->Buttons = Message->Buttons;
+  Glide->Easing = Message->Easing;
+  Glide->Step = 0;
+  Glide->Steps = Interval == 0 ? 1 : (Message->Duration + Interval - 1) / Interval;
+  if(Glide->Steps == 0)
+    Glide->Steps = 1;
+  Glide->StartX = StartX;
+  Glide->StartY = StartY;
+  if(Message->Kind == AEM_MESSAGE_GLIDE_TO && !Glide->IsRelative) {
+    Glide->DeltaX = Message->Point.X - StartX;
+    Glide->DeltaY = Message->Point.Y - StartY;
+  } else {
+    Glide->DeltaX = Message->Point.X;
+    Glide->DeltaY = Message->Point.Y;
+  }
+  Glide->DoneX = 0;
+  Glide->DoneY = 0;
+}
+
+BOOLEAN AemGlideIsActive(PAEM_GLIDE Glide) {
+  return Glide->Step < Glide->Steps || Glide->DoneX != Glide->DeltaX || Glide->DoneY != Glide->DeltaY;
+}
+
+VOID AemGlideNext(PAEM_GLIDE Glide, PAEM_MESSAGE Message) {
+  LONG progress, x, y;
+
+  if(Glide->Step < Glide->Steps)
+    Glide->Step++;
+  progress = Glide->Step == Glide->Steps ? AEM_GLIDE_ONE : AemGlideEase(Glide->Easing, (LONG) (((LONGLONG) Glide->Step << 16) / Glide->Steps));
+  x = AemGlideScale(Glide->DeltaX, progress);
+  y = AemGlideScale(Glide->DeltaY, progress);
+
+  Message->Kind = AEM_MESSAGE_MOVE;
+  Message->IsRelative = Glide->IsRelative;
+  Message->Buttons = Glide->Buttons;
+  if(Glide->IsRelative) {
+    Message->Point.X = (SHORT) AemGlideClamp(x - Glide->DoneX);
+    Message->Point.Y = (SHORT) AemGlideClamp(y - Glide->DoneY);
+    Glide->DoneX += Message->Point.X;
+    Glide->DoneY += Message->Point.Y;
+  } else {
+    Message->Point.X = (SHORT) (Glide->StartX + x);
+    Message->Point.Y = (SHORT) (Glide->StartY + y);
+    Glide->DoneX = x;
+    Glide->DoneY = y;
+  }
+}
@@ -0,0 +1,73 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_GLIDE_H__
+#define __AEM_GLIDE_H__
+
+#include "portable.h"
+#include "common.h"
+#include "message.h"
+
+/* Expansion of a glide message into per-tick moves. Progress along the path is computed in 16.16 
+ * fixed point from the easing curve. Each step targets an exact offset from the glide start, 
+ * so sub-unit remainders never accumulate. In relative mode a step that doesn't fit into a report 
+ * is clamped, and the rest is emitted by the following steps. */
+
+typedef struct _AEM_GLIDE {
+  BOOLEAN IsRelative; /**< Motion mode of the moves. */
+  UCHAR   Buttons;    /**< Button flags of all the moves. */
+  UCHAR   Easing;     /**< AEM_EASING_XXX. */
+  ULONG   Step;       /**< Number of steps taken. */
+  ULONG   Steps;      /**< Total number of steps, zero if no glide is active. */
+  LONG    StartX;     /**< Start position, absolute mode only. */
+  LONG    StartY;
+  LONG    DeltaX;     /**< Total offset. */
+  LONG    DeltaY;
+  LONG    DoneX;      /**< Offset emitted so far, relative mode only. */
+  LONG    DoneY;
+} AEM_GLIDE, *PAEM_GLIDE;
+
+/** Initializes an inactive glide.
+ *
+ * @param Glide                        Glide to initialize. */
+VOID AemGlideInit(PAEM_GLIDE Glide);
+
+/** Starts a glide.
+ *
+ * @param Glide                        Glide.
+ * @param Message                      Glide message, defines the motion mode of the glide.
+ * @param StartX                       Current position, ignored in relative mode.
+ * @param StartY                       Current position, ignored in relative mode.
+ * @param Interval                     Interval between moves, in 1/1000000 sec. */
+VOID AemGlideStart(PAEM_GLIDE Glide, PAEM_MESSAGE Message, LONG StartX, LONG StartY, ULONG Interval);
+
+/** @param Glide                       Glide.
+ * @returns                            TRUE if the glide has moves left. */
+BOOLEAN AemGlideIsActive(PAEM_GLIDE Glide);
+
+/** Takes the next move of an active glide.
+ *
+ * @param Glide                        Active glide.
+ * @param Message                      (out) Move. */
+VOID AemGlideNext(PAEM_GLIDE Glide, PAEM_MESSAGE Message);
+
+/** @param Easing                      AEM_EASING_XXX.
+ * @param Progress                     Time progress, in 16.16 fixed point, in [0, 1].
+ * @returns                            Path progress, in 16.16 fixed point, in [0, 1]. */
+LONG AemGlideEase(UCHAR Easing, LONG Progress);
+
+#endif // __AEM_GLIDE_H__
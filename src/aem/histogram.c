@@ -0,0 +1,54 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "histogram.h"
+
+VOID AemHistogramInit(PAEM_HISTOGRAM Histogram) {
+  RtlZeroMemory(Histogram, sizeof(AEM_HISTOGRAM));
+}
+
+ULONG AemHistogramBucket(ULONG Value) {
+  ULONG exponent;
+
+  if(Value < AEM_HISTOGRAM_SUB_BUCKETS)
+    return Value;
+  if(Value >= (1UL << AEM_HISTOGRAM_MAX_EXPONENT))
+    return AEM_HISTOGRAM_BUCKETS - 1;
+
+  for(exponent = AEM_HISTOGRAM_SUB_BUCKET_BITS; (Value >> (exponent + 1)) != 0; exponent++)
+    ;
+  return (exponent - AEM_HISTOGRAM_SUB_BUCKET_BITS + 1) * AEM_HISTOGRAM_SUB_BUCKETS + 
+    ((Value >> (exponent - AEM_HISTOGRAM_SUB_BUCKET_BITS)) & (AEM_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+ULONG AemHistogramBucketLowerBound(ULONG Bucket) {
+  ULONG exponent;
+
+  if(Bucket < AEM_HISTOGRAM_SUB_BUCKETS)
+    return Bucket;
+
+  exponent = Bucket / AEM_HISTOGRAM_SUB_BUCKETS + AEM_HISTOGRAM_SUB_BUCKET_BITS - 1;
+  return (AEM_HISTOGRAM_SUB_BUCKETS + Bucket % AEM_HISTOGRAM_SUB_BUCKETS) << (exponent - AEM_HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+VOID AemHistogramAdd(PAEM_HISTOGRAM Histogram, ULONG Value) {
+  Histogram->Buckets[AemHistogramBucket(Value)]++;
+  Histogram->Count++;
+  Histogram->Sum += Value;
+  if(Value > Histogram->Max)
+    Histogram->Max = Value;
+}
@@ -0,0 +1,54 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_HISTOGRAM_H__
+#define __AEM_HISTOGRAM_H__
+
+#include "portable.h"
+#include "common.h"
+
+/* Log-linear histogram of durations in 1/1000000 sec. Every power of two range is split into 
+ * AEM_HISTOGRAM_SUB_BUCKETS equal buckets, so the relative error of a bucket is below 1/8 over the whole range,
+ * while the whole histogram fits into a single feature report. See common.h for the bucket layout. */
+
+typedef struct _AEM_HISTOGRAM {
+  ULONG     Buckets[AEM_HISTOGRAM_BUCKETS]; /**< Number of values that fell into each bucket. */
+  ULONG     Count;                          /**< Total number of values. */
+  ULONG     Max;                            /**< Largest value. */
+  ULONGLONG Sum;                            /**< Sum of all values. */
+} AEM_HISTOGRAM, *PAEM_HISTOGRAM;
+
+/** Initializes an empty histogram.
+ *
+ * @param Histogram                    Histogram to initialize. */
+VOID AemHistogramInit(PAEM_HISTOGRAM Histogram);
+
+/** @param Value                       Duration in 1/1000000 sec.
+ * @returns                            Index of the bucket the value falls into. */
+ULONG AemHistogramBucket(ULONG Value);
+
+/** @param Bucket                      Bucket index.
+ * @returns                            Smallest value that falls into the bucket. */
+ULONG AemHistogramBucketLowerBound(ULONG Bucket);
+
+/** Adds a value to the histogram.
+ *
+ * @param Histogram                    Histogram.
+ * @param Value                        Duration in 1/1000000 sec. */
+VOID AemHistogramAdd(PAEM_HISTOGRAM Histogram, ULONG Value);
+
+#endif // __AEM_HISTOGRAM_H__
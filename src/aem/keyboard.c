@@ -0,0 +1,68 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "keyboard.h"
+
+VOID AemKeyboardInit(PAEM_KEYBOARD Keyboard) {
+  RtlZeroMemory(Keyboard, sizeof(AEM_KEYBOARD));
+}
+
+VOID AemKeyboardApply(PAEM_KEYBOARD Keyboard, UCHAR Key, BOOLEAN IsDown) {
+  ULONG i, j;
+
+  if(Key == AEM_KEY_ALL) {
+    if(!IsDown)
+      AemKeyboardInit(Keyboard);
+    return;
+  }
+  if(Key > AEM_MAX_KEY)
+    return;
+
+  if(Key >= AEM_KEY_LEFT_CONTROL) {
+    if(IsDown)
+      Keyboard->Modifiers |= (UCHAR) (1 << (Key - AEM_KEY_LEFT_CONTROL));
+    else
+      Keyboard->Modifiers &= (UCHAR) ~(1 << (Key - AEM_KEY_LEFT_CONTROL));
+    return;
+  }
+
+  for(i = 0; i < AEM_KEYBOARD_ROLLOVER && Keyboard->Keys[i] != 0; i++)
+    if(Keyboard->Keys[i] == Key)
+      break;
+
+  if(IsDown) {
+    if(i < AEM_KEYBOARD_ROLLOVER)
+      Keyboard->Keys[i] = Key; /* Either already held or the first free entry. */
+  } else if(i < AEM_KEYBOARD_ROLLOVER && Keyboard->Keys[i] == Key) {
+    /* Keep the array packed, hidclass reports keys in the order they appear in it. */
+    for(j = i; j + 1 < AEM_KEYBOARD_ROLLOVER; j++)
+      Keyboard->Keys[j] = Keyboard->Keys[j + 1];
+    Keyboard->Keys[AEM_KEYBOARD_ROLLOVER - 1] = 0;
+  }
+}
+
+BOOLEAN AemKeyboardIsPressed(PAEM_KEYBOARD Keyboard) {
+  return Keyboard->Modifiers != 0 || Keyboard->Keys[0] != 0;
+}
+
+ULONG AemKeyboardPack(PAEM_KEYBOARD Keyboard, PUCHAR Report) {
+  Report[0] = AEM_KEYBOARD_REPORT_ID;
+  Report[1] = Keyboard->Modifiers;
+  Report[2] = 0;
+  RtlCopyMemory(Report + 3, Keyboard->Keys, AEM_KEYBOARD_ROLLOVER);
+  return AEM_KEYBOARD_INPUT_REPORT_SIZE + 1;
+}
@@ -0,0 +1,62 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_KEYBOARD_H__
+#define __AEM_KEYBOARD_H__
+
+#include "portable.h"
+#include "common.h"
+
+/* State of the virtual keyboard. Key events change it one at a time, and every change is reported as a 
+ * full boot-style report: a byte of modifier bits, a reserved byte and an array of the other held keys. */
+
+/** Number of non-modifier keys that can be held at once. Presses beyond it are dropped. */
+#define AEM_KEYBOARD_ROLLOVER 6
+
+/** Size of keyboard input reports, without report ID. */
+#define AEM_KEYBOARD_INPUT_REPORT_SIZE (AEM_KEYBOARD_ROLLOVER + 2)
+
+typedef struct _AEM_KEYBOARD {
+  UCHAR Modifiers;                     /**< Bits of the held modifiers, LeftControl being the lowest one. */
+  UCHAR Keys[AEM_KEYBOARD_ROLLOVER];   /**< Usages of the held keys in the order they were pressed, zero-padded. */
+} AEM_KEYBOARD, *PAEM_KEYBOARD;
+
+/** Initializes the keyboard with all keys released.
+ *
+ * @param Keyboard                     Keyboard to initialize. */
+VOID AemKeyboardInit(PAEM_KEYBOARD Keyboard);
+
+/** Applies a key event.
+ *
+ * @param Keyboard                     Keyboard.
+ * @param Key                          Usage on the Keyboard/Keypad page, up to AEM_MAX_KEY. Releasing 
+ *                                     AEM_KEY_ALL releases all keys.
+ * @param IsDown                       TRUE if the key is pressed, FALSE if it is released. */
+VOID AemKeyboardApply(PAEM_KEYBOARD Keyboard, UCHAR Key, BOOLEAN IsDown);
+
+/** @param Keyboard                    Keyboard.
+ * @returns                            TRUE if any key is held. */
+BOOLEAN AemKeyboardIsPressed(PAEM_KEYBOARD Keyboard);
+
+/** Packs the state of the keyboard into an input report.
+ *
+ * @param Keyboard                     Keyboard.
+ * @param Report                       (out) Buffer for at least AEM_KEYBOARD_INPUT_REPORT_SIZE + 1 bytes.
+ * @returns                            Size of the report, including report ID. */
+ULONG AemKeyboardPack(PAEM_KEYBOARD Keyboard, PUCHAR Report);
+
+#endif // __AEM_KEYBOARD_H__
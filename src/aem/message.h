@@ -0,0 +1,46 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_MESSAGE_H__
+#define __AEM_MESSAGE_H__
+
+#include "portable.h"
+#include "common.h"
+
+/** Kinds of messages. */
+#define AEM_MESSAGE_MOVE     0x00 /**< Single move. */
+#define AEM_MESSAGE_GLIDE_TO 0x01 /**< Glide to a position, expanded into moves when emitted. */
+#define AEM_MESSAGE_GLIDE_BY 0x02 /**< Glide by a delta, expanded into moves when emitted. */
+#define AEM_MESSAGE_KEY      0x03 /**< Key press or release, emitted as a keyboard report. */
+#define AEM_MESSAGE_SCROLL   0x04 /**< Wheel and pan deltas, emitted as a pointer report without motion. */
+
+/** Entry of the message queue of arx ethereal mouse device. */
+typedef struct _AEM_MESSAGE {
+  UCHAR       Kind;        /**< AEM_MESSAGE_XXX. */
+  BOOLEAN     IsRelative;  /**< Motion mode of the message. */
+  UCHAR       Buttons;     /**< Button flags. */
+  SHORT       Wheel;       /**< Scrolls only, vertical wheel delta in detents. */
+  SHORT       Pan;         /**< Scrolls only, horizontal pan delta in detents. */
+  UCHAR       Key;         /**< Key messages only, usage on the Keyboard/Keypad page. */
+  BOOLEAN     IsKeyDown;   /**< Key messages only, TRUE if the key is pressed, FALSE if it is released. */
+  SHORT_POINT Point;       /**< New coord or delta, depending on the motion mode. Target or delta for glides. */
+  UCHAR       Easing;      /**< Glides only, AEM_EASING_XXX. */
+  DWORD32     Duration;    /**< Glides only, duration in 1/1000000 sec. */
+  ULONGLONG   EnqueueTime; /**< Interrupt time when the message was queued, in 100 ns. Not used by timed messages. */
+} AEM_MESSAGE, *PAEM_MESSAGE;
+
+#endif // __AEM_MESSAGE_H__
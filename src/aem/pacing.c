@@ -0,0 +1,33 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "pacing.h"
+
+DWORD32 AemPacingNextInterval(PAEM_PACING Pacing, DWORD32 Interval, ULONG Depth) {
+  ULONGLONG next = Interval;
+
+  if(Depth > Pacing->TargetDepth)
+    next -= next >> AEM_PACING_SHORTEN_SHIFT;
+  else if(Depth <= Pacing->TargetDepth / 2)
+    next += (next >> AEM_PACING_RELAX_SHIFT) + 1; /* Plus one, so that short intervals relax too. */
+
+  if(next < Pacing->MinInterval)
+    next = Pacing->MinInterval;
+  if(next > Pacing->MaxInterval)
+    next = Pacing->MaxInterval;
+  return (DWORD32) next;
+}
@@ -0,0 +1,48 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_PACING_H__
+#define __AEM_PACING_H__
+
+#include "portable.h"
+
+/* Adaptive pacing of emission slots. The interval between slots shortens step by step while the queue is 
+ * deeper than the target depth, and relaxes back once it drains to a half of it. In between the interval 
+ * is kept as it is, so that it doesn't flap around the target. Policy is a pure function of its inputs, 
+ * so that it can be replayed against recorded traces, see aemtrace -p. */
+
+/** Interval shortens by 1/2^AEM_PACING_SHORTEN_SHIFT of itself per emission slot while the queue is too deep. */
+#define AEM_PACING_SHORTEN_SHIFT 2
+
+/** Interval relaxes by 1/2^AEM_PACING_RELAX_SHIFT of itself per emission slot once the queue has drained. */
+#define AEM_PACING_RELAX_SHIFT 3
+
+typedef struct _AEM_PACING {
+  DWORD32 MinInterval;  /**< Shortest interval, in 1/1000000 sec. */
+  DWORD32 MaxInterval;  /**< Longest interval, the one used while the queue is shallow, in 1/1000000 sec. */
+  DWORD32 TargetDepth;  /**< Queue depth above which the interval shortens. It relaxes at a half of it or below. */
+} AEM_PACING, *PAEM_PACING;
+
+/** Computes the interval until the next emission slot.
+ *
+ * @param Pacing                       Pacing settings, MinInterval must not exceed MaxInterval.
+ * @param Interval                     Interval until the current slot, in 1/1000000 sec.
+ * @param Depth                        Number of messages in the queue at the current slot.
+ * @returns                            Interval until the next slot, in [MinInterval, MaxInterval]. */
+DWORD32 AemPacingNextInterval(PAEM_PACING Pacing, DWORD32 Interval, ULONG Depth);
+
+#endif // __AEM_PACING_H__
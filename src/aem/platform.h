@@ -0,0 +1,77 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_PLATFORM_H__
+#define __AEM_PLATFORM_H__
+
+#include "core.h"
+
+/* Functions the core expects from the platform it runs on. The driver implements them on top of WDM
+ * in aem.c, the simulator in src/aemsim implements them on top of a virtual clock.
+ * Platform can get from the core to its own device state with CONTAINING_RECORD.
+ * All of them may be called at DISPATCH_LEVEL, some with core locks held. */
+
+/** @param Core                        Core.
+ * @returns                            Monotonic time, in 100 ns. */
+ULONGLONG AemPlatformInterruptTime(PAEM_CORE Core);
+
+/** @param Core                        Core.
+ * @returns                            System time, in 100 ns since January 1, 1601 (UTC). */
+LONGLONG AemPlatformSystemTime(PAEM_CORE Core);
+
+/** Arms the schedule timer, replacing the previous due time. When the timer fires,
+ * the platform calls AemCoreWake. Called with ScheduleLock held.
+ *
+ * @param Core                         Core.
+ * @param DueTime                      Interrupt time when the timer is to fire, may be in the past. */
+VOID AemPlatformSetScheduleTimer(PAEM_CORE Core, ULONGLONG DueTime);
+
+/** Cancels the schedule timer. Called with ScheduleLock held.
+ *
+ * @param Core                         Core. */
+VOID AemPlatformCancelScheduleTimer(PAEM_CORE Core);
+
+/** Delays a read request. When it is due, the platform calls AemCoreCompleteRead.
+ *
+ * @param Core                         Core.
+ * @param Request                      Pending read request.
+ * @param DueTime                      Interrupt time when the request is due, in the future.
+ * @returns                            TRUE if successful, FALSE if out of resources. */
+BOOLEAN AemPlatformDelayRead(PAEM_CORE Core, PVOID Request, ULONGLONG DueTime);
+
+/** Adds a read request to the queue of parked requests. Parked requests can be cancelled by the platform.
+ *
+ * @param Core                         Core.
+ * @param Request                      Pending read request. */
+VOID AemPlatformParkRead(PAEM_CORE Core, PVOID Request);
+
+/** Removes the first parked read request.
+ *
+ * @param Core                         Core.
+ * @returns                            Removed request, or NULL if there are none. */
+PVOID AemPlatformUnparkRead(PAEM_CORE Core);
+
+/** Completes a read request.
+ *
+ * @param Core                         Core.
+ * @param Request                      Pending read request.
+ * @param Status                       Completion status.
+ * @param Report                       Input report, NULL if Status is a failure.
+ * @param Size                         Size of the input report, including report ID. */
+VOID AemPlatformCompleteRead(PAEM_CORE Core, PVOID Request, NTSTATUS Status, PUCHAR Report, ULONG Size);
+
+#endif // __AEM_PLATFORM_H__
@@ -0,0 +1,135 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_PORTABLE_H__
+#define __AEM_PORTABLE_H__
+
+/* Code that includes this header instead of <wdm.h> or <Windows.h> directly
+ * can be compiled into the driver, into aemctl, and on non-Windows hosts. 
+ * The driver build defines AEM_KERNEL_MODE (see sources). */
+
+#if defined(AEM_KERNEL_MODE)
+#  include <wdm.h>
+#  define AEM_POOL_TAG ((ULONG) 'diHV')
+#elif defined(_WIN32)
+#  include <Windows.h>
+#else
+#  include <sched.h>
+#  include <stddef.h>
+#  include <stdint.h>
+#  include <stdlib.h>
+#  include <string.h>
+
+typedef void                VOID, *PVOID;
+typedef char                CHAR, *PCHAR;
+typedef uint8_t             UCHAR, *PUCHAR;
+typedef int16_t             SHORT, *PSHORT;
+typedef uint16_t            USHORT, *PUSHORT;
+typedef int32_t             LONG, *PLONG;
+typedef uint32_t            ULONG, *PULONG;
+typedef uint32_t            DWORD32, *PDWORD32;
+typedef uint32_t            DWORD;
+typedef int64_t             LONGLONG, *PLONGLONG;
+typedef uint64_t            ULONGLONG, *PULONGLONG;
+typedef uintptr_t           ULONG_PTR;
+typedef uint8_t             BOOLEAN, *PBOOLEAN;
+typedef int32_t             NTSTATUS;
+
+#  ifndef TRUE
+#    define TRUE  1
+#    define FALSE 0
+#  endif
+
+#  define FIELD_OFFSET(TYPE, FIELD) ((LONG) offsetof(TYPE, FIELD))
+#  define RtlCopyMemory(DST, SRC, LEN) memcpy((DST), (SRC), (LEN))
+#  define RtlMoveMemory(DST, SRC, LEN) memmove((DST), (SRC), (LEN))
+#  define RtlZeroMemory(DST, LEN) memset((DST), 0, (LEN))
+#  define CONTAINING_RECORD(ADDRESS, TYPE, FIELD) ((TYPE *) ((PCHAR) (ADDRESS) - offsetof(TYPE, FIELD)))
+#  define UNREFERENCED_PARAMETER(P) ((void) (P))
+
+#  define STATUS_SUCCESS                ((NTSTATUS) 0x00000000L)
+#  define STATUS_PENDING                ((NTSTATUS) 0x00000103L)
+#  define STATUS_INVALID_PARAMETER      ((NTSTATUS) 0xC000000DL)
+#  define STATUS_BUFFER_TOO_SMALL       ((NTSTATUS) 0xC0000023L)
+#  define STATUS_INSUFFICIENT_RESOURCES ((NTSTATUS) 0xC000009AL)
+#  define STATUS_NOT_SUPPORTED          ((NTSTATUS) 0xC00000BBL)
+#  define STATUS_CANCELLED              ((NTSTATUS) 0xC0000120L)
+#  define NT_SUCCESS(STATUS) ((NTSTATUS) (STATUS) >= 0)
+#endif
+
+/* Nonpaged memory. */
+#if defined(AEM_KERNEL_MODE)
+#  define AemAllocate(SIZE) ExAllocatePoolWithTag(NonPagedPool, (SIZE), AEM_POOL_TAG)
+#  define AemFree(PTR) ExFreePool(PTR)
+#elif defined(_WIN32)
+#  define AemAllocate(SIZE) HeapAlloc(GetProcessHeap(), 0, (SIZE))
+#  define AemFree(PTR) HeapFree(GetProcessHeap(), 0, (PTR))
+#else
+#  define AemAllocate(SIZE) malloc(SIZE)
+#  define AemFree(PTR) free(PTR)
+#endif
+
+/* Atomic operations on 32-bit values. Volatile accesses have acquire / release 
+ * semantics with MSVC, so plain volatile reads and writes are used there. */
+#if defined(_WIN32)
+#  define AemInterlockedCompareExchange(DST, EXCHANGE, COMPARAND) InterlockedCompareExchange((DST), (EXCHANGE), (COMPARAND))
+#  define AemInterlockedIncrement(DST) InterlockedIncrement(DST)
+#  define AemInterlockedAdd(DST, VALUE) ((void) InterlockedExchangeAdd((DST), (VALUE)))
+#  define AemInterlockedDecrement(DST) InterlockedDecrement(DST)
+#  define AemInterlockedExchange(DST, VALUE) InterlockedExchange((DST), (VALUE))
+#  define AemYieldProcessor() YieldProcessor()
+#  define AemReadAcquire(SRC) (*(volatile LONG *) (SRC))
+#  define AemWriteRelease(DST, VALUE) (*(volatile LONG *) (DST) = (VALUE))
+#  if defined(AEM_KERNEL_MODE)
+#    define AemMemoryBarrier() KeMemoryBarrier()
+#  else
+#    define AemMemoryBarrier() MemoryBarrier()
+#  endif
+#else
+#  define AemInterlockedCompareExchange(DST, EXCHANGE, COMPARAND) __sync_val_compare_and_swap((DST), (COMPARAND), (EXCHANGE))
+#  define AemInterlockedIncrement(DST) __sync_add_and_fetch((DST), 1)
+#  define AemInterlockedAdd(DST, VALUE) ((void) __sync_add_and_fetch((DST), (VALUE)))
+#  define AemInterlockedDecrement(DST) __sync_sub_and_fetch((DST), 1)
+#  define AemInterlockedExchange(DST, VALUE) __atomic_exchange_n((DST), (VALUE), __ATOMIC_SEQ_CST)
+#  define AemYieldProcessor() ((void) sched_yield()) /* Lock holder may be preempted, let it run. */
+#  define AemReadAcquire(SRC) __atomic_load_n((SRC), __ATOMIC_ACQUIRE)
+#  define AemWriteRelease(DST, VALUE) __atomic_store_n((DST), (VALUE), __ATOMIC_RELEASE)
+#  define AemMemoryBarrier() __sync_synchronize()
+#endif
+
+/* Spin locks. In kernel mode they raise IRQL to DISPATCH_LEVEL, elsewhere they just spin. 
+ * AemRaiseToDispatch / AemLowerFromDispatch keep the caller from being preempted in kernel mode, 
+ * and do nothing elsewhere. */
+#if defined(AEM_KERNEL_MODE)
+typedef KSPIN_LOCK AEM_LOCK, *PAEM_LOCK;
+typedef KIRQL      AEM_LOCK_STATE, *PAEM_LOCK_STATE;
+#  define AemLockInit(LOCK) KeInitializeSpinLock(LOCK)
+#  define AemLockAcquire(LOCK, STATE) KeAcquireSpinLock((LOCK), (STATE))
+#  define AemLockRelease(LOCK, STATE) KeReleaseSpinLock((LOCK), (STATE))
+#  define AemRaiseToDispatch(STATE) KeRaiseIrql(DISPATCH_LEVEL, (STATE))
+#  define AemLowerFromDispatch(STATE) KeLowerIrql(STATE)
+#else
+typedef volatile LONG AEM_LOCK, *PAEM_LOCK;
+typedef LONG          AEM_LOCK_STATE, *PAEM_LOCK_STATE;
+#  define AemLockInit(LOCK) AemWriteRelease((LOCK), 0)
+#  define AemLockAcquire(LOCK, STATE) do { *(STATE) = 0; while(AemInterlockedCompareExchange((LOCK), 1, 0) != 0) AemYieldProcessor(); } while(0)
+#  define AemLockRelease(LOCK, STATE) do { (void) (STATE); AemWriteRelease((LOCK), 0); } while(0)
+#  define AemRaiseToDispatch(STATE) (*(STATE) = 0)
+#  define AemLowerFromDispatch(STATE) ((void) (STATE))
+#endif
+
+#endif // __AEM_PORTABLE_H__
@@ -0,0 +1,50 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "readtimer.h"
+
+VOID AemReadTimerInit(PAEM_READ_TIMER Timer) {
+  Timer->IsArmed = FALSE;
+  Timer->DueTime = 0;
+  Timer->Period = 0;
+}
+
+BOOLEAN AemReadTimerIsArmNeeded(PAEM_READ_TIMER Timer, ULONGLONG DueTime, BOOLEAN IsFirst) {
+  return IsFirst && (!Timer->IsArmed || DueTime != Timer->DueTime);
+}
+
+LONG AemReadTimerArm(PAEM_READ_TIMER Timer, ULONGLONG DueTime, DWORD32 Interval) {
+  Timer->IsArmed = TRUE;
+  Timer->DueTime = DueTime;
+  Timer->Period = (LONG) (Interval / 1000);
+  return Timer->Period;
+}
+
+ULONGLONG AemReadTimerDelay(PAEM_READ_TIMER Timer, ULONGLONG Now) {
+  return Timer->DueTime > Now ? Timer->DueTime - Now : 1;
+}
+
+BOOLEAN AemReadTimerAdvance(PAEM_READ_TIMER Timer, ULONGLONG Now, ULONGLONG NextDueTime) {
+  /* Periods already past are skipped, the requests due on them have just been taken. */
+  while(Timer->DueTime <= Now && Timer->Period != 0)
+    Timer->DueTime += 10000 * (ULONGLONG) Timer->Period; /* In 100 ns. */
+  return NextDueTime != Timer->DueTime;
+}
+
+VOID AemReadTimerStop(PAEM_READ_TIMER Timer) {
+  Timer->IsArmed = FALSE;
+}
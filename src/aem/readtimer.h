@@ -0,0 +1,77 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_READTIMER_H__
+#define __AEM_READTIMER_H__
+
+#include "portable.h"
+
+/* Single periodic timer completing the delayed read requests of a device at their emission slots. The timer runs 
+ * with the period of the emission interval, so while the interval stays the same every slot falls on a period and the 
+ * timer is left alone. Periods are whole milliseconds, so the timer is moved to the next slot when the interval isn't 
+ * one, or when it changes. This is the bookkeeping only. The platform owns the actual timer and the list of delayed 
+ * requests, and calls in with the lock that protects them held. */
+
+typedef struct _AEM_READ_TIMER {
+  BOOLEAN   IsArmed;  /**< Timer is running. */
+  ULONGLONG DueTime;  /**< Interrupt time of the next period, in 100 ns. */
+  LONG      Period;   /**< Period, in 1/1000 sec. Zero if the timer fires only once. */
+} AEM_READ_TIMER, *PAEM_READ_TIMER;
+
+/** Initializes a stopped timer.
+ *
+ * @param Timer                        Timer to initialize. */
+VOID AemReadTimerInit(PAEM_READ_TIMER Timer);
+
+/** Called when a read request is delayed. Timer is stopped while there are no delayed requests, 
+ * and it has to be moved if the request is due before its next period.
+ *
+ * @param Timer                        Timer.
+ * @param DueTime                      Interrupt time the request is due at.
+ * @param IsFirst                      TRUE if the request is now the first one to be due.
+ * @returns                            TRUE if the timer has to be armed at DueTime. */
+BOOLEAN AemReadTimerIsArmNeeded(PAEM_READ_TIMER Timer, ULONGLONG DueTime, BOOLEAN IsFirst);
+
+/** Arms the timer at the given due time, with the period of the given emission interval.
+ *
+ * @param Timer                        Timer.
+ * @param DueTime                      Interrupt time of the first period.
+ * @param Interval                     Emission interval, in 1/1000000 sec.
+ * @returns                            Period to arm the platform timer with, in 1/1000 sec. */
+LONG AemReadTimerArm(PAEM_READ_TIMER Timer, ULONGLONG DueTime, DWORD32 Interval);
+
+/** @param Timer                       Armed timer.
+ * @param Now                          Current interrupt time.
+ * @returns                            Delay until the next period, in 100 ns. A period in the past is due right away, 
+ *                                     which is a delay of 1. */
+ULONGLONG AemReadTimerDelay(PAEM_READ_TIMER Timer, ULONGLONG Now);
+
+/** Called when the timer has fired and the due requests have been taken, while some requests are left. 
+ * Moves the timer to its first period past the current time.
+ *
+ * @param Timer                        Armed timer.
+ * @param Now                          Current interrupt time.
+ * @param NextDueTime                  Interrupt time the first of the remaining requests is due at.
+ * @returns                            TRUE if the request is off the period, and the timer has to be armed at NextDueTime. */
+BOOLEAN AemReadTimerAdvance(PAEM_READ_TIMER Timer, ULONGLONG Now, ULONGLONG NextDueTime);
+
+/** Called when the timer is cancelled, because no requests are left or the device is going away.
+ *
+ * @param Timer                        Timer. */
+VOID AemReadTimerStop(PAEM_READ_TIMER Timer);
+
+#endif // __AEM_READTIMER_H__
@@ -0,0 +1,204 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "ring.h"
+
+static VOID AemRingCountSpin(PAEM_RING Ring) {
+  if(Ring->Spins != NULL)
+    AemInterlockedIncrement(Ring->Spins);
+}
+
+/** @returns                           Offset of Tail from the position of the next slot to be claimed. */
+static ULONG AemRingTailOffset(PAEM_RING Ring) {
+  return Ring->Exclusive ? AEM_RING_LOCKED : 0;
+}
+
+VOID AemRingInit(PAEM_RING Ring, PAEM_RING_SLOT Slots, ULONG Capacity) {
+  ULONG i;
+
+  Ring->Slots = Slots;
+  Ring->Mask = Capacity - 1;
+  Ring->Head = 0;
+  Ring->Tail = 0;
+  Ring->Exclusive = 0;
+  Ring->Spins = NULL;
+  for(i = 0; i < Capacity; i++)
+    Ring->Slots[i].Sequence = (LONG) i;
+}
+
+ULONG AemRingCapacity(PAEM_RING Ring) {
+  return Ring->Mask + 1;
+}
+
+ULONG AemRingReserve(PAEM_RING Ring, ULONG Count, PULONG Position) {
+  LONG  tail, head;
+  ULONG used, free;
+
+  for(;;) {
+    tail = AemReadAcquire(&Ring->Tail);
+    head = AemReadAcquire(&Ring->Head);
+
+    /* Head may have been advanced past the tail we've read, retry with a fresh tail then. 
+     * Tail of a ring locked for exclusive access looks the same, so producers wait here until it is unlocked. */
+    used = (ULONG) (tail - head);
+    if(used > AemRingCapacity(Ring)) {
+      AemRingCountSpin(Ring);
+      AemYieldProcessor();
+      continue;
+    }
+
+    /* Consumer stores slot sequence before advancing head, so all positions below head + capacity 
+     * are free for producers once head is observed. */
+    free = AemRingCapacity(Ring) - used;
+    if(free == 0)
+      return 0;
+    if(Count > free)
+      Count = free;
+
+    if(AemInterlockedCompareExchange(&Ring->Tail, tail + (LONG) Count, tail) == tail) {
+      *Position = (ULONG) tail;
+      return Count;
+    }
+    AemRingCountSpin(Ring);
+  }
+}
+
+PAEM_MESSAGE AemRingSlot(PAEM_RING Ring, ULONG Position) {
+  return &Ring->Slots[Position & Ring->Mask].Message;
+}
+
+VOID AemRingCommit(PAEM_RING Ring, ULONG Position) {
+  AemWriteRelease(&Ring->Slots[Position & Ring->Mask].Sequence, (LONG) (Position + 1));
+}
+
+BOOLEAN AemRingPush(PAEM_RING Ring, PAEM_MESSAGE Message) {
+  ULONG position;
+
+  if(AemRingReserve(Ring, 1, &position) == 0)
+    return FALSE;
+
+  *AemRingSlot(Ring, position) = *Message;
+  AemRingCommit(Ring, position);
+  return TRUE;
+}
+
+PAEM_MESSAGE AemRingPeek(PAEM_RING Ring, ULONG Offset) {
+  ULONG          position = (ULONG) Ring->Head + Offset;
+  PAEM_RING_SLOT slot = &Ring->Slots[position & Ring->Mask];
+
+  if(Offset > Ring->Mask || AemReadAcquire(&slot->Sequence) != (LONG) (position + 1))
+    return NULL;
+  return &slot->Message;
+}
+
+BOOLEAN AemRingPop(PAEM_RING Ring, PAEM_MESSAGE Message) {
+  ULONG          position = (ULONG) Ring->Head;
+  PAEM_RING_SLOT slot = &Ring->Slots[position & Ring->Mask];
+
+  if(AemReadAcquire(&slot->Sequence) != (LONG) (position + 1))
+    return FALSE;
+
+  if(Message != NULL)
+    *Message = slot->Message;
+
+  /* Hand the slot back to producers, then advance the head. */
+  AemWriteRelease(&slot->Sequence, (LONG) (position + AemRingCapacity(Ring)));
+  AemWriteRelease(&Ring->Head, (LONG) (position + 1));
+  return TRUE;
+}
+
+ULONG AemRingClear(PAEM_RING Ring) {
+  ULONG count = 0;
+
+  while(AemRingPop(Ring, NULL))
+    count++;
+  return count;
+}
+
+BOOLEAN AemRingIsEmpty(PAEM_RING Ring) {
+  return AemRingPeek(Ring, 0) == NULL;
+}
+
+ULONG AemRingSize(PAEM_RING Ring) {
+  LONG  head = AemReadAcquire(&Ring->Head);
+  LONG  tail = AemReadAcquire(&Ring->Tail);
+  ULONG size = (ULONG) (tail - head) - AemRingTailOffset(Ring);
+
+  /* Head may have been advanced past the tail we've read, or the ring may have been locked or unlocked meanwhile. */
+  return size > AemRingCapacity(Ring) ? 0 : size;
+}
+
+LONG AemRingTail(PAEM_RING Ring) {
+  return (LONG) ((ULONG) Ring->Tail - AemRingTailOffset(Ring));
+}
+
+VOID AemRingLockExclusive(PAEM_RING Ring) {
+  LONG  tail;
+  ULONG position;
+
+  /* Once Tail is moved, compare-exchanges of producers that have read it before fail. */
+  do {
+    tail = AemReadAcquire(&Ring->Tail);
+  } while(AemInterlockedCompareExchange(&Ring->Tail, (LONG) ((ULONG) tail + AEM_RING_LOCKED), tail) != tail);
+  Ring->Exclusive = 1;
+
+  /* Producers that got in before publish their slots & leave. */
+  for(position = (ULONG) Ring->Head; position != (ULONG) tail; position++) {
+    while(AemReadAcquire(&Ring->Slots[position & Ring->Mask].Sequence) != (LONG) (position + 1)) {
+      AemRingCountSpin(Ring);
+      AemYieldProcessor();
+    }
+  }
+}
+
+VOID AemRingUnlockExclusive(PAEM_RING Ring) {
+  LONG tail = AemRingTail(Ring);
+
+  Ring->Exclusive = 0;
+  AemWriteRelease(&Ring->Tail, tail);
+}
+
+VOID AemRingRelocate(PAEM_RING Ring, PAEM_RING_SLOT Slots, ULONG Capacity) {
+  ULONG size = AemRingSize(Ring);
+  ULONG mask = Capacity - 1;
+  ULONG base, i;
+
+  /* Producers may hold a stale tail, but none past the current one, so positions from past it are never reused. */
+  base = (ULONG) AemRingTail(Ring) + 1;
+  for(i = 0; i < Capacity; i++)
+    Slots[(base + i) & mask].Sequence = (LONG) (base + i);
+  for(i = 0; i < size; i++) {
+    Slots[(base + i) & mask].Message = *AemRingPeek(Ring, i);
+    Slots[(base + i) & mask].Sequence = (LONG) (base + i + 1);
+  }
+
+  Ring->Slots = Slots;
+  Ring->Mask = mask;
+  Ring->Head = (LONG) base;
+  AemWriteRelease(&Ring->Tail, (LONG) (base + size + AemRingTailOffset(Ring)));
+}
+
+VOID AemRingTruncate(PAEM_RING Ring, ULONG Size) {
+  ULONG head = (ULONG) Ring->Head;
+  ULONG tail = (ULONG) AemRingTail(Ring);
+  ULONG position;
+
+  /* Dropped slots become free again at their current positions. */
+  for(position = head + Size; position != tail; position++)
+    Ring->Slots[position & Ring->Mask].Sequence = (LONG) position;
+  AemWriteRelease(&Ring->Tail, (LONG) (head + Size + AemRingTailOffset(Ring)));
+}
@@ -0,0 +1,153 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_RING_H__
+#define __AEM_RING_H__
+
+#include "portable.h"
+#include "message.h"
+
+/** Offset of Tail while the ring is locked for exclusive access. */
+#define AEM_RING_LOCKED 0x80000000
+
+/* Bounded lock-free multi-producer / single-consumer ring of messages.
+ *
+ * Each slot carries a sequence number. A slot at position Pos is free for producers when its sequence 
+ * equals Pos, and holds a published message when its sequence equals Pos + 1. Producers claim positions 
+ * by advancing Tail with a compare-exchange, fill the slots and then publish them with a release store 
+ * of the sequence. The consumer reads a slot only after an acquire load of its sequence, 
+ * and hands it back to producers by storing Pos + Capacity.
+ *
+ * Producers may run concurrently with each other and with the consumer. Consumer-side 
+ * functions (AemRingPeek, AemRingPop, AemRingClear) must be serialized by the caller. 
+ *
+ * Operations that rearrange the storage (AemRingRelocate, AemRingTruncate) need exclusive access. 
+ * AemRingLockExclusive moves Tail half the position range away from Head, so producers take it for 
+ * a stale read and spin until AemRingUnlockExclusive, and then waits for the claimed slots to be published.
+ * Producers don't write anything but Tail and the slots, so there is no shared counter on the push path.
+ * The consumer is excluded by the caller's consumer lock. Both sides spin, so producers must not be 
+ * preempted while holding claimed slots. */
+
+typedef struct _AEM_RING_SLOT {
+  volatile LONG Sequence; /**< Slot state, see above. */
+  AEM_MESSAGE   Message;  /**< Message stored in the slot. */
+} AEM_RING_SLOT, *PAEM_RING_SLOT;
+
+typedef struct _AEM_RING {
+  PAEM_RING_SLOT Slots;  /**< Slot storage, Mask + 1 slots. */
+  ULONG          Mask;   /**< Capacity - 1, capacity is a power of two. */
+  volatile LONG  Head;   /**< Position of the next slot to be consumed. Written by consumer only. */
+  volatile LONG  Tail;   /**< Position of the next slot to be claimed by a producer. */
+  volatile LONG  Exclusive; /**< Non-zero while the ring is locked for exclusive access, Tail is offset by AEM_RING_LOCKED then. */
+  volatile LONG *Spins;  /**< Optional, incremented whenever a producer or the exclusive locker has to spin. */
+} AEM_RING, *PAEM_RING;
+
+/** Initializes an empty ring.
+ *
+ * @param Ring                         Ring to initialize.
+ * @param Slots                        Storage for Capacity slots.
+ * @param Capacity                     Number of slots, must be a power of two. */
+VOID AemRingInit(PAEM_RING Ring, PAEM_RING_SLOT Slots, ULONG Capacity);
+
+/** @param Ring                        Ring.
+ * @returns                            Capacity of the ring. */
+ULONG AemRingCapacity(PAEM_RING Ring);
+
+/** Claims up to Count consecutive free slots. Claimed slots must be filled via AemRingSlot and then
+ * published via AemRingCommit, in any order. The consumer won't see messages past an unpublished slot.
+ *
+ * @param Ring                         Ring.
+ * @param Count                        Number of slots to claim.
+ * @param Position                     (out) Position of the first claimed slot.
+ * @returns                            Number of claimed slots, zero if the ring is full. */
+ULONG AemRingReserve(PAEM_RING Ring, ULONG Count, PULONG Position);
+
+/** @param Ring                        Ring.
+ * @param Position                     Position of a claimed slot.
+ * @returns                            Pointer to the message storage of the slot. */
+PAEM_MESSAGE AemRingSlot(PAEM_RING Ring, ULONG Position);
+
+/** Publishes a previously claimed and filled slot to the consumer.
+ *
+ * @param Ring                         Ring.
+ * @param Position                     Position of a claimed slot. */
+VOID AemRingCommit(PAEM_RING Ring, ULONG Position);
+
+/** Pushes a single message.
+ *
+ * @param Ring                         Ring.
+ * @param Message                      Message to push.
+ * @returns                            FALSE if the ring is full, TRUE otherwise. */
+BOOLEAN AemRingPush(PAEM_RING Ring, PAEM_MESSAGE Message);
+
+/** Consumer side. Gets a published message without removing it from the ring.
+ *
+ * @param Ring                         Ring.
+ * @param Offset                       Offset of the message from the head of the ring.
+ * @returns                            Pointer to the message, or NULL if there is no published message at the given offset. */
+PAEM_MESSAGE AemRingPeek(PAEM_RING Ring, ULONG Offset);
+
+/** Consumer side. Removes a message from the head of the ring.
+ *
+ * @param Ring                         Ring.
+ * @param Message                      (out, optional) Removed message.
+ * @returns                            FALSE if there is no published message at the head of the ring, TRUE otherwise. */
+BOOLEAN AemRingPop(PAEM_RING Ring, PAEM_MESSAGE Message);
+
+/** Consumer side. Removes all published messages.
+ *
+ * @param Ring                         Ring.
+ * @returns                            Number of removed messages. */
+ULONG AemRingClear(PAEM_RING Ring);
+
+/** @param Ring                        Ring.
+ * @returns                            TRUE if there is no published message at the head of the ring. */
+BOOLEAN AemRingIsEmpty(PAEM_RING Ring);
+
+/** @param Ring                        Ring.
+ * @returns                            Number of claimed slots, including the ones not yet published. 
+ *                                     This is a snapshot and may be outdated by the time it is returned. */
+ULONG AemRingSize(PAEM_RING Ring);
+
+/** @param Ring                        Ring locked for exclusive access, or one with no producers running.
+ * @returns                            Position of the next slot to be claimed, as producers will see it once the ring is unlocked. */
+LONG AemRingTail(PAEM_RING Ring);
+
+/** Locks the ring for exclusive access. The caller must already exclude the consumer. 
+ * Waits for the producers to publish the slots they have claimed.
+ *
+ * @param Ring                         Ring. */
+VOID AemRingLockExclusive(PAEM_RING Ring);
+
+/** @param Ring                        Ring locked for exclusive access. */
+VOID AemRingUnlockExclusive(PAEM_RING Ring);
+
+/** Moves all messages into new slot storage. Requires exclusive access. Positions continue past the old tail, 
+ * so that a producer holding a stale tail can't claim a slot in the new storage.
+ *
+ * @param Ring                         Ring locked for exclusive access.
+ * @param Slots                        New storage for Capacity slots.
+ * @param Capacity                     New capacity, must be a power of two that is not less than AemRingSize(Ring). */
+VOID AemRingRelocate(PAEM_RING Ring, PAEM_RING_SLOT Slots, ULONG Capacity);
+
+/** Drops all messages except the first Size ones. Requires exclusive access.
+ *
+ * @param Ring                         Ring.
+ * @param Size                         Number of messages to keep, must not exceed the ring size. */
+VOID AemRingTruncate(PAEM_RING Ring, ULONG Size);
+
+#endif // __AEM_RING_H__
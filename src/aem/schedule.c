@@ -0,0 +1,115 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "schedule.h"
+
+/** @returns                           TRUE if entry A is due before entry B. */
+static BOOLEAN AemScheduleLess(PAEM_SCHEDULE_ENTRY A, PAEM_SCHEDULE_ENTRY B) {
+  if(A->DueTime != B->DueTime)
+    return A->DueTime < B->DueTime;
+  return (LONG) (A->Sequence - B->Sequence) < 0;
+}
+
+VOID AemScheduleInit(PAEM_SCHEDULE Schedule, PAEM_SCHEDULE_ENTRY Entries, ULONG Capacity) {
+  Schedule->Entries = Entries;
+  Schedule->Capacity = Capacity;
+  Schedule->Size = 0;
+  Schedule->NextSequence = 0;
+}
+
+BOOLEAN AemScheduleInsert(PAEM_SCHEDULE Schedule, ULONGLONG DueTime, PAEM_MESSAGE Message) {
+  AEM_SCHEDULE_ENTRY entry;
+  ULONG              i, parent;
+
+  if(Schedule->Size == Schedule->Capacity)
+    return FALSE;
+
+  entry.DueTime = DueTime;
+  entry.Sequence = Schedule->NextSequence++;
+  entry.Message = *Message;
+
+  /* Sift up. */
+  for(i = Schedule->Size++; i > 0; i = parent) {
+    parent = (i - 1) / 2;
+    if(!AemScheduleLess(&entry, &Schedule->Entries[parent]))
+      break;
+    Schedule->Entries[i] = Schedule->Entries[parent];
+  }
+  Schedule->Entries[i] = entry;
+  return TRUE;
+}
+
+PAEM_SCHEDULE_ENTRY AemScheduleMin(PAEM_SCHEDULE Schedule) {
+  return Schedule->Size == 0 ? NULL : &Schedule->Entries[0];
+}
+
+VOID AemSchedulePop(PAEM_SCHEDULE Schedule, PAEM_MESSAGE Message) {
+  PAEM_SCHEDULE_ENTRY last;
+  ULONG               i, child;
+
+  if(Message != NULL)
+    *Message = Schedule->Entries[0].Message;
+
+  /* Sift the last entry down from the root. */
+  last = &Schedule->Entries[--Schedule->Size];
+  for(i = 0; (child = 2 * i + 1) < Schedule->Size; i = child) {
+    if(child + 1 < Schedule->Size && AemScheduleLess(&Schedule->Entries[child + 1], &Schedule->Entries[child]))
+      child++;
+    if(!AemScheduleLess(&Schedule->Entries[child], last))
+      break;
+    Schedule->Entries[i] = Schedule->Entries[child];
+  }
+  Schedule->Entries[i] = *last;
+}
+
+VOID AemScheduleClear(PAEM_SCHEDULE Schedule) {
+  Schedule->Size = 0;
+}
+
+BOOLEAN AemScheduleIsValidBatch(PAEM_TIMED_BATCH_FEATURE_REPORT Batch, ULONG BufferLength) {
+  if(BufferLength < AEM_TIMED_BATCH_FEATURE_REPORT_SIZE(0))
+    return FALSE;
+  if(Batch->Count > AEM_MAX_TIMED_BATCH_SIZE)
+    return FALSE;
+  return BufferLength >= AEM_TIMED_BATCH_FEATURE_REPORT_SIZE(Batch->Count);
+}
+
+ULONG AemScheduleBatch(PAEM_SCHEDULE Schedule, PAEM_TIMED_BATCH_FEATURE_REPORT Batch, ULONGLONG StartTime) {
+  PAEM_TIMED_ENTRY entry;
+  AEM_MESSAGE      message;
+  ULONGLONG        dueTime = StartTime;
+  ULONG            i;
+
+  for(i = 0; i < Batch->Count; i++) {
+    entry = &Batch->Entries[i];
+    if(entry->Flags & AEM_TIMED_FROM_START)
+      dueTime = StartTime + 10 * (ULONGLONG) entry->Time; /* In 100 ns. */
+    else
+      dueTime = dueTime + 10 * (ULONGLONG) entry->Time;
+
+    if(entry->Flags & AEM_TIMED_WAIT)
+      continue;
+
+    message.Kind = AEM_MESSAGE_MOVE;
+    message.IsRelative = !(entry->Flags & AEM_TIMED_ABSOLUTE);
+    message.Buttons = entry->Buttons;
+    message.Point = entry->Point;
+    if(!AemScheduleInsert(Schedule, dueTime, &message))
+      break;
+  }
+  return i;
+}
@@ -0,0 +1,87 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_SCHEDULE_H__
+#define __AEM_SCHEDULE_H__
+
+#include "portable.h"
+#include "common.h"
+#include "message.h"
+
+/* Binary min-heap of messages ordered by due time. Messages with equal due times 
+ * are ordered by insertion. All functions must be serialized by the caller. */
+
+typedef struct _AEM_SCHEDULE_ENTRY {
+  ULONGLONG   DueTime;  /**< Due time, in caller-defined units. */
+  ULONG       Sequence; /**< Insertion number, breaks ties between equal due times. */
+  AEM_MESSAGE Message;  /**< Scheduled message. */
+} AEM_SCHEDULE_ENTRY, *PAEM_SCHEDULE_ENTRY;
+
+typedef struct _AEM_SCHEDULE {
+  PAEM_SCHEDULE_ENTRY Entries;      /**< Heap storage. */
+  ULONG               Capacity;     /**< Number of entries in heap storage. */
+  ULONG               Size;         /**< Number of scheduled messages. */
+  ULONG               NextSequence; /**< Insertion number for the next message. */
+} AEM_SCHEDULE, *PAEM_SCHEDULE;
+
+/** Initializes an empty schedule.
+ *
+ * @param Schedule                     Schedule to initialize.
+ * @param Entries                      Storage for Capacity entries.
+ * @param Capacity                     Maximal number of scheduled messages. */
+VOID AemScheduleInit(PAEM_SCHEDULE Schedule, PAEM_SCHEDULE_ENTRY Entries, ULONG Capacity);
+
+/** Schedules a message.
+ *
+ * @param Schedule                     Schedule.
+ * @param DueTime                      Due time of the message.
+ * @param Message                      Message.
+ * @returns                            FALSE if the schedule is full, TRUE otherwise. */
+BOOLEAN AemScheduleInsert(PAEM_SCHEDULE Schedule, ULONGLONG DueTime, PAEM_MESSAGE Message);
+
+/** @param Schedule                    Schedule.
+ * @returns                            Entry with the earliest due time, or NULL if the schedule is empty. */
+PAEM_SCHEDULE_ENTRY AemScheduleMin(PAEM_SCHEDULE Schedule);
+
+/** Removes the entry with the earliest due time.
+ *
+ * @param Schedule                     Non-empty schedule.
+ * @param Message                      (out, optional) Removed message. */
+VOID AemSchedulePop(PAEM_SCHEDULE Schedule, PAEM_MESSAGE Message);
+
+/** Removes all scheduled messages.
+ *
+ * @param Schedule                     Schedule. */
+VOID AemScheduleClear(PAEM_SCHEDULE Schedule);
+
+/** Checks that a timed batch report received in a buffer of the given length is well-formed.
+ *
+ * @param Batch                        Timed batch report.
+ * @param BufferLength                 Length of the buffer holding the report, in bytes.
+ * @returns                            TRUE if the report is well-formed, FALSE otherwise. */
+BOOLEAN AemScheduleIsValidBatch(PAEM_TIMED_BATCH_FEATURE_REPORT Batch, ULONG BufferLength);
+
+/** Schedules the moves of a timed batch report. Due times are computed from the batch timeline,
+ * so they don't depend on when the report arrives. Stops at the first move that doesn't fit.
+ *
+ * @param Schedule                     Schedule.
+ * @param Batch                        Well-formed timed batch report.
+ * @param StartTime                    Due time of the sequence start, in 100 ns.
+ * @returns                            Number of leading batch entries that were consumed. */
+ULONG AemScheduleBatch(PAEM_SCHEDULE Schedule, PAEM_TIMED_BATCH_FEATURE_REPORT Batch, ULONGLONG StartTime);
+
+#endif // __AEM_SCHEDULE_H__
@@ -0,0 +1,72 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "trace.h"
+
+VOID AemTraceInit(PAEM_TRACE Trace, PAEM_TRACE_EVENT Events, ULONG Capacity) {
+  RtlZeroMemory(Events, Capacity * sizeof(AEM_TRACE_EVENT));
+  Trace->Events = Events;
+  Trace->Mask = Capacity - 1;
+  Trace->Position = 0;
+}
+
+VOID AemTraceWrite(PAEM_TRACE Trace, ULONGLONG Time, UCHAR Kind, DWORD32 Arg1, DWORD32 Arg2) {
+  PAEM_TRACE_EVENT event;
+  ULONG            position;
+
+  position = (ULONG) AemInterlockedIncrement(&Trace->Position) - 1;
+  event = &Trace->Events[position & Trace->Mask];
+  event->Kind = Kind;
+  event->Time = Time;
+  event->Arg1 = Arg1;
+  event->Arg2 = Arg2;
+  AemWriteRelease(&event->Sequence, position + 1);
+}
+
+ULONG AemTraceRead(PAEM_TRACE Trace, PULONG First, PULONG Next, PAEM_TRACE_EVENT Events, ULONG Count) {
+  PAEM_TRACE_EVENT event;
+  ULONG            next, oldest, position, sequence, copied = 0;
+
+  next = (ULONG) AemReadAcquire(&Trace->Position);
+  oldest = next > Trace->Mask + 1 ? next - Trace->Mask - 1 : 0;
+  if(*First - oldest > next - oldest)
+    *First = oldest;
+  *Next = next;
+
+  position = *First;
+  while(position != next && copied < Count) {
+    event = &Trace->Events[position & Trace->Mask];
+    sequence = (ULONG) AemReadAcquire(&event->Sequence);
+    if((LONG) (sequence - position - 1) < 0)
+      break; /* Still being written, it is read next time. */
+    RtlCopyMemory(&Events[copied], event, sizeof(AEM_TRACE_EVENT));
+
+    /* Slot is reused only after a writer claims the position one lap ahead. */
+    AemMemoryBarrier();
+    if(sequence == position + 1 && (ULONG) AemReadAcquire(&Trace->Position) - position <= Trace->Mask + 1) {
+      copied++;
+      position++;
+      continue;
+    }
+
+    /* Writers have lapped us, skip to the events that are still there. */
+    if(copied != 0)
+      break;
+    *First = ++position;
+  }
+  return copied;
+}
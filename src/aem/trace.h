@@ -0,0 +1,77 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_TRACE_H__
+#define __AEM_TRACE_H__
+
+#include "portable.h"
+#include "common.h"
+
+/* Fixed-size ring of compact binary events, cheap enough to be always on. Older events are overwritten.
+ *
+ * Writers claim a position with a single interlocked increment and never wait for each other. Each event carries
+ * its position plus one, written last with a release store, so that a reader can tell a complete event from one
+ * that is still being written. Readers copy the event and then check that no writer has claimed its slot
+ * for a newer event in the meantime, so writers pay for nothing but the increment. */
+
+typedef struct _AEM_TRACE {
+  PAEM_TRACE_EVENT Events;   /**< Event storage, Mask + 1 events. */
+  ULONG            Mask;     /**< Capacity - 1, capacity is a power of two. */
+  volatile LONG    Position; /**< Position of the next event to be written. */
+} AEM_TRACE, *PAEM_TRACE;
+
+/** Trace dump file, as written by AemSaveTrace and read by aemtrace: a header followed by Count events in sequence order. */
+#define AEM_TRACE_FILE_MAGIC   0x544D4541 /**< "AEMT". */
+#define AEM_TRACE_FILE_VERSION 1
+
+typedef struct _AEM_TRACE_FILE_HEADER {
+  DWORD32   Magic;   /**< AEM_TRACE_FILE_MAGIC. */
+  DWORD32   Version; /**< AEM_TRACE_FILE_VERSION. */
+  DWORD32   Count;   /**< Number of events that follow. */
+  DWORD32   Lost;    /**< Number of events that were overwritten before they could be read. */
+  ULONGLONG Now;     /**< Interrupt time when the dump was taken, in 100 ns. */
+} AEM_TRACE_FILE_HEADER, *PAEM_TRACE_FILE_HEADER;
+
+/** Initializes an empty trace.
+ *
+ * @param Trace                        Trace to initialize.
+ * @param Events                       Storage for Capacity events.
+ * @param Capacity                     Number of events, must be a power of two. */
+VOID AemTraceInit(PAEM_TRACE Trace, PAEM_TRACE_EVENT Events, ULONG Capacity);
+
+/** Appends an event to the trace. Can be called concurrently from any number of threads, at any IRQL up to DISPATCH_LEVEL.
+ *
+ * @param Trace                        Trace.
+ * @param Time                         Interrupt time of the event, in 100 ns.
+ * @param Kind                         AEM_TRACE_XXX.
+ * @param Arg1                         Kind-specific argument.
+ * @param Arg2                         Kind-specific argument. */
+VOID AemTraceWrite(PAEM_TRACE Trace, ULONGLONG Time, UCHAR Kind, DWORD32 Arg1, DWORD32 Arg2);
+
+/** Copies consecutive events out of the trace, starting at the given sequence number. Can run concurrently with writers.
+ * Stops at the first event that is still being written.
+ *
+ * @param Trace                        Trace.
+ * @param First                        (in/out) Sequence number of the first event to copy. On return, sequence number of 
+ *                                     the first event copied, which is the oldest one kept if the requested one was overwritten.
+ * @param Next                         (out) Sequence number the next event will get.
+ * @param Events                       (out) Buffer for Count events.
+ * @param Count                        Maximal number of events to copy.
+ * @returns                            Number of events copied. */
+ULONG AemTraceRead(PAEM_TRACE Trace, PULONG First, PULONG Next, PAEM_TRACE_EVENT Events, ULONG Count);
+
+#endif // __AEM_TRACE_H__
@@ -0,0 +1,868 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim.h"
+#include "request.h"
+
+/* Benchmarks of the driver core running on the simulated platform, and of the aemctl request path
+ * running against a null transport.
+ *
+ * Every result is printed as a "<name> <value> <unit>" line, and all of them are lower-is-better.
+ * Throughput results are measured in wall time and depend on the machine. Latency & jitter results
+ * are measured in virtual time against a simulated hidclass consumer, so they are deterministic.
+ * Only the deterministic results are compared against the baseline by default, wall time results 
+ * are compared on request with a separate tolerance. */
+
+/** Number of queue fills measured by the enqueue & dequeue benchmarks. */
+#define AEM_BENCH_ROUNDS 1000
+
+/** Wall time benchmarks are repeated, and the best result is taken to filter out scheduling noise. */
+#define AEM_BENCH_REPEATS 7
+
+/** Number of moves sent to the full queue in each round of the rejection benchmark. */
+#define AEM_BENCH_REJECTED_MOVES 64
+
+/** Number of producer threads & moves sent by each of them in the concurrent enqueue benchmark. */
+#define AEM_BENCH_PRODUCER_COUNT 4
+#define AEM_BENCH_PRODUCER_MOVES 250000
+
+/** Number of requests sent through the aemctl request path, split between the threads, and the maximal number of threads. */
+#define AEM_BENCH_REQUESTS 2000000
+#define AEM_BENCH_MAX_REQUEST_THREADS 8
+
+/** Number of moves sent in the latency benchmark, and their mean interarrival time, in 100 ns. */
+#define AEM_BENCH_LATENCY_MOVES 20000
+#define AEM_BENCH_LATENCY_INTERARRIVAL 100000
+
+/** Number of read Irps hidclass keeps pending, and the maximal time it takes to send a completed one back, in 100 ns. */
+#define AEM_BENCH_PENDING_READS 2
+#define AEM_BENCH_MAX_TURNAROUND 2000
+
+#define AEM_BENCH_MAX_RESULTS 32
+
+typedef struct _AEM_BENCH_RESULT {
+  char    Name[64];
+  double  Value;
+  char    Unit[16];
+  BOOLEAN IsWallTime; /**< Result is measured in wall time, so it can't be compared across machines. */
+} AEM_BENCH_RESULT, *PAEM_BENCH_RESULT;
+
+static AEM_BENCH_RESULT Results[AEM_BENCH_MAX_RESULTS];
+static int              ResultCount = 0;
+
+/** Number of runs that lost or reordered moves. Such a run fails the benchmark whatever its timings. */
+static int              Failures = 0;
+
+static void AddResult(const char *name, double value, const char *unit, BOOLEAN isWallTime) {
+  PAEM_BENCH_RESULT result = &Results[ResultCount++];
+  snprintf(result->Name, sizeof(result->Name), "%s", name);
+  snprintf(result->Unit, sizeof(result->Unit), "%s", unit);
+  result->Value = value;
+  result->IsWallTime = isWallTime;
+  printf("%s %.3f %s\n", name, value, unit);
+  fflush(stdout);
+}
+
+static double WallTime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** Deterministic generator, so that latency results don't change from run to run. */
+static ULONG Random(ULONG *state) {
+  *state = *state * 1103515245 + 12345;
+  return (*state >> 8) & 0xFFFFFF;
+}
+
+static ULONGLONG RandomExponential(ULONG *state, ULONGLONG mean) {
+  double u = (Random(state) + 1.0) / (0xFFFFFF + 2.0);
+  return (ULONGLONG) (-log1p(-u) * mean);
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static double Percentile(double *values, size_t count, double q) {
+  return count == 0 ? 0 : values[(size_t) (q * (count - 1))];
+}
+
+static double Best(double (*benchmark)(void)) {
+  double best = 0, value;
+  int    i;
+
+  for(i = 0; i < AEM_BENCH_REPEATS; i++) {
+    value = benchmark();
+    if(i == 0 || value < best)
+      best = value;
+  }
+  return best;
+}
+
+static NTSTATUS GetFeature(PAEM_SIM_DEVICE device, PVOID report, ULONG size) {
+  HID_XFER_PACKET packet;
+  packet.reportBuffer = (PUCHAR) report;
+  packet.reportBufferLen = size;
+  packet.reportId = AEM_CONTROL_REPORT_ID;
+  return AemSimGetFeature(device, &packet);
+}
+
+static void SendMove(PAEM_SIM_DEVICE device, SHORT x, SHORT y, UCHAR flags) {
+  AEM_MOVE_FEATURE_REPORT report;
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_MOVE;
+  report.Buttons = 0;
+  report.Point.X = x;
+  report.Point.Y = y;
+  report.Flags = flags;
+  GetFeature(device, &report, sizeof(report));
+}
+
+static void ClearQueue(PAEM_SIM_DEVICE device) {
+  AEM_FEATURE_REPORT report;
+  report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.ControlCode = AEM_CONTROL_CODE_CLEAR_QUEUE;
+  GetFeature(device, &report, sizeof(report));
+}
+
+static void SetPacing(PAEM_SIM_DEVICE device, PAEM_PACING pacing) {
+  AEM_PACING_FEATURE_REPORT report;
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_PACING;
+  report.Flags = AEM_PACING_UPDATE | AEM_PACING_ENABLED;
+  report.MinInterval = pacing->MinInterval;
+  report.MaxInterval = pacing->MaxInterval;
+  report.TargetDepth = pacing->TargetDepth;
+  GetFeature(device, &report, sizeof(report));
+}
+
+/** Takes a message & packs a report the same way AemCoreCompleteRead does, bypassing the platform. */
+static BOOLEAN DequeueReport(PAEM_CORE core, PUCHAR report) {
+  AEM_MESSAGE    message;
+  BOOLEAN        isDequeued;
+  AEM_LOCK_STATE lockState;
+
+  AemLockAcquire(&core->ConsumerLock, &lockState);
+  isDequeued = AemCoreDequeue(core, &message);
+  AemLockRelease(&core->ConsumerLock, lockState);
+  if(isDequeued)
+    AemCorePackReport(&message, report);
+  return isDequeued;
+}
+
+static double BenchEnqueueSingle(void) {
+  AEM_SIM_DEVICE device;
+  ULONG          capacity, round, i;
+  double         start, elapsed = 0;
+
+  AemSimInit(&device, NULL, NULL);
+  capacity = device.Core.InfoReport.MessageQueueCapacity;
+  for(round = 0; round < AEM_BENCH_ROUNDS; round++) {
+    start = WallTime();
+    for(i = 0; i < capacity; i++)
+      SendMove(&device, 1, 1, 0);
+    elapsed += WallTime() - start;
+    ClearQueue(&device);
+  }
+  AemSimFree(&device);
+  return elapsed / ((double) AEM_BENCH_ROUNDS * capacity);
+}
+
+static double BenchEnqueueBatch(void) {
+  AEM_SIM_DEVICE           device;
+  AEM_BATCH_FEATURE_REPORT batch;
+  ULONG                    capacity, round, i;
+  double                   start, elapsed = 0;
+
+  AemSimInit(&device, NULL, NULL);
+  capacity = device.Core.InfoReport.MessageQueueCapacity;
+  for(round = 0; round < AEM_BENCH_ROUNDS; round++) {
+    start = WallTime();
+    for(i = 0; i < capacity; i += AEM_MAX_BATCH_SIZE) {
+      AemBatchInit(&batch);
+      while(AemBatchAppend(&batch, TRUE, 0, 1, 1))
+        ;
+      GetFeature(&device, &batch, AemBatchSize(&batch));
+    }
+    elapsed += WallTime() - start;
+    ClearQueue(&device);
+  }
+  AemSimFree(&device);
+  return elapsed / ((double) AEM_BENCH_ROUNDS * capacity);
+}
+
+typedef struct _AEM_BENCH_PRODUCERS {
+  AEM_SIM_DEVICE  Device;
+  volatile LONG   RunningProducers;
+  volatile LONG   NextProducer;
+} AEM_BENCH_PRODUCERS, *PAEM_BENCH_PRODUCERS;
+
+static void *ProducerThread(void *context) {
+  PAEM_BENCH_PRODUCERS producers = (PAEM_BENCH_PRODUCERS) context;
+  ULONG                i;
+
+  /* Alternate buttons, so that compaction of a full queue can hardly merge the moves. */
+  for(i = 0; i < AEM_BENCH_PRODUCER_MOVES; i++) {
+    AEM_MOVE_FEATURE_REPORT report;
+    report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+    report.Buttons = (UCHAR) (i & 1);
+    report.Point.X = 1;
+    report.Point.Y = 1;
+    report.Flags = 0;
+
+    /* Queue is full, retry until the consumer makes room. */
+    for(;;) {
+      report.Report.ControlCode = AEM_CONTROL_CODE_MOVE;
+      GetFeature(&producers->Device, &report, sizeof(report));
+      if(report.Report.ControlCode != AEM_CONTROL_CODE_ERROR)
+        break;
+      AemYieldProcessor();
+    }
+  }
+  AemInterlockedDecrement(&producers->RunningProducers);
+  return NULL;
+}
+
+static double BenchEnqueueConcurrent(void) {
+  static AEM_BENCH_PRODUCERS producers;
+  pthread_t                  threads[AEM_BENCH_PRODUCER_COUNT];
+  UCHAR                      report[AEM_INPUT_REPORT_SIZE + 1];
+  ULONGLONG                  dequeued = 0;
+  double                     start, elapsed;
+  int                        i;
+
+  AemSimInit(&producers.Device, NULL, NULL);
+  producers.RunningProducers = AEM_BENCH_PRODUCER_COUNT;
+  start = WallTime();
+  for(i = 0; i < AEM_BENCH_PRODUCER_COUNT; i++)
+    pthread_create(&threads[i], NULL, ProducerThread, &producers);
+
+  /* Consumer runs on this thread, as the timer DPC would. */
+  while(AemReadAcquire(&producers.RunningProducers) != 0 || !AemCoreIsQueueEmpty(&producers.Device.Core))
+    if(DequeueReport(&producers.Device.Core, report))
+      dequeued++;
+    else
+      AemYieldProcessor();
+
+  for(i = 0; i < AEM_BENCH_PRODUCER_COUNT; i++)
+    pthread_join(threads[i], NULL);
+  elapsed = WallTime() - start;
+  /* Moves of different producers can still end up next to each other & get merged when the queue is full. */
+  dequeued += producers.Device.Core.MergedCount;
+  if(dequeued != (ULONGLONG) AEM_BENCH_PRODUCER_COUNT * AEM_BENCH_PRODUCER_MOVES) {
+    Failures++;
+    fprintf(stderr, "enqueue_concurrent: %llu of %llu moves dequeued or merged\n", (unsigned long long) dequeued, (unsigned long long) AEM_BENCH_PRODUCER_COUNT * AEM_BENCH_PRODUCER_MOVES);
+  }
+  AemSimFree(&producers.Device);
+  return elapsed / ((double) AEM_BENCH_PRODUCER_COUNT * AEM_BENCH_PRODUCER_MOVES);
+}
+
+static void *ChannelProducerThread(void *context) {
+  PAEM_BENCH_PRODUCERS producers = (PAEM_BENCH_PRODUCERS) context;
+  PAEM_CHANNEL_PAGE    page = &producers->Device.ChannelPage;
+  UCHAR                index = (UCHAR) (AemInterlockedIncrement(&producers->NextProducer) - 1);
+  AEM_MOVE_ENTRY       entry;
+  ULONG                i;
+
+  /* Moves are absolute and carry the producer index & their number, so that the consumer can check their order. */
+  entry.Flags = AEM_MOVE_ABSOLUTE;
+  entry.Buttons = index;
+  entry.Point.Y = 0;
+  for(i = 0; i < AEM_BENCH_PRODUCER_MOVES; i++) {
+    entry.Point.X = (SHORT) (i & 0x7FFF);
+
+    /* Channel is full, retry until the consumer makes room. */
+    while(AemChannelWrite(page, &entry, 1) == 0)
+      AemYieldProcessor();
+
+    if(AemChannelNeedsWake(page)) {
+      AEM_CHANNEL_FEATURE_REPORT report;
+      report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+      report.Report.ControlCode = AEM_CONTROL_CODE_CHANNEL;
+      report.Flags = AEM_CHANNEL_WAKE;
+      GetFeature(&producers->Device, &report, sizeof(report));
+    }
+  }
+  AemInterlockedDecrement(&producers->RunningProducers);
+  return NULL;
+}
+
+static double BenchEnqueueChannel(void) {
+  static AEM_BENCH_PRODUCERS producers;
+  pthread_t                  threads[AEM_BENCH_PRODUCER_COUNT];
+  UCHAR                      report[AEM_INPUT_REPORT_SIZE + 1];
+  ULONG                      expected[AEM_BENCH_PRODUCER_COUNT] = {0};
+  ULONGLONG                  dequeued = 0, misordered = 0;
+  SHORT_POINT                point;
+  double                     start, elapsed;
+  int                        i;
+
+  AemSimInit(&producers.Device, NULL, NULL);
+  producers.RunningProducers = AEM_BENCH_PRODUCER_COUNT;
+  producers.NextProducer = 0;
+  start = WallTime();
+  for(i = 0; i < AEM_BENCH_PRODUCER_COUNT; i++)
+    pthread_create(&threads[i], NULL, ChannelProducerThread, &producers);
+
+  /* Consumer drains the channel into the message queue as it dequeues. */
+  while(AemReadAcquire(&producers.RunningProducers) != 0 || !AemCoreIsQueueEmpty(&producers.Device.Core)) {
+    if(!DequeueReport(&producers.Device.Core, report)) {
+      AemYieldProcessor();
+      continue;
+    }
+    RtlCopyMemory(&point, report + 2, sizeof(point));
+    if(report[1] >= AEM_BENCH_PRODUCER_COUNT || point.X != (SHORT) (expected[report[1]] & 0x7FFF))
+      misordered++;
+    else
+      expected[report[1]]++;
+    dequeued++;
+  }
+
+  for(i = 0; i < AEM_BENCH_PRODUCER_COUNT; i++)
+    pthread_join(threads[i], NULL);
+  elapsed = WallTime() - start;
+  if(dequeued != (ULONGLONG) AEM_BENCH_PRODUCER_COUNT * AEM_BENCH_PRODUCER_MOVES || misordered != 0) {
+    Failures++;
+    fprintf(stderr, "enqueue_channel: %llu of %llu moves dequeued, %llu out of order\n", (unsigned long long) dequeued, 
+            (unsigned long long) AEM_BENCH_PRODUCER_COUNT * AEM_BENCH_PRODUCER_MOVES, (unsigned long long) misordered);
+  }
+  AemSimFree(&producers.Device);
+  return elapsed / ((double) AEM_BENCH_PRODUCER_COUNT * AEM_BENCH_PRODUCER_MOVES);
+}
+
+/** Queue guarded by a spin lock, the way the message queue was kept before AEM_RING. Baseline for the ring. */
+typedef struct _AEM_BENCH_LOCKED_QUEUE {
+  AEM_LOCK    Lock;
+  AEM_MESSAGE Messages[AEM_DEFAULT_MESSAGE_QUEUE_SIZE];
+  ULONG       Head;
+  ULONG       Size;
+} AEM_BENCH_LOCKED_QUEUE, *PAEM_BENCH_LOCKED_QUEUE;
+
+typedef struct _AEM_BENCH_MPSC {
+  AEM_RING               Ring;
+  AEM_RING_SLOT          Slots[AEM_DEFAULT_MESSAGE_QUEUE_SIZE];
+  AEM_BENCH_LOCKED_QUEUE Queue;
+  BOOLEAN                IsLocked;         /**< Use Queue instead of Ring. */
+  volatile LONG          RunningProducers;
+  volatile LONG          NextProducer;
+} AEM_BENCH_MPSC, *PAEM_BENCH_MPSC;
+
+static BOOLEAN LockedQueuePush(PAEM_BENCH_LOCKED_QUEUE queue, PAEM_MESSAGE message) {
+  AEM_LOCK_STATE lockState;
+  BOOLEAN        isPushed = FALSE;
+
+  AemLockAcquire(&queue->Lock, &lockState);
+  if(queue->Size < AEM_DEFAULT_MESSAGE_QUEUE_SIZE) {
+    queue->Messages[(queue->Head + queue->Size) % AEM_DEFAULT_MESSAGE_QUEUE_SIZE] = *message;
+    queue->Size++;
+    isPushed = TRUE;
+  }
+  AemLockRelease(&queue->Lock, lockState);
+  return isPushed;
+}
+
+static BOOLEAN LockedQueuePop(PAEM_BENCH_LOCKED_QUEUE queue, PAEM_MESSAGE message) {
+  AEM_LOCK_STATE lockState;
+  BOOLEAN        isPopped = FALSE;
+
+  AemLockAcquire(&queue->Lock, &lockState);
+  if(queue->Size != 0) {
+    *message = queue->Messages[queue->Head];
+    queue->Head = (queue->Head + 1) % AEM_DEFAULT_MESSAGE_QUEUE_SIZE;
+    queue->Size--;
+    isPopped = TRUE;
+  }
+  AemLockRelease(&queue->Lock, lockState);
+  return isPopped;
+}
+
+static void *MpscProducerThread(void *context) {
+  PAEM_BENCH_MPSC mpsc = (PAEM_BENCH_MPSC) context;
+  AEM_MESSAGE     message;
+  ULONG           i;
+
+  RtlZeroMemory(&message, sizeof(message));
+  message.Kind = AEM_MESSAGE_MOVE;
+  message.Buttons = (UCHAR) (AemInterlockedIncrement(&mpsc->NextProducer) - 1);
+  for(i = 0; i < AEM_BENCH_PRODUCER_MOVES; i++) {
+    message.Duration = i;
+    if(mpsc->IsLocked) {
+      while(!LockedQueuePush(&mpsc->Queue, &message))
+        AemYieldProcessor();
+    } else {
+      while(!AemRingPush(&mpsc->Ring, &message))
+        AemYieldProcessor();
+    }
+  }
+  AemInterlockedDecrement(&mpsc->RunningProducers);
+  return NULL;
+}
+
+/** Pushes messages from several producers through a bare ring or a spin-locked queue, without the rest of the core. */
+static double BenchMpsc(BOOLEAN isLocked) {
+  static AEM_BENCH_MPSC mpsc;
+  pthread_t             threads[AEM_BENCH_PRODUCER_COUNT];
+  ULONG                 expected[AEM_BENCH_PRODUCER_COUNT] = {0};
+  ULONGLONG             popped = 0, misordered = 0;
+  AEM_MESSAGE           message;
+  BOOLEAN               isPopped;
+  double                start, elapsed;
+  int                   i;
+
+  AemRingInit(&mpsc.Ring, mpsc.Slots, AEM_DEFAULT_MESSAGE_QUEUE_SIZE);
+  AemLockInit(&mpsc.Queue.Lock);
+  mpsc.Queue.Head = 0;
+  mpsc.Queue.Size = 0;
+  mpsc.IsLocked = isLocked;
+  mpsc.RunningProducers = AEM_BENCH_PRODUCER_COUNT;
+  mpsc.NextProducer = 0;
+  start = WallTime();
+  for(i = 0; i < AEM_BENCH_PRODUCER_COUNT; i++)
+    pthread_create(&threads[i], NULL, MpscProducerThread, &mpsc);
+
+  for(;;) {
+    isPopped = isLocked ? LockedQueuePop(&mpsc.Queue, &message) : AemRingPop(&mpsc.Ring, &message);
+    if(!isPopped) {
+      if(AemReadAcquire(&mpsc.RunningProducers) == 0 && (isLocked ? mpsc.Queue.Size == 0 : AemRingIsEmpty(&mpsc.Ring)))
+        break;
+      AemYieldProcessor();
+      continue;
+    }
+    if(message.Buttons >= AEM_BENCH_PRODUCER_COUNT || message.Duration != expected[message.Buttons])
+      misordered++;
+    else
+      expected[message.Buttons]++;
+    popped++;
+  }
+
+  for(i = 0; i < AEM_BENCH_PRODUCER_COUNT; i++)
+    pthread_join(threads[i], NULL);
+  elapsed = WallTime() - start;
+  if(popped != (ULONGLONG) AEM_BENCH_PRODUCER_COUNT * AEM_BENCH_PRODUCER_MOVES || misordered != 0) {
+    Failures++;
+    fprintf(stderr, "%s: %llu of %llu messages popped, %llu out of order\n", isLocked ? "enqueue_locked_mpsc" : "enqueue_ring_mpsc",
+            (unsigned long long) popped, (unsigned long long) AEM_BENCH_PRODUCER_COUNT * AEM_BENCH_PRODUCER_MOVES, (unsigned long long) misordered);
+  }
+  return elapsed / ((double) AEM_BENCH_PRODUCER_COUNT * AEM_BENCH_PRODUCER_MOVES);
+}
+
+static double BenchRingMpsc(void) {
+  return BenchMpsc(FALSE);
+}
+
+static double BenchLockedMpsc(void) {
+  return BenchMpsc(TRUE);
+}
+
+/** Compacts a full queue of relative moves, with a button transition every few moves as in a drag. */
+static double BenchCompact(void) {
+  static AEM_RING_SLOT slots[AEM_DEFAULT_MESSAGE_QUEUE_SIZE];
+  AEM_RING             ring;
+  AEM_MESSAGE          message;
+  ULONG                round, i;
+  double               start, elapsed = 0;
+
+  RtlZeroMemory(&message, sizeof(message));
+  message.Kind = AEM_MESSAGE_MOVE;
+  message.IsRelative = TRUE;
+  message.Point.X = 3;
+  message.Point.Y = -2;
+  AemRingInit(&ring, slots, AEM_DEFAULT_MESSAGE_QUEUE_SIZE);
+  for(round = 0; round < AEM_BENCH_ROUNDS; round++) {
+    for(i = 0; i < AEM_DEFAULT_MESSAGE_QUEUE_SIZE; i++) {
+      message.Buttons = (UCHAR) ((i / 16) & 1);
+      AemRingPush(&ring, &message);
+    }
+    start = WallTime();
+    AemCoalesceRing(&ring);
+    elapsed += WallTime() - start;
+    AemRingClear(&ring);
+  }
+  return elapsed / ((double) AEM_BENCH_ROUNDS * AEM_DEFAULT_MESSAGE_QUEUE_SIZE);
+}
+
+static double BenchRejectFull(void) {
+  AEM_SIM_DEVICE device;
+  ULONG          capacity, round, i;
+  double         start, elapsed = 0;
+
+  /* Alternating motion modes can't be merged, so every move sent to the full queue is rejected. */
+  AemSimInit(&device, NULL, NULL);
+  capacity = device.Core.InfoReport.MessageQueueCapacity;
+  for(i = 0; i < capacity; i++)
+    SendMove(&device, 1, 1, (UCHAR) (i & 1 ? AEM_MOVE_ABSOLUTE : 0));
+  for(round = 0; round < AEM_BENCH_ROUNDS; round++) {
+    start = WallTime();
+    for(i = 0; i < AEM_BENCH_REJECTED_MOVES; i++)
+      SendMove(&device, 1, 1, 0);
+    elapsed += WallTime() - start;
+  }
+  if(device.Core.Stats->QueueFull != AEM_BENCH_ROUNDS * AEM_BENCH_REJECTED_MOVES) {
+    Failures++;
+    fprintf(stderr, "reject_full_queue: %ld moves rejected, expected %d\n", (long) device.Core.Stats->QueueFull, AEM_BENCH_ROUNDS * AEM_BENCH_REJECTED_MOVES);
+  }
+  AemSimFree(&device);
+  return elapsed / ((double) AEM_BENCH_ROUNDS * AEM_BENCH_REJECTED_MOVES);
+}
+
+static double BenchDequeue(void) {
+  AEM_SIM_DEVICE device;
+  UCHAR          report[AEM_INPUT_REPORT_SIZE + 1];
+  ULONG          capacity, round, i;
+  double         start, elapsed = 0;
+
+  AemSimInit(&device, NULL, NULL);
+  capacity = device.Core.InfoReport.MessageQueueCapacity;
+  for(round = 0; round < AEM_BENCH_ROUNDS; round++) {
+    for(i = 0; i < capacity; i++)
+      SendMove(&device, (SHORT) i, (SHORT) round, (UCHAR) (i & 1 ? AEM_MOVE_ABSOLUTE : 0));
+    start = WallTime();
+    while(DequeueReport(&device.Core, report))
+      ;
+    elapsed += WallTime() - start;
+  }
+  AemSimFree(&device);
+  return elapsed / ((double) AEM_BENCH_ROUNDS * capacity);
+}
+
+/* Null transport of the aemctl request path. Each thread counts its requests in its transport state, 
+ * and the count is returned as the reply, so that a thread that gets a reply meant for another one is noticed. */
+BOOLEAN TransportGetFeature(PAEM_THREAD_STATE state, PVOID file, PVOID report, DWORD size) {
+  PAEM_DWORD_FEATURE_REPORT reply = (PAEM_DWORD_FEATURE_REPORT) report;
+
+  if(state->Transport == NULL) {
+    state->Transport = calloc(1, sizeof(DWORD32));
+    if(state->Transport == NULL) {
+      SetLastErrorCode("calloc", 0);
+      return FALSE;
+    }
+  }
+  if(size < sizeof(AEM_DWORD_FEATURE_REPORT) || reply->Report.ControlCode != AEM_CONTROL_CODE_QUEUE_SIZE) {
+    SetLastErrorCode("TransportGetFeature", 1);
+    return FALSE;
+  }
+  reply->Value = ++*(DWORD32 *) state->Transport;
+  return TRUE;
+}
+
+VOID TransportFreeThreadState(PAEM_THREAD_STATE state) {
+  free(state->Transport);
+}
+
+static int           RequestThreadCount;
+static volatile LONG RequestFailures;
+
+/** Sends queue size requests the way AemGetMessageQueueSizeEx does, each thread starts with a fresh thread state. */
+static void *RequestThread(void *context) {
+  AEM_DWORD_FEATURE_REPORT report;
+  ULONG                    i, count = AEM_BENCH_REQUESTS / RequestThreadCount;
+
+  for(i = 0; i < count; i++) {
+    report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+    report.Report.ControlCode = AEM_CONTROL_CODE_QUEUE_SIZE;
+    if(!SendFeatureRequest(context, &report, sizeof(report)) || report.Value != i + 1) {
+      AemInterlockedIncrement(&RequestFailures);
+      break;
+    }
+  }
+  return NULL;
+}
+
+/** Sends requests through the aemctl request path from RequestThreadCount threads at once. Threads share nothing 
+ * but the device handle, so the time per request is to go down as threads are added, up to the number of cores. */
+static double BenchRequests(void) {
+  pthread_t threads[AEM_BENCH_MAX_REQUEST_THREADS];
+  double    start, elapsed;
+  int       i;
+
+  RequestFailures = 0;
+  start = WallTime();
+  for(i = 0; i < RequestThreadCount; i++)
+    pthread_create(&threads[i], NULL, RequestThread, NULL);
+  for(i = 0; i < RequestThreadCount; i++)
+    pthread_join(threads[i], NULL);
+  elapsed = WallTime() - start;
+  if(RequestFailures != 0) {
+    Failures++;
+    fprintf(stderr, "aemctl_request_%dt: %d threads got wrong replies\n", RequestThreadCount, (int) RequestFailures);
+  }
+  return elapsed / AEM_BENCH_REQUESTS;
+}
+
+/** State of the simulated hidclass consumer. Moves are absolute, and their coordinates carry the move index,
+ * so that each report can be matched with its submission. */
+typedef struct _AEM_BENCH_CONSUMER {
+  AEM_SIM_DEVICE  Device;
+  AEM_SIM_READ    Reads[AEM_BENCH_PENDING_READS];
+  ULONGLONG       ResubmitTimes[AEM_BENCH_PENDING_READS];
+  BOOLEAN         IsCompleted[AEM_BENCH_PENDING_READS];
+  ULONG           RandomState;
+  ULONGLONG       SubmitTimes[AEM_BENCH_LATENCY_MOVES];
+  double          Latencies[AEM_BENCH_LATENCY_MOVES];
+  size_t          LatencyCount;
+  double          Jitters[AEM_BENCH_LATENCY_MOVES];
+  size_t          JitterCount;
+  ULONGLONG       LastEmissionTime;
+  BOOLEAN         HasEmitted;
+  double          MinInterval;   /**< Range of expected tick intervals, in 1/1000000 sec. */
+  double          MaxInterval;
+} AEM_BENCH_CONSUMER, *PAEM_BENCH_CONSUMER;
+
+static VOID ConsumerCompletionRoutine(PAEM_SIM_READ read, PVOID context) {
+  PAEM_BENCH_CONSUMER consumer = (PAEM_BENCH_CONSUMER) context;
+  ULONG               index = (ULONG) (ULONG_PTR) read->Context, move;
+  SHORT_POINT         point;
+  double              interval;
+
+  consumer->IsCompleted[index] = TRUE;
+  consumer->ResubmitTimes[index] = read->CompletionTime + Random(&consumer->RandomState) % (AEM_BENCH_MAX_TURNAROUND + 1);
+  if(!NT_SUCCESS(read->Status) || read->Report[0] != AEM_ABSOLUTE_POINTER_REPORT_ID)
+    return;
+
+  RtlCopyMemory(&point, read->Report + 2, sizeof(point));
+  move = (ULONG) (USHORT) point.X | ((ULONG) (USHORT) point.Y << 15);
+  consumer->Latencies[consumer->LatencyCount++] = (read->CompletionTime - consumer->SubmitTimes[move]) / 10.0;
+
+  /* Tick jitter only makes sense while there is a backlog, i.e. the move was waiting for its slot. 
+   * With adaptive pacing any interval within the pacing range is on time. */
+  if(consumer->HasEmitted && consumer->SubmitTimes[move] <= consumer->LastEmissionTime) {
+    interval = (read->CompletionTime - consumer->LastEmissionTime) / 10.0;
+    consumer->Jitters[consumer->JitterCount++] = interval > consumer->MaxInterval ? interval - consumer->MaxInterval : 
+      interval < consumer->MinInterval ? consumer->MinInterval - interval : 0;
+  }
+  consumer->LastEmissionTime = read->CompletionTime;
+  consumer->HasEmitted = TRUE;
+}
+
+static void BenchLatency(ULONGLONG timerResolution, PAEM_PACING pacing, const char *tracePath) {
+  static AEM_BENCH_CONSUMER consumer;
+  ULONGLONG                 now, next, submitTime;
+  ULONG                     sent = 0, i;
+  double                    sum = 0;
+  BOOLEAN                   hasNext;
+
+  memset(&consumer, 0, sizeof(consumer));
+  AemSimInit(&consumer.Device, ConsumerCompletionRoutine, &consumer);
+  AemSimSetTimerResolution(&consumer.Device, timerResolution);
+  consumer.MinInterval = consumer.MaxInterval = consumer.Device.Core.MessageCheckInterval;
+  if(pacing != NULL) {
+    SetPacing(&consumer.Device, pacing);
+    consumer.MinInterval = pacing->MinInterval;
+    consumer.MaxInterval = pacing->MaxInterval;
+  }
+  consumer.RandomState = 1;
+  for(i = 0; i < AEM_BENCH_PENDING_READS; i++) {
+    consumer.Reads[i].Context = (PVOID) (ULONG_PTR) i;
+    AemSimRead(&consumer.Device, &consumer.Reads[i]);
+  }
+
+  submitTime = RandomExponential(&consumer.RandomState, AEM_BENCH_LATENCY_INTERARRIVAL);
+  for(;;) {
+    /* Find the next event, be it a submission, a resubmission of a read, or a timer. */
+    hasNext = AemSimNextDueTime(&consumer.Device, &next);
+    if(sent < AEM_BENCH_LATENCY_MOVES && (!hasNext || submitTime < next)) {
+      next = submitTime;
+      hasNext = TRUE;
+    }
+    for(i = 0; i < AEM_BENCH_PENDING_READS; i++) {
+      if(consumer.IsCompleted[i] && (!hasNext || consumer.ResubmitTimes[i] < next)) {
+        next = consumer.ResubmitTimes[i];
+        hasNext = TRUE;
+      }
+    }
+    if(!hasNext)
+      break;
+
+    now = AemSimNow(&consumer.Device);
+    AemSimAdvance(&consumer.Device, next > now ? next - now : 0);
+    now = AemSimNow(&consumer.Device);
+
+    for(i = 0; i < AEM_BENCH_PENDING_READS; i++) {
+      if(consumer.IsCompleted[i] && consumer.ResubmitTimes[i] <= now) {
+        consumer.IsCompleted[i] = FALSE;
+        AemSimRead(&consumer.Device, &consumer.Reads[i]);
+      }
+    }
+    if(sent < AEM_BENCH_LATENCY_MOVES && submitTime <= now) {
+      consumer.SubmitTimes[sent] = now;
+      SendMove(&consumer.Device, (SHORT) (sent & 0x7FFF), (SHORT) (sent >> 15), AEM_MOVE_ABSOLUTE);
+      sent++;
+      submitTime = now + RandomExponential(&consumer.RandomState, AEM_BENCH_LATENCY_INTERARRIVAL);
+    }
+    if(sent == AEM_BENCH_LATENCY_MOVES && consumer.LatencyCount == AEM_BENCH_LATENCY_MOVES)
+      break;
+  }
+  if(tracePath != NULL && !AemSimSaveTrace(&consumer.Device, tracePath))
+    fprintf(stderr, "Could not write trace to %s\n", tracePath);
+  AemSimFree(&consumer.Device);
+
+  qsort(consumer.Latencies, consumer.LatencyCount, sizeof(double), CompareDoubles);
+  AddResult("latency_p50", Percentile(consumer.Latencies, consumer.LatencyCount, 0.5), "us", FALSE);
+  AddResult("latency_p99", Percentile(consumer.Latencies, consumer.LatencyCount, 0.99), "us", FALSE);
+  AddResult("latency_p999", Percentile(consumer.Latencies, consumer.LatencyCount, 0.999), "us", FALSE);
+
+  for(i = 0; i < consumer.JitterCount; i++)
+    sum += consumer.Jitters[i];
+  qsort(consumer.Jitters, consumer.JitterCount, sizeof(double), CompareDoubles);
+  AddResult("jitter_mean", consumer.JitterCount ? sum / consumer.JitterCount : 0, "us", FALSE);
+  AddResult("jitter_max", consumer.JitterCount ? consumer.Jitters[consumer.JitterCount - 1] : 0, "us", FALSE);
+}
+
+static int WriteResults(const char *path) {
+  FILE *file;
+  int   i;
+
+  file = fopen(path, "w");
+  if(file == NULL) {
+    perror(path);
+    return 0;
+  }
+  for(i = 0; i < ResultCount; i++)
+    fprintf(file, "%s %.3f %s\n", Results[i].Name, Results[i].Value, Results[i].Unit);
+  fclose(file);
+  return 1;
+}
+
+/** @param path                       Baseline file.
+ * @param tolerance                    Allowed regression of deterministic results, in percent.
+ * @param wallTolerance                Allowed regression of wall time results, in percent. Negative to skip them.
+ * @returns                            Number of results that are worse than the baseline by more than the tolerance
+ *                                     or are missing from it, or -1 on error. */
+static int CompareResults(const char *path, double tolerance, double wallTolerance) {
+  FILE    *file;
+  char    name[64], unit[16];
+  double  value, limit;
+  BOOLEAN isInBaseline[AEM_BENCH_MAX_RESULTS] = {0};
+  int     i, regressions = 0;
+
+  file = fopen(path, "r");
+  if(file == NULL) {
+    perror(path);
+    return -1;
+  }
+  while(fscanf(file, "%63s %lf %15s", name, &value, unit) == 3) {
+    for(i = 0; i < ResultCount; i++)
+      if(strcmp(Results[i].Name, name) == 0)
+        break;
+    if(i == ResultCount) {
+      fprintf(stderr, "%s: missing from this run\n", name);
+      continue;
+    }
+    isInBaseline[i] = TRUE;
+    if(Results[i].IsWallTime && wallTolerance < 0)
+      continue;
+    limit = value * (1 + (Results[i].IsWallTime ? wallTolerance : tolerance) / 100);
+    if(Results[i].Value > limit) {
+      fprintf(stderr, "%s: REGRESSION %.3f %s, baseline %.3f %s\n", name, Results[i].Value, unit, value, unit);
+      regressions++;
+    }
+  }
+  fclose(file);
+
+  /* A result the baseline doesn't know would go unchecked, the baseline has to be regenerated. It fails
+   * the comparison unless it is a wall time result that isn't compared anyway. */
+  for(i = 0; i < ResultCount; i++) {
+    if(isInBaseline[i])
+      continue;
+    fprintf(stderr, "%s: missing from the baseline\n", Results[i].Name);
+    if(!Results[i].IsWallTime || wallTolerance >= 0)
+      regressions++;
+  }
+  return regressions;
+}
+
+static void Usage(const char *name) {
+  fprintf(stderr,
+    "Usage: %s [-o results] [-b baseline] [-t tolerance] [-w tolerance] [-r resolution] [-p min,max,target] [-T trace]\n"
+    "  -o results     Write results to the given file, e.g. to make a new baseline.\n"
+    "  -b baseline    Compare results against the given baseline, exit with 1 on regressions.\n"
+    "                 Exit code is 1 whenever moves are lost or reordered, with or without a baseline.\n"
+    "  -t tolerance   Allowed regression of latency & jitter, in percent. Default is 20.\n"
+    "  -w tolerance   Also compare wall time throughput results, with the given allowed regression in percent.\n"
+    "                 They are skipped by default, as they only compare to a baseline made on the same machine.\n"
+    "  -r resolution  Resolution of simulated timers, in 1/1000000 sec. Default is 15625, the default clock tick of Windows XP.\n"
+    "  -p min,max,target\n"
+    "                 Run the latency benchmark with adaptive pacing, intervals are in 1/1000000 sec.\n"
+    "  -T trace       Dump the device trace at the end of the latency benchmark into the given file, see aemtrace.\n", name);
+}
+
+int main(int argc, char **argv) {
+  const char *resultsPath = NULL, *baselinePath = NULL, *tracePath = NULL;
+  double     tolerance = 20, wallTolerance = -1;
+  ULONGLONG  timerResolution = 15625;
+  AEM_PACING pacing, *latencyPacing = NULL;
+  int        option, regressions = 0;
+  char       name[64];
+
+  while((option = getopt(argc, argv, "o:b:t:w:r:p:T:h")) != -1) {
+    switch(option) {
+    case 'o': resultsPath = optarg; break;
+    case 'b': baselinePath = optarg; break;
+    case 't': tolerance = atof(optarg); break;
+    case 'w': wallTolerance = atof(optarg); break;
+    case 'r': timerResolution = strtoull(optarg, NULL, 10); break;
+    case 'T': tracePath = optarg; break;
+    case 'p':
+      if(sscanf(optarg, "%u,%u,%u", &pacing.MinInterval, &pacing.MaxInterval, &pacing.TargetDepth) != 3) {
+        Usage(argv[0]);
+        return 2;
+      }
+      latencyPacing = &pacing;
+      break;
+    default:
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+
+  AddResult("enqueue_single", Best(BenchEnqueueSingle), "ns/move", TRUE);
+  AddResult("enqueue_batch", Best(BenchEnqueueBatch), "ns/move", TRUE);
+  AddResult("enqueue_concurrent", Best(BenchEnqueueConcurrent), "ns/move", TRUE);
+  AddResult("enqueue_channel", Best(BenchEnqueueChannel), "ns/move", TRUE);
+  AddResult("enqueue_ring_mpsc", Best(BenchRingMpsc), "ns/message", TRUE);
+  AddResult("enqueue_locked_mpsc", Best(BenchLockedMpsc), "ns/message", TRUE);
+  AddResult("compact_queue", Best(BenchCompact), "ns/message", TRUE);
+  AddResult("reject_full_queue", Best(BenchRejectFull), "ns/move", TRUE);
+  AddResult("dequeue_pack", Best(BenchDequeue), "ns/report", TRUE);
+  if(!StartRequests()) {
+    fprintf(stderr, "Could not allocate the thread state slot of the aemctl request path\n");
+    return 2;
+  }
+  for(RequestThreadCount = 1; RequestThreadCount <= AEM_BENCH_MAX_REQUEST_THREADS; RequestThreadCount *= 2) {
+    snprintf(name, sizeof(name), "aemctl_request_%dt", RequestThreadCount);
+    AddResult(name, Best(BenchRequests), "ns/request", TRUE);
+  }
+  StopRequests();
+  BenchLatency(timerResolution * 10, latencyPacing, tracePath);
+
+  if(resultsPath != NULL && !WriteResults(resultsPath))
+    return 2;
+  if(baselinePath != NULL) {
+    regressions = CompareResults(baselinePath, tolerance, wallTolerance);
+    if(regressions < 0)
+      return 2;
+  }
+  return regressions == 0 && Failures == 0 ? 0 : 1;
+}
@@ -1,330 +1,1931 @@
-/* This file is part of Aethered, a collection of virtual device drivers for
- * Windows.
- *
- * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
- *
- * Aethered is free software; you can redistribute it and/or
- * modify it under the terms of the GNU General Public License 
- * as published by the Free Software Foundation; either
- * version 3 of the License, or (at your option) any later version.
- *
- * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
- * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
- * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
- * for more details.
- *
- * You should have received a copy of the GNU General Public License 
- * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
-#define AEMCTLDLL
-#include "aemctl.h"
-#include <Windows.h>
-#include <hidsdi.h>
-#include <setupapi.h>
-#include "common.h"
-
-#pragma comment(lib, "setupapi.lib")
-#pragma comment(lib, "hid.lib")
-
-CHAR LastErrorMessageBuffer[4096];
-CHAR DeviceNotFound[] = "Arx Ethereal Mouse Device was not found or could not be opened.";
-CHAR OutOfBoundsAbsolute[] = "Coordinates do not lie in [1, 32767] segment.";
-CHAR OutOfBoundsRelative[] = "Coordinates do not lie in [-127, 127] segment.";
-CHAR NullPassed[] = "NULL value passed where non-NULL value was expected.";
-CHAR MessageCheckIntervalTooSmall[] = "Given message check interval is too small.";
-CHAR QueueFull[] = "Message queue is full.";
-LPCSTR LastErrorMessage;
-HANDLE Heap;
-HANDLE ArxEtherealMouse;
-CHAR Flags;
-DWORD QueueCapacity;
-
-VOID WinApiCallFailed(LPCSTR functionName) {
-  wsprintf(LastErrorMessageBuffer, "%s failed with error code 0x%x", functionName, GetLastError());
-}
-
-
-BOOL IsArxEtherealMouse(HANDLE file) {
-  PHIDP_PREPARSED_DATA Ppd; /**< The opaque parser info describing this device */
-  HIDP_CAPS            Caps; /**< The Capabilities of this hid device. */
-
-  if(!HidD_GetPreparsedData(file, &Ppd))
-    return FALSE;
-
-  if(!HidP_GetCaps(Ppd, &Caps)) {
-    HidD_FreePreparsedData (Ppd);
-    return FALSE;
-  }
-
-  if((Caps.UsagePage == AEM_USAGE_PAGE_SHORT) && (Caps.Usage == AEM_CONTROL_USAGE))
-    return TRUE;
-
-  return FALSE;
-}
-
-
-VOID StartDll(void) {
-  GUID                     hidGuid;
-  HDEVINFO                 deviceInfoSet;
-  SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
-  SP_DEVINFO_DATA          devInfoData;
-  int                      i;
-
-  /* Init error reporting. */
-  LastErrorMessageBuffer[0] = '\0';
-  LastErrorMessage = LastErrorMessageBuffer;
-
-  /* Device handle is uninitialized. */
-  ArxEtherealMouse = INVALID_HANDLE_VALUE;
-
-  /* Create standard heap that has no growth limit. */
-  Heap = HeapCreate(0, 0, 0);
-  if(Heap == NULL) {
-    WinApiCallFailed("HeapCreate");
-    return;
-  }
-
-  /* Get device info set for HID devices. */
-  HidD_GetHidGuid(&hidGuid);
-  deviceInfoSet = SetupDiGetClassDevs(&hidGuid, NULL, NULL, (DIGCF_PRESENT | DIGCF_INTERFACEDEVICE)); 
-  if(deviceInfoSet == INVALID_HANDLE_VALUE) {
-    WinApiCallFailed("SetupDiGetClassDevs");
-    return;
-  }
-
-  /* Enumerate devices of this interface class. */
-  deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
-  devInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
-  for(i = 0; SetupDiEnumDeviceInterfaces(deviceInfoSet, 0, &hidGuid, i, &deviceInterfaceData); i++) {
-    DWORD                            requiredSize = 0;
-    DWORD                            dummy;
-    PSP_DEVICE_INTERFACE_DETAIL_DATA deviceInterfaceDetailData;
-    HANDLE                           file;
-    BOOL                             deviceFound = FALSE;
-    AEM_INFO_FEATURE_REPORT         report;
-
-    /* Probing so no output buffer yet. */
-    SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL, 0, &requiredSize, NULL);
-
-    /* Allocate buffer. */
-    deviceInterfaceDetailData = (PSP_DEVICE_INTERFACE_DETAIL_DATA) HeapAlloc(Heap, 0, requiredSize);
-    if(deviceInterfaceDetailData == NULL)
-      continue;
-
-    /* Get device interface data. */
-    deviceInterfaceDetailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-    if(!SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, deviceInterfaceDetailData, requiredSize, &dummy, NULL)) {
-      HeapFree(Heap, 0, deviceInterfaceDetailData);
-      continue;
-    }
-
-    /* Open the device. */
-    file = CreateFile(deviceInterfaceDetailData->DevicePath, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
-    if(file == INVALID_HANDLE_VALUE) {
-      HeapFree(Heap, 0, deviceInterfaceDetailData);
-      continue;
-    }
-
-    /* Check if its our device. */
-    if(!IsArxEtherealMouse(file)) {
-      HeapFree(Heap, 0, deviceInterfaceDetailData);
-      continue;
-    }
-
-    /* Get flags. */
-    report.Report.ReportId = AEM_CONTROL_REPORT_ID;
-    report.Report.ControlCode = AEM_CONTROL_CODE_INFO;
-    if(!HidD_GetFeature(file, &report, sizeof(report)))
-      continue;
-    Flags = report.Flags;
-    QueueCapacity = report.MessageQueueCapacity;
-
-    /* Save device. */
-    ArxEtherealMouse = file;
-    HeapFree(Heap, 0, deviceInterfaceDetailData);
-    break;
-  }
-
-  /* Clean up & check for errors. */
-  SetupDiDestroyDeviceInfoList(deviceInfoSet);
-
-  if(ArxEtherealMouse == INVALID_HANDLE_VALUE)
-    LastErrorMessage = DeviceNotFound;
-}
-
-
-VOID StopDll(void) {
-  if(ArxEtherealMouse != INVALID_HANDLE_VALUE) {
-    CloseHandle(ArxEtherealMouse);
-    ArxEtherealMouse = INVALID_HANDLE_VALUE;
-  }
-  if(Heap != NULL) {
-    HeapDestroy(Heap);
-    Heap = NULL;
-  }
-}
-
-
-BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
-  switch(fdwReason) {
-  case DLL_PROCESS_ATTACH:
-    /* Init. */
-    StartDll();
-    break;
-
-  case DLL_THREAD_ATTACH:
-    /* No thread-specific init code. */
-    break;
-
-  case DLL_THREAD_DETACH:
-    /* No thread-specific cleanup code. */
-    break;
-
-  case DLL_PROCESS_DETACH:
-    /* Cleanup. */
-    StopDll();
-    break;
-  }
-  
-  /* The return value is used for successful DLL_PROCESS_ATTACH */
-  return TRUE;
-}
-
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessage(int x, int y, char buttons) {
-  AEM_MOVE_FEATURE_REPORT report;
-
-  if(ArxEtherealMouse == INVALID_HANDLE_VALUE)
-    return AEMCTL_INIT_FAILED;
-
-  if(Flags & AEM_FLAG_RELATIVE) {
-    if(x < -127 || x > 127 || y < -127 || y > 127) {
-      LastErrorMessage = OutOfBoundsRelative;
-      return AEMCTL_INVALID_PARAMETER;
-    }
-  } else if (x < 1 || x > 32767 || y < 1 || y > 32767) {
-    LastErrorMessage = OutOfBoundsAbsolute;
-    return AEMCTL_INVALID_PARAMETER;
-  }  
-  
-  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
-  report.Report.ControlCode = AEM_CONTROL_CODE_MOVE;
-  report.Point.X = (SHORT) x;
-  report.Point.Y = (SHORT) y;
-  report.Buttons = buttons;
-
-  if(!HidD_GetFeature(ArxEtherealMouse, &report, sizeof(report))) {
-    WinApiCallFailed("HidD_GetFeature");
-    return AEMCTL_COMMUNICATION_FAILED;
-  } else {
-    if(report.Report.ControlCode == AEM_CONTROL_CODE_MOVE) {
-      return AEMCTL_OK;
-    } else {
-      LastErrorMessage = QueueFull;
-      return AEMCTL_QUEUE_FULL;
-    }
-  }
-}
-
-AEMCTLAPI const char* AEMCTLAPIENTRY AemGetLastErrorString(void) {
-  return LastErrorMessage;
-}
-
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetDeviceInfo(int* isRelative, int* queueCapacity) {
-  if(ArxEtherealMouse == INVALID_HANDLE_VALUE)
-    return AEMCTL_INIT_FAILED;
-
-  if(isRelative == NULL || queueCapacity == NULL) {
-    LastErrorMessage = NullPassed;
-    return AEMCTL_INVALID_PARAMETER;
-  }
-
-  *isRelative = Flags & AEM_FLAG_RELATIVE;
-  *queueCapacity = QueueCapacity;
-  return AEMCTL_OK;
-}
-
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemClearMessageQueue() {
-  AEM_FEATURE_REPORT report;
-
-  if(ArxEtherealMouse == INVALID_HANDLE_VALUE)
-    return AEMCTL_INIT_FAILED;
-
-  report.ReportId = AEM_CONTROL_REPORT_ID;
-  report.ControlCode = AEM_CONTROL_CODE_CLEAR_QUEUE;
-
-  if(!HidD_GetFeature(ArxEtherealMouse, &report, sizeof(report))) {
-    WinApiCallFailed("HidD_GetFeature");
-    return AEMCTL_COMMUNICATION_FAILED;
-  } else
-    return AEMCTL_OK;
-}
-
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageQueueSize(int* size) {
-  AEM_DWORD_FEATURE_REPORT report;
-
-  if(ArxEtherealMouse == INVALID_HANDLE_VALUE)
-    return AEMCTL_INIT_FAILED;
-
-  if(size == NULL) {
-    LastErrorMessage = NullPassed;
-    return AEMCTL_INVALID_PARAMETER;
-  }
-
-  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
-  report.Report.ControlCode = AEM_CONTROL_CODE_QUEUE_SIZE;
-
-  if(!HidD_GetFeature(ArxEtherealMouse, &report, sizeof(report))) {
-    WinApiCallFailed("HidD_GetFeature");
-    return AEMCTL_COMMUNICATION_FAILED;
-  } else {
-    *size = report.Value;
-    return AEMCTL_OK;
-  }
-}
-
-
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageCheckInterval(int* interval) {
-  AEM_DWORD_FEATURE_REPORT report;
-
-  if(ArxEtherealMouse == INVALID_HANDLE_VALUE)
-    return AEMCTL_INIT_FAILED;
-
-  if(interval == NULL) {
-    LastErrorMessage = NullPassed;
-    return AEMCTL_INVALID_PARAMETER;
-  }
-
-  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
-  report.Report.ControlCode = AEM_CONTROL_CODE_INTERVAL;
-  report.Value = 0;
-
-  if(!HidD_GetFeature(ArxEtherealMouse, &report, sizeof(report))) {
-    WinApiCallFailed("HidD_GetFeature");
-    return AEMCTL_COMMUNICATION_FAILED;
-  } else {
-    *interval = report.Value;
-    return AEMCTL_OK;
-  }
-}
-
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageCheckInterval(int interval) {
-  AEM_DWORD_FEATURE_REPORT report;
-
-  if(ArxEtherealMouse == INVALID_HANDLE_VALUE)
-    return AEMCTL_INIT_FAILED;
-
-  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
-  report.Report.ControlCode = AEM_CONTROL_CODE_INTERVAL;
-  report.Value = interval;
-
-  if(!HidD_GetFeature(ArxEtherealMouse, &report, sizeof(report))) {
-    WinApiCallFailed("HidD_GetFeature");
-    return AEMCTL_COMMUNICATION_FAILED;
-  } else {
-    if(report.Report.ControlCode == AEM_CONTROL_CODE_INTERVAL) {
-      return AEMCTL_OK;
-    } else {
-      LastErrorMessage = MessageCheckIntervalTooSmall;
-      return AEMCTL_INVALID_PARAMETER;
-    }
-  }
-}
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#define AEMCTLDLL
+#include "aemctl.h"
+#include <Windows.h>
+#include <hidsdi.h>
+#include <hidclass.h>
+#include <setupapi.h>
+#include "common.h"
+#include "batch.h"
+#include "histogram.h"
+#include "trace.h"
+#include "channel.h"
+#include "request.h"
+
+#pragma comment(lib, "setupapi.lib")
+#pragma comment(lib, "hid.lib")
+#pragma comment(lib, "advapi32.lib")
+
+/** Registry location of the device path cache, relative to HKEY_CURRENT_USER. */
+#define AEM_CACHE_KEY   "Software\\Aethered\\aemctl"
+#define AEM_CACHE_VALUE "DevicePaths"
+#define AEM_CACHE_COUNT "InterfaceCount" /**< Number of HID interfaces present when the paths were cached. */
+
+/** Delay before the staging flusher retries after a failed request, in ms. */
+#define AEM_STAGING_RETRY_DELAY 10
+
+/** Device discovery states. */
+#define AEM_INIT_NONE        0
+#define AEM_INIT_IN_PROGRESS 1
+#define AEM_INIT_DONE        2
+
+C_ASSERT(sizeof(AEM_STATISTICS) == sizeof(AEM_STATS_PAGE));
+
+#if AEMCTL_LATENCY_BUCKETS != AEM_HISTOGRAM_BUCKETS
+#  error AEMCTL_LATENCY_BUCKETS must match the bucket layout in common.h
+#endif
+
+CHAR DeviceNotFound[] = "Arx Ethereal Mouse Device was not found or could not be opened.";
+CHAR OutOfBoundsAbsolute[] = "Coordinates do not lie in [1, 32767] segment.";
+CHAR OutOfBoundsRelative[] = "Coordinates do not lie in [-127, 127] segment.";
+CHAR NullPassed[] = "NULL value passed where non-NULL value was expected.";
+CHAR MessageCheckIntervalTooSmall[] = "Given message check interval is too small.";
+CHAR QueueFull[] = "Message queue is full.";
+CHAR GlideDeltaOutOfBounds[] = "Glide delta does not lie in [-32767, 32767] segment, or leaves [-32766, 32766] in absolute motion mode.";
+CHAR GlideInvalid[] = "Given glide duration is negative, or easing curve is unknown.";
+CHAR ThresholdNegative[] = "Given catch-up threshold is negative.";
+CHAR PacingInvalid[] = "Given pacing interval is too small, maximal interval is less than minimal one, or target depth is negative.";
+CHAR SequenceTooLong[] = "Timed sequence is longer than 2^32 microseconds.";
+CHAR DeviceIndexInvalid[] = "Given device index is out of range.";
+CHAR OutOfMemory[] = "Out of memory.";
+CHAR QueueCapacityInvalid[] = "Given message queue capacity is out of range or too small to hold queued messages.";
+CHAR StatisticsUnavailable[] = "Driver could not create the statistics page.";
+CHAR ScrollOutOfBounds[] = "Given wheel or pan delta is out of range [-32767, 32767].";
+CHAR WheelUnavailable[] = "Device has no wheel, driver and aemctl versions do not match.";
+CHAR KeyInvalid[] = "Given key usage is out of range, or a key other than AEMCTL_KEY_ALL is released as AEMCTL_KEY_ALL.";
+CHAR KeyboardUnavailable[] = "Device has no keyboard collection, driver and aemctl versions do not match.";
+CHAR AsyncUnavailable[] = "Asynchronous submission is not available for this device.";
+CHAR StagingInvalid[] = "Given staging capacity or timeout is negative.";
+CHAR ChannelUnavailable[] = "Driver could not create the submission channel.";
+CHAR ChannelVersionMismatch[] = "Submission channel of the driver has a different layout, driver and aemctl versions do not match.";
+CHAR StatisticsVersionMismatch[] = "Statistics page of the driver has a different layout, driver and aemctl versions do not match.";
+HANDLE Heap;
+volatile LONG InitState; /**< AEM_INIT_XXX, devices are discovered on first use. */
+LPSTR* DevicePaths; /**< Interface paths of all arx ethereal mouse devices found, allocated from Heap. */
+int DeviceCount;
+AEMHANDLE volatile DefaultDevice; /**< Device used by the functions that don't take a device handle, opened on first use. */
+
+/** Staging queue of a device, see AemSetStaging. Allocated from Heap. */
+typedef struct AEM_STAGING_ {
+  AEMHANDLE        Device;
+  CRITICAL_SECTION Lock;               /**< Protects Head and Count. */
+  PAEM_MOVE_ENTRY  Entries;            /**< Ring of Capacity staged moves and keys, allocated from Heap. */
+  int              Capacity;
+  int              Head;               /**< Index of the oldest staged entry. */
+  int              Count;              /**< Number of staged entries, including the ones being sent by the flusher. */
+  int              Timeout;            /**< How long senders wait for room, in ms, or AEMCTL_INFINITE. */
+  HANDLE           Slots;              /**< Semaphore counting free entries of the ring. */
+  HANDLE           Staged;             /**< Auto-reset event, set when the ring stops being empty. */
+  HANDLE           Empty;              /**< Manual-reset event, set while nothing is staged. */
+  HANDLE           Stop;               /**< Manual-reset event, tells the flusher to exit. */
+  HANDLE           Thread;             /**< Flusher thread. */
+  HMODULE          Module;             /**< Reference to this module held by the flusher thread. */
+  CRITICAL_SECTION SendLock;           /**< Held while a batch is being sent, so that a clear can't overtake it. */
+} AEM_STAGING, *PAEM_STAGING;
+
+/** Opened arx ethereal mouse device. */
+typedef struct AEM_DEVICE_ {
+  HANDLE File;                         /**< Handle to the control collection. */
+  CHAR   Flags;                        /**< AEM_FLAG_XXX, as reported by the device. */
+  DWORD  QueueCapacity;                /**< Message queue capacity, as reported by the device. */
+  BOOL   IsAsync;                      /**< File is bound to the system thread pool, see AemSendMessageAsync. */
+  volatile LONG PendingWrites;         /**< Number of asynchronous submissions in flight. */
+  PAEM_STAGING  Staging;               /**< Staging queue, NULL if staging is disabled. */
+  PAEM_CHANNEL_PAGE Channel;           /**< Mapped submission channel, NULL if the channel is disabled. */
+} AEM_DEVICE;
+
+/** Asynchronous submission, allocated from Heap and freed once completed. */
+typedef struct AEM_ASYNC_WRITE_ {
+  OVERLAPPED             Overlapped;
+  AEMHANDLE              Device;
+  AEM_COMPLETION_ROUTINE Routine;
+  PVOID                  Context;
+  UCHAR                  Report[AEM_OUTPUT_REPORT_SIZE + 1]; /**< Output reports are always of the full size. */
+} AEM_ASYNC_WRITE, *PAEM_ASYNC_WRITE;
+
+AEMCTLRESULT OpenDevice(int index, int flags, AEMHANDLE* device);
+VOID CloseDevice(AEMHANDLE device, BOOL isDetaching);
+
+VOID WinApiCallFailed(LPCSTR functionName) {
+  /* Error code is taken before the thread state lookup resets it. */
+  SetLastErrorCode(functionName, GetLastError());
+}
+
+/** Sends a feature request on behalf of the request path. Handles are opened for overlapped I/O, and each thread
+ * waits on its own event, so that requests from different threads are not serialized by the I/O manager. */
+BOOLEAN TransportGetFeature(PAEM_THREAD_STATE state, PVOID file, PVOID report, DWORD size) {
+  OVERLAPPED overlapped;
+  DWORD      transferred;
+
+  if(state->Transport == NULL) {
+    state->Transport = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if(state->Transport == NULL) {
+      WinApiCallFailed("CreateEvent");
+      return FALSE;
+    }
+  }
+
+  /* Low bit of the event handle keeps the completion from being posted to the thread pool the file is bound to. */
+  ZeroMemory(&overlapped, sizeof(overlapped));
+  overlapped.hEvent = (HANDLE) ((ULONG_PTR) state->Transport | 1);
+  if(!DeviceIoControl((HANDLE) file, IOCTL_HID_GET_FEATURE, NULL, 0, report, size, &transferred, &overlapped)) {
+    if(GetLastError() != ERROR_IO_PENDING || !GetOverlappedResult((HANDLE) file, &overlapped, &transferred, TRUE)) {
+      WinApiCallFailed("DeviceIoControl");
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+VOID TransportFreeThreadState(PAEM_THREAD_STATE state) {
+  if(state->Transport != NULL)
+    CloseHandle((HANDLE) state->Transport);
+}
+
+BOOL GetFeature(AEMHANDLE device, PVOID report, DWORD size) {
+  return SendFeatureRequest(device->File, report, size);
+}
+
+BOOL CheckBounds(int x, int y, BOOL isAbsolute) {
+  if(!isAbsolute) {
+    if(x < -127 || x > 127 || y < -127 || y > 127) {
+      SetLastErrorMessage(OutOfBoundsRelative);
+      return FALSE;
+    }
+  } else if (x < 1 || x > 32767 || y < 1 || y > 32767) {
+    SetLastErrorMessage(OutOfBoundsAbsolute);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+BOOL CheckDevice(AEMHANDLE device) {
+  if(device == NULL) {
+    SetLastErrorMessage(DeviceNotFound);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+
+BOOL IsArxEtherealMouse(HANDLE file) {
+  PHIDP_PREPARSED_DATA Ppd; /**< The opaque parser info describing this device */
+  HIDP_CAPS            Caps; /**< The Capabilities of this hid device. */
+
+  if(!HidD_GetPreparsedData(file, &Ppd))
+    return FALSE;
+
+  if(!HidP_GetCaps(Ppd, &Caps)) {
+    HidD_FreePreparsedData (Ppd);
+    return FALSE;
+  }
+
+  HidD_FreePreparsedData(Ppd);
+
+  if((Caps.UsagePage == AEM_USAGE_PAGE_SHORT) && (Caps.Usage == AEM_CONTROL_USAGE))
+    return TRUE;
+
+  return FALSE;
+}
+
+
+/** Checks whether the device at the given path is arx ethereal mouse. Device is opened without
+ * read and write access, which is enough to get its capabilities. */
+BOOL ProbeDevicePath(LPCSTR path) {
+  HANDLE file;
+  BOOL   result;
+
+  file = CreateFile(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+  if(file == INVALID_HANDLE_VALUE)
+    return FALSE;
+
+  result = IsArxEtherealMouse(file);
+  CloseHandle(file);
+  return result;
+}
+
+
+BOOL AddDevicePath(LPCSTR path) {
+  LPSTR  copy;
+  LPSTR* devicePaths;
+  int    size = lstrlen(path) + 1;
+
+  copy = (LPSTR) HeapAlloc(Heap, 0, size);
+  if(copy == NULL)
+    return FALSE;
+  lstrcpyn(copy, path, size);
+
+  if(DevicePaths == NULL)
+    devicePaths = (LPSTR*) HeapAlloc(Heap, 0, sizeof(LPSTR));
+  else
+    devicePaths = (LPSTR*) HeapReAlloc(Heap, 0, DevicePaths, (DeviceCount + 1) * sizeof(LPSTR));
+  if(devicePaths == NULL) {
+    HeapFree(Heap, 0, copy);
+    return FALSE;
+  }
+  DevicePaths = devicePaths;
+  DevicePaths[DeviceCount++] = copy;
+  return TRUE;
+}
+
+
+VOID ClearDevicePaths(void) {
+  int i;
+
+  for(i = 0; i < DeviceCount; i++)
+    HeapFree(Heap, 0, DevicePaths[i]);
+  if(DevicePaths != NULL)
+    HeapFree(Heap, 0, DevicePaths);
+  DevicePaths = NULL;
+  DeviceCount = 0;
+}
+
+
+/** Counts present HID interfaces. Nothing is opened, so this is much cheaper than a full enumeration.
+ *
+ * @returns                            Number of HID interfaces, or -1 if they can't be enumerated. */
+int CountHidInterfaces(void) {
+  GUID                     hidGuid;
+  HDEVINFO                 deviceInfoSet;
+  SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
+  int                      i;
+
+  HidD_GetHidGuid(&hidGuid);
+  deviceInfoSet = SetupDiGetClassDevs(&hidGuid, NULL, NULL, (DIGCF_PRESENT | DIGCF_INTERFACEDEVICE));
+  if(deviceInfoSet == INVALID_HANDLE_VALUE)
+    return -1;
+
+  deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+  for(i = 0; SetupDiEnumDeviceInterfaces(deviceInfoSet, 0, &hidGuid, i, &deviceInterfaceData); i++)
+    ;
+  SetupDiDestroyDeviceInfoList(deviceInfoSet);
+  return i;
+}
+
+
+/** Loads device paths saved by the previous discovery. Cache is trusted only if the number 
+ * of HID interfaces hasn't changed since, and every device listed in it is still there. */
+BOOL LoadCachedDevicePaths(void) {
+  HKEY  key;
+  DWORD type, size, count;
+  LPSTR paths, path;
+  BOOL  result = FALSE;
+
+  if(RegOpenKeyExA(HKEY_CURRENT_USER, AEM_CACHE_KEY, 0, KEY_READ, &key) != ERROR_SUCCESS)
+    return FALSE;
+
+  /* Devices plugged in or removed since the paths were cached change the count. */
+  size = sizeof(count);
+  if(RegQueryValueExA(key, AEM_CACHE_COUNT, NULL, &type, (LPBYTE) &count, &size) != ERROR_SUCCESS || 
+     type != REG_DWORD || (int) count != CountHidInterfaces()) {
+    RegCloseKey(key);
+    return FALSE;
+  }
+
+  paths = NULL;
+  if(RegQueryValueExA(key, AEM_CACHE_VALUE, NULL, &type, NULL, &size) == ERROR_SUCCESS && type == REG_MULTI_SZ) {
+    /* Extra zeros guarantee termination even if the stored value is malformed. */
+    paths = (LPSTR) HeapAlloc(Heap, HEAP_ZERO_MEMORY, size + 2);
+    if(paths != NULL && RegQueryValueExA(key, AEM_CACHE_VALUE, NULL, &type, (LPBYTE) paths, &size) == ERROR_SUCCESS) {
+      result = TRUE;
+      for(path = paths; *path != '\0'; path += lstrlen(path) + 1) {
+        if(!ProbeDevicePath(path) || !AddDevicePath(path)) {
+          result = FALSE;
+          break;
+        }
+      }
+    }
+  }
+  RegCloseKey(key);
+
+  if(paths != NULL)
+    HeapFree(Heap, 0, paths);
+
+  if(!result || DeviceCount == 0) {
+    ClearDevicePaths();
+    return FALSE;
+  }
+  return TRUE;
+}
+
+
+/** Saves device paths for the following discoveries, along with the number of HID interfaces they were found among.
+ *
+ * @param interfaceCount               Number of HID interfaces present before the enumeration, or -1 if unknown. */
+VOID SaveCachedDevicePaths(int interfaceCount) {
+  HKEY  key;
+  DWORD size, count;
+  LPSTR paths, path;
+  int   i;
+
+  if(DeviceCount == 0 || interfaceCount < 0)
+    return;
+
+  size = 1;
+  for(i = 0; i < DeviceCount; i++)
+    size += lstrlen(DevicePaths[i]) + 1;
+
+  paths = (LPSTR) HeapAlloc(Heap, 0, size);
+  if(paths == NULL)
+    return;
+
+  path = paths;
+  for(i = 0; i < DeviceCount; i++) {
+    lstrcpyn(path, DevicePaths[i], lstrlen(DevicePaths[i]) + 1);
+    path += lstrlen(path) + 1;
+  }
+  *path = '\0';
+
+  if(RegCreateKeyExA(HKEY_CURRENT_USER, AEM_CACHE_KEY, 0, NULL, REG_OPTION_NON_VOLATILE, KEY_WRITE, NULL, &key, NULL) == ERROR_SUCCESS) {
+    count = (DWORD) interfaceCount;
+    RegSetValueExA(key, AEM_CACHE_VALUE, 0, REG_MULTI_SZ, (const BYTE*) paths, size);
+    RegSetValueExA(key, AEM_CACHE_COUNT, 0, REG_DWORD, (const BYTE*) &count, sizeof(count));
+    RegCloseKey(key);
+  }
+  HeapFree(Heap, 0, paths);
+}
+
+
+/** Enumerates all HID devices and saves paths of arx ethereal mouse devices. */
+VOID EnumerateDevicePaths(void) {
+  GUID                     hidGuid;
+  HDEVINFO                 deviceInfoSet;
+  SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
+  SP_DEVINFO_DATA          devInfoData;
+  int                      i;
+
+  /* Get device info set for HID devices. */
+  HidD_GetHidGuid(&hidGuid);
+  deviceInfoSet = SetupDiGetClassDevs(&hidGuid, NULL, NULL, (DIGCF_PRESENT | DIGCF_INTERFACEDEVICE));
+  if(deviceInfoSet == INVALID_HANDLE_VALUE) {
+    WinApiCallFailed("SetupDiGetClassDevs");
+    return;
+  }
+
+  /* Enumerate devices of this interface class. */
+  deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+  devInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
+  for(i = 0; SetupDiEnumDeviceInterfaces(deviceInfoSet, 0, &hidGuid, i, &deviceInterfaceData); i++) {
+    DWORD                            requiredSize = 0;
+    DWORD                            dummy;
+    PSP_DEVICE_INTERFACE_DETAIL_DATA deviceInterfaceDetailData;
+
+    /* Probing so no output buffer yet. */
+    SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL, 0, &requiredSize, NULL);
+
+    /* Allocate buffer. */
+    deviceInterfaceDetailData = (PSP_DEVICE_INTERFACE_DETAIL_DATA) HeapAlloc(Heap, 0, requiredSize);
+    if(deviceInterfaceDetailData == NULL)
+      continue;
+
+    /* Get device interface data, check if its our device and save its path. Devices are opened on demand. */
+    deviceInterfaceDetailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+    if(SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, deviceInterfaceDetailData, requiredSize, &dummy, NULL))
+      if(ProbeDevicePath(deviceInterfaceDetailData->DevicePath))
+        AddDevicePath(deviceInterfaceDetailData->DevicePath);
+
+    HeapFree(Heap, 0, deviceInterfaceDetailData);
+  }
+
+  /* Clean up. */
+  SetupDiDestroyDeviceInfoList(deviceInfoSet);
+}
+
+
+/** Finds arx ethereal mouse devices. Cached device paths are tried first, full enumeration 
+ * is performed only if HID interfaces were added or removed since, or some of the cached devices are gone, 
+ * or if rescan is requested. Nothing is opened, so that discovery doesn't hold a handle to a device 
+ * the process may never use. */
+VOID DiscoverDevices(BOOL rescan) {
+  int interfaceCount;
+
+  if(rescan || !LoadCachedDevicePaths()) {
+    /* Counted before enumerating, so that an interface added meanwhile invalidates the cache next time. */
+    interfaceCount = CountHidInterfaces();
+    EnumerateDevicePaths();
+    SaveCachedDevicePaths(interfaceCount);
+  }
+}
+
+
+/** Discovers devices on first call. Concurrent callers wait for the discovery to finish,
+ * subsequent calls return right away. 
+ *
+ * @param rescan                       Ignore cached device paths.
+ * @param retry                        Discover devices once more if none were found by the previous discovery. */
+VOID Initialize(BOOL rescan, BOOL retry) {
+  /* Count is published before the state, so it is final once the state is done. Nothing can use an empty 
+   * device list, so it is safe to discover anew. Only one of the concurrent retries gets to reset the state. */
+  if(retry && InitState == AEM_INIT_DONE && DeviceCount == 0)
+    InterlockedCompareExchange(&InitState, AEM_INIT_NONE, AEM_INIT_DONE);
+
+  if(InitState == AEM_INIT_DONE)
+    return;
+
+  if(InterlockedCompareExchange(&InitState, AEM_INIT_IN_PROGRESS, AEM_INIT_NONE) == AEM_INIT_NONE) {
+    if(Heap != NULL)
+      DiscoverDevices(rescan);
+    InterlockedExchange(&InitState, AEM_INIT_DONE);
+  } else {
+    while(InitState != AEM_INIT_DONE)
+      Sleep(1);
+  }
+}
+
+
+/** Opens the default device, which is the first device found, on first use. Concurrent callers may 
+ * open it simultaneously, only one of the handles is kept then. */
+AEMHANDLE GetDefaultDevice(void) {
+  AEMHANDLE device;
+
+  Initialize(FALSE, FALSE);
+  if(DefaultDevice != NULL || DeviceCount == 0)
+    return DefaultDevice;
+
+  if(OpenDevice(0, 0, &device) != AEMCTL_OK)
+    return NULL;
+  if(InterlockedCompareExchangePointer((PVOID volatile*) &DefaultDevice, device, NULL) != NULL)
+    CloseDevice(device, FALSE);
+  return DefaultDevice;
+}
+
+
+/** Device discovery is deferred until the first call that needs a device,
+ * so that nothing heavy runs under the loader lock. */
+VOID StartDll(void) {
+  /* No devices found yet. */
+  InitState = AEM_INIT_NONE;
+  DevicePaths = NULL;
+  DeviceCount = 0;
+  DefaultDevice = NULL;
+
+  /* Create standard heap that has no growth limit. */
+  Heap = HeapCreate(0, 0, 0);
+  if(Heap == NULL)
+    return;
+
+  /* Error state is per-thread. */
+  if(!StartRequests()) {
+    HeapDestroy(Heap);
+    Heap = NULL;
+  }
+}
+
+
+VOID StopDll(void) {
+  if(DefaultDevice != NULL) {
+    CloseDevice(DefaultDevice, TRUE);
+    DefaultDevice = NULL;
+  }
+  StopRequests();
+  if(Heap != NULL) {
+    /* Device paths are freed along with the heap. */
+    HeapDestroy(Heap);
+    Heap = NULL;
+  }
+  DevicePaths = NULL;
+  DeviceCount = 0;
+  InitState = AEM_INIT_NONE;
+}
+
+
+BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
+  switch(fdwReason) {
+  case DLL_PROCESS_ATTACH:
+    /* Init. */
+    StartDll();
+    break;
+
+  case DLL_THREAD_ATTACH:
+    /* No thread-specific init code. */
+    break;
+
+  case DLL_THREAD_DETACH:
+    /* Free error state & event of the exiting thread. */
+    FreeThreadState();
+    break;
+
+  case DLL_PROCESS_DETACH:
+    /* Cleanup. */
+    StopDll();
+    break;
+  }
+  
+  /* The return value is used for successful DLL_PROCESS_ATTACH */
+  return TRUE;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemInitialize(int flags) {
+  Initialize((flags & AEMCTL_INIT_RESCAN) != 0, TRUE);
+
+  if(DeviceCount == 0) {
+    SetLastErrorMessage(DeviceNotFound);
+    return AEMCTL_INIT_FAILED;
+  }
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetDeviceCount(int* count) {
+  if(count == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  Initialize(FALSE, FALSE);
+
+  *count = DeviceCount;
+  return AEMCTL_OK;
+}
+
+/** Completion routine of asynchronous submissions, called on a thread of the system thread pool. */
+VOID CALLBACK AsyncWriteCompleted(DWORD errorCode, DWORD transferred, LPOVERLAPPED overlapped) {
+  PAEM_ASYNC_WRITE write = CONTAINING_RECORD(overlapped, AEM_ASYNC_WRITE, Overlapped);
+  AEMHANDLE device = write->Device;
+  AEMCTLRESULT result;
+
+  if(errorCode == ERROR_SUCCESS)
+    result = AEMCTL_OK;
+  else if(errorCode == ERROR_NO_SYSTEM_RESOURCES)
+    result = AEMCTL_QUEUE_FULL;
+  else
+    result = AEMCTL_COMMUNICATION_FAILED;
+
+  if(write->Routine != NULL)
+    write->Routine(result, write->Context);
+  HeapFree(Heap, 0, write);
+  InterlockedDecrement(&device->PendingWrites);
+}
+
+/** Opens a device. Monitors open it with no access, which is enough for feature requests, so that they neither
+ * need the rights of a client nor lock it out. Their handles aren't bound to the thread pool. */
+AEMCTLRESULT OpenDevice(int index, int flags, AEMHANDLE* device) {
+  AEM_INFO_FEATURE_REPORT report;
+  HANDLE                  file;
+  AEMHANDLE               result;
+  DWORD                   access;
+
+  if(device == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+  *device = NULL;
+
+  if(index < 0 || index >= DeviceCount) {
+    SetLastErrorMessage(DeviceIndexInvalid);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  access = (flags & AEMCTL_OPEN_MONITOR) ? 0 : GENERIC_READ | GENERIC_WRITE;
+  file = CreateFile(DevicePaths[index], access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+  if(file == INVALID_HANDLE_VALUE) {
+    WinApiCallFailed("CreateFile");
+    return AEMCTL_INIT_FAILED;
+  }
+
+  result = (AEMHANDLE) HeapAlloc(Heap, 0, sizeof(AEM_DEVICE));
+  if(result == NULL) {
+    SetLastErrorMessage(OutOfMemory);
+    CloseHandle(file);
+    return AEMCTL_INIT_FAILED;
+  }
+  result->File = file;
+  result->PendingWrites = 0;
+  result->Staging = NULL;
+  result->Channel = NULL;
+  result->IsAsync = !(flags & AEMCTL_OPEN_MONITOR) && BindIoCompletionCallback(file, AsyncWriteCompleted, 0);
+
+  /* Get flags. */
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_INFO;
+  if(!GetFeature(result, &report, sizeof(report))) {
+    CloseHandle(file);
+    HeapFree(Heap, 0, result);
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+  result->Flags = report.Flags;
+  result->QueueCapacity = report.MessageQueueCapacity;
+
+  *device = result;
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemOpenDevice(int index, AEMHANDLE* device) {
+  Initialize(FALSE, FALSE);
+  return OpenDevice(index, 0, device);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemOpenDeviceEx(int index, int flags, AEMHANDLE* device) {
+  Initialize(FALSE, FALSE);
+  return OpenDevice(index, flags, device);
+}
+
+/** Body of the staging flusher thread. Moves stay in the ring until the driver has queued them, 
+ * so that AemFlushStaging returns only once they are all in. 
+ *
+ * Thread holds a reference to this module and drops it on exit, so that the module can't be unloaded 
+ * from under it. Module is therefore unloaded with the flusher still around only on process exit. */
+DWORD WINAPI StagingFlusher(LPVOID parameter) {
+  PAEM_STAGING             staging = (PAEM_STAGING) parameter;
+  HMODULE                  module = staging->Module;
+  AEM_BATCH_FEATURE_REPORT report;
+  HANDLE                   events[2];
+  int                      batchSize, interval, delay, i;
+  BOOL                     isSent;
+
+  events[0] = staging->Stop;
+  events[1] = staging->Staged;
+  while(WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+    for(;;) {
+      EnterCriticalSection(&staging->SendLock);
+      AemBatchInit(&report);
+      EnterCriticalSection(&staging->Lock);
+      for(i = 0; i < staging->Count; i++)
+        if(!AemBatchAppendEntry(&report, &staging->Entries[(staging->Head + i) % staging->Capacity]))
+          break;
+      LeaveCriticalSection(&staging->Lock);
+
+      batchSize = report.Count;
+      if(batchSize == 0) {
+        LeaveCriticalSection(&staging->SendLock);
+        break;
+      }
+
+      isSent = GetFeature(staging->Device, &report, AemBatchSize(&report));
+      if(isSent) {
+        EnterCriticalSection(&staging->Lock);
+        staging->Head = (staging->Head + report.Count) % staging->Capacity;
+        staging->Count -= report.Count;
+        if(staging->Count == 0)
+          SetEvent(staging->Empty);
+        LeaveCriticalSection(&staging->Lock);
+      }
+      LeaveCriticalSection(&staging->SendLock);
+
+      if(isSent) {
+        if(report.Count > 0)
+          ReleaseSemaphore(staging->Slots, report.Count, NULL);
+
+        /* Driver takes a message from its queue once per message check interval, so wait until the rejected ones would fit. */
+        if(report.Count < batchSize) {
+          if(AemGetMessageCheckIntervalEx(staging->Device, &interval) == AEMCTL_OK)
+            delay = (batchSize - report.Count) * interval / 1000;
+          else
+            delay = AEM_STAGING_RETRY_DELAY;
+        } else {
+          delay = 0;
+        }
+      } else {
+        delay = AEM_STAGING_RETRY_DELAY;
+      }
+
+      if(delay > 0 && WaitForSingleObject(staging->Stop, delay) == WAIT_OBJECT_0)
+        FreeLibraryAndExitThread(module, 0);
+    }
+  }
+  FreeLibraryAndExitThread(module, 0);
+  return 0;
+}
+
+/** Stops the flusher thread, if it was started, and frees the staging queue along with the moves left in it. 
+ * 
+ * When the module is being unloaded, the flusher is not waited for. Exiting threads take the loader lock,
+ * so waiting under it would deadlock. Flusher pins the module, so in this case the process is exiting,
+ * and the flusher has already been terminated. */
+VOID FreeStaging(PAEM_STAGING staging, BOOL isDetaching) {
+  if(staging->Thread != NULL) {
+    SetEvent(staging->Stop);
+    if(!isDetaching)
+      WaitForSingleObject(staging->Thread, INFINITE);
+    CloseHandle(staging->Thread);
+  }
+  if(staging->Stop != NULL)
+    CloseHandle(staging->Stop);
+  if(staging->Empty != NULL)
+    CloseHandle(staging->Empty);
+  if(staging->Staged != NULL)
+    CloseHandle(staging->Staged);
+  if(staging->Slots != NULL)
+    CloseHandle(staging->Slots);
+  if(staging->Entries != NULL)
+    HeapFree(Heap, 0, staging->Entries);
+  DeleteCriticalSection(&staging->SendLock);
+  DeleteCriticalSection(&staging->Lock);
+  HeapFree(Heap, 0, staging);
+}
+
+/** Drops all staged entries. Batch being sent by the flusher is waited for, and the flusher won't send 
+ * another one until the caller leaves SendLock, which the caller must do. */
+VOID DiscardStaging(PAEM_STAGING staging) {
+  int count;
+
+  EnterCriticalSection(&staging->SendLock);
+  EnterCriticalSection(&staging->Lock);
+  count = staging->Count;
+  staging->Head = (staging->Head + count) % staging->Capacity;
+  staging->Count = 0;
+  SetEvent(staging->Empty);
+  LeaveCriticalSection(&staging->Lock);
+  if(count > 0)
+    ReleaseSemaphore(staging->Slots, count, NULL);
+}
+
+/** Creates a staging queue and starts its flusher thread. */
+AEMCTLRESULT CreateStaging(AEMHANDLE device, int capacity, int timeout, PAEM_STAGING* result) {
+  PAEM_STAGING staging;
+
+  staging = (PAEM_STAGING) HeapAlloc(Heap, HEAP_ZERO_MEMORY, sizeof(AEM_STAGING));
+  if(staging == NULL) {
+    SetLastErrorMessage(OutOfMemory);
+    return AEMCTL_INIT_FAILED;
+  }
+  InitializeCriticalSection(&staging->Lock);
+  InitializeCriticalSection(&staging->SendLock);
+  staging->Device = device;
+  staging->Capacity = capacity;
+  staging->Timeout = timeout;
+
+  staging->Entries = (PAEM_MOVE_ENTRY) HeapAlloc(Heap, 0, capacity * sizeof(AEM_MOVE_ENTRY));
+  if(staging->Entries == NULL) {
+    SetLastErrorMessage(OutOfMemory);
+    FreeStaging(staging, FALSE);
+    return AEMCTL_INIT_FAILED;
+  }
+
+  staging->Slots = CreateSemaphore(NULL, capacity, capacity, NULL);
+  if(staging->Slots == NULL) {
+    WinApiCallFailed("CreateSemaphore");
+    FreeStaging(staging, FALSE);
+    return AEMCTL_INIT_FAILED;
+  }
+
+  if((staging->Staged = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL ||
+     (staging->Empty = CreateEvent(NULL, TRUE, TRUE, NULL)) == NULL ||
+     (staging->Stop = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL) {
+    WinApiCallFailed("CreateEvent");
+    FreeStaging(staging, FALSE);
+    return AEMCTL_INIT_FAILED;
+  }
+
+  if(!GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCSTR) StagingFlusher, &staging->Module)) {
+    WinApiCallFailed("GetModuleHandleEx");
+    FreeStaging(staging, FALSE);
+    return AEMCTL_INIT_FAILED;
+  }
+
+  staging->Thread = CreateThread(NULL, 0, StagingFlusher, staging, 0, NULL);
+  if(staging->Thread == NULL) {
+    WinApiCallFailed("CreateThread");
+    FreeLibrary(staging->Module);
+    FreeStaging(staging, FALSE);
+    return AEMCTL_INIT_FAILED;
+  }
+
+  *result = staging;
+  return AEMCTL_OK;
+}
+
+/** Puts entries into the staging queue, waiting for room as configured. Entries must be valid. */
+AEMCTLRESULT StageEntries(AEMHANDLE device, const AEM_MOVE_ENTRY* entries, int count, int* accepted) {
+  PAEM_STAGING staging = device->Staging;
+  BOOL         wasEmpty;
+  int          i;
+
+  for(i = 0; i < count; i++) {
+    if(WaitForSingleObject(staging->Slots, staging->Timeout == AEMCTL_INFINITE ? INFINITE : (DWORD) staging->Timeout) != WAIT_OBJECT_0) {
+      SetLastErrorMessage(QueueFull);
+      return AEMCTL_QUEUE_FULL;
+    }
+
+    EnterCriticalSection(&staging->Lock);
+    staging->Entries[(staging->Head + staging->Count) % staging->Capacity] = entries[i];
+    wasEmpty = staging->Count++ == 0;
+    if(wasEmpty)
+      ResetEvent(staging->Empty);
+    LeaveCriticalSection(&staging->Lock);
+
+    /* Flusher keeps going while the ring is not empty, so it only needs waking up when the first move arrives. */
+    if(wasEmpty)
+      SetEvent(staging->Staged);
+
+    if(accepted != NULL)
+      (*accepted)++;
+  }
+  return AEMCTL_OK;
+}
+
+/** Writes entries into the submission channel, and wakes the driver up if it has gone idle. Entries must be valid. */
+AEMCTLRESULT WriteChannel(AEMHANDLE device, const AEM_MOVE_ENTRY* entries, int count, int* accepted) {
+  AEM_CHANNEL_FEATURE_REPORT report;
+  ULONG                      written;
+
+  written = AemChannelWrite(device->Channel, entries, count);
+  if(accepted != NULL)
+    *accepted += written;
+
+  if(AemChannelNeedsWake(device->Channel)) {
+    report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+    report.Report.ControlCode = AEM_CONTROL_CODE_CHANNEL;
+    report.Flags = AEM_CHANNEL_WAKE;
+    if(!GetFeature(device, &report, sizeof(report)))
+      return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  if((int) written < count) {
+    SetLastErrorMessage(QueueFull);
+    return AEMCTL_QUEUE_FULL;
+  }
+  return AEMCTL_OK;
+}
+
+/** Sends entries to the driver in order, through the staging queue or the submission channel if enabled, 
+ * or in batches otherwise. Entries must be valid. Accepted count is added to. */
+AEMCTLRESULT SendEntries(AEMHANDLE device, const AEM_MOVE_ENTRY* entries, int count, int* accepted) {
+  AEM_BATCH_FEATURE_REPORT report;
+  int                      sent, batchSize, i;
+
+  if(device->Staging != NULL)
+    return StageEntries(device, entries, count, accepted);
+
+  if(device->Channel != NULL)
+    return WriteChannel(device, entries, count, accepted);
+
+  for(sent = 0; sent < count; sent += report.Count) {
+    AemBatchInit(&report);
+    for(i = sent; i < count; i++)
+      if(!AemBatchAppendEntry(&report, &entries[i]))
+        break;
+    batchSize = report.Count;
+
+    if(!GetFeature(device, &report, AemBatchSize(&report))) {
+      return AEMCTL_COMMUNICATION_FAILED;
+    }
+
+    if(accepted != NULL)
+      *accepted += report.Count;
+
+    if(report.Count < batchSize) {
+      SetLastErrorMessage(QueueFull);
+      return AEMCTL_QUEUE_FULL;
+    }
+  }
+
+  return AEMCTL_OK;
+}
+
+/** Packs a move into an entry of the wire format. */
+VOID PackMove(const AEM_MOVE* move, PAEM_MOVE_ENTRY entry) {
+  entry->Flags = move->isAbsolute ? AEM_MOVE_ABSOLUTE : 0;
+  entry->Buttons = move->buttons;
+  entry->Point.X = (SHORT) move->x;
+  entry->Point.Y = (SHORT) move->y;
+}
+
+/** Packs a key event into an entry of the wire format. */
+VOID PackKey(const AEM_KEY* key, PAEM_MOVE_ENTRY entry) {
+  entry->Flags = (UCHAR) (AEM_MOVE_KEY | (key->isDown ? 0 : AEM_MOVE_KEY_UP));
+  entry->Buttons = (UCHAR) key->key;
+  entry->Point.X = 0;
+  entry->Point.Y = 0;
+}
+
+/** Closes a device. When the module is being unloaded, the threads that could still be using the device 
+ * are gone, and are not waited for, see FreeStaging. */
+VOID CloseDevice(AEMHANDLE device, BOOL isDetaching) {
+  if(device->Staging != NULL)
+    FreeStaging(device->Staging, isDetaching);
+  if(device->Channel != NULL)
+    UnmapViewOfFile(device->Channel);
+
+  /* Driver completes writes right away, so only the routines that are still running are waited for. */
+  while(!isDetaching && device->PendingWrites != 0)
+    Sleep(1);
+
+  CloseHandle(device->File);
+  HeapFree(Heap, 0, device);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemCloseDevice(AEMHANDLE device) {
+  if(!CheckDevice(device))
+    return AEMCTL_INVALID_PARAMETER;
+
+  CloseDevice(device, FALSE);
+  return AEMCTL_OK;
+}
+
+AEMCTLRESULT SendMove(AEMHANDLE device, int x, int y, char buttons, BOOL isAbsolute) {
+  AEM_MOVE_FEATURE_REPORT report;
+  AEM_MOVE                move;
+  AEM_MOVE_ENTRY          entry;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(!CheckBounds(x, y, isAbsolute))
+    return AEMCTL_INVALID_PARAMETER;
+
+  if(device->Staging != NULL || device->Channel != NULL) {
+    move.x = x;
+    move.y = y;
+    move.buttons = buttons;
+    move.isAbsolute = isAbsolute;
+    PackMove(&move, &entry);
+    return SendEntries(device, &entry, 1, NULL);
+  }
+  
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_MOVE;
+  report.Point.X = (SHORT) x;
+  report.Point.Y = (SHORT) y;
+  report.Buttons = buttons;
+  report.Flags = isAbsolute ? AEM_MOVE_ABSOLUTE : 0;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else {
+    if(report.Report.ControlCode == AEM_CONTROL_CODE_MOVE) {
+      return AEMCTL_OK;
+    } else {
+      SetLastErrorMessage(QueueFull);
+      return AEMCTL_QUEUE_FULL;
+    }
+  }
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessageAsyncEx(AEMHANDLE device, const AEM_MOVE* move, AEM_COMPLETION_ROUTINE routine, void* context) {
+  PAEM_ASYNC_WRITE write;
+  PAEM_MOVE_FEATURE_REPORT report;
+  AEMCTLRESULT result;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(move == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  if(!CheckBounds(move->x, move->y, move->isAbsolute))
+    return AEMCTL_INVALID_PARAMETER;
+
+  if(!device->IsAsync) {
+    SetLastErrorMessage(AsyncUnavailable);
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  write = (PAEM_ASYNC_WRITE) HeapAlloc(Heap, HEAP_ZERO_MEMORY, sizeof(AEM_ASYNC_WRITE));
+  if(write == NULL) {
+    SetLastErrorMessage(OutOfMemory);
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+  write->Device = device;
+  write->Routine = routine;
+  write->Context = context;
+
+  report = (PAEM_MOVE_FEATURE_REPORT) write->Report;
+  report->Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report->Report.ControlCode = AEM_CONTROL_CODE_MOVE;
+  report->Point.X = (SHORT) move->x;
+  report->Point.Y = (SHORT) move->y;
+  report->Buttons = move->buttons;
+  report->Flags = move->isAbsolute ? AEM_MOVE_ABSOLUTE : 0;
+
+  /* Completion is posted to the thread pool both when the write is pending and when it has succeeded right away. 
+   * Failures reported right away are not posted. */
+  InterlockedIncrement(&device->PendingWrites);
+  if(!WriteFile(device->File, write->Report, sizeof(write->Report), NULL, &write->Overlapped) && GetLastError() != ERROR_IO_PENDING) {
+    if(GetLastError() == ERROR_NO_SYSTEM_RESOURCES) {
+      SetLastErrorMessage(QueueFull);
+      result = AEMCTL_QUEUE_FULL;
+    } else {
+      WinApiCallFailed("WriteFile");
+      result = AEMCTL_COMMUNICATION_FAILED;
+    }
+    HeapFree(Heap, 0, write);
+    InterlockedDecrement(&device->PendingWrites);
+    return result;
+  }
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessageEx(AEMHANDLE device, int x, int y, char buttons) {
+  return SendMove(device, x, y, buttons, FALSE);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendAbsoluteMessageEx(AEMHANDLE device, int x, int y, char buttons) {
+  return SendMove(device, x, y, buttons, TRUE);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendGlideEx(AEMHANDLE device, int x, int y, char buttons, int duration, AEMCTLEASING easing, AEMCTLGLIDE kind) {
+  AEM_GLIDE_FEATURE_REPORT report;
+  int                      limit;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(duration < 0 || easing < AEMCTL_EASING_LINEAR || easing > AEMCTL_EASING_MINIMUM_JERK || kind < AEMCTL_GLIDE_RELATIVE || kind > AEMCTL_GLIDE_BY) {
+    SetLastErrorMessage(GlideInvalid);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  if(kind == AEMCTL_GLIDE_TO) {
+    if(!CheckBounds(x, y, TRUE))
+      return AEMCTL_INVALID_PARAMETER;
+  } else {
+    limit = (kind == AEMCTL_GLIDE_RELATIVE) ? 32767 : 32766;
+    if(x < -limit || x > limit || y < -limit || y > limit) {
+      SetLastErrorMessage(GlideDeltaOutOfBounds);
+      return AEMCTL_INVALID_PARAMETER;
+    }
+  }
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_GLIDE;
+  report.Flags = 0;
+  if(kind != AEMCTL_GLIDE_TO)
+    report.Flags |= AEM_GLIDE_DELTA;
+  if(kind != AEMCTL_GLIDE_RELATIVE)
+    report.Flags |= AEM_GLIDE_ABSOLUTE;
+  report.Buttons = buttons;
+  report.Point.X = (SHORT) x;
+  report.Point.Y = (SHORT) y;
+  report.Easing = (UCHAR) easing;
+  report.Duration = duration;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else {
+    if(report.Report.ControlCode == AEM_CONTROL_CODE_GLIDE) {
+      return AEMCTL_OK;
+    } else {
+      SetLastErrorMessage(QueueFull);
+      return AEMCTL_QUEUE_FULL;
+    }
+  }
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessagesEx(AEMHANDLE device, const AEM_MOVE* moves, int count, int* accepted) {
+  AEM_MOVE_ENTRY           entries[AEM_MAX_BATCH_SIZE];
+  AEMCTLRESULT             result;
+  int                      sent, chunk, i;
+
+  if(accepted != NULL)
+    *accepted = 0;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(moves == NULL && count > 0) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  for(i = 0; i < count; i++)
+    if(!CheckBounds(moves[i].x, moves[i].y, moves[i].isAbsolute))
+      return AEMCTL_INVALID_PARAMETER;
+
+  for(sent = 0; sent < count; sent += chunk) {
+    chunk = min(count - sent, AEM_MAX_BATCH_SIZE);
+    for(i = 0; i < chunk; i++)
+      PackMove(&moves[sent + i], &entries[i]);
+    if((result = SendEntries(device, entries, chunk, accepted)) != AEMCTL_OK)
+      return result;
+  }
+
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendScrollEx(AEMHANDLE device, int wheel, int pan, char buttons, int isAbsolute) {
+  AEM_MOVE_ENTRY entry;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(wheel < -AEM_MAX_WHEEL_DELTA || wheel > AEM_MAX_WHEEL_DELTA || pan < -AEM_MAX_WHEEL_DELTA || pan > AEM_MAX_WHEEL_DELTA) {
+    SetLastErrorMessage(ScrollOutOfBounds);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  if(!(device->Flags & AEM_FLAG_WHEEL)) {
+    SetLastErrorMessage(WheelUnavailable);
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  entry.Flags = (UCHAR) (AEM_MOVE_SCROLL | (isAbsolute ? AEM_MOVE_ABSOLUTE : 0));
+  entry.Buttons = buttons;
+  entry.Point.X = (SHORT) pan;
+  entry.Point.Y = (SHORT) wheel;
+  return SendEntries(device, &entry, 1, NULL);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendKeysEx(AEMHANDLE device, const AEM_KEY* keys, int count, int* accepted) {
+  AEM_MOVE_ENTRY           entries[AEM_MAX_BATCH_SIZE];
+  AEMCTLRESULT             result;
+  int                      sent, chunk, i;
+
+  if(accepted != NULL)
+    *accepted = 0;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(keys == NULL && count > 0) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  for(i = 0; i < count; i++) {
+    if(keys[i].key < AEMCTL_KEY_ALL || keys[i].key > AEM_MAX_KEY || (keys[i].key == AEMCTL_KEY_ALL && keys[i].isDown)) {
+      SetLastErrorMessage(KeyInvalid);
+      return AEMCTL_INVALID_PARAMETER;
+    }
+  }
+
+  if(!(device->Flags & AEM_FLAG_KEYBOARD)) {
+    SetLastErrorMessage(KeyboardUnavailable);
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  for(sent = 0; sent < count; sent += chunk) {
+    chunk = min(count - sent, AEM_MAX_BATCH_SIZE);
+    for(i = 0; i < chunk; i++)
+      PackKey(&keys[sent + i], &entries[i]);
+    if((result = SendEntries(device, entries, chunk, accepted)) != AEMCTL_OK)
+      return result;
+  }
+
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendKeyEx(AEMHANDLE device, int key, int isDown) {
+  AEM_KEY event;
+
+  event.key = key;
+  event.isDown = isDown;
+  return AemSendKeysEx(device, &event, 1, NULL);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendTimedMessagesEx(AEMHANDLE device, const AEM_TIMED_MOVE* moves, int count, long long startTime, int* accepted) {
+  AEM_TIMED_BATCH_FEATURE_REPORT report;
+  PAEM_TIMED_ENTRY               entry;
+  ULONGLONG                      time;
+  FILETIME                       now;
+  int                            sent, batchSize, i;
+
+  if(accepted != NULL)
+    *accepted = 0;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(moves == NULL && count > 0) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  time = 0;
+  for(i = 0; i < count; i++) {
+    if(!(moves[i].flags & AEMCTL_WAIT) && !CheckBounds(moves[i].x, moves[i].y, moves[i].flags & AEMCTL_ABSOLUTE))
+      return AEMCTL_INVALID_PARAMETER;
+    time = (moves[i].flags & AEMCTL_FROM_START) ? moves[i].time : time + moves[i].time;
+    if(time > 0xFFFFFFFF) {
+      SetLastErrorMessage(SequenceTooLong);
+      return AEMCTL_INVALID_PARAMETER;
+    }
+  }
+
+  /* All batches share the same start time, so that the sequence keeps its timeline when split. */
+  if(startTime == 0) {
+    GetSystemTimeAsFileTime(&now);
+    startTime = ((LONGLONG) now.dwHighDateTime << 32) | now.dwLowDateTime;
+  }
+
+  time = 0;
+  for(sent = 0; sent < count; sent += report.Count) {
+    report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+    report.Report.ControlCode = AEM_CONTROL_CODE_TIMED_BATCH;
+    report.StartTime = startTime;
+    report.Count = 0;
+    for(i = sent; i < count && report.Count < AEM_MAX_TIMED_BATCH_SIZE; i++) {
+      time = (moves[i].flags & AEMCTL_FROM_START) ? moves[i].time : time + moves[i].time;
+      entry = &report.Entries[report.Count++];
+      entry->Flags = 0;
+      if(moves[i].flags & AEMCTL_WAIT)
+        entry->Flags |= AEM_TIMED_WAIT;
+      if(moves[i].flags & AEMCTL_ABSOLUTE)
+        entry->Flags |= AEM_TIMED_ABSOLUTE;
+      entry->Buttons = moves[i].buttons;
+      entry->Point.X = (SHORT) moves[i].x;
+      entry->Point.Y = (SHORT) moves[i].y;
+      /* First entry of a batch can't refer to the previous one, so it is anchored to the sequence start. */
+      if(i == sent) {
+        entry->Flags |= AEM_TIMED_FROM_START;
+        entry->Time = (DWORD32) time;
+      } else {
+        if(moves[i].flags & AEMCTL_FROM_START)
+          entry->Flags |= AEM_TIMED_FROM_START;
+        entry->Time = moves[i].time;
+      }
+    }
+    batchSize = report.Count;
+
+    if(!GetFeature(device, &report, AEM_TIMED_BATCH_FEATURE_REPORT_SIZE(batchSize))) {
+      return AEMCTL_COMMUNICATION_FAILED;
+    }
+
+    if(accepted != NULL)
+      *accepted += report.Count;
+
+    if(report.Count < batchSize) {
+      SetLastErrorMessage(QueueFull);
+      return AEMCTL_QUEUE_FULL;
+    }
+  }
+
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI const char* AEMCTLAPIENTRY AemGetLastErrorString(void) {
+  PAEM_THREAD_STATE state = GetThreadState();
+
+  if(state == NULL)
+    return OutOfMemory;
+
+  if(state->ErrorMessage == NULL) {
+    wsprintf(state->ErrorMessageBuffer, "%s failed with error code 0x%x", state->FailedFunction, state->ErrorCode);
+    state->ErrorMessage = state->ErrorMessageBuffer;
+  }
+  return state->ErrorMessage;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetDeviceInfoEx(AEMHANDLE device, int* isRelative, int* queueCapacity) {
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(isRelative == NULL || queueCapacity == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  *isRelative = (device->Flags & AEM_FLAG_RELATIVE) != 0;
+  *queueCapacity = device->QueueCapacity;
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemClearMessageQueueEx(AEMHANDLE device) {
+  AEM_FEATURE_REPORT report;
+  BOOL               isCleared;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  /* Staged moves would otherwise reach the driver after the clear. */
+  if(device->Staging != NULL)
+    DiscardStaging(device->Staging);
+
+  report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.ControlCode = AEM_CONTROL_CODE_CLEAR_QUEUE;
+  isCleared = GetFeature(device, &report, sizeof(report));
+
+  if(device->Staging != NULL)
+    LeaveCriticalSection(&device->Staging->SendLock);
+
+  if(!isCleared) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else
+    return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMergedCountEx(AEMHANDLE device, int* merged) {
+  AEM_DWORD_FEATURE_REPORT report;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(merged == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_MERGED;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else {
+    *merged = report.Value;
+    return AEMCTL_OK;
+  }
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageQueueSizeEx(AEMHANDLE device, int* size) {
+  AEM_DWORD_FEATURE_REPORT report;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(size == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_QUEUE_SIZE;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else {
+    *size = report.Value;
+    return AEMCTL_OK;
+  }
+}
+
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageCheckIntervalEx(AEMHANDLE device, int* interval) {
+  AEM_DWORD_FEATURE_REPORT report;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(interval == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_INTERVAL;
+  report.Value = 0;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else {
+    *interval = report.Value;
+    return AEMCTL_OK;
+  }
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageCheckIntervalEx(AEMHANDLE device, int interval) {
+  AEM_DWORD_FEATURE_REPORT report;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_INTERVAL;
+  report.Value = interval;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else {
+    if(report.Report.ControlCode == AEM_CONTROL_CODE_INTERVAL) {
+      return AEMCTL_OK;
+    } else {
+      SetLastErrorMessage(MessageCheckIntervalTooSmall);
+      return AEMCTL_INVALID_PARAMETER;
+    }
+  }
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetReadTimerStatsEx(AEMHANDLE device, int* ticks, int* rearms) {
+  AEM_READ_TIMER_FEATURE_REPORT report;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(ticks == NULL || rearms == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_READ_TIMER;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else {
+    *ticks = report.Ticks;
+    *rearms = report.Rearms;
+    return AEMCTL_OK;
+  }
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetLatencyHistogramEx(AEMHANDLE device, AEM_LATENCY_HISTOGRAM* histogram, int reset) {
+  AEM_STATS_FEATURE_REPORT report;
+  int i;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(histogram == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_STATS;
+  report.Flags = reset ? AEM_STATS_RESET : 0;
+
+  if(!GetFeature(device, &report, sizeof(report)))
+    return AEMCTL_COMMUNICATION_FAILED;
+
+  histogram->count = report.LatencyCount;
+  histogram->max = report.LatencyMax;
+  histogram->sum = report.LatencySum;
+  for(i = 0; i < AEMCTL_LATENCY_BUCKETS; i++) {
+    histogram->lowerBounds[i] = AemHistogramBucketLowerBound(i);
+    histogram->buckets[i] = report.LatencyBuckets[i];
+  }
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemMapStatisticsEx(AEMHANDLE device, const volatile AEM_STATISTICS** statistics) {
+  AEM_DWORD_FEATURE_REPORT report;
+  CHAR name[64];
+  HANDLE mapping;
+  const volatile AEM_STATS_PAGE* page;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(statistics == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_STATS_PAGE;
+
+  if(!GetFeature(device, &report, sizeof(report)))
+    return AEMCTL_COMMUNICATION_FAILED;
+  if(report.Report.ControlCode != AEM_CONTROL_CODE_STATS_PAGE) {
+    SetLastErrorMessage(StatisticsUnavailable);
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  /* View keeps the section alive, so the mapping handle is not needed past this point. */
+  wsprintf(name, "Global\\%s%u", AEM_STATS_SECTION_NAME, report.Value);
+  mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name);
+  if(mapping == NULL) {
+    WinApiCallFailed("OpenFileMapping");
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+  page = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(AEM_STATS_PAGE));
+  CloseHandle(mapping);
+  if(page == NULL) {
+    WinApiCallFailed("MapViewOfFile");
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  if(page->Version != AEM_STATS_PAGE_VERSION) {
+    UnmapViewOfFile((LPCVOID) page);
+    SetLastErrorMessage(StatisticsVersionMismatch);
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  *statistics = (const volatile AEM_STATISTICS*) page;
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemUnmapStatistics(const volatile AEM_STATISTICS* statistics) {
+  if(statistics == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  if(!UnmapViewOfFile((LPCVOID) statistics)) {
+    WinApiCallFailed("UnmapViewOfFile");
+    return AEMCTL_INVALID_PARAMETER;
+  }
+  return AEMCTL_OK;
+}
+
+/** Writes the whole buffer into a file. */
+BOOL WriteAll(HANDLE file, LPCVOID buffer, DWORD size) {
+  DWORD written;
+
+  if(!WriteFile(file, buffer, size, &written, NULL) || written != size) {
+    WinApiCallFailed("WriteFile");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSaveTraceEx(AEMHANDLE device, const char* fileName) {
+  AEM_TRACE_FEATURE_REPORT report;
+  AEM_TRACE_FILE_HEADER header;
+  DWORD first = 0, end = 0;
+  BOOL isFirst = TRUE;
+  HANDLE file;
+  AEMCTLRESULT result = AEMCTL_OK;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(fileName == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  file = CreateFile(fileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE) {
+    WinApiCallFailed("CreateFile");
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  /* Header goes first with a zero count, and is rewritten once all the events are in. */
+  ZeroMemory(&header, sizeof(header));
+  header.Magic = AEM_TRACE_FILE_MAGIC;
+  header.Version = AEM_TRACE_FILE_VERSION;
+  if(!WriteAll(file, &header, sizeof(header)))
+    result = AEMCTL_INVALID_PARAMETER;
+
+  /* Stop at the events that were there at the start, so that a busy device doesn't keep us here forever. */
+  while(result == AEMCTL_OK) {
+    report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+    report.Report.ControlCode = AEM_CONTROL_CODE_TRACE;
+    report.First = first;
+    if(!GetFeature(device, &report, sizeof(report))) {
+      result = AEMCTL_COMMUNICATION_FAILED;
+      break;
+    }
+    if(isFirst) {
+      header.Now = report.Now;
+      end = report.Next;
+      isFirst = FALSE;
+    }
+    header.Lost += report.First - first;
+    header.Count += report.Count;
+    if(!WriteAll(file, report.Events, report.Count * sizeof(AEM_TRACE_EVENT))) {
+      result = AEMCTL_INVALID_PARAMETER;
+      break;
+    }
+    first = report.First + report.Count;
+    if(report.Count == 0 || (LONG) (end - first) <= 0)
+      break;
+  }
+
+  if(result == AEMCTL_OK) {
+    if(SetFilePointer(file, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+      WinApiCallFailed("SetFilePointer");
+      result = AEMCTL_INVALID_PARAMETER;
+    } else if(!WriteAll(file, &header, sizeof(header))) {
+      result = AEMCTL_INVALID_PARAMETER;
+    }
+  }
+  CloseHandle(file);
+  return result;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemEnableChannelEx(AEMHANDLE device, int enabled) {
+  AEM_CHANNEL_FEATURE_REPORT report;
+  CHAR name[64];
+  HANDLE mapping;
+  PAEM_CHANNEL_PAGE page;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(!enabled) {
+    if(device->Channel != NULL) {
+      UnmapViewOfFile(device->Channel);
+      device->Channel = NULL;
+    }
+    return AEMCTL_OK;
+  }
+
+  if(device->Channel != NULL)
+    return AEMCTL_OK;
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_CHANNEL;
+  report.Flags = 0;
+
+  if(!GetFeature(device, &report, sizeof(report)))
+    return AEMCTL_COMMUNICATION_FAILED;
+  if(report.Report.ControlCode != AEM_CONTROL_CODE_CHANNEL) {
+    SetLastErrorMessage(ChannelUnavailable);
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  /* View keeps the section alive, so the mapping handle is not needed past this point. */
+  wsprintf(name, "Global\\%s%u", AEM_CHANNEL_SECTION_NAME, report.PageId);
+  mapping = OpenFileMapping(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name);
+  if(mapping == NULL) {
+    WinApiCallFailed("OpenFileMapping");
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+  page = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(AEM_CHANNEL_PAGE));
+  CloseHandle(mapping);
+  if(page == NULL) {
+    WinApiCallFailed("MapViewOfFile");
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  if(page->Version != AEM_CHANNEL_PAGE_VERSION || page->Capacity != AEM_CHANNEL_SIZE) {
+    UnmapViewOfFile(page);
+    SetLastErrorMessage(ChannelVersionMismatch);
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  device->Channel = page;
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetStagingEx(AEMHANDLE device, int capacity, int timeout) {
+  PAEM_STAGING staging;
+  AEMCTLRESULT result;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(capacity < 0 || timeout < AEMCTL_INFINITE) {
+    SetLastErrorMessage(StagingInvalid);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  /* Same capacity keeps the staged moves. */
+  if(device->Staging != NULL && device->Staging->Capacity == capacity) {
+    device->Staging->Timeout = timeout;
+    return AEMCTL_OK;
+  }
+
+  if(device->Staging != NULL) {
+    FreeStaging(device->Staging, FALSE);
+    device->Staging = NULL;
+  }
+
+  if(capacity == 0)
+    return AEMCTL_OK;
+
+  result = CreateStaging(device, capacity, timeout, &staging);
+  if(result == AEMCTL_OK)
+    device->Staging = staging;
+  return result;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemFlushStagingEx(AEMHANDLE device, int timeout) {
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(timeout < AEMCTL_INFINITE) {
+    SetLastErrorMessage(StagingInvalid);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  if(device->Staging == NULL)
+    return AEMCTL_OK;
+
+  if(WaitForSingleObject(device->Staging->Empty, timeout == AEMCTL_INFINITE ? INFINITE : (DWORD) timeout) != WAIT_OBJECT_0) {
+    SetLastErrorMessage(QueueFull);
+    return AEMCTL_QUEUE_FULL;
+  }
+  return AEMCTL_OK;
+}
+
+/** Sends a catch-up feature report and fetches the resulting settings back. */
+AEMCTLRESULT CatchUpRequest(AEMHANDLE device, UCHAR flags, int threshold, int* enabled, int* resultThreshold) {
+  AEM_CATCH_UP_FEATURE_REPORT report;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_CATCH_UP;
+  report.Flags = flags;
+  report.Threshold = threshold;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  if(enabled != NULL)
+    *enabled = (report.Flags & AEM_CATCH_UP_ENABLED) != 0;
+  if(resultThreshold != NULL)
+    *resultThreshold = report.Threshold;
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetCatchUpEx(AEMHANDLE device, int enabled, int threshold) {
+  if(threshold < 0) {
+    SetLastErrorMessage(ThresholdNegative);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  return CatchUpRequest(device, (UCHAR) (AEM_CATCH_UP_UPDATE | (enabled ? AEM_CATCH_UP_ENABLED : 0)), threshold, NULL, NULL);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetCatchUpEx(AEMHANDLE device, int* enabled, int* threshold) {
+  if(enabled == NULL || threshold == NULL) {
+    SetLastErrorMessage(NullPassed);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  return CatchUpRequest(device, 0, 0, enabled, threshold);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetPacingEx(AEMHANDLE device, int enabled, int minInterval, int maxInterval, int targetDepth) {
+  AEM_PACING_FEATURE_REPORT report;
+
+  if(minInterval < 0 || maxInterval < minInterval || targetDepth < 0) {
+    SetLastErrorMessage(PacingInvalid);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_PACING;
+  report.Flags = (UCHAR) (AEM_PACING_UPDATE | (enabled ? AEM_PACING_ENABLED : 0));
+  report.MinInterval = minInterval;
+  report.MaxInterval = maxInterval;
+  report.TargetDepth = targetDepth;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else if(report.Report.ControlCode != AEM_CONTROL_CODE_PACING) {
+    SetLastErrorMessage(PacingInvalid);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetPacingEx(AEMHANDLE device, int* enabled, int* minInterval, int* maxInterval, int* targetDepth, int* interval) {
+  AEM_PACING_FEATURE_REPORT report;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_PACING;
+  report.Flags = 0;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  }
+
+  if(enabled != NULL)
+    *enabled = (report.Flags & AEM_PACING_ENABLED) != 0;
+  if(minInterval != NULL)
+    *minInterval = report.MinInterval;
+  if(maxInterval != NULL)
+    *maxInterval = report.MaxInterval;
+  if(targetDepth != NULL)
+    *targetDepth = report.TargetDepth;
+  if(interval != NULL)
+    *interval = report.Interval;
+  return AEMCTL_OK;
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageQueueCapacityEx(AEMHANDLE device, int capacity) {
+  AEM_DWORD_FEATURE_REPORT report;
+
+  if(!CheckDevice(device))
+    return AEMCTL_INIT_FAILED;
+
+  if(capacity <= 0) {
+    SetLastErrorMessage(QueueCapacityInvalid);
+    return AEMCTL_INVALID_PARAMETER;
+  }
+
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_CAPACITY;
+  report.Value = capacity;
+
+  if(!GetFeature(device, &report, sizeof(report))) {
+    return AEMCTL_COMMUNICATION_FAILED;
+  } else {
+    if(report.Report.ControlCode == AEM_CONTROL_CODE_CAPACITY) {
+      device->QueueCapacity = report.Value;
+      return AEMCTL_OK;
+    } else {
+      SetLastErrorMessage(QueueCapacityInvalid);
+      return AEMCTL_INVALID_PARAMETER;
+    }
+  }
+}
+
+
+/* Functions operating on the default device. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessage(int x, int y, char buttons) {
+  return AemSendMessageEx(GetDefaultDevice(), x, y, buttons);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendAbsoluteMessage(int x, int y, char buttons) {
+  return AemSendAbsoluteMessageEx(GetDefaultDevice(), x, y, buttons);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendGlide(int x, int y, char buttons, int duration, AEMCTLEASING easing, AEMCTLGLIDE kind) {
+  return AemSendGlideEx(GetDefaultDevice(), x, y, buttons, duration, easing, kind);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessages(const AEM_MOVE* moves, int count, int* accepted) {
+  return AemSendMessagesEx(GetDefaultDevice(), moves, count, accepted);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendTimedMessages(const AEM_TIMED_MOVE* moves, int count, long long startTime, int* accepted) {
+  return AemSendTimedMessagesEx(GetDefaultDevice(), moves, count, startTime, accepted);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetDeviceInfo(int* isRelative, int* queueCapacity) {
+  return AemGetDeviceInfoEx(GetDefaultDevice(), isRelative, queueCapacity);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessageAsync(const AEM_MOVE* move, AEM_COMPLETION_ROUTINE routine, void* context) {
+  return AemSendMessageAsyncEx(GetDefaultDevice(), move, routine, context);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendScroll(int wheel, int pan, char buttons, int isAbsolute) {
+  return AemSendScrollEx(GetDefaultDevice(), wheel, pan, buttons, isAbsolute);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendKey(int key, int isDown) {
+  return AemSendKeyEx(GetDefaultDevice(), key, isDown);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendKeys(const AEM_KEY* keys, int count, int* accepted) {
+  return AemSendKeysEx(GetDefaultDevice(), keys, count, accepted);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemClearMessageQueue(void) {
+  return AemClearMessageQueueEx(GetDefaultDevice());
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMergedCount(int* merged) {
+  return AemGetMergedCountEx(GetDefaultDevice(), merged);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageQueueSize(int* size) {
+  return AemGetMessageQueueSizeEx(GetDefaultDevice(), size);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageCheckInterval(int* interval) {
+  return AemGetMessageCheckIntervalEx(GetDefaultDevice(), interval);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageCheckInterval(int interval) {
+  return AemSetMessageCheckIntervalEx(GetDefaultDevice(), interval);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetReadTimerStats(int* ticks, int* rearms) {
+  return AemGetReadTimerStatsEx(GetDefaultDevice(), ticks, rearms);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetLatencyHistogram(AEM_LATENCY_HISTOGRAM* histogram, int reset) {
+  return AemGetLatencyHistogramEx(GetDefaultDevice(), histogram, reset);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemMapStatistics(const volatile AEM_STATISTICS** statistics) {
+  return AemMapStatisticsEx(GetDefaultDevice(), statistics);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSaveTrace(const char* fileName) {
+  return AemSaveTraceEx(GetDefaultDevice(), fileName);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemEnableChannel(int enabled) {
+  return AemEnableChannelEx(GetDefaultDevice(), enabled);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetStaging(int capacity, int timeout) {
+  return AemSetStagingEx(GetDefaultDevice(), capacity, timeout);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemFlushStaging(int timeout) {
+  return AemFlushStagingEx(GetDefaultDevice(), timeout);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetCatchUp(int enabled, int threshold) {
+  return AemSetCatchUpEx(GetDefaultDevice(), enabled, threshold);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetCatchUp(int* enabled, int* threshold) {
+  return AemGetCatchUpEx(GetDefaultDevice(), enabled, threshold);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetPacing(int enabled, int minInterval, int maxInterval, int targetDepth) {
+  return AemSetPacingEx(GetDefaultDevice(), enabled, minInterval, maxInterval, targetDepth);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetPacing(int* enabled, int* minInterval, int* maxInterval, int* targetDepth, int* interval) {
+  return AemGetPacingEx(GetDefaultDevice(), enabled, minInterval, maxInterval, targetDepth, interval);
+}
+
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageQueueCapacity(int capacity) {
+  return AemSetMessageQueueCapacityEx(GetDefaultDevice(), capacity);
+}
@@ -1,98 +1,538 @@
-/* This file is part of Aethered, a collection of virtual device drivers for
- * Windows.
- *
- * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
- *
- * Aethered is free software; you can redistribute it and/or
- * modify it under the terms of the GNU General Public License 
- * as published by the Free Software Foundation; either
- * version 3 of the License, or (at your option) any later version.
- *
- * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
- * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
- * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
- * for more details.
- *
- * You should have received a copy of the GNU General Public License 
- * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
-#ifndef __AEMCTL_H__
-#define __AEMCTL_H__
-
-#ifdef AEMCTLDLL
-#  define AEMCTLAPI __declspec(dllexport)
-#  define AEMCTLAPIENTRY  __cdecl
-#else
-#  define AEMCTLAPI __declspec(dllimport)
-#  define AEMCTLAPIENTRY  __cdecl
-#endif
-
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-typedef enum AEMCTLRESULT_ {
-  AEMCTL_OK = 0,
-  AEMCTL_INIT_FAILED = 1,
-  AEMCTL_INVALID_PARAMETER = 2,
-  AEMCTL_QUEUE_FULL = 3,
-  AEMCTL_COMMUNICATION_FAILED = 4
-} AEMCTLRESULT;
-
-/** This function sends a move mouse message to the arx ethereal mouse device.
- * Note that arx ethereal mouse device maintains a queue of incoming messages 
- * and processes only one message per tick. 
- * 
- * X and y parameters do not correspond to the actual screen size. 
- *
- * If arx ethereal mouse device driver was compiled in relative motion mode,
- * then x and y must be in range [-127, 127].
- *
- * If it was compiled in an absolute motion mode, then a coordinate system with 
- * (1, 1) and (32767, 32767) being the coordinates of upper-left and lower-right 
- * corners of the screen is used instead.
- *
- * @param x                            x coordinate.
- * @param y                            y coordinate.
- * @param buttons                      button flags.
- * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessage(int x, int y, char buttons);
-
-/** Clears the message queue of arx ethereal mouse device.
- *
- * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemClearMessageQueue();
-
-/** Gets current size of the message queue of arx ethereal mouse device.
- * 
- * @param size                         (out) size of the message queue.
- * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageQueueSize(int* size);
-
-/** Gets current message check interval of arx ethereal mouse device.
- *
- * @param interval                     (out) current message check interval of arx ethereal mouse device, int 1/1000000th of a second.
- * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageCheckInterval(int* interval);
-
-/** Sets message check interval of arx ethereal mouse device.
- *
- * @param interval                     new message check interval for arx ethereal mouse device, int 1/1000000th of a second.
- * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageCheckInterval(int interval);
-
-/** This function can be used to obtain information on arx ethereal mouse device.
- * 
- * @param isRelative                   (out) non-zero if arx ethereal mouse was compiled in relative motion mode, zero otherwise.
- * @param maxQueueSize                 (out) message queue capacity.
- * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
-AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetDeviceInfo(int* isRelative, int* queueCapacity);
-
-/** @returns                           textual representation of the last error occurred. */
-AEMCTLAPI const char* AEMCTLAPIENTRY AemGetLastErrorString(void);
-
-
-#ifdef __cplusplus
-}; // extern "C"
-#endif
-
-#endif // __AEMCTL_H__
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEMCTL_H__
+#define __AEMCTL_H__
+
+#ifdef AEMCTLDLL
+#  define AEMCTLAPI __declspec(dllexport)
+#  define AEMCTLAPIENTRY  __cdecl
+#else
+#  define AEMCTLAPI __declspec(dllimport)
+#  define AEMCTLAPIENTRY  __cdecl
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum AEMCTLRESULT_ {
+  AEMCTL_OK = 0,
+  AEMCTL_INIT_FAILED = 1,
+  AEMCTL_INVALID_PARAMETER = 2,
+  AEMCTL_QUEUE_FULL = 3,
+  AEMCTL_COMMUNICATION_FAILED = 4
+} AEMCTLRESULT;
+
+/** Handle to an arx ethereal mouse device, as returned by AemOpenDevice. */
+typedef struct AEM_DEVICE_* AEMHANDLE;
+
+/** Button flags of move messages. */
+#define AEMCTL_BUTTON_LEFT    0x01
+#define AEMCTL_BUTTON_RIGHT   0x02
+#define AEMCTL_BUTTON_MIDDLE  0x04
+#define AEMCTL_BUTTON_BACK    0x08     /**< button 4. */
+#define AEMCTL_BUTTON_FORWARD 0x10     /**< button 5. */
+
+/** Single move message, as passed to AemSendMessages. */
+typedef struct AEM_MOVE_ {
+  int x;                               /**< x coordinate. */
+  int y;                               /**< y coordinate. */
+  char buttons;                        /**< button flags. */
+  int isAbsolute;                      /**< non-zero if (x, y) is an absolute position, zero if it is a delta. */
+} AEM_MOVE;
+
+/** Single key event, as passed to AemSendKeys. */
+typedef struct AEM_KEY_ {
+  int key;                             /**< usage of the key on the Keyboard/Keypad page, e.g. 0x04 for A or 0xE1 for LeftShift. */
+  int isDown;                          /**< non-zero if the key is pressed, zero if it is released. */
+} AEM_KEY;
+
+/** Pseudo-key for AemSendKey and AemSendKeys. Releasing it releases all keys that are held. */
+#define AEMCTL_KEY_ALL 0x00
+
+/** Easing curves for AemSendGlide. */
+typedef enum AEMCTLEASING_ {
+  AEMCTL_EASING_LINEAR = 0,            /**< constant speed. */
+  AEMCTL_EASING_EASE_IN_OUT = 1,       /**< smoothstep, accelerates and then decelerates. */
+  AEMCTL_EASING_MINIMUM_JERK = 2       /**< minimum jerk trajectory, closest to a human hand motion. */
+} AEMCTLEASING;
+
+/** Kinds of glides for AemSendGlide. */
+typedef enum AEMCTLGLIDE_ {
+  AEMCTL_GLIDE_RELATIVE = 0,           /**< (x, y) is a delta, glide is reported as relative motion. */
+  AEMCTL_GLIDE_TO = 1,                 /**< (x, y) is an absolute target. */
+  AEMCTL_GLIDE_BY = 2                  /**< (x, y) is a delta from the last absolute position, glide is reported as absolute motion. */
+} AEMCTLGLIDE;
+
+/** Flags of AEM_TIMED_MOVE. */
+#define AEMCTL_WAIT       0x01         /**< Entry is not a move, it only delays the entries that follow. */
+#define AEMCTL_FROM_START 0x02         /**< Time is counted from the sequence start, not from the previous entry. */
+#define AEMCTL_ABSOLUTE   0x04         /**< (x, y) is an absolute position, not a delta. */
+
+/** Single entry of a timed sequence, as passed to AemSendTimedMessages. */
+typedef struct AEM_TIMED_MOVE_ {
+  int x;                               /**< x coordinate. */
+  int y;                               /**< y coordinate. */
+  char buttons;                        /**< button flags. */
+  unsigned int time;                   /**< due time in 1/1000000th of a second, counted from the previous entry or from the sequence start. */
+  int flags;                           /**< AEMCTL_WAIT, AEMCTL_FROM_START and AEMCTL_ABSOLUTE flags. */
+} AEM_TIMED_MOVE;
+
+/** Called when a message sent with AemSendMessageAsync is processed by the driver. Is called on a thread of the system 
+ * thread pool, and must return quickly, without waiting for other submissions to complete.
+ *
+ * @param result                       AEMCTL_OK if the message was queued, AEMCTL_QUEUE_FULL if the queue was full,
+ *                                     AEMCTL_COMMUNICATION_FAILED if the message did not reach the driver.
+ * @param context                      context passed to AemSendMessageAsync. */
+typedef void (AEMCTLAPIENTRY *AEM_COMPLETION_ROUTINE)(AEMCTLRESULT result, void* context);
+
+/** Number of buckets in AEM_LATENCY_HISTOGRAM. */
+#define AEMCTL_LATENCY_BUCKETS 176
+
+/** Histogram of times messages spent in the message queue of arx ethereal mouse device, as returned by AemGetLatencyHistogram.
+ * Bucket i holds the messages that waited for at least lowerBounds[i] and less than lowerBounds[i + 1] microseconds.
+ * Buckets are exact below 8 microseconds, and are within 1/8 of their lower bound above that. The last bucket also holds
+ * everything that waited longer than 2^24 microseconds. */
+typedef struct AEM_LATENCY_HISTOGRAM_ {
+  unsigned int count;                  /**< number of messages taken from the queue. */
+  unsigned int max;                    /**< longest wait, in 1/1000000th of a second. */
+  unsigned long long sum;              /**< total wait of all messages, in 1/1000000th of a second. */
+  unsigned int lowerBounds[AEMCTL_LATENCY_BUCKETS]; /**< smallest wait that falls into each bucket, in 1/1000000th of a second. */
+  unsigned int buckets[AEMCTL_LATENCY_BUCKETS];     /**< number of messages that fell into each bucket. */
+} AEM_LATENCY_HISTOGRAM;
+
+/** Counters of arx ethereal mouse device, as mapped by AemMapStatistics. The driver updates them as it goes, so they can be 
+ * sampled at any rate without sending any requests to the device. Counters wrap around at 2^32. Every queued message is 
+ * eventually either emitted or dropped, so enqueued - emitted - dropped is the number of messages in the queue. */
+typedef struct AEM_STATISTICS_ {
+  unsigned int version;                /**< layout version, used by aemctl to check the driver. */
+  unsigned int enqueued;               /**< messages accepted into the message queue. */
+  unsigned int emitted;                /**< queued messages taken for emission. Glides take several input reports each. */
+  unsigned int dropped;                /**< queued messages merged into other ones or cleared without being emitted. */
+  unsigned int queueFull;              /**< messages rejected because the message queue was full. */
+  unsigned int highWater;              /**< largest number of messages the message queue has held. */
+  unsigned int emptyTicks;             /**< emission slots that came with nothing to emit. */
+  unsigned int readsServed;            /**< input reports delivered to the system, including timed messages. */
+  unsigned int contentionSpins;        /**< spins of senders waiting for each other or for queue compaction. */
+} AEM_STATISTICS;
+
+/** This function sends a relative move mouse message to the arx ethereal mouse device.
+ * Note that arx ethereal mouse device maintains a queue of incoming messages 
+ * and processes only one message per tick. When the queue is full, the driver
+ * compacts it by merging queued moves with identical button flags. The final 
+ * cursor position and the order of button transitions are preserved.
+ * 
+ * X and y are deltas and must be in range [-127, 127].
+ *
+ * @param x                            x delta.
+ * @param y                            y delta.
+ * @param buttons                      button flags.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessage(int x, int y, char buttons);
+
+/** This function sends an absolute move mouse message to the arx ethereal mouse device.
+ * Relative and absolute messages can be freely interleaved, they share the same message queue.
+ *
+ * X and y parameters do not correspond to the actual screen size. A coordinate system with 
+ * (1, 1) and (32767, 32767) being the coordinates of upper-left and lower-right 
+ * corners of the screen is used instead.
+ *
+ * @param x                            x coordinate.
+ * @param y                            y coordinate.
+ * @param buttons                      button flags.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendAbsoluteMessage(int x, int y, char buttons);
+
+/** This function sends a glide message to the arx ethereal mouse device. Glide occupies a single 
+ * slot in the message queue and is expanded by the driver into one move per tick, 
+ * so that the cursor travels along a straight line in the given time.
+ *
+ * Relative glide is reported as relative motion, and x and y must be in range [-32767, 32767].
+ *
+ * Absolute glide starts at the last absolute position reported by the device, or at (0, 0) if 
+ * nothing was reported yet. For AEMCTL_GLIDE_TO, (x, y) is the target and must satisfy the same 
+ * constraints as for AemSendAbsoluteMessage. For AEMCTL_GLIDE_BY, it is a delta in range [-32766, 32766].
+ *
+ * @param x                            x coordinate of the target, or x delta.
+ * @param y                            y coordinate of the target, or y delta.
+ * @param buttons                      button flags, held during the whole glide.
+ * @param duration                     duration of the glide, in 1/1000000th of a second.
+ * @param easing                       easing curve.
+ * @param kind                         kind of the glide.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendGlide(int x, int y, char buttons, int duration, AEMCTLEASING easing, AEMCTLGLIDE kind);
+
+/** This function sends several move mouse messages to the arx ethereal mouse device.
+ * Messages are packed into batches, so that up to 64 messages are queued in
+ * a single round-trip to the driver. Messages are queued in order, and 
+ * the function stops at the first message that did not fit into the queue.
+ *
+ * Coordinates of each message must satisfy the same constraints as for
+ * AemSendMessage or AemSendAbsoluteMessage, depending on its isAbsolute field. If any of the messages is invalid, nothing is sent.
+ *
+ * @param moves                        array of messages to send.
+ * @param count                        number of messages in the array.
+ * @param accepted                     (out, optional) number of messages that were queued.
+ * @returns                            AEMCTL_OK if all messages were queued, AEMCTL_QUEUE_FULL if only 
+ *                                     some of them were queued, other non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessages(const AEM_MOVE* moves, int count, int* accepted);
+
+/** This function sends a timed sequence of move mouse messages to the arx ethereal mouse device.
+ * Each message is emitted by the driver at its due time, bypassing the message queue and 
+ * the message check interval. Due times are computed from the sequence timeline, so they are 
+ * not affected by delays in the calling thread, e.g. pressing a button, waiting 37 ms 
+ * and then moving is expressed as two entries, with the second one having time = 37000.
+ *
+ * Whole sequence must fit into 2^32 microseconds. Coordinates of each move must satisfy 
+ * the same constraints as for AemSendMessage, or AemSendAbsoluteMessage if AEMCTL_ABSOLUTE is set. If any of the entries is invalid, nothing is sent.
+ *
+ * @param moves                        array of sequence entries.
+ * @param count                        number of entries in the array.
+ * @param startTime                    system time of the sequence start as returned by GetSystemTimeAsFileTime, 
+ *                                     or zero to start right away.
+ * @param accepted                     (out, optional) number of entries that were scheduled.
+ * @returns                            AEMCTL_OK if all entries were scheduled, AEMCTL_QUEUE_FULL if only 
+ *                                     some of them were scheduled, other non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendTimedMessages(const AEM_TIMED_MOVE* moves, int count, long long startTime, int* accepted);
+
+/** Sends a move mouse message to the arx ethereal mouse device without waiting for the driver to process it. 
+ * Message is written as an output report with overlapped I/O, so any number of submissions can be in flight,
+ * and the calling thread is free to prepare the next ones meanwhile. Messages are queued in the order they are sent.
+ * Same constraints apply to the move as for AemSendMessage, or AemSendAbsoluteMessage if its isAbsolute field is set.
+ *
+ * If the function fails, the completion routine is not called. AemCloseDevice waits for the routines of in-flight submissions.
+ *
+ * @param move                         move message.
+ * @param routine                      (optional) routine to call once the driver has processed the message.
+ * @param context                      context to pass to the routine.
+ * @returns                            AEMCTL_OK if the message was sent, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessageAsync(const AEM_MOVE* move, AEM_COMPLETION_ROUTINE routine, void* context);
+
+/** This function sends a scroll message to the arx ethereal mouse device. Scroll occupies a single slot 
+ * in the message queue and is emitted as a single report, however large the deltas are, so there is 
+ * no need to split it into many small messages. The report carries no motion. Deltas are in wheel 
+ * detents, a positive wheel delta scrolls up and a positive pan delta scrolls right. Horizontal pan is 
+ * only supported by Windows Vista and later, earlier versions ignore it.
+ *
+ * @param wheel                        vertical wheel delta, in range [-32767, 32767].
+ * @param pan                          horizontal pan delta, in range [-32767, 32767].
+ * @param buttons                      button flags, held during the scroll.
+ * @param isAbsolute                   non-zero to report the scroll through the absolute pointer, at the last absolute
+ *                                     position, zero to report it through the relative one. Buttons held with absolute
+ *                                     moves should be held through the absolute pointer.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendScroll(int wheel, int pan, char buttons, int isAbsolute);
+
+/** This function sends a key message to the keyboard collection of the arx ethereal mouse device. Key messages
+ * share the message queue with move messages, and are emitted in strict order with them, one per message check 
+ * interval, so that e.g. a click while holding LeftShift can't be reordered by the system. Every key message is
+ * reported as the full state of the keyboard: up to eight modifiers and six other keys can be held at once,
+ * further presses are ignored until some of the keys are released.
+ *
+ * Keys are sent the same way as moves, so they go through the submission channel or the staging queue when 
+ * these are enabled. Clearing the message queue releases all keys that are held.
+ *
+ * @param key                          usage of the key on the Keyboard/Keypad page, in [1, 0xE7], or AEMCTL_KEY_ALL
+ *                                     to release all keys.
+ * @param isDown                       non-zero to press the key, zero to release it. AEMCTL_KEY_ALL can only be released.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendKey(int key, int isDown);
+
+/** This function sends several key messages to the arx ethereal mouse device, see AemSendKey.
+ * Messages are packed into batches in the same way as by AemSendMessages. If any of the messages is invalid, nothing is sent.
+ *
+ * @param keys                         array of key messages to send.
+ * @param count                        number of messages in the array.
+ * @param accepted                     (out, optional) number of messages that were queued.
+ * @returns                            AEMCTL_OK if all messages were queued, AEMCTL_QUEUE_FULL if only 
+ *                                     some of them were queued, other non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendKeys(const AEM_KEY* keys, int count, int* accepted);
+
+/** Clears the message queue of arx ethereal mouse device, along with all the timed messages that are not yet due.
+ *
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemClearMessageQueue();
+
+/** Gets current size of the message queue of arx ethereal mouse device. Timed messages that are not yet due are included.
+ * 
+ * @param size                         (out) size of the message queue.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageQueueSize(int* size);
+
+/** Gets the number of messages merged by arx ethereal mouse device, either when 
+ * compacting the full message queue, or in catch-up mode.
+ *
+ * @param merged                       (out) number of merged messages.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMergedCount(int* merged);
+
+/** Gets current message check interval of arx ethereal mouse device.
+ *
+ * @param interval                     (out) current message check interval of arx ethereal mouse device, int 1/1000000th of a second.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageCheckInterval(int* interval);
+
+/** Sets message check interval of arx ethereal mouse device.
+ *
+ * @param interval                     new message check interval for arx ethereal mouse device, int 1/1000000th of a second.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageCheckInterval(int interval);
+
+/** Changes the capacity of the message queue of arx ethereal mouse device. 
+ * Queued messages are preserved. Capacity is rounded up to the next power of two, 
+ * use AemGetDeviceInfo to obtain the actual value.
+ *
+ * @param capacity                     new message queue capacity, in [1, 262144].
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. 
+ *                                     AEMCTL_INVALID_PARAMETER is returned if the capacity is out of range,
+ *                                     is less than the number of queued messages, or if the driver is out of memory. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageQueueCapacity(int capacity);
+
+/** Configures catch-up mode of arx ethereal mouse device. In catch-up mode, while the message queue 
+ * holds more than the given number of messages, consecutive moves with identical button flags 
+ * are merged into a single report. Relative deltas are summed, and whatever doesn't fit 
+ * into [-127, 127] is carried over to the next report. For absolute moves intermediate positions are skipped.
+ * Moves are never merged across button transitions or between relative and absolute moves.
+ *
+ * @param enabled                      non-zero to enable catch-up mode, zero to disable it.
+ * @param threshold                    queue size above which moves are merged.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetCatchUp(int enabled, int threshold);
+
+/** Gets catch-up mode settings of arx ethereal mouse device.
+ *
+ * @param enabled                      (out) non-zero if catch-up mode is enabled, zero otherwise.
+ * @param threshold                    (out) queue size above which moves are merged.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetCatchUp(int* enabled, int* threshold);
+
+/** Configures adaptive pacing of arx ethereal mouse device. With adaptive pacing, emission slots are spaced 
+ * by an interval that shortens towards minInterval while the message queue holds more than targetDepth messages, 
+ * and relaxes back towards maxInterval once it drains to targetDepth / 2 or below. Message check interval 
+ * is not used for emission slots while adaptive pacing is enabled. Interval starts at maxInterval.
+ *
+ * @param enabled                      non-zero to enable adaptive pacing, zero to disable it.
+ * @param minInterval                  shortest interval, in 1/1000000th of a second, not less than the minimal message check interval.
+ * @param maxInterval                  longest interval, in 1/1000000th of a second, not less than minInterval.
+ * @param targetDepth                  queue size above which the interval shortens.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetPacing(int enabled, int minInterval, int maxInterval, int targetDepth);
+
+/** Gets adaptive pacing settings of arx ethereal mouse device. Any of the pointers may be NULL.
+ *
+ * @param enabled                      (out) non-zero if adaptive pacing is enabled, zero otherwise.
+ * @param minInterval                  (out) shortest interval, in 1/1000000th of a second.
+ * @param maxInterval                  (out) longest interval, in 1/1000000th of a second.
+ * @param targetDepth                  (out) queue size above which the interval shortens.
+ * @param interval                     (out) interval currently used for emission slots, in 1/1000000th of a second.
+ *                                     Same as message check interval if adaptive pacing is disabled.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetPacing(int* enabled, int* minInterval, int* maxInterval, int* targetDepth, int* interval);
+
+/** This function can be used to obtain information on arx ethereal mouse device.
+ * 
+ * @param isRelative                   (out) non-zero if arx ethereal mouse supports relative motion, zero otherwise.
+ *                                     Current driver supports both relative and absolute motion.
+ * @param maxQueueSize                 (out) message queue capacity.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetDeviceInfo(int* isRelative, int* queueCapacity);
+
+/** Gets read timer statistics of arx ethereal mouse device. A single periodic read timer paces input reports 
+ * while the message queue is not empty. A rearm means that the timer had to be moved off its period,
+ * because the interval changed or is not a whole number of milliseconds.
+ *
+ * @param ticks                        (out) number of timer periods that completed read requests.
+ * @param rearms                       (out) number of times the timer was moved off its period.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetReadTimerStats(int* ticks, int* rearms);
+
+/** Gets the histogram of times messages spent in the message queue of arx ethereal mouse device, 
+ * from the moment they were queued to the moment they were taken for an input report. Moves merged 
+ * by catch-up mode are counted separately, timed messages bypass the queue and are not counted.
+ *
+ * @param histogram                    (out) latency histogram.
+ * @param reset                        non-zero to reset the histogram once it is read, zero otherwise.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetLatencyHistogram(AEM_LATENCY_HISTOGRAM* histogram, int reset);
+
+/** Maps the counters of arx ethereal mouse device into the address space of the calling process, read-only. 
+ * Mapping stays valid until it is unmapped with AemUnmapStatistics, even if the device is removed in the meantime.
+ *
+ * @param statistics                   (out) pointer to the mapped counters.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemMapStatistics(const volatile AEM_STATISTICS** statistics);
+
+/** Unmaps the counters mapped with AemMapStatistics.
+ *
+ * @param statistics                   pointer to the mapped counters.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemUnmapStatistics(const volatile AEM_STATISTICS* statistics);
+
+/** Saves the trace of arx ethereal mouse device into a binary dump file. The driver traces queue operations, read
+ * requests and its timers as they happen, and keeps the last thousand or so events. Use aemtrace to turn the dump into a timeline.
+ *
+ * @param fileName                     name of the dump file, overwritten if it exists.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSaveTrace(const char* fileName);
+
+/** Enables or disables the submission channel. The channel is a ring of moves in memory shared with the driver. 
+ * While it is enabled, AemSendMessage, AemSendAbsoluteMessage, AemSendMessages, AemSendScroll and the key functions write their messages straight into it,
+ * without sending any requests to the device, and the driver moves them into the message queue as it emits. A request
+ * is only sent to wake the driver up when it has nothing left to emit. The channel holds a few hundred messages, 
+ * and these functions fail with AEMCTL_QUEUE_FULL once both the channel and the message queue are full.
+ *
+ * Other messages are still sent with requests, so they may overtake the messages in the channel. Same goes
+ * for the messages staged with AemSetStaging, which take precedence over the channel. The channel is shared 
+ * by all processes, and messages of different processes are queued in the order they are written. If a process
+ * is killed in the middle of a write, the driver resets the channel after a second, dropping the messages in it.
+ * AemClearMessageQueue resets it right away.
+ *
+ * Channel is disabled by default. AemCloseDevice disables it.
+ *
+ * @param enabled                      non-zero to enable the channel, zero to disable it.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemEnableChannel(int enabled);
+
+/** Timeout that never expires, for AemSetStaging and AemFlushStaging. */
+#define AEMCTL_INFINITE (-1)
+
+/** Enables or disables staging of move messages. While staging is enabled, AemSendMessage, AemSendAbsoluteMessage,
+ * AemSendMessages, AemSendScroll and the key functions put their messages into a staging queue kept by aemctl, and return right away. A background
+ * thread pushes the staged messages into the driver in batches, as the message queue of the device frees up,
+ * so the sender doesn't have to retry on AEMCTL_QUEUE_FULL. These functions then fail with AEMCTL_QUEUE_FULL
+ * only when the staging queue is full and the timeout has expired, and AemSendMessages reports the number of messages staged.
+ *
+ * Glides, timed messages and asynchronous submissions are still sent to the driver right away, so they may overtake
+ * messages that are staged. Call AemFlushStaging first to keep them in order.
+ *
+ * Staging is disabled by default. Disabling it discards the messages that are still staged. Must not be called while
+ * other threads are sending messages to the same device. AemCloseDevice disables staging. AemClearMessageQueue discards
+ * the staged messages along with the queued ones. The staging thread keeps aemctl loaded, so if aemctl is loaded 
+ * with LoadLibrary, FreeLibrary unloads it only once staging is disabled on all devices.
+ *
+ * @param capacity                     number of messages the staging queue can hold, zero to disable staging.
+ * @param timeout                      how long to wait for room in the staging queue when it is full, in 1/1000th of a second,
+ *                                     zero to fail right away, AEMCTL_INFINITE to wait for as long as it takes.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetStaging(int capacity, int timeout);
+
+/** Waits until all the staged messages are queued by the driver. Returns right away if staging is disabled.
+ *
+ * @param timeout                      how long to wait, in 1/1000th of a second, or AEMCTL_INFINITE.
+ * @returns                            AEMCTL_OK if nothing is left staged, AEMCTL_QUEUE_FULL if the timeout has expired,
+ *                                     other non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemFlushStaging(int timeout);
+
+/** Flags of AemInitialize. */
+#define AEMCTL_INIT_RESCAN 0x01        /**< Ignore cached device paths and enumerate all HID devices. */
+
+/** Finds arx ethereal mouse devices. Devices are otherwise found on first use, so calling this function 
+ * is only needed to pay the discovery cost up front. No device is opened, the default one is opened 
+ * by the first function that uses it.
+ * 
+ * Paths of the devices found are cached in the registry along with the number of HID interfaces present. 
+ * Later discoveries enumerate all HID devices only if that number has changed, or some of the cached devices 
+ * are gone. Discovery is performed only once per process, so flags take effect only if this function 
+ * is called before any other one. The exception is a discovery 
+ * that found no devices, it is repeated by each call to this function.
+ *
+ * @param flags                        AEMCTL_INIT_XXX flags.
+ * @returns                            AEMCTL_OK if at least one device was found, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemInitialize(int flags);
+
+/** Gets the number of arx ethereal mouse devices installed in the system. 
+ * Several instances of the device can be installed, each one having its own message queue, 
+ * message check interval and settings.
+ *
+ * @param count                        (out) number of devices.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetDeviceCount(int* count);
+
+/** Opens an arx ethereal mouse device. Opened device must be closed with AemCloseDevice.
+ * 
+ * Functions that don't take a device handle operate on the default device, which is the device 
+ * with index 0, opened on first use.
+ *
+ * @param index                        index of the device, in [0, count), see AemGetDeviceCount.
+ * @param device                       (out) handle to the opened device.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemOpenDevice(int index, AEMHANDLE* device);
+
+/** Flags of AemOpenDeviceEx. */
+#define AEMCTL_OPEN_MONITOR 0x01       /**< Open the device for monitoring only, without read and write access. */
+
+/** Opens an arx ethereal mouse device, same as AemOpenDevice does.
+ *
+ * A device opened with AEMCTL_OPEN_MONITOR requests no access to the device, so that a monitor
+ * like aemtop can attach next to a running client without needing its rights or getting in its way.
+ * Queries and AemMapStatisticsEx work on such a handle, AemSendMessageAsyncEx doesn't.
+ *
+ * @param index                        index of the device, in [0, count), see AemGetDeviceCount.
+ * @param flags                        AEMCTL_OPEN_XXX flags.
+ * @param device                       (out) handle to the opened device.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemOpenDeviceEx(int index, int flags, AEMHANDLE* device);
+
+/** Closes an arx ethereal mouse device opened with AemOpenDevice.
+ *
+ * @param device                       handle to the device.
+ * @returns                            AEMCTL_OK if everything went fine, non-zero error code otherwise. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemCloseDevice(AEMHANDLE device);
+
+/* Following functions are identical to the ones without the Ex suffix, 
+ * except that they operate on the given device instead of the default one. */
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessageEx(AEMHANDLE device, int x, int y, char buttons);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendAbsoluteMessageEx(AEMHANDLE device, int x, int y, char buttons);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendGlideEx(AEMHANDLE device, int x, int y, char buttons, int duration, AEMCTLEASING easing, AEMCTLGLIDE kind);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessagesEx(AEMHANDLE device, const AEM_MOVE* moves, int count, int* accepted);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendTimedMessagesEx(AEMHANDLE device, const AEM_TIMED_MOVE* moves, int count, long long startTime, int* accepted);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendMessageAsyncEx(AEMHANDLE device, const AEM_MOVE* move, AEM_COMPLETION_ROUTINE routine, void* context);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendScrollEx(AEMHANDLE device, int wheel, int pan, char buttons, int isAbsolute);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendKeyEx(AEMHANDLE device, int key, int isDown);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSendKeysEx(AEMHANDLE device, const AEM_KEY* keys, int count, int* accepted);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemClearMessageQueueEx(AEMHANDLE device);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageQueueSizeEx(AEMHANDLE device, int* size);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMergedCountEx(AEMHANDLE device, int* merged);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetMessageCheckIntervalEx(AEMHANDLE device, int* interval);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageCheckIntervalEx(AEMHANDLE device, int interval);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetMessageQueueCapacityEx(AEMHANDLE device, int capacity);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetCatchUpEx(AEMHANDLE device, int enabled, int threshold);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetCatchUpEx(AEMHANDLE device, int* enabled, int* threshold);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetPacingEx(AEMHANDLE device, int enabled, int minInterval, int maxInterval, int targetDepth);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetPacingEx(AEMHANDLE device, int* enabled, int* minInterval, int* maxInterval, int* targetDepth, int* interval);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetDeviceInfoEx(AEMHANDLE device, int* isRelative, int* queueCapacity);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetReadTimerStatsEx(AEMHANDLE device, int* ticks, int* rearms);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemGetLatencyHistogramEx(AEMHANDLE device, AEM_LATENCY_HISTOGRAM* histogram, int reset);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemMapStatisticsEx(AEMHANDLE device, const volatile AEM_STATISTICS** statistics);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSaveTraceEx(AEMHANDLE device, const char* fileName);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemSetStagingEx(AEMHANDLE device, int capacity, int timeout);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemFlushStagingEx(AEMHANDLE device, int timeout);
+AEMCTLAPI AEMCTLRESULT AEMCTLAPIENTRY AemEnableChannelEx(AEMHANDLE device, int enabled);
+
+/** Error state is kept per thread, and all the functions above can be called from several threads at once. 
+ * Requests from different threads are sent to the device concurrently.
+ *
+ * @returns                            textual representation of the last error occurred in the calling thread. */
+AEMCTLAPI const char* AEMCTLAPIENTRY AemGetLastErrorString(void);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+#endif // __AEMCTL_H__
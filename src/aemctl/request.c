@@ -0,0 +1,174 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include "request.h"
+
+#if !defined(_WIN32)
+#  include <pthread.h>
+#endif
+
+/* On Windows, thread states are kept in a private heap, so that the states of threads that are still running
+ * when the DLL is unloaded are freed along with it. Elsewhere, they are freed by the destructor of the key. */
+#if defined(_WIN32)
+static DWORD         ThreadStateIndex = TLS_OUT_OF_INDEXES; /**< TLS slot holding PAEM_THREAD_STATE of the calling thread. */
+static HANDLE        StateHeap;
+#else
+static pthread_key_t ThreadStateKey;
+static BOOLEAN       IsStarted;
+#endif
+
+static VOID DestroyThreadState(PAEM_THREAD_STATE state) {
+  TransportFreeThreadState(state);
+#if defined(_WIN32)
+  HeapFree(StateHeap, 0, state);
+#else
+  free(state);
+#endif
+}
+
+#if !defined(_WIN32)
+static void ThreadStateDestructor(void* state) {
+  DestroyThreadState((PAEM_THREAD_STATE) state);
+}
+#endif
+
+BOOLEAN StartRequests(void) {
+#if defined(_WIN32)
+  StateHeap = HeapCreate(0, 0, 0);
+  if(StateHeap == NULL)
+    return FALSE;
+  ThreadStateIndex = TlsAlloc();
+  if(ThreadStateIndex == TLS_OUT_OF_INDEXES) {
+    HeapDestroy(StateHeap);
+    StateHeap = NULL;
+    return FALSE;
+  }
+#else
+  if(pthread_key_create(&ThreadStateKey, ThreadStateDestructor) != 0)
+    return FALSE;
+  IsStarted = TRUE;
+#endif
+  return TRUE;
+}
+
+VOID StopRequests(void) {
+  FreeThreadState();
+#if defined(_WIN32)
+  if(ThreadStateIndex != TLS_OUT_OF_INDEXES) {
+    TlsFree(ThreadStateIndex);
+    ThreadStateIndex = TLS_OUT_OF_INDEXES;
+  }
+  if(StateHeap != NULL) {
+    /* States of other threads are freed along with the heap. */
+    HeapDestroy(StateHeap);
+    StateHeap = NULL;
+  }
+#else
+  if(IsStarted) {
+    pthread_key_delete(ThreadStateKey);
+    IsStarted = FALSE;
+  }
+#endif
+}
+
+PAEM_THREAD_STATE GetThreadState(void) {
+  PAEM_THREAD_STATE state;
+
+#if defined(_WIN32)
+  if(ThreadStateIndex == TLS_OUT_OF_INDEXES)
+    return NULL;
+
+  state = (PAEM_THREAD_STATE) TlsGetValue(ThreadStateIndex);
+  if(state == NULL) {
+    state = (PAEM_THREAD_STATE) HeapAlloc(StateHeap, HEAP_ZERO_MEMORY, sizeof(AEM_THREAD_STATE));
+    if(state == NULL)
+      return NULL;
+    state->ErrorMessage = "";
+    TlsSetValue(ThreadStateIndex, state);
+  }
+#else
+  if(!IsStarted)
+    return NULL;
+
+  state = (PAEM_THREAD_STATE) pthread_getspecific(ThreadStateKey);
+  if(state == NULL) {
+    state = (PAEM_THREAD_STATE) calloc(1, sizeof(AEM_THREAD_STATE));
+    if(state == NULL)
+      return NULL;
+    state->ErrorMessage = "";
+    pthread_setspecific(ThreadStateKey, state);
+  }
+#endif
+  return state;
+}
+
+VOID FreeThreadState(void) {
+  PAEM_THREAD_STATE state;
+
+#if defined(_WIN32)
+  if(ThreadStateIndex == TLS_OUT_OF_INDEXES)
+    return;
+
+  state = (PAEM_THREAD_STATE) TlsGetValue(ThreadStateIndex);
+  if(state != NULL) {
+    DestroyThreadState(state);
+    TlsSetValue(ThreadStateIndex, NULL);
+  }
+#else
+  if(!IsStarted)
+    return;
+
+  state = (PAEM_THREAD_STATE) pthread_getspecific(ThreadStateKey);
+  if(state != NULL) {
+    DestroyThreadState(state);
+    pthread_setspecific(ThreadStateKey, NULL);
+  }
+#endif
+}
+
+VOID SetLastErrorMessage(const CHAR* message) {
+  PAEM_THREAD_STATE state = GetThreadState();
+
+  if(state != NULL)
+    state->ErrorMessage = message;
+}
+
+VOID SetLastErrorCode(const CHAR* functionName, DWORD errorCode) {
+  PAEM_THREAD_STATE state = GetThreadState();
+
+  /* Message is formatted only when asked for. */
+  if(state != NULL) {
+    state->ErrorMessage = NULL;
+    state->FailedFunction = functionName;
+    state->ErrorCode = errorCode;
+  }
+}
+
+BOOLEAN SendFeatureRequest(PVOID file, PVOID report, DWORD size) {
+  PAEM_THREAD_STATE state;
+
+  /* Thread state is only missing when it couldn't be allocated, or when the TLS slot couldn't be. */
+  state = GetThreadState();
+  if(state == NULL) {
+#if defined(_WIN32)
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+#endif
+    return FALSE;
+  }
+
+  return TransportGetFeature(state, file, report, size);
+}
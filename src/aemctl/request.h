@@ -0,0 +1,89 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEMCTL_REQUEST_H__
+#define __AEMCTL_REQUEST_H__
+
+#include "portable.h"
+
+/* Request path of aemctl. Each thread keeps its own error state and whatever the transport needs to wait
+ * for a request, so that requests from different threads share nothing and take no lock. Error messages
+ * are formatted only when asked for, so nothing but the transport itself runs while requests succeed.
+ *
+ * Transport that delivers feature requests to the device is implemented by the code that links this in.
+ * aemctl implements it on top of overlapped IOCTL_HID_GET_FEATURE, aembench implements a null transport,
+ * so that the request path can be benchmarked on non-Windows hosts. */
+
+/** Per-thread state, allocated when first needed. */
+typedef struct AEM_THREAD_STATE_ {
+  const CHAR* ErrorMessage;            /**< Last error message, NULL if it is yet to be formatted from FailedFunction and ErrorCode. */
+  const CHAR* FailedFunction;          /**< Name of the last system function that failed. */
+  DWORD       ErrorCode;               /**< Error code of the last failed system call. */
+  PVOID       Transport;               /**< Per-thread state of the transport, NULL until the transport sets it. */
+  CHAR        ErrorMessageBuffer[128];
+} AEM_THREAD_STATE, *PAEM_THREAD_STATE;
+
+/** Allocates the thread-local slot for thread states. Called once, before any request is sent.
+ *
+ * @returns                            TRUE if successful, FALSE if out of resources. */
+BOOLEAN StartRequests(void);
+
+/** Frees the thread-local slot, along with the state of the calling thread. States of other threads
+ * are freed too on Windows, elsewhere they are freed as their threads exit. */
+VOID StopRequests(void);
+
+/** @returns                           State of the calling thread, NULL if it couldn't be allocated. */
+PAEM_THREAD_STATE GetThreadState(void);
+
+/** Frees the state of the calling thread. On Windows, has to be called when a thread exits. */
+VOID FreeThreadState(void);
+
+/** @param message                     Static message to be reported by the following AemGetLastErrorString call. */
+VOID SetLastErrorMessage(const CHAR* message);
+
+/** Records a failed system call. The message is formatted when asked for.
+ *
+ * @param functionName                 Static name of the function that failed.
+ * @param errorCode                    Error code it failed with. */
+VOID SetLastErrorCode(const CHAR* functionName, DWORD errorCode);
+
+/** Sends a feature request to the device, and waits for it to complete.
+ *
+ * @param file                         Transport handle of the device.
+ * @param report                       Feature report, replaced with the one returned by the device.
+ * @param size                         Size of the report, in bytes.
+ * @returns                            TRUE if successful, FALSE otherwise. Error is recorded in the thread state then. */
+BOOLEAN SendFeatureRequest(PVOID file, PVOID report, DWORD size);
+
+/* Functions the request path expects from the transport. */
+
+/** Sends a feature request to the device, and waits for it to complete. Records the error in the thread state
+ * if the request fails.
+ *
+ * @param state                        State of the calling thread.
+ * @param file                         Transport handle of the device.
+ * @param report                       Feature report, replaced with the one returned by the device.
+ * @param size                         Size of the report, in bytes.
+ * @returns                            TRUE if successful, FALSE otherwise. */
+BOOLEAN TransportGetFeature(PAEM_THREAD_STATE state, PVOID file, PVOID report, DWORD size);
+
+/** Frees the per-thread state of the transport, if any.
+ *
+ * @param state                        State of a thread that exits, or of the calling thread. */
+VOID TransportFreeThreadState(PAEM_THREAD_STATE state);
+
+#endif // __AEMCTL_REQUEST_H__
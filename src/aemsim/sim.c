@@ -0,0 +1,376 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include <stdio.h>
+#include "sim.h"
+
+/** Interrupt time of XP starts at boot, system time is in 100 ns since 1601. Start the virtual system clock
+ * at 2011-01-01 00:00:00 UTC, so that timed batches with real-looking start times behave. */
+#define AEM_SIM_INITIAL_SYSTEM_TIME 129383424000000000LL
+
+#define GET_SIM_DEVICE(CORE) CONTAINING_RECORD(CORE, AEM_SIM_DEVICE, Core)
+
+/** @returns                          Time when a timer due at the given time actually fires. Must be called with Mutex held. */
+static ULONGLONG GetFireTime(PAEM_SIM_DEVICE Device, ULONGLONG DueTime) {
+  if(Device->TimerResolution == 0)
+    return DueTime;
+  return (DueTime + Device->TimerResolution - 1) / Device->TimerResolution * Device->TimerResolution;
+}
+
+static VOID CompleteRead(PAEM_SIM_DEVICE Device, PAEM_SIM_READ Read, NTSTATUS Status) {
+  Read->Status = Status;
+  Read->Size = 0;
+  pthread_mutex_lock(&Device->Mutex);
+  Read->CompletionTime = Device->Now;
+  pthread_mutex_unlock(&Device->Mutex);
+  if(Device->CompletionRoutine != NULL)
+    Device->CompletionRoutine(Read, Device->Context);
+}
+
+NTSTATUS AemSimInit(PAEM_SIM_DEVICE Device, AEM_SIM_COMPLETION_ROUTINE CompletionRoutine, PVOID Context) {
+  NTSTATUS ntStatus;
+
+  RtlZeroMemory(Device, sizeof(AEM_SIM_DEVICE));
+  ntStatus = AemCoreInit(&Device->Core);
+  if(!NT_SUCCESS(ntStatus))
+    return ntStatus;
+
+  Device->CompletionRoutine = CompletionRoutine;
+  Device->Context = Context;
+  pthread_mutex_init(&Device->Mutex, NULL);
+  Device->Now = 0;
+  Device->SystemTimeOffset = AEM_SIM_INITIAL_SYSTEM_TIME;
+  AemReadTimerInit(&Device->ReadTimer);
+  AemCoreSetChannelPage(&Device->Core, &Device->ChannelPage, 0);
+  return STATUS_SUCCESS;
+}
+
+VOID AemSimFree(PAEM_SIM_DEVICE Device) {
+  PAEM_SIM_READ read;
+
+  for(;;) {
+    pthread_mutex_lock(&Device->Mutex);
+    read = Device->ParkedReads;
+    if(read != NULL) {
+      Device->ParkedReads = read->Next;
+    } else {
+      read = Device->DelayedReads;
+      if(read != NULL)
+        Device->DelayedReads = read->Next;
+    }
+    Device->IsScheduleTimerSet = FALSE;
+    AemReadTimerStop(&Device->ReadTimer);
+    pthread_mutex_unlock(&Device->Mutex);
+    if(read == NULL)
+      break;
+    CompleteRead(Device, read, STATUS_CANCELLED);
+  }
+
+  AemCoreFree(&Device->Core);
+  pthread_mutex_destroy(&Device->Mutex);
+}
+
+NTSTATUS AemSimGetFeature(PAEM_SIM_DEVICE Device, PHID_XFER_PACKET Packet) {
+  return AemCoreGetFeature(&Device->Core, Packet->reportId, Packet->reportBuffer, Packet->reportBufferLen);
+}
+
+NTSTATUS AemSimWriteReport(PAEM_SIM_DEVICE Device, PHID_XFER_PACKET Packet) {
+  return AemCoreWriteReport(&Device->Core, Packet->reportId, Packet->reportBuffer, Packet->reportBufferLen);
+}
+
+VOID AemSimRead(PAEM_SIM_DEVICE Device, PAEM_SIM_READ Read) {
+  Read->Next = NULL;
+  Read->Status = STATUS_PENDING;
+  Read->Size = 0;
+  AemCoreRead(&Device->Core, Read);
+}
+
+BOOLEAN AemSimCancelRead(PAEM_SIM_DEVICE Device, PAEM_SIM_READ Read) {
+  PAEM_SIM_READ *link, previous = NULL;
+  BOOLEAN       isFound = FALSE;
+
+  pthread_mutex_lock(&Device->Mutex);
+  for(link = &Device->ParkedReads; *link != NULL; previous = *link, link = &(*link)->Next) {
+    if(*link == Read) {
+      *link = Read->Next;
+      if(Device->LastParkedRead == Read)
+        Device->LastParkedRead = previous;
+      isFound = TRUE;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&Device->Mutex);
+
+  if(isFound)
+    CompleteRead(Device, Read, STATUS_CANCELLED);
+  return isFound;
+}
+
+ULONG AemSimAdvance(PAEM_SIM_DEVICE Device, ULONGLONG Duration) {
+  ULONGLONG     target, fireTime = 0;
+  PAEM_SIM_READ read, dueReads, *lastDueRead;
+  BOOLEAN       isReadTimerDue, isScheduleDue;
+  DWORD32       interval;
+  ULONG         fired = 0;
+
+  interval = AemCoreEmissionInterval(&Device->Core);
+  pthread_mutex_lock(&Device->Mutex);
+  target = Device->Now + Duration;
+  for(;;) {
+    /* Read timer goes first when due at the same time, so that a due timed message is picked up by a read
+     * that was waiting for its emission slot, same as it most likely happens in the driver. */
+    if(Device->ReadTimer.IsArmed)
+      fireTime = GetFireTime(Device, Device->ReadTimer.DueTime);
+    isReadTimerDue = Device->ReadTimer.IsArmed && fireTime <= target && 
+                     (!Device->IsScheduleTimerSet || fireTime <= Device->ScheduleDueTime);
+    isScheduleDue = FALSE;
+    dueReads = NULL;
+    if(isReadTimerDue) {
+      if(fireTime > Device->Now)
+        Device->Now = fireTime;
+
+      /* Same as ReadDpcRoutine in the driver. */
+      lastDueRead = &dueReads;
+      while(Device->DelayedReads != NULL && Device->DelayedReads->DueTime <= Device->Now) {
+        *lastDueRead = Device->DelayedReads;
+        lastDueRead = &Device->DelayedReads->Next;
+        Device->DelayedReads = Device->DelayedReads->Next;
+      }
+      *lastDueRead = NULL;
+      if(dueReads != NULL)
+        Device->Core.ReadTimerTicks++;
+
+      if(Device->DelayedReads == NULL) {
+        AemReadTimerStop(&Device->ReadTimer);
+      } else if(AemReadTimerAdvance(&Device->ReadTimer, Device->Now, Device->DelayedReads->DueTime)) {
+        Device->Core.ReadTimerRearms++;
+        AemReadTimerArm(&Device->ReadTimer, Device->DelayedReads->DueTime, interval);
+      }
+    } else if(Device->IsScheduleTimerSet && Device->ScheduleDueTime <= target) {
+      isScheduleDue = TRUE;
+      Device->IsScheduleTimerSet = FALSE;
+      if(Device->ScheduleDueTime > Device->Now)
+        Device->Now = Device->ScheduleDueTime;
+    } else {
+      break;
+    }
+    pthread_mutex_unlock(&Device->Mutex);
+
+    while(dueReads != NULL) {
+      read = dueReads;
+      dueReads = read->Next;
+      AemCoreTrace(&Device->Core, AEM_TRACE_READ_TIMER, (DWORD32) (ULONG_PTR) read, 0);
+      AemCoreCompleteRead(&Device->Core, read);
+    }
+    if(isScheduleDue) {
+      AemCoreTrace(&Device->Core, AEM_TRACE_SCHEDULE_TIMER, 0, 0);
+      AemCoreWake(&Device->Core);
+    }
+    fired++;
+
+    interval = AemCoreEmissionInterval(&Device->Core);
+    pthread_mutex_lock(&Device->Mutex);
+  }
+  if(target > Device->Now)
+    Device->Now = target;
+  pthread_mutex_unlock(&Device->Mutex);
+
+  return fired;
+}
+
+BOOLEAN AemSimNextDueTime(PAEM_SIM_DEVICE Device, PULONGLONG DueTime) {
+  BOOLEAN   isSet;
+  ULONGLONG fireTime;
+
+  pthread_mutex_lock(&Device->Mutex);
+  isSet = Device->IsScheduleTimerSet || Device->ReadTimer.IsArmed;
+  if(Device->IsScheduleTimerSet)
+    *DueTime = Device->ScheduleDueTime;
+  if(Device->ReadTimer.IsArmed) {
+    fireTime = GetFireTime(Device, Device->ReadTimer.DueTime);
+    if(!Device->IsScheduleTimerSet || fireTime < *DueTime)
+      *DueTime = fireTime;
+  }
+  pthread_mutex_unlock(&Device->Mutex);
+  return isSet;
+}
+
+ULONGLONG AemSimNow(PAEM_SIM_DEVICE Device) {
+  ULONGLONG now;
+
+  pthread_mutex_lock(&Device->Mutex);
+  now = Device->Now;
+  pthread_mutex_unlock(&Device->Mutex);
+  return now;
+}
+
+VOID AemSimSetTimerResolution(PAEM_SIM_DEVICE Device, ULONGLONG Resolution) {
+  pthread_mutex_lock(&Device->Mutex);
+  Device->TimerResolution = Resolution;
+  pthread_mutex_unlock(&Device->Mutex);
+}
+
+VOID AemSimSetSystemTime(PAEM_SIM_DEVICE Device, LONGLONG SystemTime) {
+  pthread_mutex_lock(&Device->Mutex);
+  Device->SystemTimeOffset = SystemTime - (LONGLONG) Device->Now;
+  pthread_mutex_unlock(&Device->Mutex);
+}
+
+BOOLEAN AemSimSaveTrace(PAEM_SIM_DEVICE Device, const char *Path) {
+  AEM_TRACE_FEATURE_REPORT report;
+  AEM_TRACE_FILE_HEADER    header;
+  HID_XFER_PACKET          packet;
+  ULONG                    first = 0, end = 0;
+  BOOLEAN                  isOk, isFirst = TRUE;
+  FILE                     *file;
+
+  file = fopen(Path, "wb");
+  if(file == NULL)
+    return FALSE;
+
+  /* Header goes first with a zero count, and is rewritten once all the events are in. */
+  RtlZeroMemory(&header, sizeof(header));
+  header.Magic = AEM_TRACE_FILE_MAGIC;
+  header.Version = AEM_TRACE_FILE_VERSION;
+  isOk = fwrite(&header, sizeof(header), 1, file) == 1;
+
+  /* Stop at the events that were there at the start, so that a busy device doesn't keep us here forever. */
+  packet.reportBuffer = (PUCHAR) &report;
+  packet.reportBufferLen = sizeof(report);
+  packet.reportId = AEM_CONTROL_REPORT_ID;
+  while(isOk) {
+    report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+    report.Report.ControlCode = AEM_CONTROL_CODE_TRACE;
+    report.First = first;
+    if(!NT_SUCCESS(AemSimGetFeature(Device, &packet)))
+      break;
+    if(isFirst) {
+      header.Now = report.Now;
+      end = report.Next;
+      isFirst = FALSE;
+    }
+    header.Lost += report.First - first;
+    header.Count += report.Count;
+    isOk = fwrite(report.Events, sizeof(AEM_TRACE_EVENT), report.Count, file) == report.Count;
+    first = report.First + report.Count;
+    if(report.Count == 0 || (LONG) (end - first) <= 0)
+      break;
+  }
+
+  isOk = isOk && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+  return fclose(file) == 0 && isOk;
+}
+
+
+/* Platform functions for the core, see platform.h. Read requests are AEM_SIM_READ structures. */
+
+ULONGLONG AemPlatformInterruptTime(PAEM_CORE Core) {
+  return AemSimNow(GET_SIM_DEVICE(Core));
+}
+
+LONGLONG AemPlatformSystemTime(PAEM_CORE Core) {
+  PAEM_SIM_DEVICE device = GET_SIM_DEVICE(Core);
+  LONGLONG        systemTime;
+
+  pthread_mutex_lock(&device->Mutex);
+  systemTime = (LONGLONG) device->Now + device->SystemTimeOffset;
+  pthread_mutex_unlock(&device->Mutex);
+  return systemTime;
+}
+
+VOID AemPlatformSetScheduleTimer(PAEM_CORE Core, ULONGLONG DueTime) {
+  PAEM_SIM_DEVICE device = GET_SIM_DEVICE(Core);
+
+  pthread_mutex_lock(&device->Mutex);
+  device->IsScheduleTimerSet = TRUE;
+  device->ScheduleDueTime = GetFireTime(device, DueTime);
+  pthread_mutex_unlock(&device->Mutex);
+}
+
+VOID AemPlatformCancelScheduleTimer(PAEM_CORE Core) {
+  PAEM_SIM_DEVICE device = GET_SIM_DEVICE(Core);
+
+  pthread_mutex_lock(&device->Mutex);
+  device->IsScheduleTimerSet = FALSE;
+  pthread_mutex_unlock(&device->Mutex);
+}
+
+BOOLEAN AemPlatformDelayRead(PAEM_CORE Core, PVOID Request, ULONGLONG DueTime) {
+  PAEM_SIM_DEVICE device = GET_SIM_DEVICE(Core);
+  PAEM_SIM_READ   read = (PAEM_SIM_READ) Request;
+  PAEM_SIM_READ   *link;
+  DWORD32         interval = AemCoreEmissionInterval(Core);
+
+  /* Requests with equal due times fire in submission order. Read timer fires on clock ticks, 
+   * the requests keep their exact due times, same as in the driver. */
+  pthread_mutex_lock(&device->Mutex);
+  read->DueTime = DueTime;
+  for(link = &device->DelayedReads; *link != NULL && (*link)->DueTime <= DueTime; link = &(*link)->Next)
+    ;
+  read->Next = *link;
+  *link = read;
+  if(AemReadTimerIsArmNeeded(&device->ReadTimer, DueTime, device->DelayedReads == read))
+    AemReadTimerArm(&device->ReadTimer, DueTime, interval);
+  pthread_mutex_unlock(&device->Mutex);
+  return TRUE;
+}
+
+VOID AemPlatformParkRead(PAEM_CORE Core, PVOID Request) {
+  PAEM_SIM_DEVICE device = GET_SIM_DEVICE(Core);
+  PAEM_SIM_READ   read = (PAEM_SIM_READ) Request;
+
+  read->Next = NULL;
+  pthread_mutex_lock(&device->Mutex);
+  if(device->ParkedReads == NULL)
+    device->ParkedReads = read;
+  else
+    device->LastParkedRead->Next = read;
+  device->LastParkedRead = read;
+  pthread_mutex_unlock(&device->Mutex);
+}
+
+PVOID AemPlatformUnparkRead(PAEM_CORE Core) {
+  PAEM_SIM_DEVICE device = GET_SIM_DEVICE(Core);
+  PAEM_SIM_READ   read;
+
+  pthread_mutex_lock(&device->Mutex);
+  read = device->ParkedReads;
+  if(read != NULL) {
+    device->ParkedReads = read->Next;
+    if(device->ParkedReads == NULL)
+      device->LastParkedRead = NULL;
+  }
+  pthread_mutex_unlock(&device->Mutex);
+  return read;
+}
+
+VOID AemPlatformCompleteRead(PAEM_CORE Core, PVOID Request, NTSTATUS Status, PUCHAR Report, ULONG Size) {
+  PAEM_SIM_DEVICE device = GET_SIM_DEVICE(Core);
+  PAEM_SIM_READ   read = (PAEM_SIM_READ) Request;
+
+  if(!NT_SUCCESS(Status)) {
+    CompleteRead(device, read, Status);
+    return;
+  }
+
+  RtlCopyMemory(read->Report, Report, Size);
+  read->Size = Size;
+  read->Status = Status;
+  read->CompletionTime = AemSimNow(device);
+  if(device->CompletionRoutine != NULL)
+    device->CompletionRoutine(read, device->Context);
+}
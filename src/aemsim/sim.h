@@ -0,0 +1,155 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#ifndef __AEM_SIM_H__
+#define __AEM_SIM_H__
+
+#include <pthread.h>
+#include "platform.h"
+#include "readtimer.h"
+
+/* Simulated arx ethereal mouse device. Runs the driver core on a virtual clock, so that the exact
+ * production logic can be driven from a test or a benchmark on a non-Windows host.
+ *
+ * Time only moves when AemSimAdvance is called. Read requests are completed either right away
+ * from AemSimRead / AemSimGetFeature, or from AemSimAdvance when their emission slot comes.
+ * All functions can be called concurrently from several threads. */
+
+/** Same layout as the one hidclass passes with IOCTL_HID_GET_FEATURE and IOCTL_HID_WRITE_REPORT. */
+typedef struct _HID_XFER_PACKET {
+  PUCHAR  reportBuffer;
+  ULONG   reportBufferLen;
+  UCHAR   reportId;
+} HID_XFER_PACKET, *PHID_XFER_PACKET;
+
+struct _AEM_SIM_READ;
+
+/** Called when a read request is completed. Is called without any locks held, so it may submit the request again.
+ *
+ * @param Read                         Completed read request.
+ * @param Context                      Context passed to AemSimInit. */
+typedef VOID (*AEM_SIM_COMPLETION_ROUTINE)(struct _AEM_SIM_READ *Read, PVOID Context);
+
+/** Read request, counterpart of the IOCTL_HID_READ_REPORT Irp. Owned by the caller, must stay valid until completed. */
+typedef struct _AEM_SIM_READ {
+  struct _AEM_SIM_READ *Next;          /**< Link in the parked or delayed list, used by the simulator. */
+  ULONGLONG             DueTime;       /**< Interrupt time the request is delayed until, used by the simulator. */
+  NTSTATUS              Status;        /**< Completion status. */
+  ULONG                 Size;          /**< Size of Report, including report ID. */
+  UCHAR                 Report[AEM_INPUT_REPORT_SIZE + 1];
+  ULONGLONG             CompletionTime; /**< Interrupt time of completion. */
+  PVOID                 Context;       /**< Free for use by the caller. */
+} AEM_SIM_READ, *PAEM_SIM_READ;
+
+typedef struct _AEM_SIM_DEVICE {
+  AEM_CORE                   Core;
+  AEM_SIM_COMPLETION_ROUTINE CompletionRoutine;
+  PVOID                      Context;
+
+  pthread_mutex_t            Mutex;             /**< Protects everything below. Never held while calling into the core. */
+  ULONGLONG                  Now;               /**< Virtual interrupt time, in 100 ns. */
+  LONGLONG                   SystemTimeOffset;  /**< Difference between system time and interrupt time. */
+  ULONGLONG                  TimerResolution;   /**< Timers fire on multiples of it, as they do on clock ticks in Windows. Zero for exact timers. */
+  BOOLEAN                    IsScheduleTimerSet;
+  ULONGLONG                  ScheduleDueTime;
+  PAEM_SIM_READ              ParkedReads;       /**< FIFO of parked read requests. */
+  PAEM_SIM_READ              LastParkedRead;
+  PAEM_SIM_READ              DelayedReads;      /**< Delayed read requests ordered by due time. */
+  AEM_READ_TIMER             ReadTimer;         /**< Single periodic timer completing the delayed requests, as in the driver. */
+
+  AEM_CHANNEL_PAGE           ChannelPage;       /**< Submission channel, stands in for the section the driver shares. Not protected by Mutex. */
+} AEM_SIM_DEVICE, *PAEM_SIM_DEVICE;
+
+/** Initializes a simulated device. Virtual clock starts at zero. Submission channel is set up, with page ID 0.
+ *
+ * @param Device                       Device to initialize.
+ * @param CompletionRoutine            Routine to call when a read request is completed, may be NULL.
+ * @param Context                      Context for the completion routine.
+ * @returns                            NT status code. */
+NTSTATUS AemSimInit(PAEM_SIM_DEVICE Device, AEM_SIM_COMPLETION_ROUTINE CompletionRoutine, PVOID Context);
+
+/** Cancels all pending read requests and frees the device.
+ *
+ * @param Device                       Device. */
+VOID AemSimFree(PAEM_SIM_DEVICE Device);
+
+/** Sends a feature request to the device, as hidclass does with IOCTL_HID_GET_FEATURE.
+ *
+ * @param Device                       Device.
+ * @param Packet                       Transfer packet, the reply is written into its report buffer.
+ * @returns                            NT status code. */
+NTSTATUS AemSimGetFeature(PAEM_SIM_DEVICE Device, PHID_XFER_PACKET Packet);
+
+/** Sends an output report to the device, as hidclass does with IOCTL_HID_WRITE_REPORT.
+ *
+ * @param Device                       Device.
+ * @param Packet                       Transfer packet holding the report.
+ * @returns                            NT status code. */
+NTSTATUS AemSimWriteReport(PAEM_SIM_DEVICE Device, PHID_XFER_PACKET Packet);
+
+/** Submits a read request, as hidclass does with IOCTL_HID_READ_REPORT.
+ *
+ * @param Device                       Device.
+ * @param Read                         Read request. */
+VOID AemSimRead(PAEM_SIM_DEVICE Device, PAEM_SIM_READ Read);
+
+/** Cancels a parked read request. Delayed requests can't be cancelled, same as in the driver.
+ *
+ * @param Device                       Device.
+ * @param Read                         Read request.
+ * @returns                            TRUE if the request was parked and is now completed with STATUS_CANCELLED. */
+BOOLEAN AemSimCancelRead(PAEM_SIM_DEVICE Device, PAEM_SIM_READ Read);
+
+/** Moves the virtual clock forward, firing all timers that become due in the order of their due times.
+ * The clock is set to the due time of each timer before it fires.
+ *
+ * @param Device                       Device.
+ * @param Duration                     Time to advance by, in 100 ns.
+ * @returns                            Number of timers fired. */
+ULONG AemSimAdvance(PAEM_SIM_DEVICE Device, ULONGLONG Duration);
+
+/** @param Device                      Device.
+ * @param DueTime                      (out) Interrupt time when the earliest timer is due.
+ * @returns                            FALSE if there are no timers set, TRUE otherwise. */
+BOOLEAN AemSimNextDueTime(PAEM_SIM_DEVICE Device, PULONGLONG DueTime);
+
+/** @param Device                      Device.
+ * @returns                            Current virtual interrupt time, in 100 ns. */
+ULONGLONG AemSimNow(PAEM_SIM_DEVICE Device);
+
+/** Sets the resolution of simulated timers. Windows fires timers on clock ticks, 15.625 ms apart
+ * by default, or down to 1 ms apart when an application raises the resolution with timeBeginPeriod.
+ *
+ * @param Device                       Device.
+ * @param Resolution                   Timer resolution, in 100 ns. Zero for exact timers. */
+VOID AemSimSetTimerResolution(PAEM_SIM_DEVICE Device, ULONGLONG Resolution);
+
+/** Sets the virtual system time, without affecting the interrupt time.
+ *
+ * @param Device                       Device.
+ * @param SystemTime                   New system time, in 100 ns. */
+VOID AemSimSetSystemTime(PAEM_SIM_DEVICE Device, LONGLONG SystemTime);
+
+/** Reads the device trace through AEM_CONTROL_CODE_TRACE requests and writes it into a dump file,
+ * same as AemSaveTrace of aemctl does, see trace.h for the format.
+ *
+ * @param Device                       Device.
+ * @param Path                         Path of the dump file.
+ * @returns                            TRUE if successful, FALSE if the file couldn't be written. */
+BOOLEAN AemSimSaveTrace(PAEM_SIM_DEVICE Device, const char *Path);
+
+#endif // __AEM_SIM_H__
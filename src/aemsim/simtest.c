@@ -0,0 +1,1387 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+/* Unit & stress tests of the driver core on the simulated platform. 
+ *
+ * Tests run in virtual time, so they are deterministic unless they spawn threads. Stress tests check
+ * that nothing is lost or reordered whichever way the threads interleave. Every failed check is reported,
+ * and the exit code is non-zero if any check has failed. */
+
+/** Capacity of the rings in the ring tests, small so that they wrap around a lot. */
+#define AEM_TEST_RING_CAPACITY 16
+
+/** Number of randomized rounds & messages in each of them in the compaction tests. */
+#define AEM_TEST_COMPACTION_ROUNDS 200
+#define AEM_TEST_COMPACTION_SIZE   256
+
+/** Number of producer threads & moves sent by each of them in the stress tests. */
+#define AEM_TEST_PRODUCER_COUNT 4
+#define AEM_TEST_PRODUCER_MOVES 30000
+
+static int Failures = 0;
+
+#define CHECK(CONDITION)                                                                      \
+  do {                                                                                        \
+    if(!(CONDITION)) {                                                                        \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #CONDITION);           \
+      Failures++;                                                                             \
+    }                                                                                         \
+  } while(0)
+
+static NTSTATUS GetFeature(PAEM_SIM_DEVICE device, PVOID report, ULONG size) {
+  HID_XFER_PACKET packet;
+  packet.reportBuffer = (PUCHAR) report;
+  packet.reportBufferLen = size;
+  packet.reportId = AEM_CONTROL_REPORT_ID;
+  return AemSimGetFeature(device, &packet);
+}
+
+/** @returns                           FALSE if the move was rejected, the queue being full. */
+static BOOLEAN SendMove(PAEM_SIM_DEVICE device, SHORT x, SHORT y, UCHAR buttons, UCHAR flags) {
+  AEM_MOVE_FEATURE_REPORT report;
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_MOVE;
+  report.Buttons = buttons;
+  report.Point.X = x;
+  report.Point.Y = y;
+  report.Flags = flags;
+  GetFeature(device, &report, sizeof(report));
+  return report.Report.ControlCode != AEM_CONTROL_CODE_ERROR;
+}
+
+static void ClearQueue(PAEM_SIM_DEVICE device) {
+  AEM_FEATURE_REPORT report;
+  report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.ControlCode = AEM_CONTROL_CODE_CLEAR_QUEUE;
+  GetFeature(device, &report, sizeof(report));
+}
+
+/** Takes a message & packs a report the same way AemCoreCompleteRead does, bypassing the platform. */
+static BOOLEAN DequeueReport(PAEM_CORE core, PUCHAR report) {
+  AEM_MESSAGE    message;
+  BOOLEAN        isDequeued;
+  AEM_LOCK_STATE lockState;
+
+  AemLockAcquire(&core->ConsumerLock, &lockState);
+  isDequeued = AemCoreDequeue(core, &message);
+  AemLockRelease(&core->ConsumerLock, lockState);
+  if(isDequeued)
+    AemCorePackReport(&message, report);
+  return isDequeued;
+}
+
+/** @returns                           Position carried by an absolute pointer report. */
+static SHORT_POINT ReportPoint(PUCHAR report) {
+  SHORT_POINT point;
+  RtlCopyMemory(&point, report + 2, sizeof(point));
+  return point;
+}
+
+
+/* Core. */
+
+static void TestMovesComeOutInOrder(void) {
+  AEM_SIM_DEVICE device;
+  AEM_SIM_READ   read;
+  SHORT          i;
+
+  AemSimInit(&device, NULL, NULL);
+  for(i = 0; i < 3; i++)
+    CHECK(SendMove(&device, (SHORT) (100 + i), (SHORT) (200 + i), (UCHAR) i, AEM_MOVE_ABSOLUTE));
+
+  for(i = 0; i < 3; i++) {
+    AemSimRead(&device, &read);
+    AemSimAdvance(&device, 10 * (ULONGLONG) device.Core.MessageCheckInterval);
+    CHECK(read.Status == STATUS_SUCCESS);
+    CHECK(read.Report[0] == AEM_ABSOLUTE_POINTER_REPORT_ID);
+    CHECK(read.Report[1] == i);
+    CHECK(ReportPoint(read.Report).X == 100 + i && ReportPoint(read.Report).Y == 200 + i);
+  }
+  AemSimFree(&device);
+}
+
+static void TestReadIsParkedUntilInput(void) {
+  AEM_SIM_DEVICE device;
+  AEM_SIM_READ   read;
+
+  AemSimInit(&device, NULL, NULL);
+  AemSimRead(&device, &read);
+  CHECK(read.Status == STATUS_PENDING);
+  CHECK(device.ParkedReads == &read);
+
+  AemSimAdvance(&device, 1000000);
+  CHECK(read.Status == STATUS_PENDING);
+
+  /* Input completes it right away, the device has been idle for longer than an interval. */
+  CHECK(SendMove(&device, 5, -5, 0, 0));
+  CHECK(read.Status == STATUS_SUCCESS);
+  CHECK(read.CompletionTime == 1000000);
+  CHECK(read.Report[0] == AEM_POINTER_REPORT_ID);
+  CHECK((CHAR) read.Report[2] == 5 && (CHAR) read.Report[3] == -5);
+  CHECK(device.ParkedReads == NULL);
+
+  /* Cancelled while parked. */
+  AemSimRead(&device, &read);
+  CHECK(AemSimCancelRead(&device, &read));
+  CHECK(read.Status == STATUS_CANCELLED);
+  AemSimFree(&device);
+}
+
+static void TestReadsAreSpacedByInterval(void) {
+  AEM_SIM_DEVICE device;
+  AEM_SIM_READ   reads[3];
+  ULONGLONG      interval;
+  int            i;
+
+  AemSimInit(&device, NULL, NULL);
+  interval = 10 * (ULONGLONG) device.Core.MessageCheckInterval;
+  for(i = 0; i < 3; i++)
+    CHECK(SendMove(&device, 1, 1, 0, 0));
+
+  /* First read takes the current slot, the following ones wait for theirs. */
+  for(i = 0; i < 3; i++)
+    AemSimRead(&device, &reads[i]);
+  CHECK(reads[0].Status == STATUS_SUCCESS && reads[0].CompletionTime == 0);
+  CHECK(reads[1].Status == STATUS_PENDING && reads[2].Status == STATUS_PENDING);
+
+  AemSimAdvance(&device, interval - 1);
+  CHECK(reads[1].Status == STATUS_PENDING);
+  AemSimAdvance(&device, 2 * interval);
+  CHECK(reads[1].Status == STATUS_SUCCESS && reads[1].CompletionTime == interval);
+  CHECK(reads[2].Status == STATUS_SUCCESS && reads[2].CompletionTime == 2 * interval);
+  AemSimFree(&device);
+}
+
+static void TestClearDropsQueuedMoves(void) {
+  AEM_SIM_DEVICE device;
+  AEM_SIM_READ   read;
+  int            i;
+
+  AemSimInit(&device, NULL, NULL);
+  for(i = 0; i < 10; i++)
+    CHECK(SendMove(&device, 1, 1, 0, 0));
+  ClearQueue(&device);
+  CHECK(AemCoreIsQueueEmpty(&device.Core));
+
+  AemSimRead(&device, &read);
+  CHECK(read.Status == STATUS_PENDING);
+  AemSimFree(&device);
+}
+
+static void TestFullQueueRejectsMoves(void) {
+  AEM_SIM_DEVICE device;
+  ULONG          capacity, accepted = 0, i;
+  UCHAR          report[AEM_INPUT_REPORT_SIZE + 1];
+
+  /* Alternating buttons keep the moves from being merged by compaction. */
+  AemSimInit(&device, NULL, NULL);
+  capacity = device.Core.InfoReport.MessageQueueCapacity;
+  for(i = 0; i < capacity + 10; i++)
+    if(SendMove(&device, 1, 1, (UCHAR) (i & 1), 0))
+      accepted++;
+  CHECK(accepted == capacity);
+  CHECK(device.Core.MergedCount == 0);
+  CHECK(device.Core.IsCompacted && device.Core.CompactedTail == device.Core.MessageQueue.Tail);
+
+  /* Room is made by taking a message. A push makes the queue worth compacting again. */
+  CHECK(DequeueReport(&device.Core, report));
+  CHECK(device.Core.IsCompacted && device.Core.CompactedTail == device.Core.MessageQueue.Tail);
+  CHECK(SendMove(&device, 1, 1, (UCHAR) (capacity & 1), 0));
+  CHECK(device.Core.CompactedTail != device.Core.MessageQueue.Tail);
+  CHECK(!SendMove(&device, 1, 1, 0, 0));
+  CHECK(device.Core.IsCompacted && device.Core.CompactedTail == device.Core.MessageQueue.Tail);
+
+  /* Push that repeats the last buttons is merged by the compaction that follows it. */
+  CHECK(DequeueReport(&device.Core, report));
+  CHECK(SendMove(&device, 1, 1, (UCHAR) (capacity & 1), 0));
+  CHECK(SendMove(&device, 1, 1, 0, 0));
+  CHECK(device.Core.MergedCount == 1 && !device.Core.IsCompacted);
+  AemSimFree(&device);
+}
+
+typedef struct _AEM_TEST_PRODUCERS {
+  AEM_SIM_DEVICE  Device;
+  volatile LONG   RunningProducers;
+  volatile LONG   NextProducer;
+} AEM_TEST_PRODUCERS, *PAEM_TEST_PRODUCERS;
+
+static void *ProducerThread(void *context) {
+  PAEM_TEST_PRODUCERS producers = (PAEM_TEST_PRODUCERS) context;
+  UCHAR               index = (UCHAR) (AemInterlockedIncrement(&producers->NextProducer) - 1);
+  ULONG               i;
+
+  /* Moves are absolute and carry their number & the producer index. Buttons alternate, so that compaction 
+   * of a full queue can't merge the moves of a single producer. */
+  for(i = 0; i < AEM_TEST_PRODUCER_MOVES; i++)
+    while(!SendMove(&producers->Device, (SHORT) i, (SHORT) index, (UCHAR) (i & 1), AEM_MOVE_ABSOLUTE))
+      AemYieldProcessor();
+  AemInterlockedDecrement(&producers->RunningProducers);
+  return NULL;
+}
+
+static void TestConcurrentProducers(void) {
+  static AEM_TEST_PRODUCERS producers;
+  pthread_t                 threads[AEM_TEST_PRODUCER_COUNT];
+  UCHAR                     report[AEM_INPUT_REPORT_SIZE + 1];
+  ULONG                     expected[AEM_TEST_PRODUCER_COUNT] = {0};
+  ULONG                     dequeued = 0, misordered = 0, i;
+  SHORT_POINT               point;
+
+  AemSimInit(&producers.Device, NULL, NULL);
+  producers.RunningProducers = AEM_TEST_PRODUCER_COUNT;
+  producers.NextProducer = 0;
+  for(i = 0; i < AEM_TEST_PRODUCER_COUNT; i++)
+    pthread_create(&threads[i], NULL, ProducerThread, &producers);
+
+  /* Moves of different producers may still be merged with each other, a merged move is reported 
+   * with the position of the later one, so the order of each producer is checked as a subsequence. */
+  while(AemReadAcquire(&producers.RunningProducers) != 0 || !AemCoreIsQueueEmpty(&producers.Device.Core)) {
+    if(!DequeueReport(&producers.Device.Core, report)) {
+      AemYieldProcessor();
+      continue;
+    }
+    point = ReportPoint(report);
+    if(point.Y < 0 || point.Y >= AEM_TEST_PRODUCER_COUNT || point.X < (LONG) expected[point.Y] || report[1] != (point.X & 1))
+      misordered++;
+    else
+      expected[point.Y] = point.X + 1;
+    dequeued++;
+  }
+  for(i = 0; i < AEM_TEST_PRODUCER_COUNT; i++)
+    pthread_join(threads[i], NULL);
+
+  CHECK(misordered == 0);
+  CHECK(dequeued + producers.Device.Core.MergedCount == AEM_TEST_PRODUCER_COUNT * AEM_TEST_PRODUCER_MOVES);
+  AemSimFree(&producers.Device);
+}
+
+
+/* Ring. */
+
+static void InitNumbered(PAEM_MESSAGE message, UCHAR producer, ULONG number) {
+  RtlZeroMemory(message, sizeof(*message));
+  message->Kind = AEM_MESSAGE_MOVE;
+  message->Buttons = producer;
+  message->Duration = number;
+}
+
+static void TestRingWrapsAround(void) {
+  static AEM_RING_SLOT slots[AEM_TEST_RING_CAPACITY];
+  AEM_RING             ring;
+  AEM_MESSAGE          message;
+  ULONG                pushed = 0, popped = 0, position, round, i;
+
+  AemRingInit(&ring, slots, AEM_TEST_RING_CAPACITY);
+  CHECK(AemRingIsEmpty(&ring));
+  CHECK(!AemRingPop(&ring, &message));
+
+  /* Fill & drain by uneven amounts, so that the positions cross the end of the storage at different offsets. */
+  for(round = 0; round < 100; round++) {
+    for(i = 0; i < round % 7 + 1; i++) {
+      InitNumbered(&message, 0, pushed);
+      CHECK(AemRingPush(&ring, &message));
+      pushed++;
+    }
+    for(i = 0; i < round % 5 + 3 && AemRingPop(&ring, &message); i++) {
+      CHECK(message.Duration == popped);
+      popped++;
+    }
+  }
+  while(AemRingPop(&ring, &message)) {
+    CHECK(message.Duration == popped);
+    popped++;
+  }
+  CHECK(popped == pushed);
+
+  /* Full ring rejects both single pushes and reservations. */
+  for(i = 0; i < AEM_TEST_RING_CAPACITY; i++) {
+    InitNumbered(&message, 0, i);
+    CHECK(AemRingPush(&ring, &message));
+  }
+  CHECK(AemRingSize(&ring) == AEM_TEST_RING_CAPACITY);
+  CHECK(!AemRingPush(&ring, &message));
+  CHECK(AemRingReserve(&ring, 1, &position) == 0);
+
+  /* Reservations are cut to the free space, and an unpublished slot holds back the ones after it. */
+  CHECK(AemRingPop(&ring, NULL) && AemRingPop(&ring, NULL));
+  CHECK(AemRingReserve(&ring, 4, &position) == 2);
+  InitNumbered(AemRingSlot(&ring, position + 1), 0, AEM_TEST_RING_CAPACITY + 1);
+  AemRingCommit(&ring, position + 1);
+  CHECK(AemRingClear(&ring) == AEM_TEST_RING_CAPACITY - 2);
+  CHECK(AemRingIsEmpty(&ring));
+  InitNumbered(AemRingSlot(&ring, position), 0, AEM_TEST_RING_CAPACITY);
+  AemRingCommit(&ring, position);
+  CHECK(AemRingPop(&ring, &message) && message.Duration == AEM_TEST_RING_CAPACITY);
+  CHECK(AemRingPop(&ring, &message) && message.Duration == AEM_TEST_RING_CAPACITY + 1);
+  CHECK(AemRingIsEmpty(&ring));
+}
+
+typedef struct _AEM_TEST_RING_PRODUCERS {
+  AEM_RING        Ring;
+  AEM_RING_SLOT   Slots[AEM_TEST_RING_CAPACITY];
+  AEM_RING_SLOT   OtherSlots[2 * AEM_TEST_RING_CAPACITY]; /**< Storage the ring is moved into & back by the relocation test. */
+  volatile LONG   RunningProducers;
+  volatile LONG   NextProducer;
+} AEM_TEST_RING_PRODUCERS, *PAEM_TEST_RING_PRODUCERS;
+
+static void *RingProducerThread(void *context) {
+  PAEM_TEST_RING_PRODUCERS producers = (PAEM_TEST_RING_PRODUCERS) context;
+  UCHAR                    index = (UCHAR) (AemInterlockedIncrement(&producers->NextProducer) - 1);
+  ULONG                    sent = 0, position, claimed, count, i;
+
+  /* Claims up to three slots at a time & publishes them last to first, so that the consumer sees 
+   * partially published runs. */
+  while(sent < AEM_TEST_PRODUCER_MOVES) {
+    count = AEM_TEST_PRODUCER_MOVES - sent < 3 ? AEM_TEST_PRODUCER_MOVES - sent : sent % 3 + 1;
+    claimed = AemRingReserve(&producers->Ring, count, &position);
+    for(i = 0; i < claimed; i++)
+      InitNumbered(AemRingSlot(&producers->Ring, position + i), index, sent + i);
+    for(i = claimed; i > 0; i--)
+      AemRingCommit(&producers->Ring, position + i - 1);
+
+    sent += claimed;
+    if(claimed == 0)
+      AemYieldProcessor();
+  }
+  AemInterlockedDecrement(&producers->RunningProducers);
+  return NULL;
+}
+
+/** Runs the ring producers against a consumer that relocates the ring between the two storages every few pops, if asked to. */
+static void RunRingProducers(BOOLEAN isRelocating) {
+  static AEM_TEST_RING_PRODUCERS producers;
+  pthread_t                      threads[AEM_TEST_PRODUCER_COUNT];
+  ULONG                          expected[AEM_TEST_PRODUCER_COUNT] = {0};
+  ULONG                          popped = 0, misordered = 0, relocated = 0, i;
+  AEM_MESSAGE                    message;
+
+  /* Every message must come out exactly once, in the order of its producer. */
+  AemRingInit(&producers.Ring, producers.Slots, AEM_TEST_RING_CAPACITY);
+  producers.RunningProducers = AEM_TEST_PRODUCER_COUNT;
+  producers.NextProducer = 0;
+  for(i = 0; i < AEM_TEST_PRODUCER_COUNT; i++)
+    pthread_create(&threads[i], NULL, RingProducerThread, &producers);
+
+  while(AemReadAcquire(&producers.RunningProducers) != 0 || !AemRingIsEmpty(&producers.Ring)) {
+    if(!AemRingPop(&producers.Ring, &message)) {
+      AemYieldProcessor();
+      continue;
+    }
+    if(message.Buttons >= AEM_TEST_PRODUCER_COUNT || message.Duration != expected[message.Buttons])
+      misordered++;
+    else
+      expected[message.Buttons]++;
+    popped++;
+
+    if(isRelocating && popped % 97 == 0) {
+      AemRingLockExclusive(&producers.Ring);
+      if(producers.Ring.Slots == producers.Slots)
+        AemRingRelocate(&producers.Ring, producers.OtherSlots, 2 * AEM_TEST_RING_CAPACITY);
+      else if(AemRingSize(&producers.Ring) <= AEM_TEST_RING_CAPACITY)
+        AemRingRelocate(&producers.Ring, producers.Slots, AEM_TEST_RING_CAPACITY);
+      AemRingUnlockExclusive(&producers.Ring);
+      relocated++;
+    }
+  }
+  for(i = 0; i < AEM_TEST_PRODUCER_COUNT; i++)
+    pthread_join(threads[i], NULL);
+
+  CHECK(misordered == 0);
+  CHECK(popped == AEM_TEST_PRODUCER_COUNT * AEM_TEST_PRODUCER_MOVES);
+  CHECK(!isRelocating || relocated > 0);
+}
+
+static void TestRingConcurrentProducers(void) {
+  RunRingProducers(FALSE);
+}
+
+static void TestRingIsRelocatedUnderProducers(void) {
+  RunRingProducers(TRUE);
+}
+
+
+/* Compaction. */
+
+/** Run of moves with identical button flags & motion mode, or a single message of another kind. Compaction 
+ * must turn the input into the same sequence of runs, see coalesce.h. */
+typedef struct _AEM_TEST_RUN {
+  UCHAR   Kind;
+  UCHAR   Buttons;
+  BOOLEAN IsRelative;
+  UCHAR   Key;
+  LONG    X;         /**< Sum of deltas or last position. */
+  LONG    Y;
+} AEM_TEST_RUN, *PAEM_TEST_RUN;
+
+/** Deterministic generator, so that a failure can be reproduced. */
+static ULONG Random(ULONG *state) {
+  *state = *state * 1103515245 + 12345;
+  return (*state >> 8) & 0xFFFFFF;
+}
+
+static ULONG SummarizeRuns(PAEM_MESSAGE messages, ULONG count, PAEM_TEST_RUN runs) {
+  PAEM_TEST_RUN run = NULL;
+  ULONG         runCount = 0, i;
+
+  for(i = 0; i < count; i++) {
+    if(run == NULL || messages[i].Kind != AEM_MESSAGE_MOVE || run->Kind != AEM_MESSAGE_MOVE || 
+       run->Buttons != messages[i].Buttons || run->IsRelative != messages[i].IsRelative) {
+      run = &runs[runCount++];
+      run->Kind = messages[i].Kind;
+      run->Buttons = messages[i].Buttons;
+      run->IsRelative = messages[i].IsRelative;
+      run->Key = messages[i].Kind == AEM_MESSAGE_KEY ? messages[i].Key : 0;
+      run->X = 0;
+      run->Y = 0;
+    }
+    if(!run->IsRelative) {
+      run->X = 0;
+      run->Y = 0;
+    }
+    run->X += messages[i].Point.X;
+    run->Y += messages[i].Point.Y;
+  }
+  return runCount;
+}
+
+static void TestCompactionKeepsRuns(void) {
+  static AEM_RING_SLOT slots[AEM_TEST_COMPACTION_SIZE];
+  static AEM_MESSAGE   input[AEM_TEST_COMPACTION_SIZE], output[AEM_TEST_COMPACTION_SIZE];
+  static AEM_TEST_RUN  inputRuns[AEM_TEST_COMPACTION_SIZE], outputRuns[AEM_TEST_COMPACTION_SIZE];
+  AEM_RING             ring;
+  ULONG                state = 1, round, merged, outputCount, runCount, i;
+
+  for(round = 0; round < AEM_TEST_COMPACTION_ROUNDS; round++) {
+    /* Few distinct buttons & modes, so that there are long runs to merge. Keys split the runs. */
+    AemRingInit(&ring, slots, AEM_TEST_COMPACTION_SIZE);
+    for(i = 0; i < AEM_TEST_COMPACTION_SIZE; i++) {
+      RtlZeroMemory(&input[i], sizeof(input[i]));
+      input[i].Kind = Random(&state) % 16 == 0 ? AEM_MESSAGE_KEY : AEM_MESSAGE_MOVE;
+      input[i].Key = (UCHAR) i;
+      input[i].Buttons = (UCHAR) (Random(&state) % 8 == 0);
+      input[i].IsRelative = Random(&state) % 8 != 0;
+      input[i].Point.X = (SHORT) ((LONG) (Random(&state) % (2 * AEM_MAX_RELATIVE_DELTA + 1)) - AEM_MAX_RELATIVE_DELTA);
+      input[i].Point.Y = (SHORT) ((LONG) (Random(&state) % (2 * AEM_MAX_RELATIVE_DELTA + 1)) - AEM_MAX_RELATIVE_DELTA);
+      CHECK(AemRingPush(&ring, &input[i]));
+    }
+
+    merged = AemCoalesceRing(&ring);
+    for(outputCount = 0; AemRingPop(&ring, &output[outputCount]); outputCount++)
+      CHECK(!output[outputCount].IsRelative || (abs(output[outputCount].Point.X) <= AEM_MAX_RELATIVE_DELTA && 
+                                                abs(output[outputCount].Point.Y) <= AEM_MAX_RELATIVE_DELTA));
+    CHECK(merged == AEM_TEST_COMPACTION_SIZE - outputCount);
+    CHECK(merged > 0);
+
+    runCount = SummarizeRuns(input, AEM_TEST_COMPACTION_SIZE, inputRuns);
+    CHECK(SummarizeRuns(output, outputCount, outputRuns) == runCount);
+    for(i = 0; i < runCount; i++)
+      CHECK(inputRuns[i].Kind == outputRuns[i].Kind && inputRuns[i].Buttons == outputRuns[i].Buttons && 
+            inputRuns[i].IsRelative == outputRuns[i].IsRelative && inputRuns[i].Key == outputRuns[i].Key && 
+            inputRuns[i].X == outputRuns[i].X && inputRuns[i].Y == outputRuns[i].Y);
+  }
+}
+
+static void TestCompactionMergesExactly(void) {
+  static AEM_RING_SLOT slots[AEM_TEST_RING_CAPACITY];
+  AEM_RING             ring;
+  AEM_MESSAGE          message;
+  ULONG                i;
+
+  /* Absolute: b0 (1,1) (2,2) (3,3), b1 (4,4), b0 (5,5) (6,6) collapse to the last position of each run. */
+  AemRingInit(&ring, slots, AEM_TEST_RING_CAPACITY);
+  RtlZeroMemory(&message, sizeof(message));
+  for(i = 1; i <= 6; i++) {
+    message.Buttons = (UCHAR) (i == 4);
+    message.Point.X = message.Point.Y = (SHORT) i;
+    AemRingPush(&ring, &message);
+  }
+  CHECK(AemCoalesceRing(&ring) == 3);
+  CHECK(AemRingPop(&ring, &message) && message.Buttons == 0 && message.Point.X == 3);
+  CHECK(AemRingPop(&ring, &message) && message.Buttons == 1 && message.Point.X == 4);
+  CHECK(AemRingPop(&ring, &message) && message.Buttons == 0 && message.Point.X == 6);
+  CHECK(AemRingIsEmpty(&ring));
+
+  /* Relative: deltas of 100 are left alone, two of them would not fit into a report. Deltas of 1 are summed. */
+  RtlZeroMemory(&message, sizeof(message));
+  message.IsRelative = TRUE;
+  message.Point.X = 100;
+  message.Point.Y = -1;
+  for(i = 0; i < 10; i++)
+    AemRingPush(&ring, &message);
+  AemCoalesceRing(&ring);
+  for(i = 0; AemRingPop(&ring, &message); i++)
+    CHECK(message.Point.X == 100 && message.Point.Y == -1);
+  CHECK(i == 10);
+
+  message.Point.X = 1;
+  for(i = 0; i < 10; i++)
+    AemRingPush(&ring, &message);
+  CHECK(AemCoalesceRing(&ring) == 9);
+  CHECK(AemRingPop(&ring, &message) && message.Point.X == 10 && message.Point.Y == -10);
+}
+
+static void TestFullQueueIsCompacted(void) {
+  AEM_SIM_DEVICE device;
+  ULONG          capacity, i;
+  LONG           x = 0, y = 0;
+  UCHAR          report[AEM_INPUT_REPORT_SIZE + 1];
+
+  /* Moves that can be merged are never rejected, and the final position is kept. */
+  AemSimInit(&device, NULL, NULL);
+  capacity = device.Core.InfoReport.MessageQueueCapacity;
+  for(i = 0; i < 2 * capacity; i++)
+    CHECK(SendMove(&device, 1, -1, 0, 0));
+  CHECK(device.Core.MergedCount > 0);
+
+  while(DequeueReport(&device.Core, report)) {
+    x += (CHAR) report[2];
+    y += (CHAR) report[3];
+  }
+  CHECK(x == 2 * (LONG) capacity && y == -2 * (LONG) capacity);
+  AemSimFree(&device);
+}
+
+
+/* Catch-up. */
+
+static void SetCatchUp(PAEM_SIM_DEVICE device, UCHAR flags, DWORD32 threshold) {
+  AEM_CATCH_UP_FEATURE_REPORT report;
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_CATCH_UP;
+  report.Flags = flags | AEM_CATCH_UP_UPDATE;
+  report.Threshold = threshold;
+  GetFeature(device, &report, sizeof(report));
+}
+
+static void TestCatchUpMergesBacklog(void) {
+  AEM_SIM_DEVICE  device;
+  PAEM_STATS_PAGE stats;
+  ULONG           count = 0, edges = 0, i;
+  LONG            x[3] = {0, 0, 0}, y[3] = {0, 0, 0}, group = 0;
+  UCHAR           report[AEM_INPUT_REPORT_SIZE + 1], buttons = 0;
+
+  /* Button down, moves, button up: a backlog of three runs that may only be merged within themselves. */
+  AemSimInit(&device, NULL, NULL);
+  SetCatchUp(&device, AEM_CATCH_UP_ENABLED, 4);
+  for(i = 0; i < 100; i++)
+    CHECK(SendMove(&device, 3, -2, 0, 0));
+  for(i = 0; i < 10; i++)
+    CHECK(SendMove(&device, 5, 5, 1, 0));
+  for(i = 0; i < 10; i++)
+    CHECK(SendMove(&device, 1, 0, 0, 0));
+  stats = device.Core.Stats;
+  CHECK(stats->Enqueued == 120);
+
+  while(DequeueReport(&device.Core, report)) {
+    CHECK(report[0] == AEM_POINTER_REPORT_ID);
+    if(report[1] != buttons) {
+      buttons = report[1];
+      edges++;
+      group++;
+    }
+    if(group < 3) {
+      x[group] += (CHAR) report[2];
+      y[group] += (CHAR) report[3];
+    }
+    count++;
+    CHECK(stats->Enqueued - stats->Emitted - stats->Dropped == (LONG) AemRingSize(&device.Core.MessageQueue));
+  }
+  CHECK(edges == 2 && buttons == 0);
+  CHECK(x[0] == 300 && y[0] == -200);
+  CHECK(x[1] == 50 && y[1] == 50);
+  CHECK(x[2] == 10 && y[2] == 0);
+
+  /* Backlog is merged into as few reports as fit the deltas, the last moves under the threshold go out one by one. */
+  CHECK(count < 120);
+  CHECK(stats->Emitted + stats->Dropped == 120);
+  CHECK((LONG) device.Core.MergedCount == stats->Dropped);
+  CHECK(stats->Dropped > 100);
+  AemSimFree(&device);
+}
+
+static void TestCatchUpWaitsForThreshold(void) {
+  AEM_SIM_DEVICE device;
+  ULONG          count = 0, i;
+  UCHAR          report[AEM_INPUT_REPORT_SIZE + 1];
+
+  AemSimInit(&device, NULL, NULL);
+  SetCatchUp(&device, AEM_CATCH_UP_ENABLED, 16);
+  for(i = 0; i < 16; i++)
+    CHECK(SendMove(&device, 1, 1, 0, 0));
+  while(DequeueReport(&device.Core, report))
+    count++;
+  CHECK(count == 16);
+  CHECK(device.Core.MergedCount == 0 && device.Core.Stats->Dropped == 0);
+  AemSimFree(&device);
+}
+
+
+/* Glides. */
+
+static void TestGlideEasing(void) {
+  static const UCHAR easings[3] = {AEM_EASING_LINEAR, AEM_EASING_EASE_IN_OUT, AEM_EASING_MINIMUM_JERK};
+  LONG               progress, value, last;
+  int                i;
+
+  for(i = 0; i < 3; i++) {
+    CHECK(AemGlideEase(easings[i], 0) == 0);
+    CHECK(AemGlideEase(easings[i], 0x10000) == 0x10000);
+    last = 0;
+    for(progress = 0; progress <= 0x10000; progress++) {
+      value = AemGlideEase(easings[i], progress);
+      CHECK(value >= last && value <= 0x10000);
+      last = value;
+    }
+  }
+}
+
+static void TestGlideCarriesClampedSteps(void) {
+  static const SHORT deltas[4][2] = {{1000, -700}, {-30000, 20000}, {32767, -32768}, {5, 0}};
+  AEM_GLIDE          glide;
+  AEM_MESSAGE        message;
+  LONG               x, y;
+  ULONG              steps;
+  int                i;
+
+  /* Deltas far over the report range, spread over few steps. Every step is clamped and the rest is carried. */
+  for(i = 0; i < 4; i++) {
+    RtlZeroMemory(&message, sizeof(message));
+    message.Kind = AEM_MESSAGE_GLIDE_BY;
+    message.IsRelative = TRUE;
+    message.Point.X = deltas[i][0];
+    message.Point.Y = deltas[i][1];
+    message.Easing = (UCHAR) (i % 3);
+    message.Duration = 32000;
+    AemGlideInit(&glide);
+    AemGlideStart(&glide, &message, 0, 0, 8000);
+    CHECK(glide.Steps == 4);
+
+    x = y = 0;
+    for(steps = 0; AemGlideIsActive(&glide) && steps < 1000; steps++) {
+      AemGlideNext(&glide, &message);
+      CHECK(message.Kind == AEM_MESSAGE_MOVE && message.IsRelative);
+      CHECK(message.Point.X >= -AEM_MAX_RELATIVE_DELTA && message.Point.X <= AEM_MAX_RELATIVE_DELTA);
+      CHECK(message.Point.Y >= -AEM_MAX_RELATIVE_DELTA && message.Point.Y <= AEM_MAX_RELATIVE_DELTA);
+      x += message.Point.X;
+      y += message.Point.Y;
+    }
+    CHECK(!AemGlideIsActive(&glide));
+    CHECK(glide.DoneX == glide.DeltaX && glide.DoneY == glide.DeltaY);
+    CHECK(x == deltas[i][0] && y == deltas[i][1]);
+    CHECK(steps >= 4);
+  }
+}
+
+static void TestGlideToStartsFromLastPosition(void) {
+  static const SHORT       points[4][2] = {{150, 175}, {200, 150}, {250, 125}, {300, 100}};
+  AEM_SIM_DEVICE           device;
+  AEM_SIM_READ             read;
+  AEM_GLIDE_FEATURE_REPORT report;
+  ULONGLONG                interval;
+  int                      i;
+
+  AemSimInit(&device, NULL, NULL);
+  interval = 10 * (ULONGLONG) device.Core.MessageCheckInterval;
+  CHECK(SendMove(&device, 100, 200, 0, AEM_MOVE_ABSOLUTE));
+  AemSimRead(&device, &read);
+  CHECK(read.Status == STATUS_SUCCESS && ReportPoint(read.Report).X == 100);
+
+  /* Four intervals long linear glide, so every step is a quarter of the way. */
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_GLIDE;
+  report.Flags = AEM_GLIDE_ABSOLUTE;
+  report.Buttons = 0;
+  report.Point.X = 300;
+  report.Point.Y = 100;
+  report.Easing = AEM_EASING_LINEAR;
+  report.Duration = 4 * device.Core.MessageCheckInterval;
+  CHECK(GetFeature(&device, &report, sizeof(report)) == STATUS_SUCCESS);
+  CHECK(report.Report.ControlCode == AEM_CONTROL_CODE_GLIDE);
+
+  for(i = 0; i < 4; i++) {
+    AemSimAdvance(&device, interval);
+    AemSimRead(&device, &read);
+    AemSimAdvance(&device, interval);
+    CHECK(read.Status == STATUS_SUCCESS && read.Report[0] == AEM_ABSOLUTE_POINTER_REPORT_ID);
+    CHECK(ReportPoint(read.Report).X == points[i][0] && ReportPoint(read.Report).Y == points[i][1]);
+  }
+  CHECK(!AemGlideIsActive(&device.Core.Glide));
+  AemSimFree(&device);
+}
+
+
+/* Submission channel. */
+
+static void InitNumberedEntry(PAEM_MOVE_ENTRY entry, UCHAR producer, ULONG number) {
+  entry->Flags = AEM_MOVE_ABSOLUTE;
+  entry->Buttons = producer;
+  entry->Point.X = (SHORT) number;
+  entry->Point.Y = 0;
+}
+
+static void TestChannelWrapsAround(void) {
+  static AEM_CHANNEL_PAGE page;
+  AEM_CHANNEL             channel;
+  AEM_MOVE_ENTRY          entries[AEM_TEST_RING_CAPACITY + 4], entry;
+  ULONG                   written = 0, read = 0, round, count, i;
+
+  AemChannelInit(&channel, &page, AEM_TEST_RING_CAPACITY);
+  CHECK(!AemChannelPeek(&channel, &entry));
+  CHECK(!AemChannelIsStuck(&channel));
+
+  /* Write & read by uneven amounts, so that the positions cross the end of the slots at different offsets. */
+  for(round = 0; round < 100; round++) {
+    count = round % 7 + 1;
+    for(i = 0; i < count; i++)
+      InitNumberedEntry(&entries[i], 0, written + i);
+    CHECK(AemChannelWrite(&page, entries, count) == count);
+    written += count;
+    for(i = 0; i < round % 5 + 3 && AemChannelPeek(&channel, &entry); i++) {
+      CHECK(entry.Point.X == (SHORT) read);
+      AemChannelPop(&channel);
+      read++;
+    }
+  }
+  while(AemChannelPeek(&channel, &entry)) {
+    CHECK(entry.Point.X == (SHORT) read);
+    AemChannelPop(&channel);
+    read++;
+  }
+  CHECK(read == written);
+  CHECK(page.Head == (LONG) read);
+
+  /* Full channel takes what fits and then nothing. */
+  for(i = 0; i < AEM_TEST_RING_CAPACITY + 4; i++)
+    InitNumberedEntry(&entries[i], 0, i);
+  CHECK(AemChannelWrite(&page, entries, AEM_TEST_RING_CAPACITY + 4) == AEM_TEST_RING_CAPACITY);
+  CHECK(AemChannelWrite(&page, entries, 1) == 0);
+  CHECK(!AemChannelIsStuck(&channel));
+  CHECK(AemChannelClear(&channel) == AEM_TEST_RING_CAPACITY);
+  CHECK(AemChannelWrite(&page, entries, 1) == 1);
+}
+
+typedef struct _AEM_TEST_CHANNEL_PRODUCERS {
+  AEM_CHANNEL_PAGE Page;
+  volatile LONG    RunningProducers;
+  volatile LONG    NextProducer;
+} AEM_TEST_CHANNEL_PRODUCERS, *PAEM_TEST_CHANNEL_PRODUCERS;
+
+static void *ChannelProducerThread(void *context) {
+  PAEM_TEST_CHANNEL_PRODUCERS producers = (PAEM_TEST_CHANNEL_PRODUCERS) context;
+  UCHAR                       index = (UCHAR) (AemInterlockedIncrement(&producers->NextProducer) - 1);
+  AEM_MOVE_ENTRY              entries[3];
+  ULONG                       sent = 0, count, i;
+
+  /* Writes up to three moves at a time, the channel takes as many of them as fit. */
+  while(sent < AEM_TEST_PRODUCER_MOVES) {
+    count = AEM_TEST_PRODUCER_MOVES - sent < 3 ? AEM_TEST_PRODUCER_MOVES - sent : sent % 3 + 1;
+    for(i = 0; i < count; i++)
+      InitNumberedEntry(&entries[i], index, sent + i);
+    count = AemChannelWrite(&producers->Page, entries, count);
+    sent += count;
+    if(count == 0)
+      AemYieldProcessor();
+  }
+  AemInterlockedDecrement(&producers->RunningProducers);
+  return NULL;
+}
+
+static void TestChannelConcurrentProducers(void) {
+  static AEM_TEST_CHANNEL_PRODUCERS producers;
+  AEM_CHANNEL                       channel;
+  pthread_t                         threads[AEM_TEST_PRODUCER_COUNT];
+  ULONG                             expected[AEM_TEST_PRODUCER_COUNT] = {0};
+  ULONG                             read = 0, misordered = 0, i;
+  AEM_MOVE_ENTRY                    entry;
+
+  /* Every move must come out exactly once, in the order of its producer. */
+  AemChannelInit(&channel, &producers.Page, AEM_TEST_RING_CAPACITY);
+  producers.RunningProducers = AEM_TEST_PRODUCER_COUNT;
+  producers.NextProducer = 0;
+  for(i = 0; i < AEM_TEST_PRODUCER_COUNT; i++)
+    pthread_create(&threads[i], NULL, ChannelProducerThread, &producers);
+
+  for(;;) {
+    if(!AemChannelPeek(&channel, &entry)) {
+      if(AemReadAcquire(&producers.RunningProducers) == 0 && !AemChannelPeek(&channel, &entry))
+        break;
+      AemYieldProcessor();
+      continue;
+    }
+    AemChannelPop(&channel);
+    if(entry.Buttons >= AEM_TEST_PRODUCER_COUNT || entry.Point.X != (SHORT) expected[entry.Buttons])
+      misordered++;
+    else
+      expected[entry.Buttons]++;
+    read++;
+  }
+  for(i = 0; i < AEM_TEST_PRODUCER_COUNT; i++)
+    pthread_join(threads[i], NULL);
+
+  CHECK(misordered == 0);
+  CHECK(read == AEM_TEST_PRODUCER_COUNT * AEM_TEST_PRODUCER_MOVES);
+  CHECK(!AemChannelIsStuck(&channel));
+}
+
+/** Claims a slot of the channel & never publishes it, as a producer that died in the middle of a write would. 
+ *
+ * @returns                            Claimed position. */
+static LONG AbandonSlot(PAEM_CHANNEL_PAGE page) {
+  return AemInterlockedIncrement(&page->Tail) - 1;
+}
+
+static void TestChannelStuckSlotIsRecovered(void) {
+  AEM_SIM_DEVICE    device;
+  PAEM_CHANNEL_PAGE page = &device.ChannelPage;
+  AEM_MOVE_ENTRY    entry;
+  UCHAR             report[AEM_INPUT_REPORT_SIZE + 1];
+  LONG              abandoned;
+
+  AemSimInit(&device, NULL, NULL);
+  abandoned = AbandonSlot(page);
+  InitNumberedEntry(&entry, 0, 1);
+  CHECK(AemChannelWrite(page, &entry, 1) == 1);
+
+  /* Move behind the abandoned slot is held back until the head has been stuck for the timeout. */
+  CHECK(!DequeueReport(&device.Core, report));
+  AemSimAdvance(&device, AEM_CHANNEL_STUCK_TIMEOUT - 1);
+  CHECK(!DequeueReport(&device.Core, report));
+  CHECK(page->Generation == 0);
+  AemSimAdvance(&device, 1);
+  CHECK(!DequeueReport(&device.Core, report));
+  CHECK(page->Generation == 1);
+  CHECK(!device.Core.IsChannelStuck);
+
+  /* Producer that held the abandoned slot can't publish into the renumbered channel. */
+  CHECK(AemInterlockedCompareExchange(&page->Slots[abandoned & (AEM_CHANNEL_SIZE - 1)].Sequence, abandoned + 1, abandoned) != abandoned);
+
+  InitNumberedEntry(&entry, 0, 2);
+  CHECK(AemChannelWrite(page, &entry, 1) == 1);
+  CHECK(DequeueReport(&device.Core, report) && ReportPoint(report).X == 2);
+  CHECK(!DequeueReport(&device.Core, report));
+  AemSimFree(&device);
+}
+
+static void TestClearResetsStuckChannel(void) {
+  AEM_SIM_DEVICE    device;
+  PAEM_CHANNEL_PAGE page = &device.ChannelPage;
+  AEM_MOVE_ENTRY    entry;
+  UCHAR             report[AEM_INPUT_REPORT_SIZE + 1];
+
+  /* Clearing doesn't wait for the timeout. */
+  AemSimInit(&device, NULL, NULL);
+  AbandonSlot(page);
+  InitNumberedEntry(&entry, 0, 1);
+  CHECK(AemChannelWrite(page, &entry, 1) == 1);
+  CHECK(!DequeueReport(&device.Core, report));
+  ClearQueue(&device);
+  CHECK(page->Generation == 1);
+
+  InitNumberedEntry(&entry, 0, 2);
+  CHECK(AemChannelWrite(page, &entry, 1) == 1);
+  CHECK(DequeueReport(&device.Core, report) && ReportPoint(report).X == 2);
+  AemSimFree(&device);
+}
+
+
+/* Batches. */
+
+static NTSTATUS SendBatch(PAEM_SIM_DEVICE device, PAEM_BATCH_FEATURE_REPORT batch, ULONG length) {
+  batch->Report.ReportId = AEM_CONTROL_REPORT_ID;
+  batch->Report.ControlCode = AEM_CONTROL_CODE_MOVE_BATCH;
+  return GetFeature(device, batch, length);
+}
+
+static void TestBatchPacking(void) {
+  AEM_BATCH_FEATURE_REPORT batch;
+  AEM_MOVE_ENTRY           entry;
+  AEM_MESSAGE              message;
+  ULONG                    i;
+
+  AemBatchInit(&batch);
+  CHECK(batch.Count == 0 && AemBatchSize(&batch) == AEM_BATCH_FEATURE_REPORT_SIZE(0));
+  for(i = 0; i < AEM_MAX_BATCH_SIZE; i++) {
+    InitNumberedEntry(&entry, 1, i);
+    CHECK(AemBatchAppendEntry(&batch, &entry));
+  }
+  CHECK(!AemBatchAppendEntry(&batch, &entry));
+  CHECK(!AemBatchAppend(&batch, TRUE, 0, 1, 1));
+  CHECK(batch.Count == AEM_MAX_BATCH_SIZE);
+  CHECK(AemBatchSize(&batch) == sizeof(batch));
+  for(i = 0; i < AEM_MAX_BATCH_SIZE; i++) {
+    AemBatchGetMessage(&batch, i, &message);
+    CHECK(message.Kind == AEM_MESSAGE_MOVE && !message.IsRelative && message.Buttons == 1 && message.Point.X == (SHORT) i);
+  }
+
+  /* Short buffer, too many entries, and a length that doesn't cover the entries. */
+  CHECK(!AemBatchIsValid(&batch, AEM_BATCH_FEATURE_REPORT_SIZE(0) - 1));
+  CHECK(AemBatchIsValid(&batch, AemBatchSize(&batch)));
+  CHECK(!AemBatchIsValid(&batch, AemBatchSize(&batch) - 1));
+  batch.Count = AEM_MAX_BATCH_SIZE + 1;
+  CHECK(!AemBatchIsValid(&batch, sizeof(batch) + sizeof(AEM_MOVE_ENTRY)));
+  batch.Count = 0;
+  CHECK(AemBatchIsValid(&batch, AEM_BATCH_FEATURE_REPORT_SIZE(0)));
+
+  /* Entries of every kind. */
+  entry.Flags = 0;
+  entry.Buttons = 2;
+  entry.Point.X = -3;
+  entry.Point.Y = 4;
+  AemBatchUnpackEntry(&entry, &message);
+  CHECK(message.Kind == AEM_MESSAGE_MOVE && message.IsRelative && message.Buttons == 2);
+  CHECK(message.Point.X == -3 && message.Point.Y == 4);
+
+  entry.Flags = AEM_MOVE_SCROLL | AEM_MOVE_ABSOLUTE;
+  AemBatchUnpackEntry(&entry, &message);
+  CHECK(message.Kind == AEM_MESSAGE_SCROLL && !message.IsRelative && message.Buttons == 2);
+  CHECK(message.Pan == -3 && message.Wheel == 4 && message.Point.X == 0 && message.Point.Y == 0);
+
+  entry.Flags = AEM_MOVE_KEY;
+  entry.Buttons = 0x04;
+  AemBatchUnpackEntry(&entry, &message);
+  CHECK(message.Kind == AEM_MESSAGE_KEY && message.Key == 0x04 && message.IsKeyDown);
+  entry.Flags = AEM_MOVE_KEY | AEM_MOVE_KEY_UP;
+  AemBatchUnpackEntry(&entry, &message);
+  CHECK(message.Kind == AEM_MESSAGE_KEY && message.Key == 0x04 && !message.IsKeyDown);
+}
+
+static void TestMalformedBatchIsRejected(void) {
+  AEM_SIM_DEVICE           device;
+  AEM_BATCH_FEATURE_REPORT batch;
+  ULONG                    i;
+
+  AemSimInit(&device, NULL, NULL);
+  AemBatchInit(&batch);
+  for(i = 0; i < 10; i++)
+    AemBatchAppend(&batch, TRUE, 0, 1, 1);
+
+  CHECK(SendBatch(&device, &batch, AEM_BATCH_FEATURE_REPORT_SIZE(0) - 1) == STATUS_BUFFER_TOO_SMALL);
+  CHECK(SendBatch(&device, &batch, AEM_BATCH_FEATURE_REPORT_SIZE(9)) == STATUS_BUFFER_TOO_SMALL);
+  batch.Count = AEM_MAX_BATCH_SIZE + 1;
+  CHECK(SendBatch(&device, &batch, sizeof(batch)) == STATUS_BUFFER_TOO_SMALL);
+  CHECK(AemCoreIsQueueEmpty(&device.Core));
+
+  batch.Count = 10;
+  CHECK(SendBatch(&device, &batch, AemBatchSize(&batch)) == STATUS_SUCCESS);
+  CHECK(batch.Count == 10);
+  CHECK(AemRingSize(&device.Core.MessageQueue) == 10);
+  AemSimFree(&device);
+}
+
+static void TestBatchIsPartiallyAccepted(void) {
+  AEM_SIM_DEVICE           device;
+  AEM_BATCH_FEATURE_REPORT batch;
+  ULONG                    capacity, i;
+  UCHAR                    report[AEM_INPUT_REPORT_SIZE + 1];
+
+  /* Alternating buttons keep compaction from freeing any slot, so only the leading entries that fit are taken. */
+  AemSimInit(&device, NULL, NULL);
+  capacity = device.Core.InfoReport.MessageQueueCapacity;
+  for(i = 0; i < capacity - 10; i++)
+    CHECK(SendMove(&device, 1, 1, (UCHAR) (i & 1), 0));
+
+  AemBatchInit(&batch);
+  for(i = 0; i < AEM_MAX_BATCH_SIZE; i++)
+    AemBatchAppend(&batch, FALSE, (UCHAR) ((capacity - 10 + i) & 1), (SHORT) i, 0);
+  CHECK(SendBatch(&device, &batch, AemBatchSize(&batch)) == STATUS_SUCCESS);
+  CHECK(batch.Count == 10);
+  CHECK(device.Core.Stats->QueueFull == AEM_MAX_BATCH_SIZE - 10);
+
+  for(i = 0; i < capacity - 10; i++)
+    CHECK(DequeueReport(&device.Core, report) && report[0] == AEM_POINTER_REPORT_ID);
+  for(i = 0; i < 10; i++)
+    CHECK(DequeueReport(&device.Core, report) && ReportPoint(report).X == (SHORT) i);
+  CHECK(!DequeueReport(&device.Core, report));
+  AemSimFree(&device);
+}
+
+static void TestBatchIsRetriedAfterCompaction(void) {
+  AEM_SIM_DEVICE           device;
+  AEM_BATCH_FEATURE_REPORT batch;
+  ULONG                    capacity, i;
+  LONG                     x = 0, y = 0;
+  UCHAR                    report[AEM_INPUT_REPORT_SIZE + 1];
+
+  /* Full queue of mergeable moves is compacted mid-batch, and the batch comes out whole & in order after them. */
+  AemSimInit(&device, NULL, NULL);
+  capacity = device.Core.InfoReport.MessageQueueCapacity;
+  for(i = 0; i < capacity; i++)
+    CHECK(SendMove(&device, 1, -1, 0, 0));
+  CHECK(device.Core.MergedCount == 0);
+
+  AemBatchInit(&batch);
+  for(i = 0; i < AEM_MAX_BATCH_SIZE; i++)
+    AemBatchAppend(&batch, FALSE, (UCHAR) (1 + (i & 1)), (SHORT) i, 0);
+  CHECK(SendBatch(&device, &batch, AemBatchSize(&batch)) == STATUS_SUCCESS);
+  CHECK(batch.Count == AEM_MAX_BATCH_SIZE);
+  CHECK(device.Core.MergedCount > 0);
+
+  while(DequeueReport(&device.Core, report) && report[0] == AEM_POINTER_REPORT_ID) {
+    x += (CHAR) report[2];
+    y += (CHAR) report[3];
+  }
+  CHECK(x == (LONG) capacity && y == -(LONG) capacity);
+
+  /* The first absolute report has been taken by the loop above. */
+  CHECK(report[0] == AEM_ABSOLUTE_POINTER_REPORT_ID && ReportPoint(report).X == 0 && report[1] == 1);
+  for(i = 1; i < AEM_MAX_BATCH_SIZE; i++) {
+    CHECK(DequeueReport(&device.Core, report));
+    CHECK(ReportPoint(report).X == (SHORT) i && report[1] == 1 + (i & 1));
+  }
+  CHECK(!DequeueReport(&device.Core, report));
+  AemSimFree(&device);
+}
+
+
+/* Schedule. */
+
+/** Number of messages in the randomized schedule test. */
+#define AEM_TEST_SCHEDULE_SIZE 256
+
+static void InitTimedEntry(PAEM_TIMED_ENTRY entry, UCHAR flags, SHORT x, DWORD32 time) {
+  entry->Flags = flags;
+  entry->Buttons = 0;
+  entry->Point.X = x;
+  entry->Point.Y = 0;
+  entry->Time = time;
+}
+
+static NTSTATUS SendTimedBatch(PAEM_SIM_DEVICE device, PAEM_TIMED_BATCH_FEATURE_REPORT batch) {
+  batch->Report.ReportId = AEM_CONTROL_REPORT_ID;
+  batch->Report.ControlCode = AEM_CONTROL_CODE_TIMED_BATCH;
+  return GetFeature(device, batch, AEM_TIMED_BATCH_FEATURE_REPORT_SIZE(batch->Count));
+}
+
+static void TestScheduleKeepsSubmissionOrder(void) {
+  static AEM_SCHEDULE_ENTRY entries[AEM_TEST_SCHEDULE_SIZE];
+  AEM_SCHEDULE              schedule;
+  AEM_MESSAGE               message;
+  ULONGLONG                 dueTime, lastDueTime = 0;
+  ULONG                     state = 1, i;
+  LONG                      lastNumber = -1;
+
+  /* Few distinct due times, so that most messages tie with others. */
+  AemScheduleInit(&schedule, entries, AEM_TEST_SCHEDULE_SIZE);
+  CHECK(AemScheduleMin(&schedule) == NULL);
+  for(i = 0; i < AEM_TEST_SCHEDULE_SIZE; i++) {
+    InitNumbered(&message, 0, i);
+    CHECK(AemScheduleInsert(&schedule, Random(&state) % 8, &message));
+  }
+  CHECK(!AemScheduleInsert(&schedule, 0, &message));
+
+  for(i = 0; i < AEM_TEST_SCHEDULE_SIZE; i++) {
+    dueTime = AemScheduleMin(&schedule)->DueTime;
+    AemSchedulePop(&schedule, &message);
+    CHECK(dueTime >= lastDueTime);
+    if(dueTime != lastDueTime)
+      lastNumber = -1;
+    CHECK((LONG) message.Duration > lastNumber);
+    lastDueTime = dueTime;
+    lastNumber = (LONG) message.Duration;
+  }
+  CHECK(schedule.Size == 0 && AemScheduleMin(&schedule) == NULL);
+}
+
+static void TestScheduleBatchTimeline(void) {
+  AEM_SCHEDULE_ENTRY             entries[4];
+  AEM_SCHEDULE                   schedule;
+  AEM_TIMED_BATCH_FEATURE_REPORT batch;
+  AEM_MESSAGE                    message;
+  static const ULONGLONG         dueTimes[4] = {1001000, 1010000, 1010600, 1020000};
+  ULONG                          i;
+
+  /* Relative times accumulate, including over waits. FROM_START entries reset the timeline. */
+  AemScheduleInit(&schedule, entries, 4);
+  batch.Count = 6;
+  InitTimedEntry(&batch.Entries[0], 0, 0, 100);
+  InitTimedEntry(&batch.Entries[1], AEM_TIMED_FROM_START, 1, 1000);
+  InitTimedEntry(&batch.Entries[2], AEM_TIMED_WAIT, 0, 50);
+  InitTimedEntry(&batch.Entries[3], AEM_TIMED_ABSOLUTE, 2, 10);
+  InitTimedEntry(&batch.Entries[4], AEM_TIMED_FROM_START | AEM_TIMED_WAIT, 0, 1900);
+  InitTimedEntry(&batch.Entries[5], 0, 3, 100);
+  CHECK(AemScheduleBatch(&schedule, &batch, 1000000) == 6);
+
+  for(i = 0; i < 4; i++) {
+    CHECK(AemScheduleMin(&schedule)->DueTime == dueTimes[i]);
+    AemSchedulePop(&schedule, &message);
+    CHECK(message.Kind == AEM_MESSAGE_MOVE && message.Point.X == (SHORT) i);
+    CHECK(message.IsRelative == (i != 2));
+  }
+
+  /* Full schedule stops at the first move that doesn't fit, waits before it are consumed. */
+  batch.Count = 6;
+  for(i = 0; i < 6; i++)
+    InitTimedEntry(&batch.Entries[i], i == 2 ? AEM_TIMED_WAIT : 0, (SHORT) i, 10);
+  CHECK(AemScheduleBatch(&schedule, &batch, 0) == 5);
+  CHECK(schedule.Size == 4);
+}
+
+static void TestTimedBatchStartTime(void) {
+  AEM_SIM_DEVICE                 device;
+  AEM_TIMED_BATCH_FEATURE_REPORT batch;
+  LONGLONG                       systemTime;
+  ULONGLONG                      now;
+
+  AemSimInit(&device, NULL, NULL);
+  AemSimAdvance(&device, 100000000);
+  now = device.Now;
+  systemTime = AemPlatformSystemTime(&device.Core);
+
+  /* Zero starts right away, on interrupt time. */
+  batch.Count = 1;
+  batch.StartTime = 0;
+  InitTimedEntry(&batch.Entries[0], 0, 1, 100);
+  CHECK(SendTimedBatch(&device, &batch) == STATUS_SUCCESS && batch.Count == 1);
+  CHECK(AemScheduleMin(&device.Core.Schedule)->DueTime == now + 1000);
+  ClearQueue(&device);
+
+  /* System time in the future is converted to the same offset on interrupt time. */
+  batch.StartTime = systemTime + 5000000;
+  CHECK(SendTimedBatch(&device, &batch) == STATUS_SUCCESS);
+  CHECK(AemScheduleMin(&device.Core.Schedule)->DueTime == now + 5001000);
+  CHECK(!AemCoreIsScheduledMessageDue(&device.Core));
+  ClearQueue(&device);
+
+  /* Start time in the past keeps the timeline: the first entry is already due, the second isn't. */
+  batch.StartTime = systemTime - 2000000;
+  batch.Count = 2;
+  InitTimedEntry(&batch.Entries[0], AEM_TIMED_FROM_START, 1, 100000);
+  InitTimedEntry(&batch.Entries[1], AEM_TIMED_FROM_START, 2, 300000);
+  CHECK(SendTimedBatch(&device, &batch) == STATUS_SUCCESS && batch.Count == 2);
+  CHECK(AemScheduleMin(&device.Core.Schedule)->DueTime == now - 1000000);
+  CHECK(AemCoreIsScheduledMessageDue(&device.Core));
+  ClearQueue(&device);
+
+  /* Start time further in the past than interrupt time goes is clamped to zero. */
+  batch.StartTime = systemTime - 2 * (LONGLONG) now;
+  CHECK(SendTimedBatch(&device, &batch) == STATUS_SUCCESS);
+  CHECK(AemScheduleMin(&device.Core.Schedule)->DueTime == 1000000);
+  ClearQueue(&device);
+
+  /* Later change of the system clock doesn't affect what is already scheduled. */
+  batch.StartTime = systemTime + 5000000;
+  batch.Count = 1;
+  CHECK(SendTimedBatch(&device, &batch) == STATUS_SUCCESS);
+  AemSimSetSystemTime(&device, systemTime + 100000000);
+  CHECK(AemScheduleMin(&device.Core.Schedule)->DueTime == now + 6000000);
+  AemSimFree(&device);
+}
+
+static void TestTimedBatchIsEmittedOnTime(void) {
+  AEM_SIM_DEVICE                 device;
+  AEM_TIMED_BATCH_FEATURE_REPORT batch;
+  AEM_SIM_READ                   reads[2];
+
+  /* Parked read is completed by the schedule timer, not by the next read slot. */
+  AemSimInit(&device, NULL, NULL);
+  batch.Count = 2;
+  batch.StartTime = 0;
+  InitTimedEntry(&batch.Entries[0], AEM_TIMED_ABSOLUTE, 10, 250000);
+  InitTimedEntry(&batch.Entries[1], AEM_TIMED_ABSOLUTE, 20, 250000);
+  CHECK(SendTimedBatch(&device, &batch) == STATUS_SUCCESS && batch.Count == 2);
+  AemSimRead(&device, &reads[0]);
+  AemSimRead(&device, &reads[1]);
+  CHECK(reads[0].Status == STATUS_PENDING);
+
+  AemSimAdvance(&device, 2499999);
+  CHECK(reads[0].Status == STATUS_PENDING);
+  AemSimAdvance(&device, 1000000);
+  CHECK(reads[0].Status == STATUS_SUCCESS && reads[0].CompletionTime == 2500000);
+  CHECK(ReportPoint(reads[0].Report).X == 10);
+  CHECK(reads[1].Status == STATUS_PENDING);
+  AemSimAdvance(&device, 10000000);
+  CHECK(reads[1].Status == STATUS_SUCCESS && reads[1].CompletionTime == 5000000);
+  CHECK(ReportPoint(reads[1].Report).X == 20);
+  AemSimFree(&device);
+}
+
+
+/* Read timer. */
+
+static void SetInterval(PAEM_SIM_DEVICE device, DWORD32 interval) {
+  AEM_DWORD_FEATURE_REPORT report;
+  report.Report.ReportId = AEM_CONTROL_REPORT_ID;
+  report.Report.ControlCode = AEM_CONTROL_CODE_INTERVAL;
+  report.Value = interval;
+  GetFeature(device, &report, sizeof(report));
+}
+
+static void TestReadTimerPeriods(void) {
+  AEM_READ_TIMER timer;
+
+  AemReadTimerInit(&timer);
+  CHECK(AemReadTimerIsArmNeeded(&timer, 1000, TRUE));
+  CHECK(!AemReadTimerIsArmNeeded(&timer, 1000, FALSE));
+
+  /* Whole milliseconds: slots stay on the period. */
+  CHECK(AemReadTimerArm(&timer, 80000, 8000) == 8);
+  CHECK(AemReadTimerDelay(&timer, 30000) == 50000);
+  CHECK(AemReadTimerDelay(&timer, 90000) == 1);
+  CHECK(!AemReadTimerIsArmNeeded(&timer, 80000, TRUE));
+  CHECK(AemReadTimerIsArmNeeded(&timer, 70000, TRUE));
+  CHECK(!AemReadTimerAdvance(&timer, 80000, 160000));
+  CHECK(timer.DueTime == 160000);
+
+  /* Late timer skips the periods it has missed. */
+  CHECK(!AemReadTimerAdvance(&timer, 250000, 320000));
+  CHECK(timer.DueTime == 320000);
+
+  /* Changed interval moves the next slot off the period. */
+  CHECK(AemReadTimerAdvance(&timer, 320000, 380000));
+
+  /* Fractional milliseconds are cut off the period, every slot is off it. */
+  CHECK(AemReadTimerArm(&timer, 55000, 5500) == 5);
+  CHECK(AemReadTimerAdvance(&timer, 55000, 110000));
+  CHECK(timer.DueTime == 105000);
+
+  /* Intervals under a millisecond make a one-shot timer, which is armed for every slot. */
+  CHECK(AemReadTimerArm(&timer, 5000, 500) == 0);
+  CHECK(AemReadTimerAdvance(&timer, 5000, 10000));
+  CHECK(timer.DueTime == 5000);
+
+  AemReadTimerStop(&timer);
+  CHECK(!timer.IsArmed);
+  CHECK(AemReadTimerIsArmNeeded(&timer, 5000, TRUE));
+}
+
+/** Sends some moves and submits reads for them. The first read takes the current slot, the rest are delayed. */
+static void SubmitReads(PAEM_SIM_DEVICE device, PAEM_SIM_READ reads, int count) {
+  int i;
+
+  for(i = 0; i < count; i++)
+    CHECK(SendMove(device, 1, 1, 0, 0));
+  for(i = 0; i < count; i++)
+    AemSimRead(device, &reads[i]);
+  CHECK(reads[0].Status == STATUS_SUCCESS);
+}
+
+static void TestReadTimerStaysOnPeriod(void) {
+  AEM_SIM_DEVICE device;
+  AEM_SIM_READ   reads[4];
+  int            i;
+
+  AemSimInit(&device, NULL, NULL);
+  SubmitReads(&device, reads, 4);
+  CHECK(device.ReadTimer.IsArmed && device.ReadTimer.Period == 8);
+  AemSimAdvance(&device, 1000000);
+  for(i = 1; i < 4; i++)
+    CHECK(reads[i].Status == STATUS_SUCCESS && reads[i].CompletionTime == 80000 * (ULONGLONG) i);
+  CHECK(device.Core.ReadTimerTicks == 3);
+  CHECK(device.Core.ReadTimerRearms == 0);
+  CHECK(!device.ReadTimer.IsArmed);
+  AemSimFree(&device);
+}
+
+static void TestReadTimerIsMovedOffPeriod(void) {
+  AEM_SIM_DEVICE device;
+  AEM_SIM_READ   reads[4];
+  int            i;
+
+  AemSimInit(&device, NULL, NULL);
+  SetInterval(&device, 5500);
+  SubmitReads(&device, reads, 4);
+  AemSimAdvance(&device, 1000000);
+  for(i = 1; i < 4; i++)
+    CHECK(reads[i].Status == STATUS_SUCCESS && reads[i].CompletionTime == 55000 * (ULONGLONG) i);
+  CHECK(device.Core.ReadTimerTicks == 3);
+  CHECK(device.Core.ReadTimerRearms == 2);
+  AemSimFree(&device);
+}
+
+static void TestReadTimerFiresOnTicks(void) {
+  AEM_SIM_DEVICE device;
+  AEM_SIM_READ   reads[4];
+
+  /* With 15.625 ms ticks, the second tick finds two 8 ms slots due. */
+  AemSimInit(&device, NULL, NULL);
+  AemSimSetTimerResolution(&device, 156250);
+  SubmitReads(&device, reads, 4);
+  AemSimAdvance(&device, 1000000);
+  CHECK(reads[1].Status == STATUS_SUCCESS && reads[1].CompletionTime == 156250);
+  CHECK(reads[2].Status == STATUS_SUCCESS && reads[2].CompletionTime == 312500);
+  CHECK(reads[3].Status == STATUS_SUCCESS && reads[3].CompletionTime == 312500);
+  CHECK(device.Core.ReadTimerTicks == 2);
+  CHECK(device.Core.ReadTimerRearms == 0);
+  AemSimFree(&device);
+}
+
+
+typedef struct _AEM_TEST {
+  const char *Name;
+  void       (*Run)(void);
+} AEM_TEST;
+
+static const AEM_TEST Tests[] = {
+  {"moves_come_out_in_order", TestMovesComeOutInOrder},
+  {"read_is_parked_until_input", TestReadIsParkedUntilInput},
+  {"reads_are_spaced_by_interval", TestReadsAreSpacedByInterval},
+  {"clear_drops_queued_moves", TestClearDropsQueuedMoves},
+  {"full_queue_rejects_moves", TestFullQueueRejectsMoves},
+  {"concurrent_producers", TestConcurrentProducers},
+  {"ring_wraps_around", TestRingWrapsAround},
+  {"ring_concurrent_producers", TestRingConcurrentProducers},
+  {"ring_is_relocated_under_producers", TestRingIsRelocatedUnderProducers},
+  {"compaction_keeps_runs", TestCompactionKeepsRuns},
+  {"compaction_merges_exactly", TestCompactionMergesExactly},
+  {"full_queue_is_compacted", TestFullQueueIsCompacted},
+  {"catch_up_merges_backlog", TestCatchUpMergesBacklog},
+  {"catch_up_waits_for_threshold", TestCatchUpWaitsForThreshold},
+  {"glide_easing", TestGlideEasing},
+  {"glide_carries_clamped_steps", TestGlideCarriesClampedSteps},
+  {"glide_to_starts_from_last_position", TestGlideToStartsFromLastPosition},
+  {"channel_wraps_around", TestChannelWrapsAround},
+  {"channel_concurrent_producers", TestChannelConcurrentProducers},
+  {"channel_stuck_slot_is_recovered", TestChannelStuckSlotIsRecovered},
+  {"clear_resets_stuck_channel", TestClearResetsStuckChannel},
+  {"batch_packing", TestBatchPacking},
+  {"malformed_batch_is_rejected", TestMalformedBatchIsRejected},
+  {"batch_is_partially_accepted", TestBatchIsPartiallyAccepted},
+  {"batch_is_retried_after_compaction", TestBatchIsRetriedAfterCompaction},
+  {"schedule_keeps_submission_order", TestScheduleKeepsSubmissionOrder},
+  {"schedule_batch_timeline", TestScheduleBatchTimeline},
+  {"timed_batch_start_time", TestTimedBatchStartTime},
+  {"timed_batch_is_emitted_on_time", TestTimedBatchIsEmittedOnTime},
+  {"read_timer_periods", TestReadTimerPeriods},
+  {"read_timer_stays_on_period", TestReadTimerStaysOnPeriod},
+  {"read_timer_is_moved_off_period", TestReadTimerIsMovedOffPeriod},
+  {"read_timer_fires_on_ticks", TestReadTimerFiresOnTicks},
+};
+
+int main(int argc, char **argv) {
+  size_t i;
+  int    j, failures, isSelected;
+
+  for(i = 0; i < sizeof(Tests) / sizeof(Tests[0]); i++) {
+    isSelected = argc < 2;
+    for(j = 1; j < argc; j++)
+      if(strcmp(argv[j], Tests[i].Name) == 0)
+        isSelected = 1;
+    if(!isSelected)
+      continue;
+
+    failures = Failures;
+    Tests[i].Run();
+    printf("%s %s\n", Failures == failures ? "ok  " : "FAIL", Tests[i].Name);
+    fflush(stdout);
+  }
+  return Failures == 0 ? 0 : 1;
+}
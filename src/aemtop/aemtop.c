@@ -0,0 +1,120 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <conio.h>
+#include <Windows.h>
+#include <aemctl.h>
+#pragma comment(lib, "aemctl.lib")
+
+/* Live view of the counters of arx ethereal mouse device. Counters are sampled from the statistics page 
+ * that the driver shares with user mode, so watching the device doesn't send any requests to it. */
+
+#define DEFAULT_INTERVAL 1000
+
+/** Snapshot of the counters, see AEM_STATISTICS. */
+typedef struct SAMPLE_ {
+  DWORD        time;
+  unsigned int enqueued;
+  unsigned int emitted;
+  unsigned int dropped;
+  unsigned int queueFull;
+  unsigned int highWater;
+  unsigned int emptyTicks;
+  unsigned int readsServed;
+  unsigned int contentionSpins;
+} SAMPLE;
+
+void TakeSample(const volatile AEM_STATISTICS* statistics, SAMPLE* sample) {
+  sample->time = GetTickCount();
+  sample->enqueued = statistics->enqueued;
+  sample->emitted = statistics->emitted;
+  sample->dropped = statistics->dropped;
+  sample->queueFull = statistics->queueFull;
+  sample->highWater = statistics->highWater;
+  sample->emptyTicks = statistics->emptyTicks;
+  sample->readsServed = statistics->readsServed;
+  sample->contentionSpins = statistics->contentionSpins;
+}
+
+/** Prints a counter along with its rate. Counters wrap around, so the difference is taken modulo 2^32. */
+void PrintCounter(const char* name, unsigned int current, unsigned int previous, DWORD elapsed) {
+  printf("  %-18s %12u %12.1f\n", name, current, elapsed == 0 ? 0.0 : (current - previous) * 1000.0 / elapsed);
+}
+
+void PrintSample(int index, int interval, const SAMPLE* current, const SAMPLE* previous) {
+  DWORD elapsed = current->time - previous->time;
+  COORD origin = {0, 0};
+
+  SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), origin);
+  printf("aemtop - arx ethereal mouse device %d, every %d ms, press q to quit\n\n", index, interval);
+  printf("  %-18s %12u\n", "queue depth", current->enqueued - current->emitted - current->dropped);
+  printf("  %-18s %12u\n\n", "high-water mark", current->highWater);
+  printf("  %-18s %12s %12s\n", "", "total", "per sec");
+  PrintCounter("enqueued", current->enqueued, previous->enqueued, elapsed);
+  PrintCounter("emitted", current->emitted, previous->emitted, elapsed);
+  PrintCounter("dropped", current->dropped, previous->dropped, elapsed);
+  PrintCounter("queue full", current->queueFull, previous->queueFull, elapsed);
+  PrintCounter("reads served", current->readsServed, previous->readsServed, elapsed);
+  PrintCounter("empty ticks", current->emptyTicks, previous->emptyTicks, elapsed);
+  PrintCounter("contention spins", current->contentionSpins, previous->contentionSpins, elapsed);
+}
+
+int main(int argc, char** argv) {
+  const volatile AEM_STATISTICS* statistics;
+  AEMHANDLE device;
+  SAMPLE current, previous;
+  int index = 0, interval = DEFAULT_INTERVAL, i;
+
+  for(i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      index = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+      interval = atoi(argv[++i]);
+    } else {
+      printf("Usage: aemtop [-d device index] [-i refresh interval in ms]\n");
+      return 1;
+    }
+  }
+  if(interval <= 0)
+    interval = DEFAULT_INTERVAL;
+
+  /* Monitor handle needs no access rights, so it can be opened next to a running client. */
+  if(AemOpenDeviceEx(index, AEMCTL_OPEN_MONITOR, &device) != AEMCTL_OK || AemMapStatisticsEx(device, &statistics) != AEMCTL_OK) {
+    printf("%s\n", AemGetLastErrorString());
+    return 1;
+  }
+
+  system("cls");
+  TakeSample(statistics, &previous);
+  for(;;) {
+    Sleep(interval);
+    TakeSample(statistics, &current);
+    PrintSample(index, interval, &current, &previous);
+    previous = current;
+
+    if(_kbhit() && tolower(_getch()) == 'q')
+      break;
+  }
+
+  AemUnmapStatistics(statistics);
+  AemCloseDevice(device);
+  return 0;
+}
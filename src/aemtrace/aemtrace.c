@@ -0,0 +1,338 @@
+/* This file is part of Aethered, a collection of virtual device drivers for
+ * Windows.
+ *
+ * Copyright (C) 2010-2011 Alexander Fokin <apfokin@gmail.com>
+ *
+ * Aethered is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Aethered is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License 
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with Aethered. If not, see <http://www.gnu.org/licenses/>. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "pacing.h"
+
+/* Turns a device trace dump into a timeline, one line per event, followed by a summary.
+ * Dumps are little-endian, same as the machines that write them.
+ *
+ * With -p the messages queued in the trace are also replayed through the adaptive pacing policy, and through
+ * a static interval for comparison, so that pacing settings can be tuned offline. Replay assumes that a read request 
+ * is always pending, as it is with hidclass, and ignores catch-up merging, glides and timed messages. */
+
+/** Maximal number of delayed read requests tracked at once, hidclass keeps only a few of them pending. */
+#define AEM_TRACE_MAX_DELAYED_READS 64
+
+typedef struct _DELAYED_READ {
+  DWORD32   Request;
+  ULONGLONG DueTime;  /**< In 100 ns. */
+} DELAYED_READ;
+
+typedef struct _SUMMARY {
+  ULONG        Counts[256];
+  DWORD32      MaxQueueSize;
+  ULONGLONG    WaitSum;         /**< In 1/1000000 sec. */
+  DWORD32      WaitMax;
+  ULONG        TimerCount;      /**< Read timers matched to their delays. */
+  double       LatenessSum;     /**< In 1/1000000 sec. */
+  double       LatenessMax;
+  DELAYED_READ Delayed[AEM_TRACE_MAX_DELAYED_READS];
+  ULONG        DelayedCount;
+} SUMMARY;
+
+typedef struct _REPLAY {
+  ULONGLONG *Arrivals;       /**< Enqueue times of the queued messages, in 100 ns. */
+  ULONG      Count;
+  ULONG      Capacity;
+} REPLAY;
+
+typedef struct _REPLAY_RESULT {
+  double     WaitSum;        /**< In 1/1000000 sec. */
+  double     WaitMax;
+  double     IntervalSum;    /**< In 1/1000000 sec. */
+  DWORD32    IntervalMin;
+  ULONG      Changes;        /**< Number of times the interval changed. */
+} REPLAY_RESULT;
+
+static const char *KindName(UCHAR kind) {
+  switch(kind) {
+  case AEM_TRACE_ENQUEUE:        return "enqueue";
+  case AEM_TRACE_QUEUE_FULL:     return "queue-full";
+  case AEM_TRACE_DEQUEUE:        return "dequeue";
+  case AEM_TRACE_CLEAR:          return "clear";
+  case AEM_TRACE_READ_PARK:      return "read-park";
+  case AEM_TRACE_READ_DELAY:     return "read-delay";
+  case AEM_TRACE_READ_COMPLETE:  return "read-complete";
+  case AEM_TRACE_READ_TIMER:     return "read-timer";
+  case AEM_TRACE_SCHEDULE_TIMER: return "schedule-timer";
+  case AEM_TRACE_INTERVAL:       return "interval";
+  case AEM_TRACE_CHANNEL_RESET:  return "channel-reset";
+  default:                       return "unknown";
+  }
+}
+
+static void PrintDetails(PAEM_TRACE_EVENT event, double lateness) {
+  switch(event->Kind) {
+  case AEM_TRACE_ENQUEUE:
+  case AEM_TRACE_QUEUE_FULL:
+    printf("queue %u, %u message(s)", event->Arg1, event->Arg2);
+    break;
+  case AEM_TRACE_DEQUEUE:
+    printf("queue %u, waited %u us", event->Arg1, event->Arg2);
+    break;
+  case AEM_TRACE_CLEAR:
+    printf("%u message(s) dropped", event->Arg2);
+    break;
+  case AEM_TRACE_READ_PARK:
+    printf("read %08x", event->Arg1);
+    break;
+  case AEM_TRACE_READ_DELAY:
+    printf("read %08x, for %u us", event->Arg1, event->Arg2);
+    break;
+  case AEM_TRACE_READ_COMPLETE:
+    printf("read %08x, status %08x", event->Arg1, event->Arg2);
+    break;
+  case AEM_TRACE_READ_TIMER:
+    if(lateness >= 0)
+      printf("read %08x, %.1f us late", event->Arg1, lateness);
+    else
+      printf("read %08x", event->Arg1);
+    break;
+  case AEM_TRACE_INTERVAL:
+    printf("%u us, was %u us", event->Arg1, event->Arg2);
+    break;
+  case AEM_TRACE_CHANNEL_RESET:
+    printf("%u slot(s) dropped", event->Arg2);
+    break;
+  case AEM_TRACE_SCHEDULE_TIMER:
+    break;
+  default:
+    printf("kind %02x, %08x %08x", event->Kind, event->Arg1, event->Arg2);
+    break;
+  }
+}
+
+/** Updates the summary with the given event.
+ *
+ * @returns                            How late a read timer fired, in 1/1000000 sec, or a negative value. */
+static double Account(SUMMARY *summary, PAEM_TRACE_EVENT event) {
+  double lateness = -1;
+  ULONG  i;
+
+  summary->Counts[event->Kind]++;
+  switch(event->Kind) {
+  case AEM_TRACE_ENQUEUE:
+  case AEM_TRACE_DEQUEUE:
+    if(event->Arg1 > summary->MaxQueueSize)
+      summary->MaxQueueSize = event->Arg1;
+    if(event->Kind == AEM_TRACE_DEQUEUE) {
+      summary->WaitSum += event->Arg2;
+      if(event->Arg2 > summary->WaitMax)
+        summary->WaitMax = event->Arg2;
+    }
+    break;
+  case AEM_TRACE_READ_DELAY:
+    for(i = 0; i < summary->DelayedCount && summary->Delayed[i].Request != event->Arg1; i++)
+      ;
+    if(i == AEM_TRACE_MAX_DELAYED_READS)
+      break;
+    if(i == summary->DelayedCount)
+      summary->DelayedCount++;
+    summary->Delayed[i].Request = event->Arg1;
+    summary->Delayed[i].DueTime = event->Time + 10 * (ULONGLONG) event->Arg2;
+    break;
+  case AEM_TRACE_READ_TIMER:
+    for(i = 0; i < summary->DelayedCount && summary->Delayed[i].Request != event->Arg1; i++)
+      ;
+    if(i == summary->DelayedCount)
+      break;
+    lateness = event->Time > summary->Delayed[i].DueTime ? (event->Time - summary->Delayed[i].DueTime) / 10.0 : 0;
+    summary->Delayed[i] = summary->Delayed[--summary->DelayedCount];
+    summary->TimerCount++;
+    summary->LatenessSum += lateness;
+    if(lateness > summary->LatenessMax)
+      summary->LatenessMax = lateness;
+    break;
+  }
+  return lateness;
+}
+
+static void PrintSummary(SUMMARY *summary) {
+  int kind;
+
+  printf("\n");
+  for(kind = 0; kind < 256; kind++)
+    if(summary->Counts[kind] != 0)
+      printf("%-16s %u\n", KindName((UCHAR) kind), summary->Counts[kind]);
+  printf("max queue size   %u\n", summary->MaxQueueSize);
+  if(summary->Counts[AEM_TRACE_DEQUEUE] != 0)
+    printf("queue wait       %.1f us mean, %u us max\n", 
+           (double) summary->WaitSum / summary->Counts[AEM_TRACE_DEQUEUE], summary->WaitMax);
+  if(summary->TimerCount != 0)
+    printf("read timer delay %.1f us mean, %.1f us max\n", summary->LatenessSum / summary->TimerCount, summary->LatenessMax);
+}
+
+/** Remembers the messages queued by an enqueue event for the replay. */
+static int Record(REPLAY *replay, PAEM_TRACE_EVENT event) {
+  ULONGLONG *arrivals;
+  ULONG     i;
+
+  if(event->Kind != AEM_TRACE_ENQUEUE)
+    return 1;
+  if(replay->Count + event->Arg2 > replay->Capacity) {
+    replay->Capacity = 2 * (replay->Count + event->Arg2);
+    arrivals = realloc(replay->Arrivals, replay->Capacity * sizeof(ULONGLONG));
+    if(arrivals == NULL)
+      return 0;
+    replay->Arrivals = arrivals;
+  }
+  for(i = 0; i < event->Arg2; i++)
+    replay->Arrivals[replay->Count++] = event->Time;
+  return 1;
+}
+
+/** Emits the recorded messages one per emission slot, spacing the slots as AemCoreRead does. */
+static void Replay(REPLAY *replay, PAEM_PACING pacing, REPLAY_RESULT *result) {
+  ULONGLONG next = 0, due;
+  DWORD32   interval = pacing->MaxInterval, previous;
+  ULONG     head, tail = 0;
+  double    wait;
+
+  memset(result, 0, sizeof(REPLAY_RESULT));
+  result->IntervalMin = interval;
+  for(head = 0; head < replay->Count; head++) {
+    /* Events are stamped slightly out of order, so the slot is never earlier than the message. */
+    due = next > replay->Arrivals[head] ? next : replay->Arrivals[head];
+    while(tail < replay->Count && replay->Arrivals[tail] <= due)
+      tail++;
+
+    previous = interval;
+    interval = AemPacingNextInterval(pacing, interval, tail - head);
+    next = due + 10 * (ULONGLONG) interval;
+
+    wait = (due - replay->Arrivals[head]) / 10.0;
+    result->WaitSum += wait;
+    if(wait > result->WaitMax)
+      result->WaitMax = wait;
+    result->IntervalSum += interval;
+    if(interval < result->IntervalMin)
+      result->IntervalMin = interval;
+    if(interval != previous)
+      result->Changes++;
+  }
+}
+
+static void PrintReplay(REPLAY *replay, PAEM_PACING pacing) {
+  AEM_PACING    fixed;
+  REPLAY_RESULT result;
+  int           i;
+
+  printf("\nreplay of %u queued message(s)\n", replay->Count);
+  if(replay->Count == 0)
+    return;
+
+  fixed.MinInterval = fixed.MaxInterval = pacing->MaxInterval;
+  fixed.TargetDepth = 0;
+  for(i = 0; i < 2; i++) {
+    Replay(replay, i == 0 ? &fixed : pacing, &result);
+    printf("%-16s wait %.1f us mean, %.1f us max; interval %.1f us mean, %u us min, %u change(s)\n", 
+           i == 0 ? "static" : "adaptive", result.WaitSum / replay->Count, result.WaitMax, 
+           result.IntervalSum / replay->Count, result.IntervalMin, result.Changes);
+  }
+}
+
+static void Usage(const char *name) {
+  fprintf(stderr,
+    "Usage: %s [-s] [-p min,max,target] dump\n"
+    "  -s             Print the summary only, without the timeline.\n"
+    "  -p min,max,target\n"
+    "                 Replay queued messages through adaptive pacing with the given intervals, in us,\n"
+    "                 and target queue depth, and through a static interval of max us.\n", name);
+}
+
+int main(int argc, char **argv) {
+  static SUMMARY        summary;
+  static REPLAY         replay;
+  AEM_PACING            pacing;
+  AEM_TRACE_FILE_HEADER header;
+  AEM_TRACE_EVENT       event;
+  ULONGLONG             start = 0, previous = 0;
+  const char            *path;
+  int                   i, isSummaryOnly = 0, isReplay = 0;
+  double                lateness;
+  ULONG                 read;
+  FILE                  *file;
+
+  for(i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if(strcmp(argv[i], "-s") == 0) {
+      isSummaryOnly = 1;
+    } else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc && 
+              sscanf(argv[++i], "%u,%u,%u", &pacing.MinInterval, &pacing.MaxInterval, &pacing.TargetDepth) == 3 &&
+              pacing.MinInterval <= pacing.MaxInterval) {
+      isReplay = 1;
+    } else {
+      Usage(argv[0]);
+      return 2;
+    }
+  }
+  if(i != argc - 1) {
+    Usage(argv[0]);
+    return 2;
+  }
+  path = argv[i];
+
+  file = fopen(path, "rb");
+  if(file == NULL) {
+    fprintf(stderr, "Could not open %s\n", path);
+    return 1;
+  }
+  if(fread(&header, sizeof(header), 1, file) != 1 || header.Magic != AEM_TRACE_FILE_MAGIC) {
+    fprintf(stderr, "%s is not a trace dump\n", path);
+    return 1;
+  }
+  if(header.Version != AEM_TRACE_FILE_VERSION) {
+    fprintf(stderr, "%s is a trace dump of unsupported version %u\n", path, header.Version);
+    return 1;
+  }
+
+  printf("%u event(s), %u lost, dumped at %.6f s of interrupt time\n", header.Count, header.Lost, header.Now / 1e7);
+  if(!isSummaryOnly)
+    printf("%14s %12s  %-16s %s\n", "time, ms", "delta, us", "event", "details");
+  for(read = 0; read < header.Count; read++) {
+    if(fread(&event, sizeof(event), 1, file) != 1) {
+      fprintf(stderr, "%s is truncated after %u event(s)\n", path, read);
+      break;
+    }
+    if(read == 0)
+      start = previous = event.Time;
+    lateness = Account(&summary, &event);
+    if(isReplay && !Record(&replay, &event)) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+    if(isSummaryOnly)
+      continue;
+
+    /* Events are in the order they claimed their slots, writers may have stamped them slightly out of order. */
+    printf("%14.3f %+12.1f  %-16s ", ((LONGLONG) (event.Time - start)) / 1e4, ((LONGLONG) (event.Time - previous)) / 10.0, 
+           KindName(event.Kind));
+    PrintDetails(&event, lateness);
+    printf("\n");
+    previous = event.Time;
+  }
+  fclose(file);
+
+  PrintSummary(&summary);
+  if(isReplay)
+    PrintReplay(&replay, &pacing);
+  free(replay.Arrivals);
+  return 0;
+}